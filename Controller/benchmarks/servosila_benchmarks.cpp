@@ -0,0 +1,23 @@
+/*
+    Runs the CAN stack benchmarks
+    Usage:
+        servosila_benchmarks [can_interface_name [periods_count]]
+    The dispatch benchmarks need no CANbus.
+    The latency benchmarks need a virtual CANbus (vcan0 by default, see cansocket.h); they are skipped without it.
+*/
+
+#include <stdio.h>      /* printf() */
+#include <stdlib.h>     /* strtoul() */
+#include "devices/servosila-canbus-benchmark.h"
+#include "devices/servosila-latency-benchmark.h"
+
+int main(int argc, char** argv)
+{
+    const char* can_interface_name = (argc > 1) ? argv[1] : "vcan0";
+    const size_t periods_count = (argc > 2) ? strtoul(argv[2], NULL, 10) : 1000;
+    printf("dispatch benchmarks\n");
+    devices::benchmark::run_dispatch_benchmarks();
+    printf("latency benchmarks on %s\n", can_interface_name);
+    devices::benchmark::run_latency_benchmarks(can_interface_name, periods_count);
+    return 0;
+} //main()
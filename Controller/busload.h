@@ -0,0 +1,326 @@
+#ifndef NETWORK_BUSLOAD_H_INCLUDED
+#define NETWORK_BUSLOAD_H_INCLUDED
+
+/*
+CANbus load meter - frame rates per COB ID and per node, estimated bus utilisation
+    - sees every frame sent or received through a socket (see can_socket::set_traffic_observer())
+    - counts in windows: sample() closes the window and publishes a snapshot,
+      the owning thread reads it with get_snapshot(), any other (single) thread with fetch_snapshot()
+    - the utilisation is estimated from the on-wire length of the frames with worst-case bit stuffing,
+      so it errs on the high side; CAN FD data phases are timed at the data bitrate
+    - only the frames passing the kernel-side filters of the socket are seen: a filtered socket
+      underestimates the load caused by foreign nodes
+    NOTE: the object is about 40KB, avoid placing it on a small thread stack
+
+Watching a bus at 1Mbit/s:
+    network::can_bus_load_meter meter;
+    meter.configure(1000000);
+    can.set_traffic_observer(&meter);
+    ...every second: meter.sample(control::get_now_nsec(), can.get_statistics());
+                     printf("%.1f%%\n", 100.0 * meter.get_snapshot().utilisation);
+*/
+
+#include <assert.h>
+#include <stdio.h>      /* snprintf() */
+#include <stdint.h>     /* uint32_t */
+#include <string.h>
+#include "network/cansocket.h"
+#include "control/timer.h"
+#include "ftl/spsc-ring-buffer.h"
+
+namespace network
+{
+
+//size of the 11bit COB ID space
+const size_t CAN_BUS_LOAD_COB_ID_SPACE = 2048;
+//7bit Node IDs - Node ID 0 stands for the broadcasts (NMT, SYNC) and the frames of the master
+const size_t CAN_BUS_LOAD_NODE_ID_SPACE = 128;
+//snapshots buffered for the threads not owning the socket
+const size_t CAN_BUS_LOAD_SNAPSHOT_RING_CAPACITY = 4;
+//default nominal bitrate - the usual CANopen bitrate of the Servosila drives
+const uint32_t CAN_BUS_LOAD_DEFAULT_BITRATE = 1000000;
+
+/*
+    On-wire bits of a classic frame, worst-case bit stuffing, interframe space included
+    (Davis et al., "Controller Area Network (CAN) schedulability analysis")
+*/
+inline size_t get_can_frame_bits(canid_t can_id, size_t payload_size)
+{
+    const size_t data_bits = ((can_id & CAN_RTR_FLAG) != 0) ? 0 : 8*payload_size;
+    if((can_id & CAN_EFF_FLAG) != 0) return 67 + data_bits + (54 + data_bits - 1)/4;
+    else                             return 47 + data_bits + (34 + data_bits - 1)/4;
+} //get_can_frame_bits()
+
+/*
+    On-wire time of a frame in nanoseconds
+    CAN FD frames (CANFD_FDF in fd_flags): arbitration and acknowledgement at the nominal bitrate,
+    the data phase at data_bitrate if CANFD_BRS is set; worst-case bit stuffing.
+*/
+inline control::nsec_t get_can_frame_time_nsec(canid_t can_id, size_t payload_size, uint8_t fd_flags, uint32_t bitrate, uint32_t data_bitrate)
+{
+    assert((bitrate > 0) && (data_bitrate > 0));
+    if((fd_flags & CANFD_FDF) == 0) return control::nsec_t(get_can_frame_bits(can_id, payload_size)) * control::NSEC_PER_SEC / bitrate;
+    //nominal phase: SOF, identifier, control bits up to BRS; CRC delimiter, ACK, EOF, IFS
+    const size_t arbitration_bits = ((can_id & CAN_EFF_FLAG) != 0) ? 36 : 17;
+    const size_t nominal_bits     = arbitration_bits + (arbitration_bits - 1)/4 + 13;
+    //data phase: ESI, DLC, data, stuff count, CRC with its fixed stuff bits
+    const size_t crc_bits  = (payload_size <= 16) ? 17 : 21;
+    const size_t data_bits = 5 + 8*payload_size;
+    const size_t fd_bits   = data_bits + (data_bits - 1)/4 + 4 + crc_bits + (4 + crc_bits + 3)/4;
+    const uint32_t fd_bitrate = ((fd_flags & CANFD_BRS) != 0) ? data_bitrate : bitrate;
+    return control::nsec_t(nominal_bits) * control::NSEC_PER_SEC / bitrate + control::nsec_t(fd_bits) * control::NSEC_PER_SEC / fd_bitrate;
+} //get_can_frame_time_nsec()
+
+/*
+    Bus load over a window - see can_bus_load_meter::sample()
+*/
+struct can_bus_load_snapshot_t
+{
+    control::nsec_t timestamp;          //end of the window, CLOCK_MONOTONIC; 0 - no window closed yet
+    control::nsec_t window;             //length of the window
+    double   utilisation;               //estimated share of the bus time, 0..1 (more if the estimate overshoots)
+    double   frames_sent_per_second;
+    double   frames_received_per_second;
+    double   bytes_sent_per_second;     //payload
+    double   bytes_received_per_second; //payload
+    size_t   errors_in_window;          //error frames, kernel drops, send failures and full send buffers
+    can_socket_statistics_t socket;     //cumulative counters of the socket at the end of the window
+    uint32_t node_frames[CAN_BUS_LOAD_NODE_ID_SPACE]; //frames to and from each node within the window
+};
+
+class can_bus_load_meter : public can_traffic_observer
+{
+private:
+    uint32_t        m_bitrate;
+    uint32_t        m_data_bitrate;
+    //current window
+    control::nsec_t m_window_start;
+    control::nsec_t m_bus_time;         //on-wire time of the frames seen
+    size_t          m_frames_sent;
+    size_t          m_frames_received;
+    size_t          m_bytes_sent;
+    size_t          m_bytes_received;
+    uint32_t        m_frames[CAN_BUS_LOAD_COB_ID_SPACE];     //both directions
+    uint32_t        m_bytes[CAN_BUS_LOAD_COB_ID_SPACE];
+    //the last closed window
+    uint32_t        m_window_frames[CAN_BUS_LOAD_COB_ID_SPACE];
+    uint32_t        m_window_bytes[CAN_BUS_LOAD_COB_ID_SPACE];
+    can_bus_load_snapshot_t m_snapshot;
+    //for other threads - lock-free
+    ftl::spsc_ring_buffer<can_bus_load_snapshot_t, CAN_BUS_LOAD_SNAPSHOT_RING_CAPACITY> m_snapshots;
+
+public:
+    can_bus_load_meter()
+        :   m_bitrate(CAN_BUS_LOAD_DEFAULT_BITRATE),
+            m_data_bitrate(CAN_BUS_LOAD_DEFAULT_BITRATE)
+    {
+        reset();
+    } //can_bus_load_meter()
+
+    /*
+        Bitrates of the interface (ip link set canX type can bitrate ... dbitrate ...)
+        data_bitrate 0 - the same as the nominal one (classic CAN)
+    */
+    void configure(uint32_t bitrate, uint32_t data_bitrate = 0)
+    {
+        assert(bitrate > 0);
+        m_bitrate      = bitrate;
+        m_data_bitrate = (data_bitrate > 0) ? data_bitrate : bitrate;
+    } //configure()
+
+    /*
+        Starts over - the counters and the snapshot are cleared, the bitrates are kept
+    */
+    void reset()
+    {
+        m_window_start    = 0;
+        m_bus_time        = 0;
+        m_frames_sent     = 0;
+        m_frames_received = 0;
+        m_bytes_sent      = 0;
+        m_bytes_received  = 0;
+        memset(m_frames, 0, sizeof(m_frames));
+        memset(m_bytes,  0, sizeof(m_bytes));
+        memset(m_window_frames, 0, sizeof(m_window_frames));
+        memset(m_window_bytes,  0, sizeof(m_window_bytes));
+        memset(&m_snapshot, 0, sizeof(m_snapshot));
+    } //reset()
+
+    virtual void on_frame_sent(canid_t can_id, uint8_t payload_size, uint8_t fd_flags)
+    {
+        m_frames_sent++;
+        m_bytes_sent += payload_size;
+        _count(can_id, payload_size, fd_flags);
+    } //on_frame_sent()
+
+    virtual void on_frame_received(canid_t can_id, uint8_t payload_size, uint8_t fd_flags)
+    {
+        if((can_id & CAN_ERR_FLAG) != 0) return; //error frames are generated by the driver, not seen on the bus
+        m_frames_received++;
+        m_bytes_received += payload_size;
+        _count(can_id, payload_size, fd_flags);
+    } //on_frame_received()
+
+    /*
+        Closes the current window and publishes its snapshot - call periodically from the thread using the socket
+        The first call only opens the window. Returns true if a snapshot has been published.
+    */
+    bool sample(control::nsec_t now, const can_socket_statistics_t& socket_statistics)
+    {
+        bool result = false;
+        if((m_window_start != 0) && (now > m_window_start))
+        {
+            const control::nsec_t window  = now - m_window_start;
+            const double seconds = double(window) / double(control::NSEC_PER_SEC);
+            can_bus_load_snapshot_t& s = m_snapshot;
+            s.errors_in_window = _get_errors_count(socket_statistics) - _get_errors_count(s.socket);
+            s.timestamp   = now;
+            s.window      = window;
+            s.utilisation = double(m_bus_time) / double(window);
+            s.frames_sent_per_second     = double(m_frames_sent) / seconds;
+            s.frames_received_per_second = double(m_frames_received) / seconds;
+            s.bytes_sent_per_second      = double(m_bytes_sent) / seconds;
+            s.bytes_received_per_second  = double(m_bytes_received) / seconds;
+            s.socket      = socket_statistics;
+            //per COB ID and per node
+            memset(s.node_frames, 0, sizeof(s.node_frames));
+            for(size_t cob_id=0; cob_id<CAN_BUS_LOAD_COB_ID_SPACE; cob_id++)
+            {
+                s.node_frames[cob_id & (CAN_BUS_LOAD_NODE_ID_SPACE-1)] += m_frames[cob_id];
+            }
+            memcpy(m_window_frames, m_frames, sizeof(m_frames));
+            memcpy(m_window_bytes,  m_bytes,  sizeof(m_bytes));
+            m_snapshots.push(s);
+            result = true;
+        }
+        else
+        {   //the first window - the socket counters are the baseline for errors_in_window
+            m_snapshot.socket = socket_statistics;
+        }
+        //next window
+        m_window_start    = now;
+        m_bus_time        = 0;
+        m_frames_sent     = 0;
+        m_frames_received = 0;
+        m_bytes_sent      = 0;
+        m_bytes_received  = 0;
+        memset(m_frames, 0, sizeof(m_frames));
+        memset(m_bytes,  0, sizeof(m_bytes));
+        return result;
+    } //sample()
+
+    /*
+        The latest snapshot - for the thread calling sample()
+    */
+    const can_bus_load_snapshot_t& get_snapshot() const
+    {
+        return m_snapshot;
+    } //get_snapshot()
+
+    /*
+        The latest snapshot published since the previous call - for a single thread other than the one calling sample()
+        Returns false if there is no new snapshot.
+    */
+    bool fetch_snapshot(can_bus_load_snapshot_t& snapshot)
+    {
+        bool result = false;
+        while(m_snapshots.pop(&snapshot, 1) == 1) result = true;
+        return result;
+    } //fetch_snapshot()
+
+    /*
+        Frames and payload bytes per second of a COB ID, both directions, over the last closed window
+        For the thread calling sample().
+    */
+    double get_cob_id_frame_rate(uint16_t cob_id) const
+    {
+        assert(cob_id < CAN_BUS_LOAD_COB_ID_SPACE);
+        return (m_snapshot.window > 0) ? double(m_window_frames[cob_id]) * double(control::NSEC_PER_SEC) / double(m_snapshot.window) : 0.0;
+    } //get_cob_id_frame_rate()
+
+    double get_cob_id_byte_rate(uint16_t cob_id) const
+    {
+        assert(cob_id < CAN_BUS_LOAD_COB_ID_SPACE);
+        return (m_snapshot.window > 0) ? double(m_window_bytes[cob_id]) * double(control::NSEC_PER_SEC) / double(m_snapshot.window) : 0.0;
+    } //get_cob_id_byte_rate()
+
+    uint32_t get_bitrate() const
+    {
+        return m_bitrate;
+    } //get_bitrate()
+
+    uint32_t get_data_bitrate() const
+    {
+        return m_data_bitrate;
+    } //get_data_bitrate()
+
+private:
+    //helper function
+    void _count(canid_t can_id, uint8_t payload_size, uint8_t fd_flags)
+    {
+        m_bus_time += get_can_frame_time_nsec(can_id, payload_size, fd_flags, m_bitrate, m_data_bitrate);
+        if((can_id & CAN_EFF_FLAG) == 0)
+        {   //extended frames are counted in the totals only
+            const canid_t cob_id = can_id & CAN_SFF_MASK;
+            m_frames[cob_id]++;
+            m_bytes[cob_id] += payload_size;
+        }
+    } //_count()
+
+    //helper function
+    static size_t _get_errors_count(const can_socket_statistics_t& statistics)
+    {
+        return statistics.error_frames + statistics.frames_dropped + statistics.send_failures + statistics.send_buffer_full;
+    } //_get_errors_count()
+
+}; //class can_bus_load_meter
+
+//diagnostic levels - the values of diagnostic_msgs/DiagnosticStatus
+const uint8_t CAN_BUS_LOAD_LEVEL_OK    = 0;
+const uint8_t CAN_BUS_LOAD_LEVEL_WARN  = 1;
+const uint8_t CAN_BUS_LOAD_LEVEL_ERROR = 2;
+
+/*
+    Diagnostic level of a snapshot: ERROR above error_utilisation, WARN above warn_utilisation or on any error within the window
+*/
+inline uint8_t get_bus_load_level(const can_bus_load_snapshot_t& snapshot, double warn_utilisation = 0.7, double error_utilisation = 0.9)
+{
+    if(snapshot.utilisation > error_utilisation)                        return CAN_BUS_LOAD_LEVEL_ERROR;
+    if((snapshot.utilisation > warn_utilisation) || (snapshot.errors_in_window > 0)) return CAN_BUS_LOAD_LEVEL_WARN;
+    return CAN_BUS_LOAD_LEVEL_OK;
+} //get_bus_load_level()
+
+/*
+    Walks a snapshot as diagnostic key/value pairs - e.g. for the diagnostic_updater task of a ROS node:
+        network::visit_bus_load_diagnostics(snapshot, [&](const char* key, double value) { status.add(key, value); });
+        status.summary(network::get_bus_load_level(snapshot), "CANbus load");
+    The frame rates of the nodes are reported for the nodes seen within the window only.
+*/
+template <class visitor_t>
+inline void visit_bus_load_diagnostics(const can_bus_load_snapshot_t& snapshot, visitor_t visitor)
+{
+    visitor("utilisation, %",            100.0 * snapshot.utilisation);
+    visitor("frames sent per second",     snapshot.frames_sent_per_second);
+    visitor("frames received per second", snapshot.frames_received_per_second);
+    visitor("bytes sent per second",      snapshot.bytes_sent_per_second);
+    visitor("bytes received per second",  snapshot.bytes_received_per_second);
+    visitor("errors in window",           double(snapshot.errors_in_window));
+    visitor("error frames",               double(snapshot.socket.error_frames));
+    visitor("frames dropped",             double(snapshot.socket.frames_dropped));
+    visitor("send buffer full",           double(snapshot.socket.send_buffer_full));
+    visitor("send failures",              double(snapshot.socket.send_failures));
+    visitor("receive failures",           double(snapshot.socket.receive_failures));
+    visitor("last error",                 double(snapshot.socket.last_error));
+    const double seconds = double(snapshot.window) / double(control::NSEC_PER_SEC);
+    for(size_t node_id=0; (node_id<CAN_BUS_LOAD_NODE_ID_SPACE) && (seconds > 0.0); node_id++)
+    {
+        if(snapshot.node_frames[node_id] == 0) continue;
+        char key[32];
+        snprintf(key, sizeof(key), "node %u frames per second", unsigned(node_id));
+        visitor(key, double(snapshot.node_frames[node_id]) / seconds);
+    }
+} //visit_bus_load_diagnostics()
+
+} //namespace network
+
+#endif // NETWORK_BUSLOAD_H_INCLUDED
@@ -0,0 +1,415 @@
+#ifndef NETWORK_CAN_LOG_H_INCLUDED
+#define NETWORK_CAN_LOG_H_INCLUDED
+
+/*
+Compact binary log of CANbus traffic
+    - a header followed by fixed-size records, one record per frame
+    - the file is preallocated and memory-mapped: appending a frame is a memcpy,
+      no allocations, no formatting, no syscalls
+    - the records count in the header is updated on every append,
+      so a log survives a crash of the recording process
+    - classic frames only: a recording socket cannot be switched to the FD mode
+
+Recording the traffic of a dispatcher:
+    network::can_recording_socket recorder;
+    recorder.startup("can0");
+    recorder.start_recording("/tmp/can.log", 1000000);
+    dispatcher.set_can_socket(recorder);
+Replaying it: see canreplay.h
+*/
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>      /* open() */
+#include <unistd.h>
+#include <string.h>
+#include <assert.h>
+#include <stdint.h>     /* uint32_t */
+#include "network/cansocket.h"
+#include "control/timer.h"    /* nsec_t */
+
+namespace network
+{
+
+//"CANL" - little endian
+const uint32_t CAN_LOG_MAGIC   = 0x4C4E4143;
+const uint32_t CAN_LOG_VERSION = 1;
+
+//direction of a logged frame
+enum class can_log_direction_t : uint8_t
+{
+    RX = 0, //received from the bus
+    TX = 1  //sent to the bus
+};
+
+/*
+    Log record - one per frame, 24 bytes
+*/
+struct can_log_record_t
+{
+    control::nsec_t timestamp;  //CLOCK_MONOTONIC, see control::get_now_nsec()
+    uint32_t        can_id;
+    uint8_t         can_dlc;
+    uint8_t         direction;  //can_log_direction_t
+    uint16_t        reserved;
+    uint8_t         data[8];
+};
+static_assert(sizeof(can_log_record_t) == 24, "can_log_record_t must be packed");
+
+/*
+    Log file header - followed by the records
+*/
+struct can_log_header_t
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t reserved;
+    uint64_t capacity;          //number of preallocated records
+    uint64_t records_count;     //number of records written
+};
+static_assert(sizeof(can_log_header_t) == 32, "can_log_header_t must be packed");
+
+/*
+    Writes a log file
+*/
+class can_log_writer
+{
+private:
+    int               m_fd;
+    can_log_header_t* m_header;
+    can_log_record_t* m_records;
+    size_t            m_mapping_size;
+    size_t            m_overflow_counter; //frames dropped because the log is full
+
+public:
+    can_log_writer()
+        :   m_fd(-1),
+            m_header(nullptr),
+            m_records(nullptr),
+            m_mapping_size(0),
+            m_overflow_counter(0)
+    {
+    }
+
+    ~can_log_writer()
+    {
+        if(is_open()) close();
+    }
+
+    /*
+        Creates (truncates) the log file and preallocates room for capacity records
+    */
+    bool open(const char* file_name, size_t capacity)
+    {
+        assert(!is_open());
+        assert(capacity > 0);
+        bool result = false;
+        m_overflow_counter = 0;
+        m_fd = ::open(file_name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if(m_fd != -1)
+        {
+            m_mapping_size = sizeof(can_log_header_t) + capacity*sizeof(can_log_record_t);
+            //preallocating the disk blocks - no page faults on holes while recording
+            if(::posix_fallocate(m_fd, 0, m_mapping_size) == 0)
+            {
+                void* mapping = ::mmap(nullptr, m_mapping_size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+                if(mapping != MAP_FAILED)
+                {
+                    m_header  = static_cast<can_log_header_t*>(mapping);
+                    m_records = reinterpret_cast<can_log_record_t*>(m_header + 1);
+                    m_header->magic         = CAN_LOG_MAGIC;
+                    m_header->version       = CAN_LOG_VERSION;
+                    m_header->record_size   = sizeof(can_log_record_t);
+                    m_header->reserved      = 0;
+                    m_header->capacity      = capacity;
+                    m_header->records_count = 0;
+                    result = true;
+                }
+            }
+            if(!result) close(); //ERROR
+        }
+        return result;
+    } //open()
+
+    /*
+        Flushes the log and shrinks the file to the records actually written
+    */
+    void close()
+    {
+        assert(m_fd != -1);
+        if(m_header != nullptr)
+        {
+            const size_t used_size = sizeof(can_log_header_t) + size_t(m_header->records_count)*sizeof(can_log_record_t);
+            ::msync(m_header, m_mapping_size, MS_SYNC);
+            ::munmap(m_header, m_mapping_size);
+            const int r = ::ftruncate(m_fd, used_size);
+            if(r==-1) assert(false);
+        }
+        ::close(m_fd);
+        m_fd           = -1;
+        m_header       = nullptr;
+        m_records      = nullptr;
+        m_mapping_size = 0;
+    } //close()
+
+    bool is_open() const
+    {
+        return (m_fd != -1);
+    } //is_open()
+
+    /*
+        Appends a frame - a memcpy into the mapping
+        Returns false if the log is full (the frame is dropped).
+    */
+    bool append(const can_frame& frame, control::nsec_t timestamp, can_log_direction_t direction)
+    {
+        bool result = false;
+        if(m_header != nullptr)
+        {
+            const uint64_t index = m_header->records_count;
+            if(index < m_header->capacity)
+            {
+                can_log_record_t& record = m_records[index];
+                record.timestamp = timestamp;
+                record.can_id    = frame.can_id;
+                record.can_dlc   = frame.can_dlc;
+                record.direction = uint8_t(direction);
+                record.reserved  = 0;
+                memcpy(record.data, frame.data, sizeof(record.data));
+                //publishing the record
+                m_header->records_count = index + 1;
+                result = true;
+            }
+            else m_overflow_counter++;
+        }
+        return result;
+    } //append()
+
+    size_t get_records_count() const
+    {
+        return (m_header != nullptr) ? size_t(m_header->records_count) : 0;
+    } //get_records_count()
+
+    size_t get_overflow_counter() const
+    {
+        return m_overflow_counter;
+    } //get_overflow_counter()
+
+}; //class can_log_writer
+
+/*
+    Reads a log file - the records are accessed in place, straight from the mapping
+*/
+class can_log_reader
+{
+private:
+    int                     m_fd;
+    const can_log_header_t* m_header;
+    const can_log_record_t* m_records;
+    size_t                  m_mapping_size;
+    size_t                  m_records_count;
+
+public:
+    can_log_reader()
+        :   m_fd(-1),
+            m_header(nullptr),
+            m_records(nullptr),
+            m_mapping_size(0),
+            m_records_count(0)
+    {
+    }
+
+    ~can_log_reader()
+    {
+        if(is_open()) close();
+    }
+
+    bool open(const char* file_name)
+    {
+        assert(!is_open());
+        bool result = false;
+        m_fd = ::open(file_name, O_RDONLY);
+        if(m_fd != -1)
+        {
+            struct stat file_status;
+            if((::fstat(m_fd, &file_status) == 0) && (size_t(file_status.st_size) >= sizeof(can_log_header_t)))
+            {
+                m_mapping_size = file_status.st_size;
+                void* mapping = ::mmap(nullptr, m_mapping_size, PROT_READ, MAP_PRIVATE, m_fd, 0);
+                if(mapping != MAP_FAILED)
+                {
+                    m_header  = static_cast<const can_log_header_t*>(mapping);
+                    m_records = reinterpret_cast<const can_log_record_t*>(m_header + 1);
+                    //validating the header
+                    const size_t records_in_file = (m_mapping_size - sizeof(can_log_header_t)) / sizeof(can_log_record_t);
+                    if((m_header->magic == CAN_LOG_MAGIC) && (m_header->version == CAN_LOG_VERSION)
+                        && (m_header->record_size == sizeof(can_log_record_t)) && (m_header->records_count <= records_in_file))
+                    {
+                        m_records_count = size_t(m_header->records_count);
+                        //the records are read sequentially
+                        ::madvise(mapping, m_mapping_size, MADV_SEQUENTIAL);
+                        result = true;
+                    }
+                }
+            }
+            if(!result) close(); //ERROR
+        }
+        return result;
+    } //open()
+
+    void close()
+    {
+        assert(m_fd != -1);
+        if(m_header != nullptr) ::munmap(const_cast<can_log_header_t*>(m_header), m_mapping_size);
+        ::close(m_fd);
+        m_fd            = -1;
+        m_header        = nullptr;
+        m_records       = nullptr;
+        m_mapping_size  = 0;
+        m_records_count = 0;
+    } //close()
+
+    bool is_open() const
+    {
+        return (m_fd != -1);
+    } //is_open()
+
+    size_t get_records_count() const
+    {
+        return m_records_count;
+    } //get_records_count()
+
+    const can_log_record_t& get_record(size_t index) const
+    {
+        assert(index < m_records_count);
+        return m_records[index];
+    } //get_record()
+
+}; //class can_log_reader
+
+/*
+    CANbus socket that logs every frame received and sent
+    Logging is active between start_recording() and stop_recording().
+    NOTE: the FD mode is refused (see set_fd_mode()) - the FD paths would bypass the log
+*/
+class can_recording_socket : public can_socket
+{
+private:
+    can_log_writer m_log;
+
+public:
+    can_recording_socket() : can_socket(), m_log()
+    {
+    }
+
+    virtual ~can_recording_socket()
+    {
+        if(m_log.is_open()) m_log.close();
+    }
+
+    /*
+        Opens the log - capacity is the maximum number of frames recorded
+    */
+    bool start_recording(const char* file_name, size_t capacity)
+    {
+        if(m_log.is_open()) m_log.close();
+        return m_log.open(file_name, capacity);
+    } //start_recording()
+
+    void stop_recording()
+    {
+        if(m_log.is_open()) m_log.close();
+    } //stop_recording()
+
+    const can_log_writer& get_log() const
+    {
+        return m_log;
+    } //get_log()
+
+    /*
+        The logs hold classic frames only
+    */
+    virtual bool set_fd_mode(bool is_enabled = true)
+    {
+        return !is_enabled;
+    } //set_fd_mode()
+
+    virtual bool send(canid_t destination_can_id, const void* payload, uint8_t payload_size)
+    {
+        const bool result = can_socket::send(destination_can_id, payload, payload_size);
+        if(result && m_log.is_open())
+        {
+            can_frame frame;
+            frame.can_id  = destination_can_id;
+            frame.can_dlc = payload_size;
+            memset(frame.data, 0, sizeof(frame.data));
+            memcpy(frame.data, payload, payload_size);
+            m_log.append(frame, control::get_now_nsec(), can_log_direction_t::TX);
+        }
+        return result;
+    } //send()
+
+    virtual bool receive(void* buffer, size_t buffer_size, uint8_t& bytes_received, canid_t& source_can_id)
+    {
+        control::nsec_t timestamp = 0;
+        return receive_with_timestamp(buffer, buffer_size, bytes_received, source_can_id, timestamp);
+    } //receive()
+
+    virtual bool receive_with_timestamp(void* buffer, size_t buffer_size, uint8_t& bytes_received, canid_t& source_can_id, control::nsec_t& timestamp)
+    {
+        const bool result = can_socket::receive_with_timestamp(buffer, buffer_size, bytes_received, source_can_id, timestamp);
+        if(result && m_log.is_open())
+        {
+            can_frame frame;
+            frame.can_id  = source_can_id;
+            frame.can_dlc = bytes_received;
+            memset(frame.data, 0, sizeof(frame.data));
+            memcpy(frame.data, buffer, bytes_received);
+            m_log.append(frame, timestamp, can_log_direction_t::RX);
+        }
+        return result;
+    } //receive_with_timestamp()
+
+    virtual size_t send_batch(const can_frame* frames, size_t frames_count)
+    {
+        const size_t frames_sent = can_socket::send_batch(frames, frames_count);
+        if(m_log.is_open())
+        {
+            const control::nsec_t now = control::get_now_nsec();
+            for(size_t i=0; i<frames_sent; i++) m_log.append(frames[i], now, can_log_direction_t::TX);
+        }
+        return frames_sent;
+    } //send_batch()
+
+    virtual size_t send_batch_until(const can_frame* frames, size_t frames_count, control::nsec_t deadline, control::nsec_t retry_period)
+    {
+        const size_t frames_sent = can_socket::send_batch_until(frames, frames_count, deadline, retry_period);
+        if(m_log.is_open())
+        {
+            const control::nsec_t now = control::get_now_nsec();
+            for(size_t i=0; i<frames_sent; i++) m_log.append(frames[i], now, can_log_direction_t::TX);
+        }
+        return frames_sent;
+    } //send_batch_until()
+
+    virtual size_t receive_batch(can_frame* frames, size_t max_frames, control::nsec_t* timestamps = nullptr, bool never_block = false)
+    {
+        size_t frames_received = 0;
+        if(m_log.is_open())
+        {   //the log needs the timestamps even if the caller does not
+            control::nsec_t local_timestamps[CAN_SOCKET_MAX_BATCH_SIZE];
+            control::nsec_t* t = (timestamps != nullptr) ? timestamps : local_timestamps;
+            if(max_frames > CAN_SOCKET_MAX_BATCH_SIZE) max_frames = CAN_SOCKET_MAX_BATCH_SIZE;
+            frames_received = can_socket::receive_batch(frames, max_frames, t, never_block);
+            for(size_t i=0; i<frames_received; i++) m_log.append(frames[i], t[i], can_log_direction_t::RX);
+        }
+        else frames_received = can_socket::receive_batch(frames, max_frames, timestamps, never_block);
+        return frames_received;
+    } //receive_batch()
+
+}; //class can_recording_socket
+
+} //namespace network
+
+#endif // NETWORK_CAN_LOG_H_INCLUDED
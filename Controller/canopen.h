@@ -62,6 +62,14 @@ const uint8_t READ_COMMAND_BYTE_1_BYTES_PAYLOAD  = 0x4F; //length 1bytes
 //these channels work in all states of the CANopen device state machine
 const uint16_t PREDEFINED_SDO_CHANNEL           = 0x600;
 const uint16_t PREDEFINED_SDO_RESPONSE_CHANNEL  = 0x580;
+//SYNC - broadcast, no Node ID
+const uint16_t PREDEFINED_SYNC_CHANNEL          = 0x080;
+//NMT - master to nodes, no Node ID
+const uint16_t PREDEFINED_NMT_CHANNEL           = 0x000;
+//heartbeat, boot-up and node guarding
+const uint16_t PREDEFINED_HEARTBEAT_CHANNEL     = 0x700;
+//EMCY - shares the function code with SYNC, but with a Node ID
+const uint16_t PREDEFINED_EMCY_CHANNEL          = 0x080;
 
 const uint16_t CHANNEL_MASK = 0x780;
 
@@ -88,9 +96,9 @@ inline bool send_expedited_sdo_write (network::can_socket& _can, uint8_t node_id
     payload[2] = ftl::get_high(index);
     //setting the subindex
     payload[3] = subindex;
-    //copy the data value
+    //copy the data value - lowest byte first
     assert(sizeof(data) <= 4);
-    ::memcpy(&(payload[4]), &data, sizeof(data)); //PORTABILITY ISSUE: this is not portable since the order of bytes can be different on non-Intel-like platforms
+    ftl::store_little_endian(&(payload[4]), data);
     //sending out
     return _can.send(PREDEFINED_SDO_CHANNEL+node_id, payload, sizeof(payload)); //CANopen mandates 8bytes-long payload
 } //canopen_send_expedited_sdo
@@ -122,24 +130,300 @@ inline bool send_expedited_sdo_read (network::can_socket& _can, uint8_t node_id,
     return _can.send(PREDEFINED_SDO_CHANNEL+node_id, payload, sizeof(payload)); //CANopen mandates 8bytes-long payload
 } //canopen_send_expedited_sdo
 
+/*
+Segmented and block SDO transfers (CiA 301), data of any size
+
+Segmented download (write): initiate (size in bytes 5-8) -> response, then for each segment:
+    |  Byte 1: 000 t nnn c  |  Bytes 2-8: data  |  -> response 001 t 0000
+Segmented upload (read): initiate -> response (size), then for each segment:
+    request 011 t 0000  ->  |  Byte 1: 000 t nnn c  |  Bytes 2-8: data  |
+  t = toggle bit, alternates starting with 0; n = bytes not containing data; c = last segment
+
+Block download: initiate 110 00 cc s 0 -> response 101 00 sc 00, byte 5 = block size,
+    then up to "block size" segments sent back to back without responses:
+    |  Byte 1: c seqno(7 bits)  |  Bytes 2-8: data  |
+    -> block acknowledge 101 000 10, byte 2 = last sequence number received in order, byte 3 = next block size;
+    end: 110 nnn 01, bytes 2-3 = CRC -> response 101 000 01
+Block upload: initiate 101 00 cc 00, byte 5 = block size -> response 110 00 sc s 0, size in bytes 5-8,
+    start 101 000 11 -> the server sends the segments of a block, the client acknowledges each block
+    with 101 000 10; end: server 110 nnn 01 with the CRC -> client 101 000 01
+*/
+
+//client command specifiers (upper 3 bits of the command byte)
+const uint8_t SDO_CCS_DOWNLOAD_SEGMENT  = 0x00;
+const uint8_t SDO_CCS_INITIATE_DOWNLOAD = 0x20;
+const uint8_t SDO_CCS_INITIATE_UPLOAD   = 0x40;
+const uint8_t SDO_CCS_UPLOAD_SEGMENT    = 0x60;
+const uint8_t SDO_CCS_BLOCK_UPLOAD      = 0xA0;
+const uint8_t SDO_CCS_BLOCK_DOWNLOAD    = 0xC0;
+//server command specifiers
+const uint8_t SDO_SCS_UPLOAD_SEGMENT    = 0x00;
+const uint8_t SDO_SCS_DOWNLOAD_SEGMENT  = 0x20;
+const uint8_t SDO_SCS_UPLOAD_RESPONSE   = 0x40; //initiate upload response, expedited data in bytes 5-8
+const uint8_t SDO_SCS_DOWNLOAD_RESPONSE = 0x60; //initiate download response
+const uint8_t SDO_SCS_BLOCK_DOWNLOAD    = 0xA0;
+const uint8_t SDO_SCS_BLOCK_UPLOAD      = 0xC0;
+//abort transfer - both directions, abort code in bytes 5-8
+const uint8_t SDO_CS_ABORT              = 0x80;
+const uint8_t SDO_CS_MASK               = 0xE0;
+//bits of the command byte
+const uint8_t SDO_SIZE_INDICATED_BIT    = 0x01; //initiate
+const uint8_t SDO_EXPEDITED_BIT         = 0x02; //initiate
+const uint8_t SDO_LAST_SEGMENT_BIT      = 0x01; //segment
+const uint8_t SDO_TOGGLE_BIT            = 0x10; //segment
+const uint8_t SDO_BLOCK_CRC_BIT         = 0x04; //block initiate
+const uint8_t SDO_BLOCK_SIZE_INDICATED_BIT = 0x02; //block initiate
+const uint8_t SDO_BLOCK_LAST_SEGMENT_BIT   = 0x80; //block segment, along with the sequence number
+//block subcommands (lower 2 bits; the lowest bit only in the block upload responses of the server)
+const uint8_t SDO_BLOCK_SUBCOMMAND_MASK = 0x03;
+const uint8_t SDO_BLOCK_UPLOAD_SUBCOMMAND_MASK = 0x01;
+const uint8_t SDO_BLOCK_INITIATE        = 0x00;
+const uint8_t SDO_BLOCK_END             = 0x01;
+const uint8_t SDO_BLOCK_ACK             = 0x02;
+const uint8_t SDO_BLOCK_START_UPLOAD    = 0x03;
+//data bytes in a segment
+const size_t  SDO_SEGMENT_DATA_SIZE     = 7;
+//maximum number of segments in a block
+const uint8_t SDO_MAX_BLOCK_SIZE        = 127;
+
+//abort codes
+const uint32_t SDO_ABORT_TOGGLE_BIT          = 0x05030000;
+const uint32_t SDO_ABORT_TIMEOUT             = 0x05040000;
+const uint32_t SDO_ABORT_INVALID_COMMAND     = 0x05040001;
+const uint32_t SDO_ABORT_INVALID_BLOCK_SIZE  = 0x05040002;
+const uint32_t SDO_ABORT_INVALID_SEQUENCE    = 0x05040003;
+const uint32_t SDO_ABORT_CRC_ERROR           = 0x05040004;
+const uint32_t SDO_ABORT_OUT_OF_MEMORY       = 0x05040005;
+const uint32_t SDO_ABORT_UNSUPPORTED_ACCESS  = 0x06010000;
+const uint32_t SDO_ABORT_OBJECT_NOT_EXISTING = 0x06020000;
+const uint32_t SDO_ABORT_LENGTH_MISMATCH     = 0x06070010;
+const uint32_t SDO_ABORT_VALUE_OUT_OF_RANGE  = 0x06090030;
+
+/*
+    Sends an SDO frame with the initiate/abort layout: command byte, index, subindex, 4 bytes of value
+*/
+inline bool send_sdo_command(network::can_socket& _can, uint8_t node_id, uint8_t command, uint16_t index, uint8_t subindex, uint32_t value = 0)
+{
+    uint8_t payload[8] = {0,0,0,0,0,0,0,0}; //CANopen mandates 8bytes-long payload
+    payload[0] = command;
+    payload[1] = ftl::get_low(index);
+    payload[2] = ftl::get_high(index);
+    payload[3] = subindex;
+    ftl::store_little_endian(&(payload[4]), value);
+    return _can.send(PREDEFINED_SDO_CHANNEL+node_id, payload, sizeof(payload));
+} //send_sdo_command()
+
+/*
+    Builds an SDO segment frame: command (or sequence number) byte followed by up to 7 data bytes
+    The frame is built in place - the data is copied straight from the caller's buffer.
+*/
+inline void build_sdo_segment(can_frame& frame, uint8_t node_id, uint8_t command, const uint8_t* data, size_t data_size)
+{
+    assert(data_size <= SDO_SEGMENT_DATA_SIZE);
+    frame.can_id  = PREDEFINED_SDO_CHANNEL+node_id;
+    frame.can_dlc = 8; //CANopen mandates 8bytes-long payload
+    ::memset(frame.data, 0, sizeof(frame.data));
+    frame.data[0] = command;
+    if(data_size > 0) ::memcpy(&(frame.data[1]), data, data_size);
+} //build_sdo_segment()
+
+/*
+    CRC of the block transfers: CRC-16-CCITT, polynomial 0x1021, initial value 0
+    Can be computed incrementally - pass the previous result as crc.
+*/
+inline uint16_t compute_sdo_block_crc(uint16_t crc, const uint8_t* data, size_t data_size)
+{
+    for(size_t i=0; i<data_size; i++)
+    {
+        crc ^= uint16_t(data[i]) << 8;
+        for(int bit=0; bit<8; bit++)
+        {
+            crc = (crc & 0x8000) ? uint16_t((crc << 1) ^ 0x1021) : uint16_t(crc << 1);
+        }
+    }
+    return crc;
+} //compute_sdo_block_crc()
+
+/*
+    Builds an RPDO frame: 2 bytes command field followed by the value at the given offset
+*/
 template <class datatype>
-inline bool send_expedited_rpdo (network::can_socket& _can, uint8_t node_id, uint16_t channel, uint16_t command, uint8_t offset, datatype data)
+inline void build_expedited_rpdo (can_frame& frame, uint8_t node_id, uint16_t channel, uint16_t command, uint8_t offset, datatype data)
 {   //CANopen allows only payloads of size 1, 2 or 4 bytes long
     assert((sizeof(data)==1) || (sizeof(data)==2) || (sizeof(data)==4));
     //buffer
-    uint8_t payload[8] = {0,0,0,0,0,0,0,0}; //CANopen mandates 8bytes-long payload
-    assert(offset<sizeof(payload));
+    memset(&frame, 0, sizeof(frame));
+    frame.can_id  = channel+node_id;
+    frame.can_dlc = 8; //CANopen mandates 8bytes-long payload
     //setting the command field
     assert(sizeof(command)==2);
-    ::memcpy(&(payload[0]), &command, sizeof(command)); //PORTABILITY ISSUE: this is not portable since the order of bytes can be different on non-Intel-like platforms
+    ftl::store_little_endian(&(frame.data[0]), command);
 
-    //copy the data value
-    assert(offset<sizeof(payload));
-    ::memcpy(&(payload[offset]), &data, sizeof(data)); //PORTABILITY ISSUE: this is not portable since the order of bytes can be different on non-Intel-like platforms
+    //copy the data value - lowest byte first
+    assert(offset+sizeof(data)<=sizeof(frame.data));
+    ftl::store_little_endian(&(frame.data[offset]), data);
+} //build_expedited_rpdo()
+
+template <class datatype>
+inline bool send_expedited_rpdo (network::can_socket& _can, uint8_t node_id, uint16_t channel, uint16_t command, uint8_t offset, datatype data)
+{
+    can_frame frame;
+    build_expedited_rpdo(frame, node_id, channel, command, offset, data);
     //sending out
-    return _can.send(channel+node_id, payload, sizeof(payload)); //CANopen mandates 8bytes-long payload
+    return _can.send(frame.can_id, frame.data, frame.can_dlc);
 } //send_expedited_rpdo
 
+/*
+SYNC and synchronous PDOs (CiA 301)
+    - the SYNC producer broadcasts an empty frame (or a 1-byte counter 1..240) on 0x080
+    - a synchronous TPDO (transmission type 1..240) is sampled and sent on every n-th SYNC,
+      so all the nodes sample their telemetry at the same moment
+    - a synchronous RPDO (transmission type 0..240) takes effect on the next SYNC,
+      so all the nodes apply their commands at the same moment
+    - the transmission type is subindex 2 of the PDO communication parameter objects
+*/
+const uint16_t RPDO_COMMUNICATION_PARAMETER_INDEX = 0x1400; //+ RPDO number (0..3)
+const uint16_t TPDO_COMMUNICATION_PARAMETER_INDEX = 0x1800; //+ TPDO number (0..3)
+const uint8_t  PDO_TRANSMISSION_TYPE_SUBINDEX     = 2;
+const uint8_t  PDO_TRANSMISSION_TYPE_SYNCHRONOUS_MAX = 240; //1..240 - every n-th SYNC
+const uint8_t  PDO_TRANSMISSION_TYPE_ASYNCHRONOUS    = 255; //device profile specific (event driven)
+const uint8_t  SYNC_COUNTER_MAX = 240;
+
+/*
+    Builds a SYNC frame; counter 0 - no counter (empty frame), 1..240 - with the counter
+*/
+inline void build_sync(can_frame& frame, uint8_t counter = 0)
+{
+    assert(counter <= SYNC_COUNTER_MAX);
+    memset(&frame, 0, sizeof(frame));
+    frame.can_id  = PREDEFINED_SYNC_CHANNEL;
+    frame.can_dlc = (counter > 0) ? 1 : 0;
+    frame.data[0] = counter;
+} //build_sync()
+
+inline bool send_sync(network::can_socket& _can, uint8_t counter = 0)
+{
+    can_frame frame;
+    build_sync(frame, counter);
+    return _can.send(frame.can_id, frame.data, frame.can_dlc);
+} //send_sync()
+
+/*
+NMT and error control (CiA 301)
+    - NMT command of the master on 0x000:
+        | Byte 1: command | Byte 2: Node ID, 0 - all the nodes |
+    - heartbeat of a node on 0x700 + Node ID, every "producer heartbeat time" (object 0x1017, ms):
+        | Byte 1: NMT state |
+      boot-up message - the same frame with state 0, sent once after a power-on or a reset
+    - node guarding: the master sends an RTR frame on 0x700 + Node ID, the node answers
+        | Byte 1: toggle bit (bit 7) + NMT state |
+      the toggle bit alternates starting with 0 after the boot-up
+*/
+//NMT commands
+const uint8_t NMT_COMMAND_START                 = 0x01;
+const uint8_t NMT_COMMAND_STOP                  = 0x02;
+const uint8_t NMT_COMMAND_ENTER_PRE_OPERATIONAL = 0x80;
+const uint8_t NMT_COMMAND_RESET_NODE            = 0x81;
+const uint8_t NMT_COMMAND_RESET_COMMUNICATION   = 0x82;
+const uint8_t NMT_ALL_NODES = 0;
+//NMT states as reported by the heartbeat
+const uint8_t NMT_STATE_BOOTUP          = 0x00;
+const uint8_t NMT_STATE_STOPPED         = 0x04;
+const uint8_t NMT_STATE_OPERATIONAL     = 0x05;
+const uint8_t NMT_STATE_PRE_OPERATIONAL = 0x7F;
+const uint8_t NMT_STATE_UNKNOWN         = 0xFF; //not reported by the nodes - no heartbeat received (yet)
+const uint8_t NMT_STATE_MASK            = 0x7F;
+const uint8_t NODE_GUARDING_TOGGLE_BIT  = 0x80;
+//heartbeat period of a node, 16bit, ms
+const uint16_t PRODUCER_HEARTBEAT_TIME_INDEX = 0x1017;
+
+/*
+    Builds an NMT command frame; node_id NMT_ALL_NODES addresses all the nodes on the bus
+*/
+inline void build_nmt_command(can_frame& frame, uint8_t command, uint8_t node_id = NMT_ALL_NODES)
+{
+    assert(node_id < 128);
+    memset(&frame, 0, sizeof(frame));
+    frame.can_id  = PREDEFINED_NMT_CHANNEL;
+    frame.can_dlc = 2;
+    frame.data[0] = command;
+    frame.data[1] = node_id;
+} //build_nmt_command()
+
+inline bool send_nmt_command(network::can_socket& _can, uint8_t command, uint8_t node_id = NMT_ALL_NODES)
+{
+    can_frame frame;
+    build_nmt_command(frame, command, node_id);
+    return _can.send(frame.can_id, frame.data, frame.can_dlc);
+} //send_nmt_command()
+
+/*
+    Builds a heartbeat (or, with NMT_STATE_BOOTUP, a boot-up) frame of a node
+*/
+inline void build_heartbeat(can_frame& frame, uint8_t node_id, uint8_t nmt_state)
+{
+    assert((node_id != 0) && (node_id < 128));
+    memset(&frame, 0, sizeof(frame));
+    frame.can_id  = PREDEFINED_HEARTBEAT_CHANNEL+node_id;
+    frame.can_dlc = 1;
+    frame.data[0] = nmt_state;
+} //build_heartbeat()
+
+/*
+    Node guarding request - a remote frame, the node answers with its state and the toggle bit
+*/
+inline bool send_node_guarding_request(network::can_socket& _can, uint8_t node_id)
+{
+    assert((node_id != 0) && (node_id < 128));
+    const uint8_t dummy_payload[1] = {0};
+    return _can.send(CAN_RTR_FLAG | (PREDEFINED_HEARTBEAT_CHANNEL+node_id), dummy_payload, 0);
+} //send_node_guarding_request()
+
+/*
+EMCY (CiA 301) - sent by a node once on every error, on 0x080 + Node ID:
+    | Bytes 1-2: error code | Byte 3: error register (object 0x1001) | Bytes 4-8: manufacturer specific |
+  error code 0x0000 - error reset: the node has no errors left
+*/
+const uint16_t EMCY_ERROR_CODE_RESET   = 0x0000;
+const uint16_t EMCY_ERROR_CODE_GENERIC = 0x1000;
+const size_t   EMCY_MANUFACTURER_DATA_SIZE = 5;
+
+struct emcy_message_t
+{
+    uint16_t error_code;
+    uint8_t  error_register;
+    uint8_t  manufacturer_data[EMCY_MANUFACTURER_DATA_SIZE];
+};
+
+/*
+    Returns false if the payload is too short for an EMCY
+*/
+inline bool parse_emcy(const uint8_t* payload, uint8_t payload_size, emcy_message_t& emcy)
+{
+    bool result = false;
+    if(payload_size >= 3)
+    {
+        emcy.error_code     = ftl::load_little_endian<uint16_t>(&(payload[0]));
+        emcy.error_register = payload[2];
+        memset(emcy.manufacturer_data, 0, sizeof(emcy.manufacturer_data));
+        const size_t data_size = (payload_size < 8) ? (payload_size - 3u) : EMCY_MANUFACTURER_DATA_SIZE;
+        memcpy(emcy.manufacturer_data, &(payload[3]), data_size);
+        result = true;
+    }
+    return result;
+} //parse_emcy()
+
+inline void build_emcy(can_frame& frame, uint8_t node_id, const emcy_message_t& emcy)
+{
+    assert((node_id != 0) && (node_id < 128));
+    memset(&frame, 0, sizeof(frame));
+    frame.can_id  = PREDEFINED_EMCY_CHANNEL+node_id;
+    frame.can_dlc = 8;
+    ftl::store_little_endian(&(frame.data[0]), emcy.error_code);
+    frame.data[2] = emcy.error_register;
+    memcpy(&(frame.data[3]), emcy.manufacturer_data, sizeof(emcy.manufacturer_data));
+} //build_emcy()
+
 /*
     Extract Node ID from COB ID
     COB_ID = 4bits Function Code, 7bits Node ID
@@ -162,11 +446,82 @@ inline uint16_t extract_function_code_from_cob_id(uint16_t cob_id)
     return function_code;
 } //extract_function_code_from_cob_id()
 
+/*
+    Builds a compact set of kernel receive filters (see can_socket::set_filters())
+    matching exactly the COB IDs "function code + node ID" for all given nodes and function codes.
+    Exact filters differing in a single bit are merged into one masked filter, repeatedly,
+    so no foreign COB ID ever passes, e.g. 0x180+N and 0x380+N collapse into one filter.
+    Only standard (11bit) data frames pass; extended and RTR frames are rejected.
+    Returns the number of filters written or 0 if max_filters is too small.
+*/
+inline size_t build_receive_filters(const uint8_t* node_ids, size_t nodes_count,
+                                    const uint16_t* function_codes, size_t function_codes_count,
+                                    can_filter* filters, size_t max_filters)
+{
+    //working set of the filters - never more than the 11bit COB ID space
+    struct cob_id_filter { uint16_t id; uint16_t mask; };
+    cob_id_filter work[2048];
+    size_t work_count = 0;
+    //exact filters - one per COB ID, no duplicates
+    for(size_t f=0; f<function_codes_count; f++)
+    {
+        for(size_t n=0; n<nodes_count; n++)
+        {
+            const uint16_t cob_id = (function_codes[f] | node_ids[n]) & CAN_SFF_MASK;
+            bool is_duplicate = false;
+            for(size_t i=0; i<work_count; i++) if(work[i].id==cob_id) { is_duplicate = true; break; }
+            if(!is_duplicate)
+            {
+                assert(work_count < sizeof(work)/sizeof(work[0]));
+                work[work_count].id   = cob_id;
+                work[work_count].mask = CAN_SFF_MASK;
+                work_count++;
+            }
+        }
+    }
+    //merging filters with equal masks and ids differing in a single bit
+    bool is_merged = true;
+    while(is_merged)
+    {
+        is_merged = false;
+        for(size_t i=0; i<work_count; i++)
+        {
+            for(size_t j=i+1; j<work_count; j++)
+            {
+                const uint16_t difference = work[i].id ^ work[j].id;
+                if((work[i].mask==work[j].mask) && (difference!=0) && ((difference & (difference-1))==0))
+                {   //merging j into i
+                    work[i].mask &= ~difference;
+                    work[i].id   &= work[i].mask;
+                    //removing j
+                    work[j] = work[work_count-1];
+                    work_count--;
+                    is_merged = true;
+                    j = i; //starting over for the merged filter
+                }
+            }
+        }
+    }
+    //output
+    size_t result = 0;
+    if(work_count <= max_filters)
+    {
+        for(size_t i=0; i<work_count; i++)
+        {
+            filters[i].can_id   = work[i].id;
+            filters[i].can_mask = work[i].mask | CAN_EFF_FLAG | CAN_RTR_FLAG;
+        }
+        result = work_count;
+    }
+    //
+    return result;
+} //build_receive_filters()
+
 /*
 */
 inline uint16_t extract_index_from_payload(uint8_t payload[8])
 {
-    const uint16_t index = *((uint16_t*)&(payload[1]));
+    const uint16_t index = ftl::load_little_endian<uint16_t>(&(payload[1]));
     return index;
 } //extract_index_from_payload()
 
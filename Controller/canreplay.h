@@ -0,0 +1,288 @@
+#ifndef NETWORK_CAN_REPLAY_H_INCLUDED
+#define NETWORK_CAN_REPLAY_H_INCLUDED
+
+/*
+Replay of a CANbus log recorded with network::can_recording_socket (see canlog.h)
+    - stands in for network::can_socket: the received (RX) frames of the log are fed back
+      through receive()/receive_batch(), the sent frames are swallowed and counted
+    - original speed (1.0), accelerated (e.g. 10.0) or as fast as possible (0.0)
+    - the recorded timestamps are shifted to the replay start, so the controllers
+      see the original inter-frame intervals (scaled by the speed factor, unscaled if 0.0)
+
+Replaying against the motor controllers:
+    network::can_replay_socket replay;
+    replay.startup("/tmp/can.log", 1.0);
+    dispatcher.set_can_socket(replay);
+    while(replay.is_connected()) dispatcher.execute();
+NOTE: there is no file descriptor to wait on (get_fd() returns -1), drive the replay with
+servosila_canbus_dispatcher::execute() rather than with the event loop.
+*/
+
+#include <time.h>       /* clock_nanosleep() */
+#include <errno.h>
+#include "network/cansocket.h"
+#include "network/canlog.h"
+#include "control/timer.h"
+
+namespace network
+{
+
+class can_replay_socket : public can_socket
+{
+private:
+    can_log_reader  m_log;
+    size_t          m_next_record;      //index of the next record to be examined
+    double          m_speed_factor;     //0 = as fast as possible
+    bool            m_nonblocking;
+    control::nsec_t m_log_start_time;   //timestamp of the first record
+    control::nsec_t m_replay_start_time;
+    size_t          m_frames_sent;      //frames swallowed by send()
+    size_t          m_last_receive_count;
+
+public:
+    can_replay_socket()
+        :   can_socket(),
+            m_log(),
+            m_next_record(0),
+            m_speed_factor(1.0),
+            m_nonblocking(true),
+            m_log_start_time(0),
+            m_replay_start_time(0),
+            m_frames_sent(0),
+            m_last_receive_count(0)
+    {
+    }
+
+    virtual ~can_replay_socket()
+    {
+        if(m_log.is_open()) m_log.close();
+    }
+
+    /*
+        Opens a log and starts the replay
+        speed_factor: 1.0 = original speed, 2.0 = twice as fast, 0.0 = as fast as possible
+        In the blocking mode, receive() sleeps until the next frame is due.
+    */
+    bool startup(const char* log_file_name, double speed_factor = 1.0, bool nonblocking = true)
+    {
+        assert(!m_log.is_open());
+        assert(speed_factor >= 0.0);
+        m_speed_factor = speed_factor;
+        m_nonblocking  = nonblocking;
+        m_frames_sent  = 0;
+        const bool result = m_log.open(log_file_name);
+        if(result) restart();
+        return result;
+    } //startup()
+
+    /*
+        Rewinds the replay to the beginning of the log
+    */
+    void restart()
+    {
+        assert(m_log.is_open());
+        m_next_record       = 0;
+        m_log_start_time    = (m_log.get_records_count() > 0) ? m_log.get_record(0).timestamp : 0;
+        m_replay_start_time = control::get_now_nsec();
+    } //restart()
+
+    virtual void shutdown()
+    {
+        assert(m_log.is_open());
+        m_log.close();
+    } //shutdown()
+
+    /*
+        Connected until the last received frame of the log has been replayed
+    */
+    virtual bool is_connected() const
+    {
+        return m_log.is_open() && (m_next_record < m_log.get_records_count());
+    } //is_connected()
+
+    virtual int get_fd() const
+    {
+        return -1;
+    } //get_fd()
+
+    /*
+        The logs hold classic frames only
+    */
+    virtual bool set_fd_mode(bool is_enabled = true)
+    {
+        return !is_enabled;
+    } //set_fd_mode()
+
+    /*
+        The log is replayed as recorded - the filters are accepted and ignored
+    */
+    virtual bool set_filters(const can_filter* filters, size_t filters_count) const
+    {
+        (void)filters;
+        (void)filters_count;
+        return true;
+    } //set_filters()
+
+    virtual bool set_error_filter(can_err_mask_t error_mask) const
+    {
+        (void)error_mask;
+        return true;
+    } //set_error_filter()
+
+    /*
+        The sent frames are not replayed - there is nothing to confirm
+    */
+    virtual bool set_tx_confirmation_mode(bool is_enabled = true)
+    {
+        return !is_enabled;
+    } //set_tx_confirmation_mode()
+
+    /*
+        Sent frames are not replayed - only counted
+    */
+    virtual bool send(canid_t destination_can_id, const void* payload, uint8_t payload_size)
+    {
+        (void)destination_can_id;
+        (void)payload;
+        assert(payload_size<=8);
+        const bool result = is_connected();
+        if(result) m_frames_sent++;
+        return result;
+    } //send()
+
+    virtual size_t send_batch(const can_frame* frames, size_t frames_count)
+    {
+        (void)frames;
+        const size_t frames_sent = is_connected() ? frames_count : 0;
+        m_frames_sent += frames_sent;
+        return frames_sent;
+    } //send_batch()
+
+    virtual size_t send_batch_until(const can_frame* frames, size_t frames_count, control::nsec_t deadline, control::nsec_t retry_period)
+    {
+        (void)deadline;
+        (void)retry_period;
+        return send_batch(frames, frames_count);
+    } //send_batch_until()
+
+    virtual bool receive(void* buffer, size_t buffer_size, uint8_t& bytes_received, canid_t& source_can_id)
+    {
+        control::nsec_t timestamp = 0;
+        return receive_with_timestamp(buffer, buffer_size, bytes_received, source_can_id, timestamp);
+    } //receive()
+
+    virtual bool receive_with_timestamp(void* buffer, size_t buffer_size, uint8_t& bytes_received, canid_t& source_can_id, control::nsec_t& timestamp)
+    {
+        bool result = false;
+        const can_log_record_t* record = _fetch_next_rx_record(timestamp);
+        if(record != nullptr)
+        {
+            source_can_id  = record->can_id;
+            bytes_received = record->can_dlc;
+            //checking for buffer overflow
+            if(bytes_received<=buffer_size)
+            {
+                memcpy(buffer, record->data, bytes_received);
+                result = true;
+            }
+        }
+        return result;
+    } //receive_with_timestamp()
+
+    /*
+        Fetches up to max_frames frames that are due; blocks for the first one if blocking, unless never_block
+    */
+    virtual size_t receive_batch(can_frame* frames, size_t max_frames, control::nsec_t* timestamps = nullptr, bool never_block = false)
+    {
+        size_t frames_received = 0;
+        while(frames_received < max_frames)
+        {
+            control::nsec_t timestamp = 0;
+            const can_log_record_t* record = _fetch_next_rx_record(timestamp, never_block || (frames_received > 0));
+            if(record == nullptr) break;
+            frames[frames_received].can_id  = record->can_id;
+            frames[frames_received].can_dlc = record->can_dlc;
+            memcpy(frames[frames_received].data, record->data, sizeof(record->data));
+            if(timestamps != nullptr) timestamps[frames_received] = timestamp;
+            frames_received++;
+        }
+        m_last_receive_count = frames_received;
+        return frames_received;
+    } //receive_batch()
+
+    virtual size_t get_last_receive_count() const
+    {
+        return m_last_receive_count;
+    } //get_last_receive_count()
+
+    size_t get_frames_sent() const
+    {
+        return m_frames_sent;
+    } //get_frames_sent()
+
+    /*
+        Replay progress - index of the next record of the log
+    */
+    size_t get_position() const
+    {
+        return m_next_record;
+    } //get_position()
+
+    const can_log_reader& get_log() const
+    {
+        return m_log;
+    } //get_log()
+
+private:
+    //helper function - the next received frame of the log if it is due, null otherwise
+    //...the timestamp is converted to the replay time
+    const can_log_record_t* _fetch_next_rx_record(control::nsec_t& timestamp, bool never_block = false)
+    {
+        const can_log_record_t* result = nullptr;
+        //skipping the sent frames
+        while(is_connected() && (m_log.get_record(m_next_record).direction != uint8_t(can_log_direction_t::RX)))
+        {
+            m_next_record++;
+        }
+        if(is_connected())
+        {
+            const can_log_record_t& record = m_log.get_record(m_next_record);
+            const control::nsec_t due_time = _get_due_time(record.timestamp);
+            //as fast as possible - every frame is due right away
+            control::nsec_t now = (m_speed_factor > 0.0) ? control::get_now_nsec() : due_time;
+            if((now < due_time) && !m_nonblocking && !never_block)
+            {   //waiting for the frame
+                timespec deadline;
+                deadline.tv_sec  = due_time / control::NSEC_PER_SEC;
+                deadline.tv_nsec = due_time % control::NSEC_PER_SEC;
+                while(::clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, nullptr) == EINTR);
+                now = due_time;
+            }
+            if(now >= due_time)
+            {
+                timestamp = due_time;
+                result = &record;
+                m_next_record++;
+            }
+        }
+        return result;
+    } //_fetch_next_rx_record()
+
+    //helper function - recorded time to replay time
+    //...as fast as possible keeps the original intervals
+    control::nsec_t _get_due_time(control::nsec_t recorded_timestamp) const
+    {
+        control::nsec_t due_time = m_replay_start_time;
+        if(recorded_timestamp > m_log_start_time)
+        {
+            const double scale = (m_speed_factor > 0.0) ? m_speed_factor : 1.0;
+            due_time += control::nsec_t(double(recorded_timestamp - m_log_start_time) / scale);
+        }
+        return due_time;
+    } //_get_due_time()
+
+}; //class can_replay_socket
+
+} //namespace network
+
+#endif // NETWORK_CAN_REPLAY_H_INCLUDED
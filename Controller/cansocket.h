@@ -14,6 +14,10 @@ $ sudo ip link set up vcan0
 $ ip link show vcan0
 3: vcan0: <NOARP,UP,LOWER_UP> mtu 16 qdisc noqueue state UNKNOWN
     link/can
+
+CAN FD (see set_fd_mode()):
+$ sudo ip link set vcan0 mtu 72                                         # virtual CAN
+$ sudo ip link set can0 type can bitrate 1000000 dbitrate 5000000 fd on  # real hardware
 */
 
 #include <net/if.h>
@@ -27,18 +31,106 @@ $ ip link show vcan0
 #include <assert.h>
 #include <stdint.h>     /* uint8_t */
 #include <errno.h>
+#include <time.h>       /* clock_gettime(), clock_nanosleep() */
+#include <poll.h>       /* ppoll() */
+#include <linux/net_tstamp.h> /* SOF_TIMESTAMPING_* */
+#include "control/timer.h"    /* nsec_t */
 
 namespace network
 {
 
-//TODO: Implement Filters
+//maximum number of frames moved by a single sendmmsg()/recvmmsg() call
+const size_t CAN_SOCKET_MAX_BATCH_SIZE = 64;
+
+//CAN FD frames without the FDF bit in the flags are classic frames received into a canfd_frame
+#ifndef CANFD_FDF
+#define CANFD_FDF 0x04
+#endif
+
+//payload sizes allowed by CAN FD
+const uint8_t CANFD_PAYLOAD_SIZES[] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 12, 16, 20, 24, 32, 48, 64 };
+
+/*
+    The smallest CAN FD payload size that fits payload_size bytes - the rest of the payload is padded
+*/
+inline uint8_t get_canfd_payload_size(size_t payload_size)
+{
+    assert(payload_size <= CANFD_MAX_DLEN);
+    size_t i = 0;
+    while(CANFD_PAYLOAD_SIZES[i] < payload_size) i++;
+    return CANFD_PAYLOAD_SIZES[i];
+} //get_canfd_payload_size()
+
+inline bool is_canfd_frame(const canfd_frame& frame)
+{
+    return (frame.flags & CANFD_FDF) != 0;
+} //is_canfd_frame()
+
+/*
+    A classic frame in a canfd_frame - e.g. SYNC or NMT in a send_batch_fd() batch
+*/
+inline void copy_to_canfd_frame(const can_frame& from, canfd_frame& to)
+{
+    memset(&to, 0, sizeof(to));
+    to.can_id = from.can_id;
+    to.len    = from.can_dlc;
+    memcpy(to.data, from.data, from.can_dlc);
+} //copy_to_canfd_frame()
+
+//size of the control message buffer for a single frame - room for SCM_TIMESTAMPING (3 timespecs) and SO_RXQ_OVFL
+const size_t CAN_SOCKET_CONTROL_BUFFER_SIZE = CMSG_SPACE(3*sizeof(timespec)) + CMSG_SPACE(sizeof(uint32_t));
+
+/*
+    Cumulative counters of a can_socket since startup() - see can_socket::get_statistics()
+*/
+struct can_socket_statistics_t
+{
+    size_t frames_sent;
+    size_t bytes_sent;          //payload
+    size_t frames_received;     //error frames included
+    size_t bytes_received;      //payload
+    size_t error_frames;        //received, as per set_error_filter()
+    size_t frames_dropped;      //by the kernel - the receive queue of the socket overflowed (SO_RXQ_OVFL)
+    size_t send_buffer_full;    //frames not sent: ENOBUFS or EAGAIN - the TX queue of the interface is full
+    size_t frames_confirmed;    //sent frames echoed back by the kernel, see set_tx_confirmation_mode()
+    size_t send_failures;       //frames not sent: any other error
+    size_t receive_failures;    //errors other than EAGAIN (nothing to receive)
+    int    last_error;          //errno of the latest send or receive failure, 0 - none
+};
+
+/*
+    Sees every frame moved by a can_socket, e.g. network::can_bus_load_meter (see can_socket::set_traffic_observer())
+    Called from the thread using the socket.
+*/
+class can_traffic_observer
+{
+public:
+    virtual ~can_traffic_observer()
+    {
+    }
+    virtual void on_frame_sent(canid_t can_id, uint8_t payload_size, uint8_t fd_flags) = 0;
+    virtual void on_frame_received(canid_t can_id, uint8_t payload_size, uint8_t fd_flags) = 0;
+}; //class can_traffic_observer
+
 class can_socket
 {
 private:
-    int m_socket_fd; //file descriptor for the socket
+    int  m_socket_fd; //file descriptor for the socket
+    bool m_is_timestamp_enabled;
+    bool m_is_fd_enabled;
+    //instrumentation
+    can_socket_statistics_t m_statistics;
+    uint32_t                m_kernel_drops;     //SO_RXQ_OVFL counter of the kernel, cumulative per socket
+    can_traffic_observer*   m_observer;
+    size_t                  m_last_receive_count; //frames taken off the socket by the last batch receive
+    //TX confirmations
+    bool                    m_is_tx_confirmation_enabled;
+    size_t                  m_frames_sent_unconfirmed;    //frames sent before the confirmations were enabled
+    control::nsec_t         m_last_confirmation_timestamp;
 
 public:
-    can_socket() : m_socket_fd(-1)
+    can_socket() : m_socket_fd(-1), m_is_timestamp_enabled(false), m_is_fd_enabled(false), m_statistics(), m_kernel_drops(0), m_observer(nullptr), m_last_receive_count(0),
+                   m_is_tx_confirmation_enabled(false), m_frames_sent_unconfirmed(0), m_last_confirmation_timestamp(0)
     {
     } //can_socket()
 
@@ -54,6 +146,13 @@ public:
     {
         assert(m_socket_fd == -1);
         bool result = false;
+        m_is_timestamp_enabled = false;
+        m_is_fd_enabled = false;
+        memset(&m_statistics, 0, sizeof(m_statistics));
+        m_kernel_drops = 0;
+        m_is_tx_confirmation_enabled  = false;
+        m_frames_sent_unconfirmed     = 0;
+        m_last_confirmation_timestamp = 0;
         //creating a socket
         m_socket_fd = ::socket(PF_CAN, SOCK_RAW, CAN_RAW);
         //checking result
@@ -80,6 +179,9 @@ public:
                         const int fr = ::fcntl(m_socket_fd, F_SETFL, O_NONBLOCK, 1); //No result code check
                         if(fr==-1) assert(false);
                     }
+                    //the kernel reports its receive queue drops along with the frames - no result code check, optional
+                    const int rxq_ovfl_flag = 1;
+                    ::setsockopt(m_socket_fd, SOL_SOCKET, SO_RXQ_OVFL, &rxq_ovfl_flag, sizeof(rxq_ovfl_flag));
                     //OK
                     result = true;
                 }
@@ -94,7 +196,7 @@ public:
     /*
         Deinitializes the CANbus socket.
     */
-    void shutdown()
+    virtual void shutdown()
     {
         assert(m_socket_fd != -1);
         const int result = ::close(m_socket_fd);
@@ -105,7 +207,7 @@ public:
     /*
         Sends a CANbus packet to a specified destination.
     */
-    bool send(canid_t destination_can_id, const void* payload, uint8_t payload_size)
+    virtual bool send(canid_t destination_can_id, const void* payload, uint8_t payload_size)
     {
         assert(payload_size<=8);
         bool result = false;
@@ -126,28 +228,12 @@ public:
             if(nbytes != -1)
             {
                 //printf("Wrote %d bytes\n", nbytes);
+                _count_sent(frame.can_id, frame.can_dlc, 0);
                 result = true; //OK
             }
             else
             {   //Error code analysis - looking for USB Device Unplugged situations
-                int error = errno;
-                switch(error)
-                {
-                    case ENODEV: //"No such device"
-                    {   //USB device unplugged
-                        shutdown();
-                        break;
-                    }
-                    case ENXIO: //"No such device or address"
-                    {   //USB device unplugged
-                        shutdown();
-                        break;
-                    }
-                    default:
-                    {   //ignoring all errors except those related to USB Device Unplugged
-                        break;
-                    }
-                } //switch(error)
+                _process_send_error(errno, 1);
             } //else
         } //if is connected
         //
@@ -158,21 +244,33 @@ public:
         Fetches a CANbus frame
         Blocking or Non-blocking depending on the startup() parameter
     */
-    bool receive(void* buffer, size_t buffer_size, uint8_t& bytes_received, canid_t& source_can_id)
+    virtual bool receive(void* buffer, size_t buffer_size, uint8_t& bytes_received, canid_t& source_can_id)
     {
         bool result = false;
         if(is_connected())
         {
             //buffer data structure
             can_frame frame;
+            //message header - no control messages
+            iovec  vector;
+            msghdr message;
+            vector.iov_base = &frame;
+            vector.iov_len  = sizeof(frame);
+            memset(&message, 0, sizeof(message));
+            message.msg_iov    = &vector;
+            message.msg_iovlen = 1;
             //reading a CANbus frame (could be blocking or non-blocking)
-            const int nbytes = ::read(m_socket_fd, &frame, sizeof(can_frame));
+            const ssize_t nbytes = ::recvmsg(m_socket_fd, &message, 0);
             assert(nbytes!=0); //no such thing as an empty CANbus frame
             //checking if a frame has been received
-            if (nbytes != -1) //if a frame has been fetched
+            //...in the FD mode an FD frame does not fit and is truncated (MSG_TRUNC) - skipped
+            //...a TX confirmation is counted and skipped, without its timestamp
+            if ((nbytes != -1) && _is_tx_confirmation(message)) _count_confirmed(0);
+            else if ((nbytes != -1) && ((message.msg_flags & MSG_TRUNC) == 0)) //if a frame has been fetched
             {   //extracting data from the frame
                 source_can_id = frame.can_id;
                 bytes_received = frame.can_dlc;
+                _count_received(frame.can_id, frame.can_dlc, 0);
                 //checking for buffer overflow
                 if(bytes_received<=buffer_size)
                 {   //copying the data
@@ -180,26 +278,9 @@ public:
                     result = true;
                 }
             }
-            else
+            else if(nbytes == -1)
             {   //Error code analysis - looking for USB Device Unplugged situations
-                int error = errno;
-                switch(error)
-                {
-                    case ENODEV: //"No such device"
-                    {   //USB device unplugged
-                        shutdown();
-                        break;
-                    }
-                    case ENXIO: //"No such device or address"
-                    {   //USB device unplugged
-                        shutdown();
-                        break;
-                    }
-                    default:
-                    {   //ignoring all errors except those related to USB Device Unplugged situatiopn
-                        break;
-                    }
-                } //switch(error)
+                _process_receive_error(errno);
             } //else
         } //if is connected
         //
@@ -208,22 +289,381 @@ public:
 
     /*
         Fetches a CANbus frame with Timestamp
-            (this is a wrapper around the main function)
+            the kernel receive timestamp comes along with the frame as a control message,
+            no extra syscall is needed; see set_timestamp_flag()
+        The timestamp is in CLOCK_MONOTONIC nanoseconds (see control::get_now_nsec()).
         Blocking or Non-blocking depending on the startup() parameter
     */
-    bool receive_with_timestamp(void* buffer, size_t buffer_size, uint8_t& bytes_received, canid_t& source_can_id, timeval& timestamp)
+    virtual bool receive_with_timestamp(void* buffer, size_t buffer_size, uint8_t& bytes_received, canid_t& source_can_id, control::nsec_t& timestamp)
     {
-        //calling the main function first
-        bool result = receive(buffer, buffer_size, bytes_received, source_can_id);
-        if(result == true)
-        {   //fetching exact timestamp
-            const int ir = ::ioctl(m_socket_fd, SIOCGSTAMP, &timestamp); //No result check
-            if(ir==-1) assert(false);
-        }
+        bool result = false;
+        if(is_connected() && (m_is_timestamp_enabled || set_timestamp_flag()))
+        {
+            //buffer data structure
+            can_frame frame;
+            //message header
+            iovec  vector;
+            msghdr message;
+            char   control[CAN_SOCKET_CONTROL_BUFFER_SIZE];
+            vector.iov_base = &frame;
+            vector.iov_len  = sizeof(frame);
+            memset(&message, 0, sizeof(message));
+            message.msg_iov        = &vector;
+            message.msg_iovlen     = 1;
+            message.msg_control    = control;
+            message.msg_controllen = sizeof(control);
+            //reading a CANbus frame (could be blocking or non-blocking)
+            const ssize_t nbytes = ::recvmsg(m_socket_fd, &message, 0);
+            assert(nbytes!=0); //no such thing as an empty CANbus frame
+            //checking if a frame has been received
+            //...in the FD mode an FD frame does not fit and is truncated (MSG_TRUNC) - skipped
+            //...a TX confirmation is counted and skipped
+            if ((nbytes != -1) && _is_tx_confirmation(message)) _count_confirmed(_process_control_messages(message, _get_realtime_to_monotonic_offset()));
+            else if ((nbytes != -1) && ((message.msg_flags & MSG_TRUNC) == 0)) //if a frame has been fetched
+            {   //extracting data from the frame
+                source_can_id = frame.can_id;
+                bytes_received = frame.can_dlc;
+                _count_received(frame.can_id, frame.can_dlc, 0);
+                //extracting the timestamp
+                timestamp = _process_control_messages(message, _get_realtime_to_monotonic_offset());
+                //checking for buffer overflow
+                if(bytes_received<=buffer_size)
+                {   //copying the data
+                    memcpy(buffer, frame.data, bytes_received);
+                    result = true;
+                }
+            }
+            else if(nbytes == -1)
+            {   //Error code analysis - looking for USB Device Unplugged situations
+                _process_receive_error(errno);
+            }
+        } //if is connected
         //
         return result;
     } //receive_with_timestamp()
 
+    /*
+        Sends a batch of CANbus frames with a single sendmmsg() syscall
+        (more than one call only if frames_count > CAN_SOCKET_MAX_BATCH_SIZE)
+        Returns the number of frames actually sent.
+    */
+    virtual size_t send_batch(const can_frame* frames, size_t frames_count)
+    {
+        int error = 0;
+        const size_t frames_sent = _send_batch(frames, frames_count, error);
+        if(error != 0) _process_send_error(error, frames_count - frames_sent);
+        return frames_sent;
+    } //send_batch()
+
+    /*
+        send_batch() that does not give up on a full TX queue of the interface (ENOBUFS, EAGAIN) till the deadline
+        - between the attempts the thread waits for the socket to become writable, then retry_period at a time:
+          POLLOUT reflects the send buffer of the socket, not the TX queue of the interface, which drains
+          a frame at a time - a frame time on the wire is a sensible retry_period
+        - the frames still not sent at the deadline are counted in the statistics once, not per attempt
+        deadline: CLOCK_MONOTONIC nanoseconds (see control::get_now_nsec())
+        Returns the number of frames actually sent.
+    */
+    virtual size_t send_batch_until(const can_frame* frames, size_t frames_count, control::nsec_t deadline, control::nsec_t retry_period)
+    {
+        int error = 0;
+        bool is_writable = false; //the socket has reported POLLOUT during this call
+        size_t frames_sent = _send_batch(frames, frames_count, error);
+        while((frames_sent < frames_count) && _is_tx_queue_full(error) && is_connected() && _wait_for_tx_queue(deadline, retry_period, is_writable))
+        {   //the TX queue is full - retrying the rest
+            frames_sent += _send_batch(&(frames[frames_sent]), frames_count - frames_sent, error);
+        }
+        if(error != 0) _process_send_error(error, frames_count - frames_sent);
+        return frames_sent;
+    } //send_batch_until()
+
+    /*
+        Fetches up to max_frames CANbus frames with a single recvmmsg() syscall
+        Blocks until at least one frame arrives if the socket is blocking.
+        If timestamps is not null, it receives the kernel timestamps of the frames
+        in CLOCK_MONOTONIC nanoseconds (see control::get_now_nsec()); 0 if not available.
+        Returns the number of frames received.
+        never_block: MSG_DONTWAIT even on a blocking socket - for the repeated calls of a drain loop,
+        which must not wait for more frames once the pending ones have been taken
+        NOTE: the skipped FD frames make a full batch look short - drain the socket
+        while get_last_receive_count() == CAN_SOCKET_MAX_BATCH_SIZE rather than on the returned count
+    */
+    virtual size_t receive_batch(can_frame* frames, size_t max_frames, control::nsec_t* timestamps = nullptr, bool never_block = false)
+    {
+        size_t frames_received = 0;
+        m_last_receive_count = 0;
+        if(is_connected() && (max_frames > 0))
+        {   //enabling the timestamps on first use
+            if((timestamps != nullptr) && !m_is_timestamp_enabled) set_timestamp_flag();
+            //message headers - one per frame
+            mmsghdr messages[CAN_SOCKET_MAX_BATCH_SIZE];
+            iovec   vectors[CAN_SOCKET_MAX_BATCH_SIZE];
+            //control message buffers for the timestamps and the kernel drops counter
+            char    control[CAN_SOCKET_MAX_BATCH_SIZE][CAN_SOCKET_CONTROL_BUFFER_SIZE];
+            //size of the batch
+            const size_t batch_size = _min(max_frames, CAN_SOCKET_MAX_BATCH_SIZE);
+            //setting up the message headers
+            memset(messages, 0, batch_size*sizeof(mmsghdr));
+            for(size_t i=0; i<batch_size; i++)
+            {
+                vectors[i].iov_base = &(frames[i]);
+                vectors[i].iov_len  = sizeof(can_frame);
+                messages[i].msg_hdr.msg_iov        = &(vectors[i]);
+                messages[i].msg_hdr.msg_iovlen     = 1;
+                messages[i].msg_hdr.msg_control    = control[i];
+                messages[i].msg_hdr.msg_controllen = sizeof(control[i]);
+            }
+            //reading the frames (blocks for the first frame only if the socket is blocking)
+            const int nframes = ::recvmmsg(m_socket_fd, messages, batch_size, never_block ? (MSG_WAITFORONE | MSG_DONTWAIT) : MSG_WAITFORONE, nullptr);
+            if(nframes > 0)
+            {   //the kernel stamps the frames with CLOCK_REALTIME
+                const int64_t offset = ((timestamps != nullptr) || m_is_tx_confirmation_enabled) ? _get_realtime_to_monotonic_offset() : 0;
+                m_last_receive_count = nframes;
+                for(int i=0; i<nframes; i++)
+                {   //no such thing as a partial CANbus frame - but in the FD mode the FD frames do not fit:
+                    //...the kernel truncates them to a can_frame and flags MSG_TRUNC, they are skipped
+                    const bool is_truncated = ((messages[i].msg_hdr.msg_flags & MSG_TRUNC) != 0);
+                    assert(!is_truncated || m_is_fd_enabled);
+                    const control::nsec_t timestamp = _process_control_messages(messages[i].msg_hdr, offset);
+                    //...the TX confirmations are counted and skipped as well
+                    if(_is_tx_confirmation(messages[i].msg_hdr))
+                    {
+                        _count_confirmed(timestamp);
+                        continue;
+                    }
+                    if(is_truncated) continue;
+                    if(size_t(i) != frames_received) frames[frames_received] = frames[i];
+                    if(timestamps != nullptr) timestamps[frames_received] = timestamp;
+                    _count_received(frames[frames_received].can_id, frames[frames_received].can_dlc, 0);
+                    frames_received++;
+                }
+            }
+            else
+            {   //Error code analysis - looking for USB Device Unplugged situations
+                if(nframes == -1) _process_receive_error(errno);
+            }
+        } //if is connected
+        //
+        return frames_received;
+    } //receive_batch()
+
+    /*
+        Sends a CAN FD frame (payload up to 64 bytes, padded with zeros to a valid CAN FD size)
+        flags: CANFD_BRS - the payload at the data bitrate
+        Requires the FD mode, see set_fd_mode().
+    */
+    virtual bool send_fd(canid_t destination_can_id, const void* payload, uint8_t payload_size, uint8_t flags = CANFD_BRS)
+    {
+        assert(payload_size<=CANFD_MAX_DLEN);
+        bool result = false;
+        if(is_connected())
+        {
+            canfd_frame frame;
+            memset(&frame, 0, sizeof(frame));
+            frame.can_id = destination_can_id;
+            frame.len    = get_canfd_payload_size(payload_size);
+            frame.flags  = flags | CANFD_FDF;
+            memcpy(frame.data, payload, payload_size);
+            result = (send_batch_fd(&frame, 1) == 1);
+        }
+        return result;
+    } //send_fd()
+
+    /*
+        Sends a batch of classic and CAN FD frames with a single sendmmsg() syscall
+        (more than one call only if frames_count > CAN_SOCKET_MAX_BATCH_SIZE)
+        The frames with CANFD_FDF in the flags go out as CAN FD frames, the others as classic frames,
+        so SYNC, NMT etc. can share a batch with the FD frames.
+        Returns the number of frames actually sent.
+    */
+    virtual size_t send_batch_fd(const canfd_frame* frames, size_t frames_count)
+    {
+        size_t frames_sent = 0;
+        while(is_connected() && (frames_sent < frames_count))
+        {   //message headers - one per frame
+            mmsghdr messages[CAN_SOCKET_MAX_BATCH_SIZE];
+            iovec   vectors[CAN_SOCKET_MAX_BATCH_SIZE];
+            //size of this chunk
+            const size_t chunk_size = _min(frames_count - frames_sent, CAN_SOCKET_MAX_BATCH_SIZE);
+            //setting up the message headers
+            memset(messages, 0, chunk_size*sizeof(mmsghdr));
+            for(size_t i=0; i<chunk_size; i++)
+            {
+                const canfd_frame& frame = frames[frames_sent+i];
+                assert(is_canfd_frame(frame) ? (m_is_fd_enabled && (frame.len<=CANFD_MAX_DLEN)) : (frame.len<=CAN_MAX_DLEN));
+                vectors[i].iov_base = const_cast<canfd_frame*>(&frame);
+                vectors[i].iov_len  = is_canfd_frame(frame) ? CANFD_MTU : CAN_MTU; //can_frame and canfd_frame share the layout
+                messages[i].msg_hdr.msg_iov    = &(vectors[i]);
+                messages[i].msg_hdr.msg_iovlen = 1;
+            }
+            //sending the data
+            const int nframes = ::sendmmsg(m_socket_fd, messages, chunk_size, 0);
+            if(nframes > 0)
+            {   //OK - could be a partial send
+                for(int i=0; i<nframes; i++) _count_sent(frames[frames_sent+i].can_id, frames[frames_sent+i].len, frames[frames_sent+i].flags);
+                frames_sent += nframes;
+            }
+            else
+            {   //Error code analysis - looking for USB Device Unplugged situations
+                if(nframes == -1) _process_send_error(errno, frames_count - frames_sent);
+                break;
+            }
+        } //while
+        //
+        return frames_sent;
+    } //send_batch_fd()
+
+    /*
+        Fetches up to max_frames classic and CAN FD frames with a single recvmmsg() syscall
+        - CAN FD frames come with CANFD_FDF in the flags (see is_canfd_frame()),
+          classic frames without it, their len is the DLC
+        - without the FD mode only classic frames arrive
+        Timestamps and never_block as per receive_batch().
+        Returns the number of frames received.
+    */
+    virtual size_t receive_batch_fd(canfd_frame* frames, size_t max_frames, control::nsec_t* timestamps = nullptr, bool never_block = false)
+    {
+        size_t frames_received = 0;
+        m_last_receive_count = 0;
+        if(is_connected() && (max_frames > 0))
+        {   //enabling the timestamps on first use
+            if((timestamps != nullptr) && !m_is_timestamp_enabled) set_timestamp_flag();
+            //message headers - one per frame
+            mmsghdr messages[CAN_SOCKET_MAX_BATCH_SIZE];
+            iovec   vectors[CAN_SOCKET_MAX_BATCH_SIZE];
+            //control message buffers for the timestamps and the kernel drops counter
+            char    control[CAN_SOCKET_MAX_BATCH_SIZE][CAN_SOCKET_CONTROL_BUFFER_SIZE];
+            //size of the batch
+            const size_t batch_size = _min(max_frames, CAN_SOCKET_MAX_BATCH_SIZE);
+            //setting up the message headers
+            memset(messages, 0, batch_size*sizeof(mmsghdr));
+            for(size_t i=0; i<batch_size; i++)
+            {
+                vectors[i].iov_base = &(frames[i]);
+                vectors[i].iov_len  = sizeof(canfd_frame);
+                messages[i].msg_hdr.msg_iov        = &(vectors[i]);
+                messages[i].msg_hdr.msg_iovlen     = 1;
+                messages[i].msg_hdr.msg_control    = control[i];
+                messages[i].msg_hdr.msg_controllen = sizeof(control[i]);
+            }
+            //reading the frames (blocks for the first frame only if the socket is blocking)
+            const int nframes = ::recvmmsg(m_socket_fd, messages, batch_size, never_block ? (MSG_WAITFORONE | MSG_DONTWAIT) : MSG_WAITFORONE, nullptr);
+            if(nframes > 0)
+            {   //the kernel stamps the frames with CLOCK_REALTIME
+                const int64_t offset = ((timestamps != nullptr) || m_is_tx_confirmation_enabled) ? _get_realtime_to_monotonic_offset() : 0;
+                m_last_receive_count = nframes;
+                for(int i=0; i<nframes; i++)
+                {   //the size tells the classic frames from the FD ones
+                    assert((messages[i].msg_len == CAN_MTU) || (messages[i].msg_len == CANFD_MTU));
+                    const control::nsec_t timestamp = _process_control_messages(messages[i].msg_hdr, offset);
+                    //the TX confirmations are counted and skipped
+                    if(_is_tx_confirmation(messages[i].msg_hdr))
+                    {
+                        _count_confirmed(timestamp);
+                        continue;
+                    }
+                    if(size_t(i) != frames_received) frames[frames_received] = frames[i];
+                    if(messages[i].msg_len == CANFD_MTU) frames[frames_received].flags |= CANFD_FDF;
+                    else                                 frames[frames_received].flags = 0;
+                    if(timestamps != nullptr) timestamps[frames_received] = timestamp;
+                    _count_received(frames[frames_received].can_id, frames[frames_received].len, frames[frames_received].flags);
+                    frames_received++;
+                }
+            }
+            else
+            {   //Error code analysis - looking for USB Device Unplugged situations
+                if(nframes == -1) _process_receive_error(errno);
+            }
+        } //if is connected
+        //
+        return frames_received;
+    } //receive_batch_fd()
+
+    /*
+        Enables CAN FD frames on the socket (CAN_RAW_FD_FRAMES); the interface has to be FD capable (MTU 72)
+        - send_fd(), send_batch_fd() and receive_batch_fd() move the FD frames
+        - the classic frame API keeps working, receive_batch() skips the FD frames
+    */
+    virtual bool set_fd_mode(bool is_enabled = true)
+    {
+        assert(m_socket_fd != -1);
+        const int fd_frames_flag = is_enabled ? 1 : 0;
+        const int r = ::setsockopt(m_socket_fd, SOL_CAN_RAW, CAN_RAW_FD_FRAMES, &fd_frames_flag, sizeof(fd_frames_flag));
+        if(r!=-1) m_is_fd_enabled = is_enabled;
+        return (r!=-1);
+    } //set_fd_mode()
+
+    virtual bool is_fd_enabled() const
+    {
+        return m_is_fd_enabled;
+    } //is_fd_enabled()
+
+    /*
+        Cumulative counters since startup() - a copy is a consistent snapshot when taken by the thread using the socket
+    */
+    const can_socket_statistics_t& get_statistics() const
+    {
+        return m_statistics;
+    } //get_statistics()
+
+    /*
+        Hands every frame sent or received to the observer, nullptr detaches it
+        The observer must outlive the socket or be detached.
+    */
+    void set_traffic_observer(can_traffic_observer* observer)
+    {
+        m_observer = observer;
+    } //set_traffic_observer()
+
+    /*
+        Enables nanosecond kernel receive timestamps (SO_TIMESTAMPNS)
+        delivered as control messages along with the frames - no extra syscall per frame.
+        Called automatically on first use by receive_with_timestamp() and receive_batch().
+        0 = disabled (default), 1 = enabled
+    */
+    bool set_timestamp_flag(int timestamp_flag = 1)
+    {
+        assert(m_socket_fd != -1);
+        const int r = ::setsockopt(m_socket_fd, SOL_SOCKET, SO_TIMESTAMPNS, &timestamp_flag, sizeof(timestamp_flag));
+        if(r!=-1) m_is_timestamp_enabled = (timestamp_flag != 0);
+        return (r!=-1);
+    } //set_timestamp_flag()
+
+    /*
+        Installs kernel-side receive filters (CAN_RAW_FILTER)
+        A frame is received if (frame.can_id & filter.can_mask) == (filter.can_id & filter.can_mask)
+        for at least one filter; filters_count = 0 means "receive no data frames at all".
+        NOTE: virtual - sockets without a kernel socket behind them (e.g. can_replay_socket) accept any filters
+    */
+    virtual bool set_filters(const can_filter* filters, size_t filters_count) const
+    {
+        assert(m_socket_fd != -1);
+        const int r = ::setsockopt(m_socket_fd, SOL_CAN_RAW, CAN_RAW_FILTER, filters, filters_count*sizeof(can_filter));
+        return (r!=-1);
+    } //set_filters()
+
+    /*
+        Removes all receive filters - every frame on the bus is received (default)
+    */
+    bool reset_filters() const
+    {
+        can_filter filter;
+        filter.can_id   = 0;
+        filter.can_mask = 0;
+        return set_filters(&filter, 1);
+    } //reset_filters()
+
+    /*
+        Selects error classes delivered as error frames (CAN_RAW_ERR_FILTER)
+        0 = no error frames (default), CAN_ERR_MASK = all error frames
+    */
+    virtual bool set_error_filter(can_err_mask_t error_mask) const
+    {
+        assert(m_socket_fd != -1);
+        const int r = ::setsockopt(m_socket_fd, SOL_CAN_RAW, CAN_RAW_ERR_FILTER, &error_mask, sizeof(error_mask));
+        return (r!=-1);
+    } //set_error_filter()
+
     /*
         0 = disabled (default), 1 = enabled
     */
@@ -234,11 +674,266 @@ public:
         return (r!=-1);
     } //set_recv_own_msgs_flag()
 
-    bool is_connected() const
+    /*
+        TX confirmation mode - the kernel echoes every frame sent by the socket back to it (CAN_RAW_RECV_OWN_MSGS)
+        - the echoes are counted in the statistics (frames_confirmed) and skipped by the receive calls,
+          get_last_confirmation_timestamp() is the kernel timestamp of the latest one
+        - drivers with IFF_ECHO echo a frame once it has been sent on the bus, so the timestamp is its wire time;
+          the drivers without IFF_ECHO (and the loopback of vcan) echo at once - the timestamp is the handover time then
+        - every frame sent comes back: one more frame to receive per frame sent
+        Enable before the traffic starts - the frames sent before are not confirmed.
+    */
+    virtual bool set_tx_confirmation_mode(bool is_enabled = true)
+    {
+        bool result = set_recv_own_msgs_flag(is_enabled ? 1 : 0) && (!is_enabled || m_is_timestamp_enabled || set_timestamp_flag());
+        if(result)
+        {
+            m_is_tx_confirmation_enabled = is_enabled;
+            m_frames_sent_unconfirmed    = m_statistics.frames_sent - m_statistics.frames_confirmed;
+        }
+        return result;
+    } //set_tx_confirmation_mode()
+
+    bool is_tx_confirmation_enabled() const
+    {
+        return m_is_tx_confirmation_enabled;
+    } //is_tx_confirmation_enabled()
+
+    /*
+        Frames sent but not confirmed yet - in the TX confirmation mode, 0 otherwise
+    */
+    size_t get_unconfirmed_frames_count() const
+    {
+        const size_t frames_confirmed = m_statistics.frames_confirmed + m_frames_sent_unconfirmed;
+        return (m_is_tx_confirmation_enabled && (m_statistics.frames_sent > frames_confirmed)) ? (m_statistics.frames_sent - frames_confirmed) : 0;
+    } //get_unconfirmed_frames_count()
+
+    /*
+        Kernel timestamp of the latest TX confirmation, CLOCK_MONOTONIC nanoseconds; 0 - none yet
+    */
+    control::nsec_t get_last_confirmation_timestamp() const
+    {
+        return m_last_confirmation_timestamp;
+    } //get_last_confirmation_timestamp()
+
+    /*
+        Number of frames the last receive_batch()/receive_batch_fd() took off the socket, the skipped ones included
+        A batch is full - more frames may be pending - if it equals CAN_SOCKET_MAX_BATCH_SIZE.
+    */
+    virtual size_t get_last_receive_count() const
+    {
+        return m_last_receive_count;
+    } //get_last_receive_count()
+
+    virtual bool is_connected() const
     {
         return (m_socket_fd != -1);
     } //is_connected()
 
+    /*
+        File descriptor of the socket - for select()/poll()/epoll()
+    */
+    virtual int get_fd() const
+    {
+        return m_socket_fd;
+    } //get_fd()
+
+private:
+    //helper function
+    static size_t _min(size_t a, size_t b)
+    {
+        return (a<b) ? a : b;
+    } //_min()
+
+    //helper function - instrumentation of a frame accepted by the kernel
+    void _count_sent(canid_t can_id, uint8_t payload_size, uint8_t fd_flags)
+    {
+        m_statistics.frames_sent++;
+        m_statistics.bytes_sent += payload_size;
+        if(m_observer != nullptr) m_observer->on_frame_sent(can_id, payload_size, fd_flags);
+    } //_count_sent()
+
+    //helper function - instrumentation of a received frame
+    void _count_received(canid_t can_id, uint8_t payload_size, uint8_t fd_flags)
+    {
+        m_statistics.frames_received++;
+        m_statistics.bytes_received += payload_size;
+        if((can_id & CAN_ERR_FLAG) != 0) m_statistics.error_frames++;
+        if(m_observer != nullptr) m_observer->on_frame_received(can_id, payload_size, fd_flags);
+    } //_count_received()
+
+    //helper function - send_batch() without counting the failure: error is the errno of the failed attempt, 0 - none
+    size_t _send_batch(const can_frame* frames, size_t frames_count, int& error)
+    {
+        size_t frames_sent = 0;
+        error = 0;
+        while(is_connected() && (frames_sent < frames_count))
+        {   //message headers - one per frame
+            mmsghdr messages[CAN_SOCKET_MAX_BATCH_SIZE];
+            iovec   vectors[CAN_SOCKET_MAX_BATCH_SIZE];
+            //size of this chunk
+            const size_t chunk_size = _min(frames_count - frames_sent, CAN_SOCKET_MAX_BATCH_SIZE);
+            //setting up the message headers
+            memset(messages, 0, chunk_size*sizeof(mmsghdr));
+            for(size_t i=0; i<chunk_size; i++)
+            {
+                assert(frames[frames_sent+i].can_dlc<=8);
+                vectors[i].iov_base = const_cast<can_frame*>(&(frames[frames_sent+i]));
+                vectors[i].iov_len  = sizeof(can_frame);
+                messages[i].msg_hdr.msg_iov    = &(vectors[i]);
+                messages[i].msg_hdr.msg_iovlen = 1;
+            }
+            //sending the data
+            const int nframes = ::sendmmsg(m_socket_fd, messages, chunk_size, 0);
+            if(nframes > 0)
+            {   //OK - could be a partial send
+                for(int i=0; i<nframes; i++) _count_sent(frames[frames_sent+i].can_id, frames[frames_sent+i].can_dlc, 0);
+                frames_sent += nframes;
+            }
+            else
+            {   //the caller analyses the error code
+                if(nframes == -1) error = errno;
+                break;
+            }
+        } //while
+        //
+        return frames_sent;
+    } //_send_batch()
+
+    //helper function - the send failed since the TX queue of the interface is full
+    static bool _is_tx_queue_full(int error)
+    {
+        return (error == ENOBUFS) || (error == EAGAIN) || (error == EWOULDBLOCK);
+    } //_is_tx_queue_full()
+
+    //helper function - waits for room in the TX queue rather than spinning on sendmmsg()
+    //...returns false if the deadline has passed already - a wait that reaches it is followed by one more attempt
+    bool _wait_for_tx_queue(control::nsec_t deadline, control::nsec_t retry_period, bool& is_writable) const
+    {
+        const control::nsec_t now = control::get_now_nsec();
+        bool result = (now < deadline);
+        if(result)
+        {
+            const control::nsec_t remaining = deadline - now;
+            if(!is_writable)
+            {   //till the socket is writable
+                pollfd descriptor;
+                descriptor.fd      = m_socket_fd;
+                descriptor.events  = POLLOUT;
+                descriptor.revents = 0;
+                timespec timeout;
+                timeout.tv_sec  = remaining / control::NSEC_PER_SEC;
+                timeout.tv_nsec = remaining % control::NSEC_PER_SEC;
+                is_writable = (::ppoll(&descriptor, 1, &timeout, nullptr) > 0);
+            }
+            else
+            {   //a retry period, at most till the deadline
+                const control::nsec_t wake_up = (retry_period < remaining) ? (now + retry_period) : deadline;
+                timespec wake_up_time;
+                wake_up_time.tv_sec  = wake_up / control::NSEC_PER_SEC;
+                wake_up_time.tv_nsec = wake_up % control::NSEC_PER_SEC;
+                while(::clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake_up_time, nullptr) == EINTR)
+                {   //interrupted by a signal - sleeping on
+                }
+            }
+        }
+        return result;
+    } //_wait_for_tx_queue()
+
+    //helper function - an own frame echoed back, in the TX confirmation mode only
+    bool _is_tx_confirmation(const msghdr& message) const
+    {
+        return m_is_tx_confirmation_enabled && ((message.msg_flags & MSG_CONFIRM) != 0);
+    } //_is_tx_confirmation()
+
+    //helper function - instrumentation of a TX confirmation, timestamp 0 - not available
+    void _count_confirmed(control::nsec_t timestamp)
+    {
+        m_statistics.frames_confirmed++;
+        if(timestamp != 0) m_last_confirmation_timestamp = timestamp;
+    } //_count_confirmed()
+
+    //helper function - frames_count frames have not been sent
+    void _process_send_error(int error, size_t frames_count)
+    {
+        if(_is_tx_queue_full(error)) m_statistics.send_buffer_full += frames_count;
+        else                                                                 m_statistics.send_failures    += frames_count;
+        m_statistics.last_error = error;
+        _process_error_code(error);
+    } //_process_send_error()
+
+    //helper function - nothing to receive on a non-blocking socket is not an error
+    void _process_receive_error(int error)
+    {
+        if((error != EAGAIN) && (error != EWOULDBLOCK) && (error != EINTR))
+        {
+            m_statistics.receive_failures++;
+            m_statistics.last_error = error;
+        }
+        _process_error_code(error);
+    } //_process_receive_error()
+
+    //helper function - Error code analysis - looking for USB Device Unplugged situations
+    void _process_error_code(int error)
+    {
+        switch(error)
+        {
+            case ENODEV: //"No such device"
+            {   //USB device unplugged
+                shutdown();
+                break;
+            }
+            case ENXIO: //"No such device or address"
+            {   //USB device unplugged
+                shutdown();
+                break;
+            }
+            default:
+            {   //ignoring all errors except those related to USB Device Unplugged situation
+                break;
+            }
+        } //switch(error)
+    } //_process_error_code()
+
+    //helper function - CLOCK_REALTIME minus CLOCK_MONOTONIC, sampled once per receive call (vDSO, no syscall)
+    static int64_t _get_realtime_to_monotonic_offset()
+    {
+        timespec realtime, monotonic;
+        clock_gettime(CLOCK_REALTIME,  &realtime);
+        clock_gettime(CLOCK_MONOTONIC, &monotonic);
+        return (int64_t(realtime.tv_sec) - int64_t(monotonic.tv_sec))*int64_t(control::NSEC_PER_SEC) + (int64_t(realtime.tv_nsec) - int64_t(monotonic.tv_nsec));
+    } //_get_realtime_to_monotonic_offset()
+
+    //helper function - fetching SCM_TIMESTAMPNS (or software SCM_TIMESTAMPING) out of the control messages
+    //...and converting it into CLOCK_MONOTONIC nanoseconds; 0 if there is no timestamp
+    //...the kernel drops counter (SO_RXQ_OVFL) goes into the statistics
+    control::nsec_t _process_control_messages(msghdr& message, int64_t realtime_to_monotonic_offset)
+    {
+        control::nsec_t timestamp = 0;
+        for(cmsghdr* cmsg = CMSG_FIRSTHDR(&message); cmsg != nullptr; cmsg = CMSG_NXTHDR(&message, cmsg))
+        {
+            if(cmsg->cmsg_level != SOL_SOCKET) continue;
+            if((cmsg->cmsg_type == SCM_TIMESTAMPNS) || (cmsg->cmsg_type == SCM_TIMESTAMPING))
+            {   //SCM_TIMESTAMPING carries 3 timestamps, the first one is the software one
+                timespec ts;
+                memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+                if((ts.tv_sec != 0) || (ts.tv_nsec != 0))
+                {
+                    const int64_t realtime = int64_t(ts.tv_sec)*int64_t(control::NSEC_PER_SEC) + ts.tv_nsec;
+                    timestamp = control::nsec_t(realtime - realtime_to_monotonic_offset);
+                }
+            }
+            else if(cmsg->cmsg_type == SO_RXQ_OVFL)
+            {   //cumulative, wraps around
+                uint32_t kernel_drops;
+                memcpy(&kernel_drops, CMSG_DATA(cmsg), sizeof(kernel_drops));
+                m_statistics.frames_dropped += uint32_t(kernel_drops - m_kernel_drops);
+                m_kernel_drops = kernel_drops;
+            }
+        }
+        return timestamp;
+    } //_process_control_messages()
+
 }; //class can_socket
 
 } //namespace network
@@ -0,0 +1,235 @@
+#ifndef CONTROL_EVENT_LOOP_H_INCLUDED
+#define CONTROL_EVENT_LOOP_H_INCLUDED
+
+/*
+Event loop multiplexing file descriptors (sockets, timers) with epoll:
+    http://man7.org/linux/man-pages/man7/epoll.7.html
+    http://man7.org/linux/man-pages/man2/timerfd_create.2.html
+
+The process sleeps in epoll_wait() until a descriptor becomes ready,
+instead of spinning over non-blocking descriptors and polled timers.
+*/
+
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>     /* uint64_t */
+#include "control/timer.h"
+
+namespace control
+{
+
+//maximum number of events fetched by a single epoll_wait() call
+const int EVENT_LOOP_MAX_EVENTS = 64;
+
+/*
+    Interface of the objects notified by the event loop
+*/
+class event_handler
+{
+public:
+    virtual ~event_handler()
+    {
+    }
+    //events - EPOLLIN, EPOLLERR etc.
+    virtual void handle_event(uint32_t events) = 0;
+}; //class event_handler
+
+/*
+    Periodic timer delivering expirations through a file descriptor
+    The kernel advances the expirations by exactly one period - no drift.
+    It can also be armed for a single expiration at a deadline (see start_once_at()).
+*/
+class periodic_timerfd
+{
+private:
+    int m_timer_fd;
+public:
+    periodic_timerfd() : m_timer_fd(-1)
+    {
+    }
+
+    ~periodic_timerfd()
+    {
+        if(m_timer_fd != -1) shutdown();
+    }
+
+    bool startup()
+    {
+        assert(m_timer_fd == -1);
+        m_timer_fd = ::timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        return (m_timer_fd != -1);
+    } //startup()
+
+    void shutdown()
+    {
+        assert(m_timer_fd != -1);
+        const int result = ::close(m_timer_fd);
+        if(result<0) assert(false);
+        m_timer_fd = -1;
+    } //shutdown()
+
+    /*
+        Arms the timer: first expiration one period from now, then every period
+        period_nsec = 0 disarms the timer
+    */
+    bool start(nsec_t period_nsec)
+    {
+        assert(m_timer_fd != -1);
+        itimerspec spec;
+        spec.it_interval.tv_sec  = period_nsec / NSEC_PER_SEC;
+        spec.it_interval.tv_nsec = period_nsec % NSEC_PER_SEC;
+        spec.it_value = spec.it_interval;
+        const int r = ::timerfd_settime(m_timer_fd, 0, &spec, nullptr);
+        return (r!=-1);
+    } //start()
+
+    /*
+        Arms the timer for a single expiration at an absolute CLOCK_MONOTONIC time (see get_now_nsec())
+        A deadline in the past expires right away.
+    */
+    bool start_once_at(nsec_t deadline_nsec)
+    {
+        assert(m_timer_fd != -1);
+        assert(deadline_nsec > 0); //0 would disarm the timer
+        itimerspec spec;
+        spec.it_interval.tv_sec  = 0;
+        spec.it_interval.tv_nsec = 0;
+        spec.it_value.tv_sec     = deadline_nsec / NSEC_PER_SEC;
+        spec.it_value.tv_nsec    = deadline_nsec % NSEC_PER_SEC;
+        const int r = ::timerfd_settime(m_timer_fd, TFD_TIMER_ABSTIME, &spec, nullptr);
+        return (r!=-1);
+    } //start_once_at()
+
+    bool stop()
+    {
+        return start(0);
+    } //stop()
+
+    /*
+        Consumes the pending expirations
+        Returns the number of expirations since the previous call (more than 1 means overrun)
+    */
+    uint64_t acknowledge()
+    {
+        uint64_t expirations = 0;
+        const ssize_t nbytes = ::read(m_timer_fd, &expirations, sizeof(expirations));
+        if(nbytes != sizeof(expirations)) expirations = 0; //EAGAIN - spurious wakeup
+        return expirations;
+    } //acknowledge()
+
+    int get_fd() const
+    {
+        return m_timer_fd;
+    } //get_fd()
+}; //class periodic_timerfd
+
+/*
+    epoll-based event loop
+*/
+class event_loop
+{
+private:
+    int m_epoll_fd;
+    volatile bool m_is_running;
+public:
+    event_loop()
+        :   m_epoll_fd(-1),
+            m_is_running(false)
+    {
+    }
+
+    ~event_loop()
+    {
+        if(m_epoll_fd != -1) shutdown();
+    }
+
+    bool startup()
+    {
+        assert(m_epoll_fd == -1);
+        m_epoll_fd = ::epoll_create1(EPOLL_CLOEXEC);
+        return (m_epoll_fd != -1);
+    } //startup()
+
+    void shutdown()
+    {
+        assert(m_epoll_fd != -1);
+        const int result = ::close(m_epoll_fd);
+        if(result<0) assert(false);
+        m_epoll_fd = -1;
+    } //shutdown()
+
+    /*
+        Starts watching a file descriptor
+        The handler must stay alive until remove() is called or the descriptor is closed.
+    */
+    bool add(int fd, event_handler* handler, uint32_t events = EPOLLIN)
+    {
+        assert(m_epoll_fd != -1);
+        assert(handler != nullptr);
+        epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events   = events;
+        event.data.ptr = handler;
+        const int r = ::epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, fd, &event);
+        return (r!=-1);
+    } //add()
+
+    bool remove(int fd)
+    {
+        assert(m_epoll_fd != -1);
+        epoll_event event; //ignored, but required by old kernels
+        memset(&event, 0, sizeof(event));
+        const int r = ::epoll_ctl(m_epoll_fd, EPOLL_CTL_DEL, fd, &event);
+        return (r!=-1);
+    } //remove()
+
+    /*
+        Sleeps till at least one descriptor is ready (or timeout_msec expires, -1 = forever)
+        and notifies the handlers.
+        Returns the number of events handled, or -1 on an error.
+    */
+    int run_once(int timeout_msec = -1)
+    {
+        assert(m_epoll_fd != -1);
+        epoll_event events[EVENT_LOOP_MAX_EVENTS];
+        const int nevents = ::epoll_wait(m_epoll_fd, events, EVENT_LOOP_MAX_EVENTS, timeout_msec);
+        for(int i=0; i<nevents; i++)
+        {
+            event_handler* handler = static_cast<event_handler*>(events[i].data.ptr);
+            handler->handle_event(events[i].events);
+        }
+        //interrupted by a signal is not an error
+        return ((nevents == -1) && (errno == EINTR)) ? 0 : nevents;
+    } //run_once()
+
+    /*
+        Runs until stop() is called (from a handler or a signal handler)
+    */
+    void run()
+    {
+        m_is_running = true;
+        while(m_is_running)
+        {
+            if(run_once() < 0) break; //ERROR
+        }
+        m_is_running = false;
+    } //run()
+
+    void stop()
+    {
+        m_is_running = false;
+    } //stop()
+
+    bool is_running() const
+    {
+        return m_is_running;
+    } //is_running()
+}; //class event_loop
+
+} //namespace control
+
+#endif // CONTROL_EVENT_LOOP_H_INCLUDED
@@ -0,0 +1,206 @@
+#ifndef NETWORK_HEARTBEAT_H_INCLUDED
+#define NETWORK_HEARTBEAT_H_INCLUDED
+
+/*
+CANopen heartbeat consumer - liveness and NMT state of a single node (see canopen.h)
+    - tracks the NMT state reported by the heartbeats (or node guarding responses) of the node
+    - tells a reboot (boot-up message) from a lost node (no heartbeat within the consumer timeout)
+      from a node that is alive, but not operational (stopped or pre-operational)
+    - the consumer timeout is typically 1.5-3 heartbeat periods of the node
+
+Watching a node:
+    network::canopen::heartbeat_consumer consumer;
+    consumer.configure(node_id, 30000);      //30ms, the node sends heartbeats every 10ms
+    ...on a frame from 0x700 + node_id:  consumer.process_heartbeat(frame.data, frame.can_dlc, timestamp);
+    ...periodically:                     if(consumer.check()) { the node is lost }
+*/
+
+#include <assert.h>
+#include <stdint.h>     /* uint8_t */
+#include "network/cansocket.h"
+#include "network/canopen.h"
+#include "control/timer.h"
+
+namespace network
+{
+
+namespace canopen
+{
+
+class heartbeat_consumer
+{
+public:
+    //what a received heartbeat says about the node
+    enum struct event_t { NONE, BOOTUP, STATE_CHANGED, TOGGLE_ERROR };
+private:
+    uint8_t         m_node_id;
+    bool            m_is_enabled;       //consumer timeout configured
+    bool            m_is_alive;         //heartbeats coming
+    uint8_t         m_state;            //NMT_STATE_UNKNOWN until the first heartbeat
+    control::timer  m_timer;            //restarted by every heartbeat
+    control::nsec_t m_timestamp;        //of the latest heartbeat
+    //node guarding
+    bool            m_is_guarding;      //guarding requests sent - the responses carry the toggle bit
+    uint8_t         m_expected_toggle;
+    //statistics
+    size_t          m_bootups_count;
+    size_t          m_timeouts_count;
+    size_t          m_toggle_errors_count;
+
+public:
+    heartbeat_consumer()
+        :   m_node_id(0),
+            m_is_enabled(false),
+            m_is_alive(false),
+            m_state(NMT_STATE_UNKNOWN),
+            m_timer(0),
+            m_timestamp(0),
+            m_is_guarding(false),
+            m_expected_toggle(0),
+            m_bootups_count(0),
+            m_timeouts_count(0),
+            m_toggle_errors_count(0)
+    {
+    }
+
+    /*
+        consumer_timeout 0 - the heartbeats are tracked, but never time out
+    */
+    void configure(uint8_t node_id, control::usec_t consumer_timeout)
+    {
+        assert(node_id < 128);
+        m_node_id    = node_id;
+        m_is_enabled = (consumer_timeout > 0);
+        m_timer.configure(consumer_timeout);
+    } //configure()
+
+    /*
+        Processes a heartbeat, a boot-up message or a node guarding response of the node
+        (the COB ID is already matched against the Node ID)
+    */
+    event_t process_heartbeat(const uint8_t* payload, uint8_t payload_size, control::nsec_t timestamp)
+    {
+        event_t result = event_t::NONE;
+        if(payload_size >= 1)
+        {
+            const uint8_t state = payload[0] & NMT_STATE_MASK;
+            if(state == NMT_STATE_BOOTUP)
+            {   //the node has been (re)started - the toggle starts over
+                m_bootups_count++;
+                m_expected_toggle = 0;
+                result = event_t::BOOTUP;
+            }
+            else if(m_is_guarding && ((payload[0] & NODE_GUARDING_TOGGLE_BIT) != m_expected_toggle))
+            {   //a guarding response has been lost
+                m_toggle_errors_count++;
+                m_expected_toggle = payload[0] & NODE_GUARDING_TOGGLE_BIT;
+                result = event_t::TOGGLE_ERROR;
+            }
+            else if(state != m_state)
+            {
+                result = event_t::STATE_CHANGED;
+            }
+            if(m_is_guarding && (state != NMT_STATE_BOOTUP)) m_expected_toggle ^= NODE_GUARDING_TOGGLE_BIT;
+            m_state     = state;
+            m_is_alive  = true;
+            m_timestamp = (timestamp != 0) ? timestamp : control::get_now_nsec();
+            m_timer.restart(); //good health
+        }
+        return result;
+    } //process_heartbeat()
+
+    /*
+        Sends a node guarding request - for the nodes that do not produce heartbeats
+        The guarding period has to be shorter than the consumer timeout.
+    */
+    bool send_guarding_request(network::can_socket& can)
+    {
+        m_is_guarding = true;
+        return send_node_guarding_request(can, m_node_id);
+    } //send_guarding_request()
+
+    /*
+        Consumer timeout verification
+        Returns true once per loss of the node - when the heartbeats stop coming.
+    */
+    bool check()
+    {
+        bool result = false;
+        if(m_is_enabled && m_is_alive && m_timer.check())
+        {   //HEARTBEAT TIMEOUT!
+            m_is_alive = false;
+            m_state    = NMT_STATE_UNKNOWN;
+            m_timeouts_count++;
+            result = true;
+        }
+        return result;
+    } //check()
+
+    /*
+        Forgets the node state, e.g. after the CANbus connection is lost; the statistics are kept
+    */
+    void reset()
+    {
+        m_is_alive = false;
+        m_state    = NMT_STATE_UNKNOWN;
+        m_expected_toggle = 0;
+    } //reset()
+
+    bool is_enabled() const
+    {
+        return m_is_enabled;
+    } //is_enabled()
+
+    bool is_alive() const
+    {
+        return m_is_alive;
+    } //is_alive()
+
+    /*
+        One of NMT_STATE_*
+    */
+    uint8_t get_state() const
+    {
+        return m_state;
+    } //get_state()
+
+    control::usec_t get_timeout() const
+    {
+        return m_is_enabled ? m_timer.get_interval() : 0;
+    } //get_timeout()
+
+    control::nsec_t get_timestamp() const
+    {
+        return m_timestamp;
+    } //get_timestamp()
+
+    /*
+        When check() reports the loss of the node unless a heartbeat comes first; 0 if it cannot time out
+    */
+    control::nsec_t get_deadline() const
+    {
+        return (m_is_enabled && m_is_alive) ? m_timer.get_set_time_nsec() : 0;
+    } //get_deadline()
+
+    size_t get_bootups_count() const
+    {
+        return m_bootups_count;
+    } //get_bootups_count()
+
+    size_t get_timeouts_count() const
+    {
+        return m_timeouts_count;
+    } //get_timeouts_count()
+
+    size_t get_toggle_errors_count() const
+    {
+        return m_toggle_errors_count;
+    } //get_toggle_errors_count()
+
+}; //class heartbeat_consumer
+
+} //namespace canopen
+
+} //namespace network
+
+#endif // NETWORK_HEARTBEAT_H_INCLUDED
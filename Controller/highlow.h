@@ -1,6 +1,10 @@
 #ifndef FTL_HIGHLOW_H_INCLUDED
 #define FTL_HIGHLOW_H_INCLUDED
 
+#include <stddef.h>     /* size_t */
+#include <stdint.h>     /* uint8_t */
+#include <string.h>     /* memcpy() */
+
 namespace ftl
 {
 
@@ -30,6 +34,43 @@ inline void set_low (uint16_t& w, uint8_t l)
     w |= uint16_t(l);
 } //set_low()
 
+//unsigned integer type of the given size
+template <size_t size> struct unsigned_of_size;
+template <> struct unsigned_of_size<1> { typedef uint8_t  type; };
+template <> struct unsigned_of_size<2> { typedef uint16_t type; };
+template <> struct unsigned_of_size<4> { typedef uint32_t type; };
+
+/*
+    Little endian (CANopen byte order) loads and stores, independent of the byte order of the host
+    Assembled byte by byte - compilers fold this into a single load/store on little endian hosts.
+    The value is reinterpreted bit by bit, so signed and floating point types are handled as well.
+*/
+template <class datatype>
+inline datatype load_little_endian(const uint8_t* bytes)
+{
+    typedef typename unsigned_of_size<sizeof(datatype)>::type unsigned_t;
+    unsigned_t value = 0;
+    for(size_t i=0; i<sizeof(datatype); i++)
+    {
+        value |= unsigned_t(unsigned_t(bytes[i]) << (8*i));
+    }
+    datatype result;
+    memcpy(&result, &value, sizeof(result));
+    return result;
+} //load_little_endian()
+
+template <class datatype>
+inline void store_little_endian(uint8_t* bytes, datatype data)
+{
+    typedef typename unsigned_of_size<sizeof(datatype)>::type unsigned_t;
+    unsigned_t value;
+    memcpy(&value, &data, sizeof(value));
+    for(size_t i=0; i<sizeof(datatype); i++)
+    {
+        bytes[i] = uint8_t(value >> (8*i));
+    }
+} //store_little_endian()
+
 } //namespace ftl
 
 #endif // FTL_HIGHLOW_H_INCLUDED
@@ -0,0 +1,105 @@
+#ifndef NETWORK_PDO_LAYOUT_H_INCLUDED
+#define NETWORK_PDO_LAYOUT_H_INCLUDED
+
+/*
+Compile-time PDO layouts
+    - a layout lists the fields of a PDO payload: type, offset and the member of a record it maps to
+    - decoders and encoders are generated from the layout at compile time:
+      no hand-written offsets, straight loads and stores
+    - the fields are little endian as per CANopen, on any host (see ftl::load_little_endian())
+    - the layout is verified at compile time: fields fit into the payload and do not overlap
+
+Describing a TPDO:
+    typedef network::canopen::pdo_layout<telemetry_t,
+                network::canopen::pdo_mapping<telemetry_t, uint16_t, &telemetry_t::status, 0>,
+                network::canopen::pdo_mapping<telemetry_t, int16_t,  &telemetry_t::speed,  4> > tpdo1_layout_t;
+    tpdo1_layout_t::decode(frame.data, telemetry);  //received
+    tpdo1_layout_t::encode(telemetry, frame.data);  //sent
+*/
+
+#include <stddef.h>     /* size_t */
+#include <stdint.h>     /* uint8_t */
+#include "ftl/highlow.h"
+
+namespace network
+{
+
+namespace canopen
+{
+
+//CANopen mandates 8bytes-long payload
+const size_t PDO_PAYLOAD_SIZE = 8;
+
+/*
+    A field of a PDO payload mapped to a member of a record
+*/
+template <class record, class datatype, datatype record::* member, size_t offset>
+struct pdo_mapping
+{
+    static_assert((sizeof(datatype)==1) || (sizeof(datatype)==2) || (sizeof(datatype)==4), "PDO fields are 1, 2 or 4 bytes long");
+    static_assert(offset + sizeof(datatype) <= PDO_PAYLOAD_SIZE, "PDO field does not fit into the payload");
+    //payload bytes occupied by the field, a bit per byte
+    static const uint8_t BYTES_MASK = uint8_t(((1u << sizeof(datatype)) - 1) << offset);
+
+    static void decode(const uint8_t* payload, record& r)
+    {
+        r.*member = ftl::load_little_endian<datatype>(payload + offset);
+    }
+
+    static void encode(const record& r, uint8_t* payload)
+    {
+        ftl::store_little_endian(payload + offset, r.*member);
+    }
+}; //struct pdo_mapping
+
+/*
+    A PDO payload layout - a list of pdo_mapping's of the same record
+    An empty layout is valid: nothing is decoded, zeros are encoded.
+*/
+template <class record, class... mappings>
+struct pdo_layout;
+
+template <class record>
+struct pdo_layout<record>
+{
+    static const uint8_t BYTES_MASK = 0;
+
+    static void decode(const uint8_t* /*payload*/, record& /*r*/)
+    {
+    }
+
+    static void encode(const record& /*r*/, uint8_t* /*payload*/)
+    {
+    }
+}; //struct pdo_layout<>
+
+template <class record, class mapping, class... mappings>
+struct pdo_layout<record, mapping, mappings...>
+{
+private:
+    typedef pdo_layout<record, mappings...> rest_t;
+    static_assert((mapping::BYTES_MASK & rest_t::BYTES_MASK) == 0, "PDO fields overlap");
+public:
+    static const uint8_t BYTES_MASK = mapping::BYTES_MASK | rest_t::BYTES_MASK;
+
+    static void decode(const uint8_t* payload, record& r)
+    {
+        mapping::decode(payload, r);
+        rest_t::decode(payload, r);
+    }
+
+    /*
+        Encodes into a zeroed payload - the bytes not covered by the layout are left untouched
+    */
+    static void encode(const record& r, uint8_t* payload)
+    {
+        mapping::encode(r, payload);
+        rest_t::encode(r, payload);
+    }
+}; //struct pdo_layout<>
+
+} //namespace canopen
+
+} //namespace network
+
+#endif // NETWORK_PDO_LAYOUT_H_INCLUDED
@@ -0,0 +1,770 @@
+#ifndef NETWORK_SDO_CLIENT_H_INCLUDED
+#define NETWORK_SDO_CLIENT_H_INCLUDED
+
+/*
+Asynchronous CANopen SDO client
+    - expedited (up to 4 bytes), segmented and block transfers (see canopen.h)
+    - any number of requests in flight: one outstanding request per node, the rest queued per node,
+      so all the nodes on the bus are configured in parallel
+    - responses (0x580 + Node ID) are matched against the outstanding request of the node:
+      by index and subindex while initiating, by the transfer state (toggle bit, sequence number) after that;
+      stale and foreign responses are ignored
+    - SDO aborts and timeouts complete the request with an error
+    - the requests are owned by the caller (no allocations): a request works as a future -
+      poll is_completed(), or get notified through an sdo_completion_handler
+    - segmented and block transfers read from/write into caller-provided buffers directly, no intermediate copies
+
+Configuring drives in parallel:
+    network::canopen::sdo_client client;
+    network::canopen::sdo_request_t requests[12];
+    client.startup("can0");
+    for(size_t i=0; i<12; i++) { requests[i].set_write(node_ids[i], 0x6081, 0, uint32_t(1000)); client.submit(requests[i]); }
+    client.wait_all(100000); //100ms
+
+Dumping a parameter table:
+    uint8_t table[4096];
+    request.set_block_read(node_id, 0x2100, 0, table, sizeof(table));
+    client.submit(request);
+    client.wait_all(1000000); //request.transferred bytes in table
+*/
+
+#include <poll.h>       /* poll() */
+#include <string.h>
+#include <assert.h>
+#include <stdint.h>     /* uint32_t */
+#include "network/cansocket.h"
+#include "network/canopen.h"
+#include "control/timer.h"
+
+namespace network
+{
+
+namespace canopen
+{
+
+//default time to wait for a response
+const control::usec_t SDO_CLIENT_DEFAULT_TIMEOUT = 50000; //50ms
+
+//number of Node IDs (7bit)
+const size_t SDO_CLIENT_NODES_COUNT = 128;
+
+struct sdo_request_t;
+
+/*
+    Interface of the objects notified when a request completes
+*/
+class sdo_completion_handler
+{
+public:
+    virtual ~sdo_completion_handler()
+    {
+    }
+    virtual void handle_sdo_completion(sdo_request_t& request) = 0;
+}; //class sdo_completion_handler
+
+/*
+    An SDO request - owned by the caller, must stay alive until completed
+*/
+struct sdo_request_t
+{
+    enum struct status_t   { IDLE, QUEUED, IN_PROGRESS, DONE, ABORTED, TIMED_OUT };
+    enum struct transfer_t { EXPEDITED, SEGMENTED, BLOCK };
+    //transfer state - client's bookkeeping
+    enum struct phase_t    { INITIATE, SEGMENT, BLOCK_DOWNLOAD_ACK, BLOCK_DOWNLOAD_END, BLOCK_UPLOAD_SEGMENTS, BLOCK_UPLOAD_END };
+    //request
+    uint8_t    node_id;
+    bool       is_write;
+    transfer_t transfer;
+    uint16_t   index;
+    uint8_t    subindex;
+    uint8_t    data_size;   //expedited: 1, 2 or 4; for reads - the expected size, updated by the response
+    uint32_t   data;        //expedited: written value or the value read
+    uint8_t*   buffer;      //segmented and block: the data written or the buffer for the data read
+    size_t     buffer_size; //segmented and block: bytes to write or the capacity of the buffer
+    uint8_t    block_size;  //block: segments per block requested by the client (1..127)
+    sdo_completion_handler* handler; //optional
+    void*      context;     //for the handler's use
+    //result
+    status_t   status;
+    uint32_t   abort_code;  //ABORTED: received from the node or detected by the client, TIMED_OUT: SDO_ABORT_TIMEOUT
+    size_t     transferred; //segmented and block: bytes written or read so far
+    //client's bookkeeping
+    phase_t    phase;
+    bool       toggle;
+    uint8_t    sequence;        //block: last sequence number received in order
+    uint8_t    server_block_size;
+    bool       is_crc_supported;
+    bool       is_size_indicated;
+    bool       is_last_segment; //block: the last segment of the transfer has been sent/received
+    size_t     indicated_size;
+    size_t     block_offset;    //block download: offset of the first segment of the current block
+    control::nsec_t deadline;
+    sdo_request_t*  next;
+
+    sdo_request_t()
+        :   node_id(0), is_write(false), transfer(transfer_t::EXPEDITED), index(0), subindex(0), data_size(0), data(0),
+            buffer(nullptr), buffer_size(0), block_size(SDO_MAX_BLOCK_SIZE),
+            handler(nullptr), context(nullptr),
+            status(status_t::IDLE), abort_code(0), transferred(0),
+            phase(phase_t::INITIATE), toggle(false), sequence(0), server_block_size(0),
+            is_crc_supported(false), is_size_indicated(false), is_last_segment(false), indicated_size(0), block_offset(0),
+            deadline(0), next(nullptr)
+    {
+    }
+
+    template <class datatype>
+    void set_write(uint8_t _node_id, uint16_t _index, uint8_t _subindex, datatype _data, sdo_completion_handler* _handler = nullptr)
+    {
+        assert((sizeof(_data)==1) || (sizeof(_data)==2) || (sizeof(_data)==4));
+        _set(_node_id, true, transfer_t::EXPEDITED, _index, _subindex, _handler);
+        data_size = sizeof(_data);
+        uint8_t bytes[4] = {0,0,0,0};
+        ftl::store_little_endian(bytes, _data); //as sent by send_expedited_sdo_write()
+        data = ftl::load_little_endian<uint32_t>(bytes);
+    }
+
+    void set_read(uint8_t _node_id, uint16_t _index, uint8_t _subindex, uint8_t expected_data_size, sdo_completion_handler* _handler = nullptr)
+    {
+        assert((expected_data_size==1) || (expected_data_size==2) || (expected_data_size==4));
+        _set(_node_id, false, transfer_t::EXPEDITED, _index, _subindex, _handler);
+        data_size = expected_data_size;
+        data = 0;
+    }
+
+    /*
+        Segmented transfers - the buffer must stay untouched until the request completes
+    */
+    void set_segmented_write(uint8_t _node_id, uint16_t _index, uint8_t _subindex, const void* _data, size_t _size, sdo_completion_handler* _handler = nullptr)
+    {
+        _set(_node_id, true, transfer_t::SEGMENTED, _index, _subindex, _handler);
+        buffer = static_cast<uint8_t*>(const_cast<void*>(_data)); //never written to
+        buffer_size = _size;
+    }
+
+    void set_segmented_read(uint8_t _node_id, uint16_t _index, uint8_t _subindex, void* _buffer, size_t _buffer_size, sdo_completion_handler* _handler = nullptr)
+    {
+        _set(_node_id, false, transfer_t::SEGMENTED, _index, _subindex, _handler);
+        buffer = static_cast<uint8_t*>(_buffer);
+        buffer_size = _buffer_size;
+    }
+
+    /*
+        Block transfers - the buffer must stay untouched until the request completes
+        _block_size: segments per block requested from the server (upload); the server decides for downloads
+    */
+    void set_block_write(uint8_t _node_id, uint16_t _index, uint8_t _subindex, const void* _data, size_t _size, sdo_completion_handler* _handler = nullptr)
+    {
+        _set(_node_id, true, transfer_t::BLOCK, _index, _subindex, _handler);
+        buffer = static_cast<uint8_t*>(const_cast<void*>(_data)); //never written to
+        buffer_size = _size;
+    }
+
+    void set_block_read(uint8_t _node_id, uint16_t _index, uint8_t _subindex, void* _buffer, size_t _buffer_size, uint8_t _block_size = SDO_MAX_BLOCK_SIZE, sdo_completion_handler* _handler = nullptr)
+    {
+        assert((_block_size > 0) && (_block_size <= SDO_MAX_BLOCK_SIZE));
+        _set(_node_id, false, transfer_t::BLOCK, _index, _subindex, _handler);
+        buffer = static_cast<uint8_t*>(_buffer);
+        buffer_size = _buffer_size;
+        block_size = _block_size;
+    }
+
+    bool is_completed() const
+    {
+        return (status == status_t::DONE) || (status == status_t::ABORTED) || (status == status_t::TIMED_OUT);
+    }
+
+    bool is_successful() const
+    {
+        return (status == status_t::DONE);
+    }
+
+    bool is_pending() const
+    {
+        return (status == status_t::QUEUED) || (status == status_t::IN_PROGRESS);
+    }
+
+private:
+    //helper function
+    void _set(uint8_t _node_id, bool _is_write, transfer_t _transfer, uint16_t _index, uint8_t _subindex, sdo_completion_handler* _handler)
+    {
+        assert(!is_pending());
+        assert((_node_id != 0) && (_node_id < SDO_CLIENT_NODES_COUNT));
+        node_id     = _node_id;
+        is_write    = _is_write;
+        transfer    = _transfer;
+        index       = _index;
+        subindex    = _subindex;
+        buffer      = nullptr;
+        buffer_size = 0;
+        block_size  = SDO_MAX_BLOCK_SIZE;
+        handler     = _handler;
+        status      = status_t::IDLE;
+        abort_code  = 0;
+        transferred = 0;
+    }
+}; //struct sdo_request_t
+
+class sdo_client
+{
+private:
+    //per node FIFO of requests, the head is the one in flight
+    struct node_queue_t
+    {
+        sdo_request_t* head;
+        sdo_request_t* tail;
+    };
+    //the socket - receives SDO responses only; owned, unless substituted with set_can_socket()
+    can_socket      m_own_can;
+    can_socket*     m_can;
+    node_queue_t    m_queues[SDO_CLIENT_NODES_COUNT];
+    size_t          m_pending_count;
+    control::nsec_t m_timeout;
+
+public:
+    sdo_client(control::usec_t timeout = SDO_CLIENT_DEFAULT_TIMEOUT)
+        :   m_own_can(),
+            m_can(&m_own_can),
+            m_pending_count(0),
+            m_timeout(control::nsec_t(timeout)*control::NSEC_PER_USEC)
+    {
+        memset(m_queues, 0, sizeof(m_queues));
+    } //sdo_client()
+
+    /*
+        Opens a dedicated socket receiving the SDO responses of all the nodes
+        A dedicated socket keeps the kernel-side filters of the control loop socket intact.
+    */
+    bool startup(const char* can_interface_name = "vcan0")
+    {
+        bool result = m_can->startup(can_interface_name, true);
+        if(result)
+        {
+            can_filter filter;
+            filter.can_id   = PREDEFINED_SDO_RESPONSE_CHANNEL;
+            filter.can_mask = CHANNEL_MASK | CAN_EFF_FLAG | CAN_RTR_FLAG;
+            result = m_can->set_filters(&filter, 1);
+            if(!result) m_can->shutdown();
+        }
+        return result;
+    } //startup()
+
+    void shutdown()
+    {
+        if(m_can->is_connected()) m_can->shutdown();
+    } //shutdown()
+
+    can_socket& get_can_socket()
+    {
+        return *m_can;
+    } //get_can_socket()
+
+    /*
+        Substitutes the socket, e.g. with a network::can_replay_socket
+        The socket must be started up by the caller and must outlive the client.
+    */
+    void set_can_socket(can_socket& can)
+    {
+        assert(m_pending_count == 0);
+        m_can = &can;
+    } //set_can_socket()
+
+    void set_timeout(control::usec_t timeout)
+    {
+        m_timeout = control::nsec_t(timeout)*control::NSEC_PER_USEC;
+    } //set_timeout()
+
+    size_t get_pending_count() const
+    {
+        return m_pending_count;
+    } //get_pending_count()
+
+    /*
+        Queues a request; it is sent right away if the node has no request in flight
+    */
+    bool submit(sdo_request_t& request)
+    {
+        assert(!request.is_pending());
+        assert((request.node_id != 0) && (request.node_id < SDO_CLIENT_NODES_COUNT));
+        request.status = sdo_request_t::status_t::QUEUED;
+        request.abort_code = 0;
+        request.transferred = 0;
+        request.next = nullptr;
+        node_queue_t& queue = m_queues[request.node_id];
+        if(queue.tail != nullptr) queue.tail->next = &request;
+        else                      queue.head = &request;
+        queue.tail = &request;
+        m_pending_count++;
+        //sending if the node is idle
+        if(queue.head == &request) _send_request(request, control::get_now_nsec());
+        return true;
+    } //submit()
+
+    /*
+        Matches a received frame against the outstanding requests
+        Returns false if the frame is not an SDO response to an outstanding request.
+    */
+    bool process_response(canid_t can_id, const uint8_t* payload, uint8_t payload_size)
+    {
+        bool result = false;
+        if(((can_id & ~CAN_SFF_MASK) == 0) && (extract_function_code_from_cob_id(can_id) == PREDEFINED_SDO_RESPONSE_CHANNEL) && (payload_size == 8))
+        {
+            const uint8_t node_id = extract_node_id_from_cob_id(can_id);
+            sdo_request_t* request = m_queues[node_id].head;
+            if((request != nullptr) && (request->status == sdo_request_t::status_t::IN_PROGRESS))
+            {
+                uint8_t frame[8];
+                memcpy(frame, payload, sizeof(frame));
+                const uint32_t value = ftl::load_little_endian<uint32_t>(&(frame[4]));
+                const bool is_matching = (extract_index_from_payload(frame) == request->index) && (extract_subindex_from_payload(frame) == request->subindex);
+                if(request->phase == sdo_request_t::phase_t::INITIATE)
+                {   //correlation by index and subindex
+                    if(is_matching)
+                    {
+                        result = true;
+                        if(frame[0] == SDO_CS_ABORT) _complete(*request, sdo_request_t::status_t::ABORTED, value);
+                        else _process_initiate_response(*request, frame, value);
+                    }
+                }
+                else if((frame[0] == SDO_CS_ABORT) && is_matching)
+                {   //aborted in the middle of the transfer
+                    result = true;
+                    _complete(*request, sdo_request_t::status_t::ABORTED, value);
+                }
+                else
+                {   //correlation by the transfer state
+                    result = true;
+                    switch(request->phase)
+                    {
+                        case sdo_request_t::phase_t::SEGMENT:               _process_segment_response(*request, frame); break;
+                        case sdo_request_t::phase_t::BLOCK_DOWNLOAD_ACK:    _process_block_download_ack(*request, frame); break;
+                        case sdo_request_t::phase_t::BLOCK_DOWNLOAD_END:    _process_block_download_end(*request, frame); break;
+                        case sdo_request_t::phase_t::BLOCK_UPLOAD_SEGMENTS: _process_block_upload_segment(*request, frame); break;
+                        case sdo_request_t::phase_t::BLOCK_UPLOAD_END:      _process_block_upload_end(*request, frame); break;
+                        default: assert(false); break;
+                    }
+                }
+                //progress - the timeout restarts
+                if(result && request->is_pending()) request->deadline = control::get_now_nsec() + m_timeout;
+            }
+        }
+        return result;
+    } //process_response()
+
+    /*
+        Receives and processes all the pending responses, then times out overdue requests
+        Non-blocking. Returns the number of requests still pending.
+    */
+    size_t execute(control::nsec_t now = control::get_now_nsec())
+    {
+        can_frame frames[CAN_SOCKET_MAX_BATCH_SIZE];
+        size_t frames_received = 0;
+        bool never_block = false; //blocking sockets: waiting for the first batch only
+        do
+        {
+            frames_received = m_can->receive_batch(frames, CAN_SOCKET_MAX_BATCH_SIZE, nullptr, never_block);
+            for(size_t i=0; i<frames_received; i++) process_response(frames[i].can_id, frames[i].data, frames[i].can_dlc);
+            never_block = true;
+        }
+        while(m_can->get_last_receive_count() == CAN_SOCKET_MAX_BATCH_SIZE);
+        //timeouts
+        if(m_pending_count > 0)
+        {
+            for(size_t n=1; n<SDO_CLIENT_NODES_COUNT; n++)
+            {
+                sdo_request_t* request = m_queues[n].head;
+                if((request != nullptr) && (request->status == sdo_request_t::status_t::IN_PROGRESS) && (now >= request->deadline))
+                {   //telling the node to give up as well
+                    _abort(*request, sdo_request_t::status_t::TIMED_OUT, SDO_ABORT_TIMEOUT);
+                }
+            }
+        }
+        return m_pending_count;
+    } //execute()
+
+    /*
+        Blocks until all the requests complete or the timeout expires
+        Returns true if nothing is pending any more.
+    */
+    bool wait_all(control::usec_t timeout)
+    {
+        const control::nsec_t deadline = control::get_now_nsec() + control::nsec_t(timeout)*control::NSEC_PER_USEC;
+        control::nsec_t now = control::get_now_nsec();
+        while((execute(now) > 0) && (now < deadline) && m_can->is_connected())
+        {   //sleeping until a response arrives - at most till the nearest request deadline
+            pollfd descriptor;
+            descriptor.fd      = m_can->get_fd();
+            descriptor.events  = POLLIN;
+            descriptor.revents = 0;
+            const control::nsec_t wake_up = _get_nearest_deadline(deadline);
+            const int timeout_msec = (wake_up > now) ? int((wake_up - now + 999999) / 1000000) : 0;
+            ::poll(&descriptor, 1, timeout_msec);
+            now = control::get_now_nsec();
+        }
+        return (m_pending_count == 0);
+    } //wait_all()
+
+private:
+    //helper function - initiates a transfer
+    void _send_request(sdo_request_t& request, control::nsec_t now)
+    {
+        request.phase             = sdo_request_t::phase_t::INITIATE;
+        request.toggle            = false;
+        request.sequence          = 0;
+        request.server_block_size = 0;
+        request.is_crc_supported  = false;
+        request.is_size_indicated = false;
+        request.is_last_segment   = false;
+        request.indicated_size    = 0;
+        request.block_offset      = 0;
+        switch(request.transfer)
+        {
+            case sdo_request_t::transfer_t::EXPEDITED:
+            {
+                if(request.is_write)
+                {
+                    switch(request.data_size)
+                    {
+                        case 1: send_expedited_sdo_write(*m_can, request.node_id, request.index, request.subindex, uint8_t(request.data));  break;
+                        case 2: send_expedited_sdo_write(*m_can, request.node_id, request.index, request.subindex, uint16_t(request.data)); break;
+                        case 4: send_expedited_sdo_write(*m_can, request.node_id, request.index, request.subindex, uint32_t(request.data)); break;
+                        default: assert(false); break;
+                    }
+                }
+                else send_expedited_sdo_read(*m_can, request.node_id, request.index, request.subindex, request.data_size);
+                break;
+            }
+            case sdo_request_t::transfer_t::SEGMENTED:
+            {
+                if(request.is_write) send_sdo_command(*m_can, request.node_id, SDO_CCS_INITIATE_DOWNLOAD | SDO_SIZE_INDICATED_BIT, request.index, request.subindex, uint32_t(request.buffer_size));
+                else                 send_sdo_command(*m_can, request.node_id, SDO_CCS_INITIATE_UPLOAD, request.index, request.subindex);
+                break;
+            }
+            case sdo_request_t::transfer_t::BLOCK:
+            {
+                if(request.is_write) send_sdo_command(*m_can, request.node_id, SDO_CCS_BLOCK_DOWNLOAD | SDO_BLOCK_CRC_BIT | SDO_BLOCK_SIZE_INDICATED_BIT | SDO_BLOCK_INITIATE, request.index, request.subindex, uint32_t(request.buffer_size));
+                else                 send_sdo_command(*m_can, request.node_id, SDO_CCS_BLOCK_UPLOAD | SDO_BLOCK_CRC_BIT | SDO_BLOCK_INITIATE, request.index, request.subindex, request.block_size); //protocol switch threshold 0 - no switch
+                break;
+            }
+            default:
+            {
+                assert(false);
+                break;
+            }
+        }
+        request.status   = sdo_request_t::status_t::IN_PROGRESS;
+        request.deadline = now + m_timeout; //a frame lost on sending times out as well
+    } //_send_request()
+
+    //helper function - response to the initiating frame, index and subindex already matched
+    void _process_initiate_response(sdo_request_t& request, const uint8_t* frame, uint32_t value)
+    {
+        const uint8_t command = frame[0];
+        const uint8_t specifier = command & SDO_CS_MASK;
+        if(request.transfer == sdo_request_t::transfer_t::BLOCK)
+        {
+            if(request.is_write && (specifier == SDO_SCS_BLOCK_DOWNLOAD) && ((command & SDO_BLOCK_SUBCOMMAND_MASK) == SDO_BLOCK_INITIATE))
+            {   //the server's block size
+                request.is_crc_supported = (command & SDO_BLOCK_CRC_BIT) != 0;
+                request.server_block_size = frame[4];
+                if((request.server_block_size > 0) && (request.server_block_size <= SDO_MAX_BLOCK_SIZE)) _send_download_block(request);
+                else _abort(request, sdo_request_t::status_t::ABORTED, SDO_ABORT_INVALID_BLOCK_SIZE);
+            }
+            else if(!request.is_write && (specifier == SDO_SCS_BLOCK_UPLOAD) && ((command & SDO_BLOCK_UPLOAD_SUBCOMMAND_MASK) == SDO_BLOCK_INITIATE))
+            {
+                request.is_crc_supported  = (command & SDO_BLOCK_CRC_BIT) != 0;
+                request.is_size_indicated = (command & SDO_BLOCK_SIZE_INDICATED_BIT) != 0;
+                request.indicated_size    = value;
+                if(request.is_size_indicated && (request.indicated_size > request.buffer_size))
+                {
+                    _abort(request, sdo_request_t::status_t::ABORTED, SDO_ABORT_OUT_OF_MEMORY);
+                }
+                else
+                {   //starting the upload
+                    request.phase    = sdo_request_t::phase_t::BLOCK_UPLOAD_SEGMENTS;
+                    request.sequence = 0;
+                    send_sdo_command(*m_can, request.node_id, SDO_CCS_BLOCK_UPLOAD | SDO_BLOCK_START_UPLOAD, 0, 0);
+                }
+            }
+            else _abort(request, sdo_request_t::status_t::ABORTED, SDO_ABORT_INVALID_COMMAND);
+        }
+        else if(request.is_write && (specifier == SDO_SCS_DOWNLOAD_RESPONSE))
+        {
+            if(request.transfer == sdo_request_t::transfer_t::EXPEDITED) _complete(request, sdo_request_t::status_t::DONE, 0);
+            else
+            {   //first segment
+                request.phase = sdo_request_t::phase_t::SEGMENT;
+                _send_download_segment(request);
+            }
+        }
+        else if(!request.is_write && (specifier == SDO_SCS_UPLOAD_RESPONSE))
+        {
+            if((command & SDO_EXPEDITED_BIT) != 0)
+            {   //expedited; if the size is indicated, n = number of bytes not containing data
+                const uint8_t size = ((command & SDO_SIZE_INDICATED_BIT) != 0) ? (4 - ((command >> 2) & 0x03)) : ((request.transfer == sdo_request_t::transfer_t::EXPEDITED) ? request.data_size : 4);
+                if(request.transfer == sdo_request_t::transfer_t::EXPEDITED)
+                {
+                    request.data_size = size;
+                    request.data = (size == 4) ? value : (value & ((uint32_t(1) << (8*size)) - 1));
+                    _complete(request, sdo_request_t::status_t::DONE, 0);
+                }
+                else if(size <= request.buffer_size)
+                {   //a short value read with a segmented request
+                    memcpy(request.buffer, &(frame[4]), size);
+                    request.transferred = size;
+                    _complete(request, sdo_request_t::status_t::DONE, 0);
+                }
+                else _abort(request, sdo_request_t::status_t::ABORTED, SDO_ABORT_OUT_OF_MEMORY);
+            }
+            else if(request.transfer == sdo_request_t::transfer_t::SEGMENTED)
+            {
+                request.is_size_indicated = (command & SDO_SIZE_INDICATED_BIT) != 0;
+                request.indicated_size    = value;
+                if(request.is_size_indicated && (request.indicated_size > request.buffer_size))
+                {
+                    _abort(request, sdo_request_t::status_t::ABORTED, SDO_ABORT_OUT_OF_MEMORY);
+                }
+                else
+                {   //requesting the first segment
+                    request.phase = sdo_request_t::phase_t::SEGMENT;
+                    send_sdo_command(*m_can, request.node_id, SDO_CCS_UPLOAD_SEGMENT, 0, 0);
+                }
+            }
+            else _abort(request, sdo_request_t::status_t::ABORTED, SDO_ABORT_INVALID_COMMAND); //segmented response to an expedited read
+        }
+        else _abort(request, sdo_request_t::status_t::ABORTED, SDO_ABORT_INVALID_COMMAND);
+    } //_process_initiate_response()
+
+    //helper function - segmented transfers
+    void _send_download_segment(sdo_request_t& request)
+    {
+        const size_t remaining = request.buffer_size - request.transferred;
+        const size_t size = (remaining < SDO_SEGMENT_DATA_SIZE) ? remaining : SDO_SEGMENT_DATA_SIZE;
+        uint8_t command = SDO_CCS_DOWNLOAD_SEGMENT | uint8_t((SDO_SEGMENT_DATA_SIZE - size) << 1);
+        if(request.toggle) command |= SDO_TOGGLE_BIT;
+        if(size == remaining) command |= SDO_LAST_SEGMENT_BIT;
+        can_frame frame;
+        build_sdo_segment(frame, request.node_id, command, request.buffer + request.transferred, size);
+        m_can->send(frame.can_id, frame.data, frame.can_dlc);
+        request.data_size = uint8_t(size); //size of the segment in flight
+    } //_send_download_segment()
+
+    //helper function - segmented transfers
+    void _process_segment_response(sdo_request_t& request, const uint8_t* frame)
+    {
+        const uint8_t command = frame[0];
+        const bool toggle = (command & SDO_TOGGLE_BIT) != 0;
+        if(toggle != request.toggle)
+        {
+            _abort(request, sdo_request_t::status_t::ABORTED, SDO_ABORT_TOGGLE_BIT);
+        }
+        else if(request.is_write)
+        {
+            if((command & SDO_CS_MASK) == SDO_SCS_DOWNLOAD_SEGMENT)
+            {   //the segment in flight is acknowledged
+                request.transferred += request.data_size;
+                request.toggle = !request.toggle;
+                if(request.transferred >= request.buffer_size) _complete(request, sdo_request_t::status_t::DONE, 0);
+                else _send_download_segment(request);
+            }
+            else _abort(request, sdo_request_t::status_t::ABORTED, SDO_ABORT_INVALID_COMMAND);
+        }
+        else
+        {
+            if((command & SDO_CS_MASK) == SDO_SCS_UPLOAD_SEGMENT)
+            {   //copying the segment straight into the caller's buffer
+                const size_t size = SDO_SEGMENT_DATA_SIZE - ((command >> 1) & 0x07);
+                if(request.transferred + size <= request.buffer_size)
+                {
+                    memcpy(request.buffer + request.transferred, &(frame[1]), size);
+                    request.transferred += size;
+                    request.toggle = !request.toggle;
+                    if((command & SDO_LAST_SEGMENT_BIT) != 0)
+                    {
+                        if(request.is_size_indicated && (request.transferred != request.indicated_size)) _abort(request, sdo_request_t::status_t::ABORTED, SDO_ABORT_LENGTH_MISMATCH);
+                        else _complete(request, sdo_request_t::status_t::DONE, 0);
+                    }
+                    else send_sdo_command(*m_can, request.node_id, SDO_CCS_UPLOAD_SEGMENT | (request.toggle ? SDO_TOGGLE_BIT : 0), 0, 0);
+                }
+                else _abort(request, sdo_request_t::status_t::ABORTED, SDO_ABORT_OUT_OF_MEMORY);
+            }
+            else _abort(request, sdo_request_t::status_t::ABORTED, SDO_ABORT_INVALID_COMMAND);
+        }
+    } //_process_segment_response()
+
+    //helper function - block download: sends a whole block back to back with send_batch()
+    void _send_download_block(sdo_request_t& request)
+    {
+        can_frame frames[SDO_MAX_BLOCK_SIZE];
+        size_t frames_count = 0;
+        size_t offset = request.block_offset;
+        request.is_last_segment = false;
+        while((frames_count < request.server_block_size) && !request.is_last_segment)
+        {
+            const size_t remaining = request.buffer_size - offset;
+            const size_t size = (remaining < SDO_SEGMENT_DATA_SIZE) ? remaining : SDO_SEGMENT_DATA_SIZE;
+            uint8_t command = uint8_t(frames_count + 1); //sequence number
+            if(size == remaining)
+            {
+                command |= SDO_BLOCK_LAST_SEGMENT_BIT;
+                request.is_last_segment = true;
+            }
+            build_sdo_segment(frames[frames_count], request.node_id, command, request.buffer + offset, size);
+            offset += size;
+            frames_count++;
+        }
+        request.sequence = uint8_t(frames_count); //segments in flight
+        request.phase = sdo_request_t::phase_t::BLOCK_DOWNLOAD_ACK;
+        m_can->send_batch(frames, frames_count);
+    } //_send_download_block()
+
+    //helper function - block download
+    void _process_block_download_ack(sdo_request_t& request, const uint8_t* frame)
+    {
+        const uint8_t command = frame[0];
+        if(((command & SDO_CS_MASK) == SDO_SCS_BLOCK_DOWNLOAD) && ((command & SDO_BLOCK_SUBCOMMAND_MASK) == SDO_BLOCK_ACK))
+        {
+            const uint8_t acknowledged = frame[1];
+            const uint8_t next_block_size = frame[2];
+            if((acknowledged <= request.sequence) && (next_block_size > 0) && (next_block_size <= SDO_MAX_BLOCK_SIZE))
+            {   //advancing past the segments received in order - the rest are repeated
+                const size_t acknowledged_size = size_t(acknowledged)*SDO_SEGMENT_DATA_SIZE;
+                const size_t remaining = request.buffer_size - request.block_offset;
+                request.block_offset += (acknowledged_size < remaining) ? acknowledged_size : remaining;
+                request.transferred = request.block_offset;
+                request.server_block_size = next_block_size;
+                if(request.is_last_segment && (acknowledged == request.sequence))
+                {   //all the data is through - ending with the CRC
+                    const size_t last_segment_size = request.buffer_size - ((request.buffer_size > 0) ? ((request.buffer_size - 1) / SDO_SEGMENT_DATA_SIZE) * SDO_SEGMENT_DATA_SIZE : 0);
+                    const uint8_t unused = uint8_t(SDO_SEGMENT_DATA_SIZE - last_segment_size);
+                    const uint16_t crc = request.is_crc_supported ? compute_sdo_block_crc(0, request.buffer, request.buffer_size) : 0;
+                    uint8_t payload[8] = {0,0,0,0,0,0,0,0};
+                    payload[0] = SDO_CCS_BLOCK_DOWNLOAD | uint8_t(unused << 2) | SDO_BLOCK_END;
+                    payload[1] = ftl::get_low(crc);
+                    payload[2] = ftl::get_high(crc);
+                    m_can->send(PREDEFINED_SDO_CHANNEL+request.node_id, payload, sizeof(payload));
+                    request.phase = sdo_request_t::phase_t::BLOCK_DOWNLOAD_END;
+                }
+                else _send_download_block(request);
+            }
+            else _abort(request, sdo_request_t::status_t::ABORTED, SDO_ABORT_INVALID_SEQUENCE);
+        }
+        else _abort(request, sdo_request_t::status_t::ABORTED, SDO_ABORT_INVALID_COMMAND);
+    } //_process_block_download_ack()
+
+    //helper function - block download
+    void _process_block_download_end(sdo_request_t& request, const uint8_t* frame)
+    {
+        const uint8_t command = frame[0];
+        if(((command & SDO_CS_MASK) == SDO_SCS_BLOCK_DOWNLOAD) && ((command & SDO_BLOCK_SUBCOMMAND_MASK) == SDO_BLOCK_END))
+        {
+            request.transferred = request.buffer_size;
+            _complete(request, sdo_request_t::status_t::DONE, 0);
+        }
+        else _abort(request, sdo_request_t::status_t::ABORTED, SDO_ABORT_INVALID_COMMAND);
+    } //_process_block_download_end()
+
+    //helper function - block upload: one segment of the block, copied straight into the caller's buffer
+    void _process_block_upload_segment(sdo_request_t& request, const uint8_t* frame)
+    {
+        const uint8_t sequence = frame[0] & uint8_t(~SDO_BLOCK_LAST_SEGMENT_BIT);
+        const bool is_last = (frame[0] & SDO_BLOCK_LAST_SEGMENT_BIT) != 0;
+        bool is_ok = true;
+        if(sequence == uint8_t(request.sequence + 1))
+        {   //in order - the size of the last segment is known only at the end, up to 7 bytes are taken
+            const size_t space = request.buffer_size - request.transferred;
+            const size_t size = (space < SDO_SEGMENT_DATA_SIZE) ? space : SDO_SEGMENT_DATA_SIZE;
+            if(is_last || (size == SDO_SEGMENT_DATA_SIZE))
+            {
+                memcpy(request.buffer + request.transferred, &(frame[1]), size);
+                request.transferred += size;
+                request.data_size = uint8_t(size); //bytes taken from the latest segment
+                request.sequence = sequence;
+                request.is_last_segment = is_last;
+            }
+            else
+            {   //more data than the buffer can hold
+                is_ok = false;
+                _abort(request, sdo_request_t::status_t::ABORTED, SDO_ABORT_OUT_OF_MEMORY);
+            }
+        }
+        //end of the block - acknowledging the segments received in order, the server repeats the rest
+        if(is_ok && (is_last || (sequence >= request.block_size)))
+        {
+            uint8_t payload[8] = {0,0,0,0,0,0,0,0};
+            payload[0] = SDO_CCS_BLOCK_UPLOAD | SDO_BLOCK_ACK;
+            payload[1] = request.sequence;
+            payload[2] = request.block_size;
+            m_can->send(PREDEFINED_SDO_CHANNEL+request.node_id, payload, sizeof(payload));
+            request.sequence = 0;
+            if(request.is_last_segment) request.phase = sdo_request_t::phase_t::BLOCK_UPLOAD_END;
+        }
+    } //_process_block_upload_segment()
+
+    //helper function - block upload
+    void _process_block_upload_end(sdo_request_t& request, const uint8_t* frame)
+    {
+        const uint8_t command = frame[0];
+        if(((command & SDO_CS_MASK) == SDO_SCS_BLOCK_UPLOAD) && ((command & SDO_BLOCK_UPLOAD_SUBCOMMAND_MASK) == SDO_BLOCK_END))
+        {   //the bytes of the last segment not containing data
+            const size_t unused = (command >> 2) & 0x07;
+            const size_t padding = SDO_SEGMENT_DATA_SIZE - request.data_size; //bytes of the last segment not taken
+            if(unused >= padding)
+            {
+                request.transferred -= (unused - padding);
+                const uint16_t crc = ftl::load_little_endian<uint16_t>(&(frame[1]));
+                if(request.is_size_indicated && (request.transferred != request.indicated_size)) _abort(request, sdo_request_t::status_t::ABORTED, SDO_ABORT_LENGTH_MISMATCH);
+                else if(request.is_crc_supported && (crc != compute_sdo_block_crc(0, request.buffer, request.transferred))) _abort(request, sdo_request_t::status_t::ABORTED, SDO_ABORT_CRC_ERROR);
+                else
+                {
+                    send_sdo_command(*m_can, request.node_id, SDO_CCS_BLOCK_UPLOAD | SDO_BLOCK_END, 0, 0);
+                    _complete(request, sdo_request_t::status_t::DONE, 0);
+                }
+            }
+            else _abort(request, sdo_request_t::status_t::ABORTED, SDO_ABORT_OUT_OF_MEMORY);
+        }
+        else _abort(request, sdo_request_t::status_t::ABORTED, SDO_ABORT_INVALID_COMMAND);
+    } //_process_block_upload_end()
+
+    //helper function - tells the node to give up and completes the request with an error
+    void _abort(sdo_request_t& request, sdo_request_t::status_t status, uint32_t abort_code)
+    {
+        send_sdo_command(*m_can, request.node_id, SDO_CS_ABORT, request.index, request.subindex, abort_code);
+        _complete(request, status, abort_code);
+    } //_abort()
+
+    //helper function - completes the node's head request and starts the next one
+    void _complete(sdo_request_t& request, sdo_request_t::status_t status, uint32_t abort_code)
+    {
+        node_queue_t& queue = m_queues[request.node_id];
+        assert(queue.head == &request);
+        //dequeuing
+        queue.head = request.next;
+        if(queue.head == nullptr) queue.tail = nullptr;
+        request.next = nullptr;
+        m_pending_count--;
+        //completing
+        request.status     = status;
+        request.abort_code = abort_code;
+        if(request.handler != nullptr) request.handler->handle_sdo_completion(request);
+        //next request of the node - unless the handler has queued and sent one already
+        if((queue.head != nullptr) && (queue.head->status == sdo_request_t::status_t::QUEUED)) _send_request(*(queue.head), control::get_now_nsec());
+    } //_complete()
+
+    //helper function
+    control::nsec_t _get_nearest_deadline(control::nsec_t deadline) const
+    {
+        for(size_t n=1; n<SDO_CLIENT_NODES_COUNT; n++)
+        {
+            const sdo_request_t* request = m_queues[n].head;
+            if((request != nullptr) && (request->status == sdo_request_t::status_t::IN_PROGRESS) && (request->deadline < deadline)) deadline = request->deadline;
+        }
+        return deadline;
+    } //_get_nearest_deadline()
+
+}; //class sdo_client
+
+} //namespace canopen
+
+} //namespace network
+
+#endif // NETWORK_SDO_CLIENT_H_INCLUDED
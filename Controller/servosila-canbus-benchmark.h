@@ -0,0 +1,98 @@
+#ifndef DEVICES_SERVOSILA_CANBUS_BENCHMARK_H_INCLUDED
+#define DEVICES_SERVOSILA_CANBUS_BENCHMARK_H_INCLUDED
+
+#include <stdio.h>      /* printf() */
+#include "control/timer.h"
+#include "devices/servosila-motor-controller.h"
+#include "devices/servosila-canbus-dispatcher.h"
+
+namespace devices
+{
+
+namespace benchmark
+{
+
+struct dispatch_benchmark_result_t
+{
+    size_t nodes_count;
+    size_t frames_count;
+    double linear_nsec_per_frame;       //every frame offered to every controller in turn
+    double dispatcher_nsec_per_frame;   //COB ID lookup table
+};
+
+/*
+    Compares the linear fan-out through process_canbus_callback() with servosila_canbus_dispatcher
+    Synthetic TPDO1-TPDO4 frames of all the nodes are routed in a round-robin order; no CANbus is needed.
+*/
+inline dispatch_benchmark_result_t benchmark_dispatch(size_t nodes_count, size_t frames_count = 1000000)
+{
+    assert((nodes_count > 0) && (nodes_count <= SERVOSILA_CANBUS_MAX_CONTROLLERS));
+    dispatch_benchmark_result_t result;
+    result.nodes_count  = nodes_count;
+    result.frames_count = frames_count;
+    //controllers - allocated once
+    static servosila_motor_controller controllers[SERVOSILA_CANBUS_MAX_CONTROLLERS];
+    static servosila_canbus_dispatcher dispatcher;
+    servosila_motor_controller* controller_pointers[SERVOSILA_CANBUS_MAX_CONTROLLERS];
+    dispatcher.clear();
+    for(size_t n=0; n<nodes_count; n++)
+    {
+        const uint8_t node_id = n + 1;
+        controllers[n].configure(node_id, servosila_motor_controller::protocol_version_t::PROTOCOL_VERSION_2_0, true, 1000, 1000000, 0, 65535, -32768, 32767, -32768, 32767);
+        controller_pointers[n] = &(controllers[n]);
+        dispatcher.register_controller(controllers[n]);
+    }
+    //synthetic TPDO frames
+    const size_t channels_count = sizeof(TPDO_SERVOSILA_CHANNELS)/sizeof(TPDO_SERVOSILA_CHANNELS[0]);
+    const size_t distinct_frames_count = nodes_count*channels_count;
+    can_frame frames[SERVOSILA_CANBUS_MAX_CONTROLLERS*channels_count];
+    for(size_t i=0; i<distinct_frames_count; i++)
+    {
+        memset(&(frames[i]), 0, sizeof(can_frame));
+        frames[i].can_id  = TPDO_SERVOSILA_CHANNELS[i%channels_count] + (i/channels_count) + 1;
+        frames[i].can_dlc = 8;
+        frames[i].data[2] = uint8_t(i);
+    }
+    const control::nsec_t timestamp = 1; //any non-zero value - avoids reading the clock
+    network::can_socket& can = dispatcher.get_can_socket(); //not connected - nothing is ever sent
+    //linear fan-out
+    control::stopwatch stopwatch;
+    for(size_t i=0; i<frames_count; i++)
+    {
+        const can_frame& frame = frames[i%distinct_frames_count];
+        for(size_t c=0; c<nodes_count; c++)
+        {
+            if(controller_pointers[c]->process_canbus_callback(can, frame.data, frame.can_dlc, frame.can_id, timestamp)) break;
+        }
+    }
+    result.linear_nsec_per_frame = stopwatch.get_elapsed_usec()*1000.0/frames_count;
+    //dispatcher
+    stopwatch.restart();
+    for(size_t i=0; i<frames_count; i++)
+    {
+        dispatcher.dispatch(frames[i%distinct_frames_count], timestamp);
+    }
+    result.dispatcher_nsec_per_frame = stopwatch.get_elapsed_usec()*1000.0/frames_count;
+    //
+    return result;
+} //benchmark_dispatch()
+
+/*
+    Runs benchmark_dispatch() for 1, 8, 32 and 127 nodes and prints a table
+*/
+inline void run_dispatch_benchmarks(size_t frames_count = 1000000)
+{
+    const size_t nodes_counts[] = {1, 8, 32, 127};
+    printf("%8s %12s %14s %14s\n", "nodes", "frames", "linear ns/fr", "table ns/fr");
+    for(size_t i=0; i<sizeof(nodes_counts)/sizeof(nodes_counts[0]); i++)
+    {
+        const dispatch_benchmark_result_t r = benchmark_dispatch(nodes_counts[i], frames_count);
+        printf("%8zu %12zu %14.1f %14.1f\n", r.nodes_count, r.frames_count, r.linear_nsec_per_frame, r.dispatcher_nsec_per_frame);
+    }
+} //run_dispatch_benchmarks()
+
+} //namespace benchmark
+
+} //namespace devices
+
+#endif // DEVICES_SERVOSILA_CANBUS_BENCHMARK_H_INCLUDED
@@ -0,0 +1,771 @@
+#ifndef DEVICES_SERVOSILA_CANBUS_DISPATCHER_H_INCLUDED
+#define DEVICES_SERVOSILA_CANBUS_DISPATCHER_H_INCLUDED
+
+#include <poll.h>       /* ppoll() */
+#include "network/cansocket.h"
+#include "network/canopen.h"
+#include "network/busload.h"
+#include "control/timer.h"
+#include "devices/servosila-motor-controller.h"
+
+namespace devices
+{
+
+//maximum number of controllers on a single bus (7bit Node IDs, 0 is not a valid device ID)
+const size_t SERVOSILA_CANBUS_MAX_CONTROLLERS = 127;
+//size of the 11bit COB ID space
+const size_t SERVOSILA_CANBUS_COB_ID_SPACE = 2048;
+//emergency stop - maximum number of copies of the halt commands in a burst
+const size_t SERVOSILA_EMERGENCY_STOP_MAX_REPETITIONS = 4;
+//emergency stop - how long a burst is retried while the TX queue of the interface is full,
+//...and how long the TX confirmations of the burst are waited for
+const control::nsec_t SERVOSILA_EMERGENCY_STOP_TIMEOUT_NSEC = 10000*control::NSEC_PER_USEC;
+
+/*
+    Emergency stops of a dispatcher since its creation - see servosila_canbus_dispatcher::emergency_stop()
+    - latency: from the trigger to the return of the sendmmsg() that handed the last frame of the burst over to the kernel
+    - wire latency: from the trigger to the kernel timestamp of the TX confirmation of the last frame of the burst,
+      measured in the TX confirmation mode only (see servosila_canbus_dispatcher::set_tx_confirmation_mode());
+      it is the time on the wire with the drivers that echo the frames once sent (IFF_ECHO), not with the others
+*/
+struct servosila_emergency_stop_statistics_t
+{
+    size_t          stops_count;
+    size_t          frames_sent;        //latest stop, all the repetitions and SYNCs
+    size_t          frames_not_sent;    //latest stop - the CANbus is down, or the TX queue stayed full for the timeout
+    control::nsec_t latency;            //latest stop
+    control::nsec_t max_latency;        //worst case
+    bool            is_wire_latency_measured; //latest stop - all its frames confirmed within the timeout
+    control::nsec_t wire_latency;       //latest stop, 0 - not measured
+    control::nsec_t max_wire_latency;   //worst case of the measured ones
+};
+
+/*
+    Bus-level dispatcher
+    - owns the CANbus socket shared by all the motor controllers on the bus
+    - keeps a COB ID lookup table pointing directly to the owning controller and its TPDO (heartbeat, EMCY) handler,
+      so each received frame is routed with a single table lookup regardless of the number of motors
+    - optionally produces SYNC: the RPDOs of all the controllers go out back to back right after SYNC
+      (see set_sync_period())
+    - optionally speaks CAN FD: combined telemetry frames are received, RPDOs can be combined (see set_fd_mode())
+    - optionally meters the bus load: frame rates per COB ID and per node, utilisation (see enable_bus_load_meter())
+    - a servosila_typed_motor_controller is served through its own methods: no protocol branches per frame
+    - stops all the motors of the bus in one burst of halt commands (see emergency_stop())
+    NOTE: the lookup table and the bus load meter take about 90KB, avoid placing the dispatcher on a small thread stack
+*/
+class servosila_canbus_dispatcher
+{
+public:
+    //TPDO (heartbeat, EMCY) handler of a motor controller - calls the method of the registered type (see _handle_frame())
+    typedef bool (*frame_handler_t)(servosila_motor_controller&, network::can_socket&, const uint8_t*, uint8_t, control::nsec_t);
+    //transmit side of a motor controller - execute(), build_rpdo() and build_halt_rpdo()
+    typedef void (*execute_handler_t)(servosila_motor_controller&, network::can_socket&);
+    typedef bool (*rpdo_builder_t)(const servosila_motor_controller&, can_frame&);
+    //lookup table entry
+    struct route_t
+    {
+        servosila_motor_controller* controller;
+        frame_handler_t             handler;
+    };
+private:
+    //the socket - owned, unless substituted with set_can_socket()
+    network::can_socket  m_own_can;
+    network::can_socket* m_can;
+    //COB ID lookup table
+    route_t m_routes[SERVOSILA_CANBUS_COB_ID_SPACE];
+    //registered controllers - in order of registration
+    servosila_motor_controller* m_controllers[SERVOSILA_CANBUS_MAX_CONTROLLERS];
+    execute_handler_t           m_execute_handlers[SERVOSILA_CANBUS_MAX_CONTROLLERS];
+    rpdo_builder_t              m_rpdo_builders[SERVOSILA_CANBUS_MAX_CONTROLLERS];
+    rpdo_builder_t              m_halt_builders[SERVOSILA_CANBUS_MAX_CONTROLLERS];
+    uint8_t                     m_controller_indices[SERVOSILA_CANBUS_MAX_CONTROLLERS + 1]; //by Node ID
+    size_t m_controllers_count;
+    //SYNC producer
+    bool           m_is_sync_enabled;
+    control::timer m_sync_timer;
+    uint8_t        m_sync_counter_overflow; //0 - SYNC frames without the counter
+    uint8_t        m_sync_counter;
+    size_t         m_syncs_sent;
+    //CAN FD
+    bool           m_is_combined_rpdo_enabled;
+    //bus load meter
+    bool           m_is_bus_load_enabled;
+    control::timer m_bus_load_timer;
+    network::can_bus_load_meter m_bus_load;
+    //emergency stop - the halt commands are kept built, as of the latest tick; a slot per controller
+    can_frame m_halt_frames[SERVOSILA_CANBUS_MAX_CONTROLLERS];
+    bool      m_is_halt_frame_built[SERVOSILA_CANBUS_MAX_CONTROLLERS];
+    servosila_emergency_stop_statistics_t m_emergency_stop_statistics;
+
+public:
+    servosila_canbus_dispatcher()
+        :   m_own_can(),
+            m_can(&m_own_can),
+            m_controllers_count(0),
+            m_is_sync_enabled(false),
+            m_sync_timer(0),
+            m_sync_counter_overflow(0),
+            m_sync_counter(0),
+            m_syncs_sent(0),
+            m_is_combined_rpdo_enabled(false),
+            m_is_bus_load_enabled(false),
+            m_bus_load_timer(0),
+            m_bus_load(),
+            m_emergency_stop_statistics()
+    {
+        memset(m_routes, 0, sizeof(m_routes));
+        memset(m_controller_indices, 0, sizeof(m_controller_indices));
+        memset(m_is_halt_frame_built, 0, sizeof(m_is_halt_frame_built));
+    } //servosila_canbus_dispatcher()
+
+    ~servosila_canbus_dispatcher()
+    {   //a substituted socket outlives the meter
+        if(m_is_bus_load_enabled) m_can->set_traffic_observer(nullptr);
+    } //~servosila_canbus_dispatcher()
+
+    /*
+        Opens the CANbus socket
+        Kernel-side filters are applied if controllers have been registered already.
+    */
+    bool startup(const char* can_interface_name = "vcan0", bool nonblocking = true)
+    {
+        bool result = m_can->startup(can_interface_name, nonblocking);
+        if(result && (m_controllers_count > 0))
+        {
+            result = apply_filters();
+        }
+        return result;
+    } //startup()
+
+    void shutdown()
+    {
+        if(m_can->is_connected()) m_can->shutdown();
+    } //shutdown()
+
+    network::can_socket& get_can_socket()
+    {
+        return *m_can;
+    } //get_can_socket()
+
+    /*
+        Substitutes the socket, e.g. with a network::can_recording_socket or a network::can_replay_socket
+        The socket must be started up by the caller and must outlive the dispatcher.
+    */
+    void set_can_socket(network::can_socket& can)
+    {
+        if(m_is_bus_load_enabled)
+        {   //the meter follows the socket
+            m_can->set_traffic_observer(nullptr);
+            can.set_traffic_observer(&m_bus_load);
+        }
+        m_can = &can;
+    } //set_can_socket()
+
+    /*
+        Registers a configured controller - its device ID must be already set with configure()
+        The controller must outlive the dispatcher.
+    */
+    bool register_controller(servosila_motor_controller& controller)
+    {
+        return _register_controller<servosila_motor_controller>(controller);
+    } //register_controller()
+
+    /*
+        Registers a controller with the protocol fixed at compile time - its frames, healthchecks and RPDOs
+        go through the methods of servosila_typed_motor_controller, without protocol branches
+    */
+    template <class protocol>
+    bool register_controller(servosila_typed_motor_controller<protocol>& controller)
+    {
+        return _register_controller<servosila_typed_motor_controller<protocol> >(controller);
+    } //register_controller()
+
+    /*
+        Unregisters all the controllers
+    */
+    void clear()
+    {
+        memset(m_routes, 0, sizeof(m_routes));
+        m_controllers_count = 0;
+    } //clear()
+
+    size_t get_controllers_count() const
+    {
+        return m_controllers_count;
+    } //get_controllers_count()
+
+    /*
+        A registered controller, read-only - commands go to the controller itself
+        (a typed controller is not to be reached through its servosila_motor_controller part)
+    */
+    const servosila_motor_controller& get_controller(size_t index) const
+    {
+        assert(index < m_controllers_count);
+        return *(m_controllers[index]);
+    } //get_controller()
+
+    /*
+        Installs kernel-side filters for all the registered controllers
+    */
+    bool apply_filters(can_err_mask_t error_mask = 0)
+    {
+        return apply_motor_controllers_filters(*m_can, m_controllers, m_controllers_count, error_mask);
+    } //apply_filters()
+
+    /*
+        Routes a single frame to its owning controller with a single table lookup
+        Returns false if the frame does not belong to any of the registered controllers.
+    */
+    bool dispatch(const can_frame& frame, control::nsec_t timestamp)
+    {
+        return _dispatch(frame.can_id, frame.data, frame.can_dlc, timestamp);
+    } //dispatch()
+
+    /*
+        Routes a classic or a CAN FD frame - a combined telemetry frame goes to the TPDO1 handler of its controller
+    */
+    bool dispatch(const canfd_frame& frame, control::nsec_t timestamp)
+    {
+        return _dispatch(frame.can_id, frame.data, frame.len, timestamp);
+    } //dispatch()
+
+    /*
+        Drains the socket with one receive_batch() call (more only if the batch is full)
+        and routes every received frame.
+        Returns the number of frames received.
+    */
+    size_t receive_and_dispatch()
+    {
+        _sample_bus_load();
+        const size_t total_frames_received = m_can->is_fd_enabled() ? _receive_and_dispatch_fd() : _receive_and_dispatch_classic();
+        _build_halt_frames(); //the halt commands follow the latest telemetry
+        return total_frames_received;
+    } //receive_and_dispatch()
+
+    /*
+        TX confirmation mode of the socket - emergency_stop() waits for the echoes of its burst
+        and measures the wire latency (see servosila_emergency_stop_statistics_t, network::can_socket::set_tx_confirmation_mode())
+        - every frame sent comes back to the socket, the receive side handles twice the frames
+        Call after startup(), before the traffic starts.
+    */
+    bool set_tx_confirmation_mode(bool is_enabled = true)
+    {
+        return m_can->set_tx_confirmation_mode(is_enabled);
+    } //set_tx_confirmation_mode()
+
+    bool is_tx_confirmation_enabled() const
+    {
+        return m_can->is_tx_confirmation_enabled();
+    } //is_tx_confirmation_enabled()
+
+    /*
+        CAN FD mode - the interface has to be FD capable, the drives have to run CAN FD firmware
+        - classic and FD frames are received, combined telemetry (TPDO1-TPDO4 in one frame) is decoded
+        - is_combined_rpdo: the SYNC producer packs the RPDOs of the 2.0 protocol controllers into
+          combined command frames, up to SERVOSILA_COMBINED_RPDO_MAX_SLOTS drives per frame (see execute_sync())
+        Call after startup().
+    */
+    bool set_fd_mode(bool is_enabled = true, bool is_combined_rpdo = false)
+    {
+        const bool result = m_can->set_fd_mode(is_enabled);
+        m_is_combined_rpdo_enabled = result && is_enabled && is_combined_rpdo;
+        return result;
+    } //set_fd_mode()
+
+    bool is_fd_enabled() const
+    {
+        return m_can->is_fd_enabled();
+    } //is_fd_enabled()
+
+    bool is_combined_rpdo_enabled() const
+    {
+        return m_is_combined_rpdo_enabled;
+    } //is_combined_rpdo_enabled()
+
+    /*
+        Meters the frames moved by the socket, a window every sample_period (sampled by receive_and_dispatch() and execute_transmit())
+        - bitrate, data_bitrate: of the interface, data_bitrate 0 for classic CAN
+        - the snapshots go to the owning thread with get_bus_load_meter().get_snapshot(),
+          to one other thread (e.g. a ROS diagnostics publisher) with get_bus_load_meter().fetch_snapshot()
+        NOTE: the kernel-side filters hide the foreign traffic (see apply_filters()), the utilisation of the bus is underestimated then
+    */
+    void enable_bus_load_meter(control::usec_t sample_period = 1000000, uint32_t bitrate = network::CAN_BUS_LOAD_DEFAULT_BITRATE, uint32_t data_bitrate = 0)
+    {
+        assert(sample_period > 0);
+        m_bus_load.configure(bitrate, data_bitrate);
+        m_bus_load.reset();
+        m_bus_load_timer.configure(sample_period);
+        m_bus_load.sample(control::get_now_nsec(), m_can->get_statistics()); //opens the first window
+        m_can->set_traffic_observer(&m_bus_load);
+        m_is_bus_load_enabled = true;
+    } //enable_bus_load_meter()
+
+    void disable_bus_load_meter()
+    {
+        m_can->set_traffic_observer(nullptr);
+        m_is_bus_load_enabled = false;
+    } //disable_bus_load_meter()
+
+    bool is_bus_load_meter_enabled() const
+    {
+        return m_is_bus_load_enabled;
+    } //is_bus_load_meter_enabled()
+
+    network::can_bus_load_meter& get_bus_load_meter()
+    {
+        return m_bus_load;
+    } //get_bus_load_meter()
+
+    /*
+        NMT master - a command to all the nodes on the bus at once (network::canopen::NMT_COMMAND_*),
+        e.g. NMT_COMMAND_START after power-on; see servosila_motor_controller for the commands to a single drive
+    */
+    bool send_nmt_command(uint8_t command)
+    {
+        return network::canopen::send_nmt_command(*m_can, command, network::canopen::NMT_ALL_NODES);
+    } //send_nmt_command()
+
+    /*
+        Synchronous group mode - SYNC every period, followed by the RPDOs of all the controllers in one send_batch()
+        - all the commands of a group leave within one burst, in registration order (e.g. left and right tracks)
+        - drives configured with servosila_motor_controller::configure_synchronous_pdos() apply the commands
+          on the next SYNC and sample their TPDOs on SYNC, so commands and telemetry are aligned across the group
+        - sync_counter_overflow 2..240 adds the SYNC counter (1..overflow) to the frames, 0 - no counter
+        period 0 turns the SYNC producer off, the controllers go back to their own RPDO timers.
+    */
+    void set_sync_period(control::usec_t period, uint8_t sync_counter_overflow = 0)
+    {
+        assert((sync_counter_overflow == 0) || ((sync_counter_overflow >= 2) && (sync_counter_overflow <= network::canopen::SYNC_COUNTER_MAX)));
+        m_is_sync_enabled = (period > 0);
+        m_sync_timer.configure(period);
+        m_sync_counter_overflow = sync_counter_overflow;
+        m_sync_counter = 0;
+        for(size_t c=0; c<m_controllers_count; c++)
+        {
+            m_controllers[c]->set_synchronous_mode(m_is_sync_enabled);
+        }
+    } //set_sync_period()
+
+    bool is_sync_enabled() const
+    {
+        return m_is_sync_enabled;
+    } //is_sync_enabled()
+
+    control::usec_t get_sync_period() const
+    {
+        return m_is_sync_enabled ? m_sync_timer.get_interval() : 0;
+    } //get_sync_period()
+
+    size_t get_syncs_sent() const
+    {
+        return m_syncs_sent;
+    } //get_syncs_sent()
+
+    /*
+        Sends SYNC and the RPDOs of all the controllers back to back, unconditionally of the SYNC timer
+        - can be called directly by an event loop when the SYNC deadline fires
+        - with the combined RPDOs enabled, the RPDOs go out in combined CAN FD frames (see set_fd_mode())
+        Returns the number of frames sent.
+    */
+    size_t execute_sync()
+    {
+        if(m_is_combined_rpdo_enabled) return _execute_sync_fd();
+        size_t frames_sent = 0;
+        if(m_can->is_connected())
+        {
+            can_frame frames[SERVOSILA_CANBUS_MAX_CONTROLLERS + 1];
+            size_t frames_count = 0;
+            //SYNC first
+            if(m_sync_counter_overflow > 0)
+            {
+                m_sync_counter = (m_sync_counter < m_sync_counter_overflow) ? uint8_t(m_sync_counter + 1) : 1;
+            }
+            network::canopen::build_sync(frames[frames_count], m_sync_counter);
+            frames_count++;
+            //then the commands
+            for(size_t c=0; c<m_controllers_count; c++)
+            {
+                if(m_rpdo_builders[c](*m_controllers[c], frames[frames_count])) frames_count++;
+            }
+            frames_sent = m_can->send_batch(frames, frames_count);
+            if(frames_sent > 0) m_syncs_sent++;
+        }
+        return frames_sent;
+    } //execute_sync()
+
+    /*
+        One tick of the control loop: receive, route, then SYNC, healthchecks and RPDOs of all controllers
+        Returns the number of frames received.
+    */
+    size_t execute()
+    {
+        const size_t frames_received = receive_and_dispatch();
+        execute_transmit();
+        return frames_received;
+    } //execute()
+
+    /*
+        Transmit half of execute(): SYNC if due, healthchecks and RPDOs of all controllers
+        - for control loops that set the commands between receiving the telemetry and sending the RPDOs
+          (read - update - write), e.g. a ros_control hardware interface
+    */
+    void execute_transmit()
+    {
+        _sample_bus_load();
+        if(m_is_sync_enabled && m_sync_timer.check_and_advance()) //drift-free
+        {
+            execute_sync();
+        }
+        for(size_t c=0; c<m_controllers_count; c++)
+        {
+            m_execute_handlers[c](*m_controllers[c], *m_can);
+        }
+        _build_halt_frames(); //the halt commands follow the latest commands and healthchecks
+    } //execute_transmit()
+
+    /*
+        Emergency stop of all the motors on the bus in one burst
+        - the halt commands of all the controllers are kept built as of the latest receive_and_dispatch() or
+          execute_transmit() (see servosila_motor_controller::build_halt_rpdo()) - nothing is built at the trigger,
+          the burst goes out with a single send_batch_until() - sendmmsg() per CAN_SOCKET_MAX_BATCH_SIZE frames
+        - repetitions 1..SERVOSILA_EMERGENCY_STOP_MAX_REPETITIONS: copies of the halt commands back to back,
+          in case a frame is lost; each copy is followed by SYNC in the synchronous group mode
+        - a TX queue full (ENOBUFS) is retried for SERVOSILA_EMERGENCY_STOP_TIMEOUT_NSEC - an e-stop does not give up early;
+          consider "ip link set canX txqueuelen 1000" so that the burst is queued at once
+        - in the TX confirmation mode the echoes of the burst are waited for, till the same timeout,
+          the frames received meanwhile are routed as usual (see set_tx_confirmation_mode())
+        - trigger_time: CLOCK_MONOTONIC of the event that caused the stop (e.g. an e-stop button), 0 - now
+        - the controllers are left in UNDEFINED_MODE, as after halt()
+        NOTE: the halt command of a motor in the position mode holds its position telemetry of the latest tick
+        Returns the number of frames sent; see get_emergency_stop_statistics() for the latency.
+    */
+    size_t emergency_stop(size_t repetitions = 1, control::nsec_t trigger_time = 0)
+    {
+        return _emergency_stop(nullptr, m_controllers_count, repetitions, trigger_time);
+    } //emergency_stop()
+
+    /*
+        Emergency stop of some of the motors on the bus in one burst, e.g. of a servosila_motor_group
+        - as emergency_stop(), for the controllers given only: the same halt commands, the same statistics;
+          SYNC in the synchronous group mode makes the other drives apply their latest commands as well
+        The controllers must be registered with the dispatcher.
+    */
+    size_t emergency_stop(servosila_motor_controller* const* controllers, size_t controllers_count, size_t repetitions = 1, control::nsec_t trigger_time = 0)
+    {
+        assert(controllers_count <= SERVOSILA_CANBUS_MAX_CONTROLLERS);
+        uint8_t controller_indices[SERVOSILA_CANBUS_MAX_CONTROLLERS];
+        for(size_t i=0; i<controllers_count; i++)
+        {
+            const uint8_t node_id = controllers[i]->get_device_id();
+            assert(m_routes[TPDO_SERVOSILA_CHANNEL_FOR_MOTOR_TELEMETRY_1 + node_id].controller == controllers[i]); //registered
+            controller_indices[i] = m_controller_indices[node_id];
+        }
+        return _emergency_stop(controller_indices, controllers_count, repetitions, trigger_time);
+    } //emergency_stop()
+
+    const servosila_emergency_stop_statistics_t& get_emergency_stop_statistics() const
+    {
+        return m_emergency_stop_statistics;
+    } //get_emergency_stop_statistics()
+
+    void reset_emergency_stop_statistics()
+    {
+        memset(&m_emergency_stop_statistics, 0, sizeof(m_emergency_stop_statistics));
+    } //reset_emergency_stop_statistics()
+
+private:
+    //helper function - the controller is kept as a servosila_motor_controller along with the handlers of controller_t,
+    //...which turn it back into the controller_t it was registered as
+    template <class controller_t>
+    bool _register_controller(controller_t& controller)
+    {
+        bool result = false;
+        const uint8_t node_id = controller.get_device_id();
+        assert(node_id != 0);
+        //checking for capacity and duplicate Node IDs
+        if((m_controllers_count < SERVOSILA_CANBUS_MAX_CONTROLLERS) && (m_routes[TPDO_SERVOSILA_CHANNEL_FOR_MOTOR_TELEMETRY_1 + node_id].controller == nullptr))
+        {   //filling the lookup table
+            _set_route(TPDO_SERVOSILA_CHANNEL_FOR_MOTOR_TELEMETRY_1 + node_id, controller, &_handle_frame<controller_t, &controller_t::process_tpdo1>);
+            _set_route(TPDO_SERVOSILA_CHANNEL_FOR_MOTOR_TELEMETRY_2 + node_id, controller, &_handle_frame<controller_t, &controller_t::process_tpdo2>);
+            _set_route(TPDO_SERVOSILA_CHANNEL_FOR_MOTOR_TELEMETRY_3 + node_id, controller, &_handle_frame<controller_t, &controller_t::process_tpdo3>);
+            _set_route(TPDO_SERVOSILA_CHANNEL_FOR_MOTOR_TELEMETRY_4 + node_id, controller, &_handle_frame<controller_t, &controller_t::process_tpdo4>);
+            _set_route(network::canopen::PREDEFINED_HEARTBEAT_CHANNEL + node_id, controller, &_handle_frame<servosila_motor_controller, &servosila_motor_controller::process_heartbeat>);
+            _set_route(network::canopen::PREDEFINED_EMCY_CHANNEL + node_id, controller, &_handle_frame<controller_t, &controller_t::process_emcy>);
+            //
+            m_controllers[m_controllers_count]      = &controller;
+            m_execute_handlers[m_controllers_count] = &_execute_controller<controller_t>;
+            m_rpdo_builders[m_controllers_count]    = &_build_rpdo<controller_t>;
+            m_halt_builders[m_controllers_count]    = &_build_halt_rpdo<controller_t>;
+            m_controller_indices[node_id]           = uint8_t(m_controllers_count);
+            m_controllers_count++;
+            controller.set_synchronous_mode(m_is_sync_enabled);
+            _build_halt_frames();
+            result = true;
+        }
+        return result;
+    } //_register_controller()
+
+    //helper function - a frame handler of controller_t
+    template <class controller_t, bool (controller_t::*handler)(network::can_socket&, const uint8_t*, uint8_t, control::nsec_t)>
+    static bool _handle_frame(servosila_motor_controller& controller, network::can_socket& can, const uint8_t* payload, uint8_t payload_size, control::nsec_t timestamp)
+    {
+        return (static_cast<controller_t&>(controller).*handler)(can, payload, payload_size, timestamp);
+    } //_handle_frame()
+
+    //helper function - execute() of controller_t
+    template <class controller_t>
+    static void _execute_controller(servosila_motor_controller& controller, network::can_socket& can)
+    {
+        static_cast<controller_t&>(controller).execute(can);
+    } //_execute_controller()
+
+    //helper function - build_rpdo() of controller_t
+    template <class controller_t>
+    static bool _build_rpdo(const servosila_motor_controller& controller, can_frame& frame)
+    {
+        return static_cast<const controller_t&>(controller).build_rpdo(frame);
+    } //_build_rpdo()
+
+    //helper function - build_halt_rpdo() of controller_t
+    template <class controller_t>
+    static bool _build_halt_rpdo(const servosila_motor_controller& controller, can_frame& frame)
+    {
+        return static_cast<const controller_t&>(controller).build_halt_rpdo(frame);
+    } //_build_halt_rpdo()
+
+    //helper function
+    bool _dispatch(canid_t can_id, const uint8_t* payload, uint8_t payload_size, control::nsec_t timestamp)
+    {
+        bool result = false;
+        //only standard data frames are routed
+        if((can_id & ~CAN_SFF_MASK) == 0)
+        {
+            const route_t& route = m_routes[can_id];
+            if(route.controller != nullptr)
+            {
+                result = route.handler(*route.controller, *m_can, payload, payload_size, timestamp);
+            }
+        }
+        return result;
+    } //_dispatch()
+
+    //helper function - closes the bus load window if due
+    //...called on both halves of a tick, so a loop that only transmits keeps the windows closing on time
+    void _sample_bus_load()
+    {
+        if(m_is_bus_load_enabled && m_bus_load_timer.check_and_advance()) //drift-free
+        {
+            m_bus_load.sample(control::get_now_nsec(), m_can->get_statistics());
+        }
+    } //_sample_bus_load()
+
+    //helper function - receive_and_dispatch() in the classic mode
+    size_t _receive_and_dispatch_classic()
+    {
+        size_t total_frames_received = 0;
+        //receive buffers
+        can_frame frames[network::CAN_SOCKET_MAX_BATCH_SIZE];
+        control::nsec_t timestamps[network::CAN_SOCKET_MAX_BATCH_SIZE];
+        //draining the socket
+        size_t frames_received = 0;
+        bool never_block = false; //blocking sockets: waiting for the first batch only
+        do
+        {
+            frames_received = m_can->receive_batch(frames, network::CAN_SOCKET_MAX_BATCH_SIZE, timestamps, never_block);
+            for(size_t i=0; i<frames_received; i++)
+            {
+                dispatch(frames[i], timestamps[i]);
+            }
+            total_frames_received += frames_received;
+            never_block = true;
+        }
+        while(m_can->get_last_receive_count() == network::CAN_SOCKET_MAX_BATCH_SIZE);
+        //
+        return total_frames_received;
+    } //_receive_and_dispatch_classic()
+
+    //helper function - receive_and_dispatch() in the CAN FD mode
+    size_t _receive_and_dispatch_fd()
+    {
+        size_t total_frames_received = 0;
+        //receive buffers
+        canfd_frame frames[network::CAN_SOCKET_MAX_BATCH_SIZE];
+        control::nsec_t timestamps[network::CAN_SOCKET_MAX_BATCH_SIZE];
+        //draining the socket
+        size_t frames_received = 0;
+        bool never_block = false; //blocking sockets: waiting for the first batch only
+        do
+        {
+            frames_received = m_can->receive_batch_fd(frames, network::CAN_SOCKET_MAX_BATCH_SIZE, timestamps, never_block);
+            for(size_t i=0; i<frames_received; i++)
+            {
+                dispatch(frames[i], timestamps[i]);
+            }
+            total_frames_received += frames_received;
+            never_block = true;
+        }
+        while(m_can->get_last_receive_count() == network::CAN_SOCKET_MAX_BATCH_SIZE);
+        //
+        return total_frames_received;
+    } //_receive_and_dispatch_fd()
+
+    //helper function - execute_sync() with the combined RPDOs
+    size_t _execute_sync_fd()
+    {
+        size_t frames_sent = 0;
+        if(m_can->is_connected())
+        {   //worst case: SYNC and a classic frame per controller
+            canfd_frame frames[SERVOSILA_CANBUS_MAX_CONTROLLERS + 1];
+            size_t frames_count = 0;
+            //SYNC first
+            if(m_sync_counter_overflow > 0)
+            {
+                m_sync_counter = (m_sync_counter < m_sync_counter_overflow) ? uint8_t(m_sync_counter + 1) : 1;
+            }
+            can_frame rpdo;
+            network::canopen::build_sync(rpdo, m_sync_counter);
+            network::copy_to_canfd_frame(rpdo, frames[frames_count]);
+            frames_count++;
+            //then the commands - combined frames, classic frames for the legacy controllers
+            canfd_frame* combined = nullptr;
+            for(size_t c=0; c<m_controllers_count; c++)
+            {
+                if(!m_rpdo_builders[c](*m_controllers[c], rpdo)) continue;
+                if(m_controllers[c]->get_protocol_version() == servosila_motor_controller::protocol_version_t::PROTOCOL_VERSION_2_0)
+                {   //all the 2.0 RPDOs are motor control RPDOs
+                    if((combined == nullptr) || !add_combined_rpdo_slot(*combined, rpdo))
+                    {   //starting a new combined frame
+                        if(combined != nullptr) finalize_combined_rpdo_frame(*combined);
+                        combined = &(frames[frames_count]);
+                        frames_count++;
+                        build_combined_rpdo_frame(*combined);
+                        add_combined_rpdo_slot(*combined, rpdo);
+                    }
+                }
+                else
+                {
+                    network::copy_to_canfd_frame(rpdo, frames[frames_count]);
+                    frames_count++;
+                }
+            }
+            if(combined != nullptr) finalize_combined_rpdo_frame(*combined);
+            frames_sent = m_can->send_batch_fd(frames, frames_count);
+            if(frames_sent > 0) m_syncs_sent++;
+        }
+        return frames_sent;
+    } //_execute_sync_fd()
+
+    //helper function - emergency_stop() of the controllers at controller_indices, nullptr - of all the controllers
+    size_t _emergency_stop(const uint8_t* controller_indices, size_t controllers_count, size_t repetitions, control::nsec_t trigger_time)
+    {
+        assert((repetitions >= 1) && (repetitions <= SERVOSILA_EMERGENCY_STOP_MAX_REPETITIONS));
+        if(trigger_time == 0) trigger_time = control::get_now_nsec();
+        can_frame frames[(SERVOSILA_CANBUS_MAX_CONTROLLERS + 1) * SERVOSILA_EMERGENCY_STOP_MAX_REPETITIONS];
+        size_t frames_count = 0;
+        //the halt commands
+        for(size_t i=0; i<controllers_count; i++)
+        {
+            const size_t c = (controller_indices != nullptr) ? controller_indices[i] : i;
+            if(m_is_halt_frame_built[c]) frames[frames_count++] = m_halt_frames[c];
+        }
+        //synchronous group mode - the drives apply the commands on SYNC
+        if(m_is_sync_enabled)
+        {
+            if(m_sync_counter_overflow > 0)
+            {
+                m_sync_counter = (m_sync_counter < m_sync_counter_overflow) ? uint8_t(m_sync_counter + 1) : 1;
+            }
+            network::canopen::build_sync(frames[frames_count], m_sync_counter);
+            frames_count++;
+        }
+        //the copies
+        const size_t burst_size = frames_count;
+        for(size_t r=1; r<repetitions; r++)
+        {
+            memcpy(&(frames[frames_count]), frames, burst_size*sizeof(can_frame));
+            frames_count += burst_size;
+        }
+        //the burst
+        const control::nsec_t deadline = trigger_time + SERVOSILA_EMERGENCY_STOP_TIMEOUT_NSEC;
+        const size_t frames_sent = (frames_count > 0) ? m_can->send_batch_until(frames, frames_count, deadline, _get_frame_time()) : 0;
+        const control::nsec_t sent_time = control::get_now_nsec();
+        if(m_is_sync_enabled && (frames_sent > 0)) m_syncs_sent++;
+        //AFTER HALT: switching to undefined mode
+        for(size_t i=0; i<controllers_count; i++)
+        {
+            const size_t c = (controller_indices != nullptr) ? controller_indices[i] : i;
+            m_controllers[c]->set_undefined_command();
+        }
+        _build_halt_frames();
+        //the echoes of the burst
+        const bool is_confirmed = (frames_sent > 0) && m_can->is_tx_confirmation_enabled() && _wait_for_tx_confirmations(deadline);
+        _update_emergency_stop_statistics(trigger_time, sent_time, is_confirmed, frames_sent, frames_count);
+        return frames_sent;
+    } //_emergency_stop()
+
+    //helper function - the halt commands of all the controllers, sent by emergency_stop() as they are
+    void _build_halt_frames()
+    {
+        for(size_t c=0; c<m_controllers_count; c++)
+        {
+            m_is_halt_frame_built[c] = m_halt_builders[c](*m_controllers[c], m_halt_frames[c]);
+        }
+    } //_build_halt_frames()
+
+    //helper function - the on-wire time of the longest classic frame, the retry period of a full TX queue
+    //...the queue drains a frame at a time
+    control::nsec_t _get_frame_time() const
+    {
+        return network::get_can_frame_time_nsec(CAN_EFF_FLAG, CAN_MAX_DLEN, 0, m_bus_load.get_bitrate(), m_bus_load.get_data_bitrate());
+    } //_get_frame_time()
+
+    //helper function - receives and routes the frames till all the frames sent have been confirmed
+    //...returns false if the deadline has passed first
+    bool _wait_for_tx_confirmations(control::nsec_t deadline)
+    {
+        while((m_can->get_unconfirmed_frames_count() > 0) && m_can->is_connected())
+        {
+            const control::nsec_t now = control::get_now_nsec();
+            if(now >= deadline) break;
+            const control::nsec_t remaining = deadline - now;
+            pollfd descriptor;
+            descriptor.fd      = m_can->get_fd();
+            descriptor.events  = POLLIN;
+            descriptor.revents = 0;
+            timespec timeout;
+            timeout.tv_sec  = remaining / control::NSEC_PER_SEC;
+            timeout.tv_nsec = remaining % control::NSEC_PER_SEC;
+            //readable - the first receive does not block
+            if(::ppoll(&descriptor, 1, &timeout, nullptr) > 0) receive_and_dispatch();
+        }
+        return m_can->get_unconfirmed_frames_count() == 0;
+    } //_wait_for_tx_confirmations()
+
+    //helper function - the latencies of the burst just sent
+    void _update_emergency_stop_statistics(control::nsec_t trigger_time, control::nsec_t sent_time, bool is_confirmed, size_t frames_sent, size_t frames_count)
+    {
+        servosila_emergency_stop_statistics_t& statistics = m_emergency_stop_statistics;
+        const control::nsec_t confirmed_time = m_can->get_last_confirmation_timestamp();
+        statistics.stops_count++;
+        statistics.frames_sent      = frames_sent;
+        statistics.frames_not_sent  = frames_count - frames_sent;
+        statistics.latency          = (sent_time > trigger_time) ? (sent_time - trigger_time) : 0;
+        statistics.is_wire_latency_measured = is_confirmed && (confirmed_time != 0);
+        statistics.wire_latency     = (statistics.is_wire_latency_measured && (confirmed_time > trigger_time)) ? (confirmed_time - trigger_time) : 0;
+        if(statistics.latency > statistics.max_latency)           statistics.max_latency      = statistics.latency;
+        if(statistics.wire_latency > statistics.max_wire_latency) statistics.max_wire_latency = statistics.wire_latency;
+    } //_update_emergency_stop_statistics()
+
+    //helper function
+    void _set_route(uint16_t cob_id, servosila_motor_controller& controller, frame_handler_t handler)
+    {
+        assert(cob_id < SERVOSILA_CANBUS_COB_ID_SPACE);
+        m_routes[cob_id].controller = &controller;
+        m_routes[cob_id].handler    = handler;
+    } //_set_route()
+
+}; //class servosila_canbus_dispatcher
+
+} //namespace devices
+
+#endif // DEVICES_SERVOSILA_CANBUS_DISPATCHER_H_INCLUDED
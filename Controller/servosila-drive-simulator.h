@@ -0,0 +1,962 @@
+#ifndef DEVICES_SERVOSILA_DRIVE_SIMULATOR_H_INCLUDED
+#define DEVICES_SERVOSILA_DRIVE_SIMULATOR_H_INCLUDED
+
+/*
+Simulated Servosila drives on a (virtual) CANbus - for load testing without hardware
+    - the drive side of the protocol spoken by servosila_motor_controller:
+      parses the RPDO commands (2.0 and legacy protocols) and emits TPDO1-TPDO4
+    - NMT slave: boot-up message, heartbeats, NMT commands (a stopped or pre-operational drive
+      ignores the RPDOs and sends no TPDOs), reboots with reboot() or an NMT reset
+    - EMCY producer: an EMCY on an injected fault, an EMCY error reset on the fault ACK
+    - a simple first order motor model per drive: position, speed and current modes
+    - any number of Node IDs (up to 127) on one socket, TPDOs sent with send_batch()
+    - optional CAN FD firmware: combined command frames are parsed, telemetry can go out combined (see set_fd_mode())
+
+Running 100 drives on vcan0 (see cansocket.h for the vcan0 setup):
+    static devices::servosila_drive_simulator simulator;
+    simulator.startup("vcan0");
+    for(uint8_t id=1; id<=100; id++) simulator.add_drive(id, servosila_motor_controller::protocol_version_t::PROTOCOL_VERSION_2_0, true);
+    simulator.set_tpdo_rate(0, 4000); //TPDO1 at 4kHz
+    simulator.run(is_running);        //returns when is_running becomes false
+*/
+
+#include "network/cansocket.h"
+#include "network/canopen.h"
+#include "control/timer.h"
+#include "devices/servosila-motor-controller.h"
+#include "devices/servosila-canbus-dispatcher.h" /* SERVOSILA_CANBUS_MAX_CONTROLLERS */
+
+namespace devices
+{
+
+//number of TPDO channels emitted by a drive (TPDO1-TPDO4)
+const size_t SERVOSILA_DRIVE_TPDO_CHANNELS_COUNT = sizeof(TPDO_SERVOSILA_CHANNELS)/sizeof(TPDO_SERVOSILA_CHANNELS[0]);
+
+/*
+    Motor model of a single drive
+    - speed follows its target with a first order lag
+    - the position integrates the speed (1 speed unit = 1 position tick per second) and wraps around
+    - POSITION mode: the speed target is proportional to the position error, AMPS mode: to the current
+*/
+class servosila_simulated_drive
+{
+public:
+    typedef servosila_motor_controller::protocol_version_t protocol_version_t;
+    typedef servosila_motor_controller::operation_mode_t   operation_mode_t;
+    //model parameters
+    struct model_t
+    {
+        double speed_time_constant; //seconds
+        double position_gain;       //speed units per position tick of error
+        double speed_per_amp;       //speed units per current unit
+        double amps_per_acceleration; //current drawn per speed unit per second of acceleration
+        double max_speed;
+        double supply_voltage;      //volts
+        double ambient_temperature; //Celsius - the motor heats up above it with the current
+        double temperature_per_amp; //Celsius per current unit
+    };
+private:
+    uint8_t            m_node_id;
+    protocol_version_t m_protocol_version;
+    bool               m_is_position_encoder_available;
+    model_t            m_model;
+    //command
+    operation_mode_t   m_operation_mode;
+    uint16_t           m_position_command;
+    int16_t            m_speed_command;
+    int16_t            m_amps_command;
+    //state
+    double             m_position;
+    double             m_speed;
+    double             m_amps;
+    int32_t            m_revolutions;      //wrap-arounds of the position - for the multiturn position
+    uint16_t           m_fault_flags;      //2.0 protocol - part of the status word
+    network::canopen::emcy_message_t m_emcy;    //latest EMCY
+    bool               m_is_emcy_pending;  //m_emcy not sent yet
+    //NMT
+    uint8_t            m_nmt_state;
+    bool               m_is_bootup_pending; //boot-up message not sent yet
+    //statistics
+    size_t             m_rpdo_counter;
+    size_t             m_fault_ack_counter;
+
+public:
+    servosila_simulated_drive()
+        :   m_node_id(0),
+            m_protocol_version(protocol_version_t::PROTOCOL_VERSION_2_0),
+            m_is_position_encoder_available(true),
+            m_model(),
+            m_operation_mode(operation_mode_t::UNDEFINED_MODE),
+            m_position_command(0),
+            m_speed_command(0),
+            m_amps_command(0),
+            m_position(0.0),
+            m_speed(0.0),
+            m_amps(0.0),
+            m_revolutions(0),
+            m_fault_flags(0),
+            m_emcy(),
+            m_is_emcy_pending(false),
+            m_nmt_state(network::canopen::NMT_STATE_OPERATIONAL),
+            m_is_bootup_pending(false),
+            m_rpdo_counter(0),
+            m_fault_ack_counter(0)
+    {
+        m_model.speed_time_constant = 0.05;
+        m_model.position_gain       = 10.0;
+        m_model.speed_per_amp       = 100.0;
+        m_model.amps_per_acceleration = 0.001;
+        m_model.max_speed           = 32767.0;
+        m_model.supply_voltage      = 24.0;
+        m_model.ambient_temperature = 25.0;
+        m_model.temperature_per_amp = 0.5;
+    }
+
+    void configure(uint8_t node_id, protocol_version_t protocol_version, bool position_encoder_available, uint16_t initial_position = 0)
+    {
+        assert((node_id != 0) && (node_id < 128));
+        m_node_id = node_id;
+        m_protocol_version = protocol_version;
+        m_is_position_encoder_available = position_encoder_available;
+        m_operation_mode = operation_mode_t::UNDEFINED_MODE;
+        m_position = initial_position;
+        m_speed = 0.0;
+        m_amps = 0.0;
+        m_revolutions = 0;
+        m_fault_flags = 0;
+        m_emcy = network::canopen::emcy_message_t();
+        m_is_emcy_pending = false;
+        m_rpdo_counter = 0;
+        m_fault_ack_counter = 0;
+        m_nmt_state = network::canopen::NMT_STATE_OPERATIONAL;
+        m_is_bootup_pending = true;
+    } //configure()
+
+    void set_model(const model_t& model)
+    {
+        assert(model.speed_time_constant > 0.0);
+        m_model = model;
+    } //set_model()
+
+    uint8_t get_node_id() const
+    {
+        return m_node_id;
+    } //get_node_id()
+
+    operation_mode_t get_operation_mode() const
+    {
+        return m_operation_mode;
+    } //get_operation_mode()
+
+    uint16_t get_position() const
+    {
+        return _wrap_position(m_position);
+    } //get_position()
+
+    int16_t get_speed() const
+    {
+        return _saturate(m_speed);
+    } //get_speed()
+
+    /*
+        Raises fault flags (TELEMETRY_STATUS_FAULT_FLAGS_MASK bits) - 2.0 protocol only
+        The flags stay in the status word until a fault ACK arrives.
+        An EMCY with error_code is sent along, unless error_code is EMCY_ERROR_CODE_RESET.
+    */
+    void inject_fault(uint16_t fault_flags, uint16_t error_code = network::canopen::EMCY_ERROR_CODE_GENERIC)
+    {
+        m_fault_flags |= (fault_flags & TELEMETRY_STATUS_FAULT_FLAGS_MASK);
+        if(error_code != network::canopen::EMCY_ERROR_CODE_RESET)
+        {
+            const uint8_t ERROR_REGISTER_GENERIC_ERROR = 0x01;
+            m_emcy.error_code     = error_code;
+            m_emcy.error_register = ERROR_REGISTER_GENERIC_ERROR;
+            m_is_emcy_pending     = true;
+        }
+    } //inject_fault()
+
+    /*
+        Builds the pending EMCY once; returns false if there is none
+    */
+    bool build_emcy(can_frame& frame)
+    {
+        const bool result = m_is_emcy_pending;
+        if(result) network::canopen::build_emcy(frame, m_node_id, m_emcy);
+        m_is_emcy_pending = false;
+        return result;
+    } //build_emcy()
+
+    uint8_t get_nmt_state() const
+    {
+        return m_nmt_state;
+    } //get_nmt_state()
+
+    bool is_operational() const
+    {
+        return m_nmt_state == network::canopen::NMT_STATE_OPERATIONAL;
+    } //is_operational()
+
+    protocol_version_t get_protocol_version() const
+    {
+        return m_protocol_version;
+    } //get_protocol_version()
+
+    /*
+        Simulates a power cycle: the commands and the faults are lost, the motor stops,
+        the drive sends its boot-up message and starts operating on its own, like the Servosila drives do
+        (an NMT master may still send NMT start - harmless)
+    */
+    void reboot()
+    {
+        m_operation_mode = operation_mode_t::UNDEFINED_MODE;
+        m_speed = 0.0;
+        m_amps = 0.0;
+        m_fault_flags = 0;
+        m_emcy = network::canopen::emcy_message_t();
+        m_is_emcy_pending = false;
+        m_nmt_state = network::canopen::NMT_STATE_OPERATIONAL;
+        m_is_bootup_pending = true;
+    } //reboot()
+
+    /*
+        Executes an NMT command addressed to this drive (or to all the nodes)
+        Returns false if the command is not known.
+    */
+    bool process_nmt_command(uint8_t command)
+    {
+        bool result = true;
+        switch(command)
+        {
+            case network::canopen::NMT_COMMAND_START:                 m_nmt_state = network::canopen::NMT_STATE_OPERATIONAL; break;
+            case network::canopen::NMT_COMMAND_STOP:                  m_nmt_state = network::canopen::NMT_STATE_STOPPED; break;
+            case network::canopen::NMT_COMMAND_ENTER_PRE_OPERATIONAL: m_nmt_state = network::canopen::NMT_STATE_PRE_OPERATIONAL; break;
+            case network::canopen::NMT_COMMAND_RESET_NODE:            reboot(); break;
+            case network::canopen::NMT_COMMAND_RESET_COMMUNICATION:   m_is_bootup_pending = true; break;
+            default:                                                  result = false; break;
+        }
+        //no commands outside of OPERATIONAL - coasting to a halt
+        if(!is_operational()) m_operation_mode = operation_mode_t::UNDEFINED_MODE;
+        return result;
+    } //process_nmt_command()
+
+    /*
+        Builds the boot-up message once after a (re)boot; returns false if it has been sent already
+    */
+    bool build_bootup(can_frame& frame)
+    {
+        const bool result = m_is_bootup_pending;
+        if(result) network::canopen::build_heartbeat(frame, m_node_id, network::canopen::NMT_STATE_BOOTUP);
+        m_is_bootup_pending = false;
+        return result;
+    } //build_bootup()
+
+    void build_heartbeat(can_frame& frame) const
+    {
+        network::canopen::build_heartbeat(frame, m_node_id, m_nmt_state);
+    } //build_heartbeat()
+
+    size_t get_rpdo_counter() const
+    {
+        return m_rpdo_counter;
+    } //get_rpdo_counter()
+
+    size_t get_fault_ack_counter() const
+    {
+        return m_fault_ack_counter;
+    } //get_fault_ack_counter()
+
+    /*
+        Parses an RPDO addressed to this drive (the COB ID is already matched against the Node ID)
+        Returns false if the frame is not a known command.
+    */
+    bool process_rpdo(uint16_t function_code, const uint8_t* payload, uint8_t payload_size)
+    {
+        bool result = false;
+        if((payload_size == 8) && is_operational()) //RPDO frames size, PDOs are processed in OPERATIONAL only
+        {
+            switch(m_protocol_version)
+            {
+                case protocol_version_t::PROTOCOL_VERSION_2_0:
+                {
+                    result = _process_rpdo_protocol_2_0(function_code, payload);
+                    break;
+                }
+                case protocol_version_t::PROTOCOL_VERSION_LEGACY:
+                {
+                    result = _process_rpdo_legacy_protocol(function_code, payload);
+                    break;
+                }
+                default:
+                {   //unknown protocol version
+                    assert(false);
+                    break;
+                }
+            }
+        }
+        if(result) m_rpdo_counter++;
+        return result;
+    } //process_rpdo()
+
+    /*
+        Advances the motor model by dt seconds
+    */
+    void step(double dt)
+    {
+        //speed target as per the operation mode
+        double target_speed = 0.0;
+        switch(m_operation_mode)
+        {
+            case operation_mode_t::POSITION_MODE:
+            {   //shortest way around the 16bit position range
+                double error = double(m_position_command) - m_position;
+                if(error >  32768.0) error -= 65536.0;
+                if(error < -32768.0) error += 65536.0;
+                target_speed = m_model.position_gain * error;
+                break;
+            }
+            case operation_mode_t::SPEED_MODE:
+            {
+                target_speed = m_speed_command;
+                break;
+            }
+            case operation_mode_t::AMPS_MODE:
+            {
+                target_speed = m_model.speed_per_amp * m_amps_command;
+                break;
+            }
+            default:
+            {   //UNDEFINED_MODE - coasting to a halt
+                break;
+            }
+        }
+        if(target_speed >  m_model.max_speed) target_speed =  m_model.max_speed;
+        if(target_speed < -m_model.max_speed) target_speed = -m_model.max_speed;
+        //first order lag
+        const double alpha = (dt < m_model.speed_time_constant) ? (dt / m_model.speed_time_constant) : 1.0;
+        const double acceleration = (target_speed - m_speed) * alpha;
+        m_speed += acceleration;
+        if(m_operation_mode == operation_mode_t::AMPS_MODE) m_amps = m_amps_command;
+        else m_amps = (dt > 0.0) ? (m_model.amps_per_acceleration * acceleration / dt) : 0.0;
+        //integrating the position - wrapping around
+        m_position += m_speed * dt;
+        if(m_position < 0.0)      { m_position += 65536.0; m_revolutions--; }
+        if(m_position >= 65536.0) { m_position -= 65536.0; m_revolutions++; }
+    } //step()
+
+    /*
+        Builds a TPDO frame; channel_index 0..3 = TPDO1..TPDO4
+    */
+    void build_tpdo(size_t channel_index, can_frame& frame) const
+    {
+        assert(channel_index < SERVOSILA_DRIVE_TPDO_CHANNELS_COUNT);
+        memset(&frame, 0, sizeof(frame));
+        frame.can_id  = TPDO_SERVOSILA_CHANNELS[channel_index] + m_node_id;
+        frame.can_dlc = 8; //TPDO frames size
+        servosila_telemetry_t telemetry;
+        telemetry.status   = m_fault_flags;
+        telemetry.position = get_position();
+        telemetry.speed    = get_speed();
+        telemetry.amps     = _saturate(m_amps);
+        telemetry.faults   = 0; //no faults in the simulated legacy drive
+        //extended telemetry - 2.0 protocol only, encoded with the PLACEHOLDER layouts (see servosila_tpdo_layouts);
+        //...decoded by the controllers with set_extended_telemetry_mapped() only
+        const double amps = (m_amps < 0.0) ? -m_amps : m_amps;
+        telemetry.supply_voltage         = uint16_t(m_model.supply_voltage * 10.0);
+        telemetry.motor_temperature      = _saturate(m_model.ambient_temperature + m_model.temperature_per_amp * amps);
+        telemetry.controller_temperature = _saturate(m_model.ambient_temperature);
+        telemetry.error_code             = m_fault_flags;
+        telemetry.multiturn_position     = m_revolutions * 65536 + int32_t(get_position());
+        telemetry.warnings               = 0;
+        telemetry.digital_inputs         = 0;
+        telemetry.analog_input           = 0;
+        //encoding with the layouts the motor controller decodes with
+        switch(channel_index)
+        {
+            case 0:  _encode_tpdo<0>(telemetry, frame.data); break;
+            case 1:  _encode_tpdo<1>(telemetry, frame.data); break;
+            case 2:  _encode_tpdo<2>(telemetry, frame.data); break;
+            case 3:  _encode_tpdo<3>(telemetry, frame.data); break;
+            default: assert(false); break;
+        }
+    } //build_tpdo()
+
+    /*
+        Builds a CAN FD combined telemetry frame - TPDO1-TPDO4 payloads on the TPDO1 COB ID, 2.0 protocol only
+    */
+    void build_combined_tpdo(canfd_frame& frame) const
+    {
+        assert(m_protocol_version == protocol_version_t::PROTOCOL_VERSION_2_0);
+        memset(&frame, 0, sizeof(frame));
+        frame.can_id = TPDO_SERVOSILA_CHANNEL_FOR_MOTOR_TELEMETRY_1 + m_node_id;
+        frame.len    = SERVOSILA_COMBINED_TPDO_PAYLOAD_SIZE;
+        frame.flags  = CANFD_BRS | CANFD_FDF;
+        can_frame tpdo;
+        for(size_t c=0; c<SERVOSILA_DRIVE_TPDO_CHANNELS_COUNT; c++)
+        {
+            build_tpdo(c, tpdo);
+            memcpy(&(frame.data[c*network::canopen::PDO_PAYLOAD_SIZE]), tpdo.data, network::canopen::PDO_PAYLOAD_SIZE);
+        }
+    } //build_combined_tpdo()
+
+private:
+    //helper function - encodes a TPDO as per its layout (see servosila_tpdo_layouts)
+    template <size_t channel_index>
+    void _encode_tpdo(const servosila_telemetry_t& telemetry, uint8_t* payload) const
+    {
+        typedef servosila_tpdo_layouts<channel_index> layouts_t;
+        if(m_protocol_version == protocol_version_t::PROTOCOL_VERSION_2_0) layouts_t::protocol_2_0_t::encode(telemetry, payload);
+        else if(m_is_position_encoder_available)                           layouts_t::legacy_servo_t::encode(telemetry, payload);
+        else                                                               layouts_t::legacy_chassis_t::encode(telemetry, payload);
+    } //_encode_tpdo()
+
+    //helper function
+    bool _process_rpdo_protocol_2_0(uint16_t function_code, const uint8_t* payload)
+    {
+        //device protocol-specific constants - see servosila_motor_controller
+        const uint16_t RPDO_COMMAND_AMPS      = 0x0001;
+        const uint16_t RPDO_COMMAND_FAULT_ACK = 0x0002;
+        const uint16_t RPDO_COMMAND_SPEED     = 0x0005;
+        const uint16_t RPDO_COMMAND_POSITION  = 0x0021;
+        bool result = false;
+        if(function_code == RPDO_SERVOSILA_CHANNEL_FOR_MOTOR_CONTROL)
+        {
+            const uint16_t command = ftl::load_little_endian<uint16_t>(&(payload[0]));
+            result = true;
+            switch(command)
+            {
+                case RPDO_COMMAND_POSITION:
+                {
+                    m_position_command = ftl::load_little_endian<uint16_t>(&(payload[2]));
+                    m_operation_mode = operation_mode_t::POSITION_MODE;
+                    break;
+                }
+                case RPDO_COMMAND_SPEED:
+                {
+                    m_speed_command = ftl::load_little_endian<int16_t>(&(payload[4]));
+                    m_operation_mode = operation_mode_t::SPEED_MODE;
+                    break;
+                }
+                case RPDO_COMMAND_AMPS:
+                {
+                    m_amps_command = ftl::load_little_endian<int16_t>(&(payload[6]));
+                    m_operation_mode = operation_mode_t::AMPS_MODE;
+                    break;
+                }
+                case RPDO_COMMAND_FAULT_ACK:
+                {
+                    m_fault_flags = 0;
+                    m_fault_ack_counter++;
+                    if(m_emcy.error_code != network::canopen::EMCY_ERROR_CODE_RESET)
+                    {   //no errors left
+                        m_emcy = network::canopen::emcy_message_t();
+                        m_is_emcy_pending = true;
+                    }
+                    break;
+                }
+                default:
+                {   //unknown command
+                    result = false;
+                    break;
+                }
+            }
+        }
+        return result;
+    } //_process_rpdo_protocol_2_0()
+
+    //helper function
+    bool _process_rpdo_legacy_protocol(uint16_t function_code, const uint8_t* payload)
+    {
+        bool result = false;
+        const uint16_t value = ftl::load_little_endian<uint16_t>(&(payload[0]));
+        if((function_code == RPDO_SERVOSILA_CHANNEL_FOR_MOTOR_CONTROL) && m_is_position_encoder_available)
+        {   //servo - position
+            m_position_command = value;
+            m_operation_mode = operation_mode_t::POSITION_MODE;
+            result = true;
+        }
+        else if(((function_code == RPDO_SERVOSILA_CHANNEL_FOR_LEGACY_SPEED_CONTROL) && m_is_position_encoder_available)
+             || ((function_code == RPDO_SERVOSILA_CHANNEL_FOR_MOTOR_CONTROL) && !m_is_position_encoder_available))
+        {   //servo or chassis drive - speed, sign and magnitude
+            const int16_t magnitude = int16_t(value & 0x7FFF);
+            m_speed_command = (value & LEGACY_SPEED_SIGN_BIT) ? int16_t(-magnitude) : magnitude;
+            m_operation_mode = operation_mode_t::SPEED_MODE;
+            result = true;
+        }
+        return result;
+    } //_process_rpdo_legacy_protocol()
+
+    //helper function
+    static uint16_t _wrap_position(double position)
+    {
+        while(position < 0.0)      position += 65536.0;
+        while(position >= 65536.0) position -= 65536.0;
+        return uint16_t(position);
+    } //_wrap_position()
+
+    //helper function
+    static int16_t _saturate(double value)
+    {
+        if(value >  32767.0) value =  32767.0;
+        if(value < -32768.0) value = -32768.0;
+        return int16_t(value);
+    } //_saturate()
+
+}; //class servosila_simulated_drive
+
+/*
+    A bus full of simulated drives sharing one CANbus socket
+    - receives RPDOs, advances the motor models and emits the TPDOs at configurable rates
+    - kernel-side filters pass only the RPDOs of the simulated Node IDs
+    NOTE: the object is large, allocate it statically or on the heap
+*/
+class servosila_drive_simulator
+{
+public:
+    struct statistics_t
+    {
+        size_t ticks_count;
+        size_t rpdo_frames_count;       //received and parsed
+        size_t tpdo_frames_count;       //sent
+        size_t tpdo_send_failures;      //frames not accepted by the socket
+        size_t sync_frames_count;       //received
+        size_t nmt_frames_count;        //received
+        size_t heartbeat_frames_count;  //sent, boot-up messages included
+        size_t emcy_frames_count;       //sent
+        size_t combined_rpdo_frames_count; //CAN FD, received
+    };
+private:
+    network::can_socket       m_can;
+    servosila_simulated_drive m_drives[SERVOSILA_CANBUS_MAX_CONTROLLERS+1]; //indexed by Node ID
+    uint8_t                   m_node_ids[SERVOSILA_CANBUS_MAX_CONTROLLERS];
+    size_t                    m_drives_count;
+    //TPDO schedule, per channel; period 0 = disabled
+    control::nsec_t           m_tpdo_periods[SERVOSILA_DRIVE_TPDO_CHANNELS_COUNT];
+    control::nsec_t           m_tpdo_deadlines[SERVOSILA_DRIVE_TPDO_CHANNELS_COUNT];
+    bool                      m_is_tpdo_every_tick[SERVOSILA_DRIVE_TPDO_CHANNELS_COUNT]; //regardless of the period
+    //synchronous TPDOs, per channel; sent on every n-th SYNC, 0 = as per the rate
+    size_t                    m_tpdo_sync_dividers[SERVOSILA_DRIVE_TPDO_CHANNELS_COUNT];
+    //heartbeats of all the drives; period 0 = disabled, boot-up messages are sent anyway
+    control::nsec_t           m_heartbeat_period;
+    control::nsec_t           m_heartbeat_deadline;
+    //model time
+    control::nsec_t           m_previous_tick_time;
+    statistics_t              m_statistics;
+    //CAN FD - TPDO1-TPDO4 of the 2.0 protocol drives in one frame, at the TPDO1 rate
+    bool                      m_is_combined_tpdo;
+
+public:
+    servosila_drive_simulator()
+        :   m_can(),
+            m_drives_count(0),
+            m_heartbeat_period(0),
+            m_heartbeat_deadline(0),
+            m_previous_tick_time(0),
+            m_statistics(),
+            m_is_combined_tpdo(false)
+    {
+        //default rates: TPDO1 at 1kHz, TPDO2-4 at 100Hz
+        for(size_t c=0; c<SERVOSILA_DRIVE_TPDO_CHANNELS_COUNT; c++)
+        {
+            m_tpdo_periods[c]   = (c == 0) ? (control::NSEC_PER_SEC / 1000) : (control::NSEC_PER_SEC / 100);
+            m_tpdo_deadlines[c] = 0;
+            m_is_tpdo_every_tick[c] = false;
+            m_tpdo_sync_dividers[c] = 0;
+        }
+    } //servosila_drive_simulator()
+
+    bool startup(const char* can_interface_name = "vcan0")
+    {
+        bool result = m_can.startup(can_interface_name, true);
+        if(result) result = apply_filters();
+        return result;
+    } //startup()
+
+    void shutdown()
+    {
+        if(m_can.is_connected()) m_can.shutdown();
+    } //shutdown()
+
+    network::can_socket& get_can_socket()
+    {
+        return m_can;
+    } //get_can_socket()
+
+    /*
+        Adds a drive; filters are re-applied if the socket is open
+    */
+    bool add_drive(uint8_t node_id, servosila_simulated_drive::protocol_version_t protocol_version, bool position_encoder_available, uint16_t initial_position = 0)
+    {
+        bool result = false;
+        if((node_id != 0) && (node_id <= SERVOSILA_CANBUS_MAX_CONTROLLERS) && (m_drives[node_id].get_node_id() == 0))
+        {
+            m_drives[node_id].configure(node_id, protocol_version, position_encoder_available, initial_position);
+            m_node_ids[m_drives_count] = node_id;
+            m_drives_count++;
+            result = m_can.is_connected() ? apply_filters() : true;
+        }
+        return result;
+    } //add_drive()
+
+    /*
+        Removes all the drives
+    */
+    void clear()
+    {
+        for(size_t d=0; d<m_drives_count; d++) m_drives[m_node_ids[d]] = servosila_simulated_drive();
+        m_drives_count = 0;
+        m_previous_tick_time = 0;
+    } //clear()
+
+    size_t get_drives_count() const
+    {
+        return m_drives_count;
+    } //get_drives_count()
+
+    servosila_simulated_drive& get_drive(uint8_t node_id)
+    {
+        assert((node_id != 0) && (node_id <= SERVOSILA_CANBUS_MAX_CONTROLLERS));
+        return m_drives[node_id];
+    } //get_drive()
+
+    /*
+        TPDO rate of a channel; channel_index 0..3 = TPDO1..TPDO4, 0Hz disables the channel
+    */
+    void set_tpdo_rate(size_t channel_index, size_t rate_hz)
+    {
+        assert(channel_index < SERVOSILA_DRIVE_TPDO_CHANNELS_COUNT);
+        m_tpdo_periods[channel_index]   = (rate_hz > 0) ? (control::NSEC_PER_SEC / rate_hz) : 0;
+        m_tpdo_deadlines[channel_index] = 0;
+        m_is_tpdo_every_tick[channel_index] = false;
+    } //set_tpdo_rate()
+
+    /*
+        TPDOs of a channel on every execute() - the rate follows the caller's tick, e.g. a benchmark loop
+        set_tpdo_rate() goes back to the rate.
+    */
+    void set_tpdo_every_tick(size_t channel_index)
+    {
+        assert(channel_index < SERVOSILA_DRIVE_TPDO_CHANNELS_COUNT);
+        m_is_tpdo_every_tick[channel_index] = true;
+    } //set_tpdo_every_tick()
+
+    /*
+        Synchronous TPDOs of a channel (CiA 301 transmission type 1..240) - sent on every sync_divider-th SYNC
+        instead of at the rate, like the drives configured with servosila_motor_controller::configure_synchronous_pdos()
+        0 - back to the rate
+    */
+    void set_tpdo_sync_divider(size_t channel_index, size_t sync_divider)
+    {
+        assert(channel_index < SERVOSILA_DRIVE_TPDO_CHANNELS_COUNT);
+        assert(sync_divider <= network::canopen::PDO_TRANSMISSION_TYPE_SYNCHRONOUS_MAX);
+        m_tpdo_sync_dividers[channel_index] = sync_divider;
+    } //set_tpdo_sync_divider()
+
+    /*
+        Heartbeat period of all the drives (as in object 0x1017), 0 disables the heartbeats
+    */
+    void set_heartbeat_period(uint16_t heartbeat_period_msec)
+    {
+        m_heartbeat_period   = control::nsec_t(heartbeat_period_msec) * 1000 * control::NSEC_PER_USEC;
+        m_heartbeat_deadline = 0;
+    } //set_heartbeat_period()
+
+    const statistics_t& get_statistics() const
+    {
+        return m_statistics;
+    } //get_statistics()
+
+    /*
+        Simulates the CAN FD firmware - call after startup()
+        - combined command frames (see add_combined_rpdo_slot()) are parsed along with the classic RPDOs
+        - is_combined_tpdo: the 2.0 protocol drives send TPDO1-TPDO4 in one FD frame at the TPDO1 rate (or on its SYNC),
+          the TPDO2-TPDO4 schedules apply to the legacy drives only
+    */
+    bool set_fd_mode(bool is_enabled = true, bool is_combined_tpdo = false)
+    {
+        const bool result = m_can.set_fd_mode(is_enabled) && apply_filters();
+        m_is_combined_tpdo = result && is_enabled && is_combined_tpdo;
+        return result;
+    } //set_fd_mode()
+
+    /*
+        Passes only SYNC, NMT and the RPDOs of the simulated drives (and the combined commands in the CAN FD mode)
+    */
+    bool apply_filters()
+    {
+        const uint16_t rpdo_channels[] = { RPDO_SERVOSILA_CHANNEL_FOR_MOTOR_CONTROL, RPDO_SERVOSILA_CHANNEL_FOR_LEGACY_SPEED_CONTROL };
+        can_filter filters[512];
+        size_t filters_count = network::canopen::build_receive_filters(m_node_ids, m_drives_count, rpdo_channels, 2, filters, sizeof(filters)/sizeof(filters[0]) - 3);
+        if(filters_count > 0)
+        {   //SYNC and NMT, the combined commands come on the RPDO COB ID of Node ID 0
+            const uint16_t broadcast_channels[] = { network::canopen::PREDEFINED_SYNC_CHANNEL, network::canopen::PREDEFINED_NMT_CHANNEL, RPDO_SERVOSILA_CHANNEL_FOR_MOTOR_CONTROL };
+            const size_t broadcast_channels_count = m_can.is_fd_enabled() ? 3 : 2;
+            for(size_t i=0; (i<broadcast_channels_count) && (filters_count<sizeof(filters)/sizeof(filters[0])); i++)
+            {
+                filters[filters_count].can_id   = broadcast_channels[i];
+                filters[filters_count].can_mask = CAN_SFF_MASK | CAN_EFF_FLAG | CAN_RTR_FLAG;
+                filters_count++;
+            }
+        }
+        return ((filters_count > 0) || (m_drives_count == 0)) && m_can.set_filters(filters, filters_count);
+    } //apply_filters()
+
+    /*
+        One tick: receive the RPDOs, advance the models, send the heartbeats, EMCYs and TPDOs that are due
+        Returns the number of frames sent.
+    */
+    size_t execute(control::nsec_t now = control::get_now_nsec())
+    {
+        size_t frames_sent = _receive_rpdos();
+        //advancing the models
+        if(m_previous_tick_time != 0)
+        {
+            const double dt = double(now - m_previous_tick_time) / double(control::NSEC_PER_SEC);
+            for(size_t d=0; d<m_drives_count; d++) m_drives[m_node_ids[d]].step(dt);
+        }
+        m_previous_tick_time = now;
+        //boot-up messages, heartbeats and EMCYs
+        frames_sent += _send_heartbeats(now);
+        frames_sent += _send_emcys();
+        //TPDOs
+        for(size_t c=0; c<SERVOSILA_DRIVE_TPDO_CHANNELS_COUNT; c++)
+        {
+            if((m_tpdo_sync_dividers[c] == 0) && m_is_tpdo_every_tick[c])
+            {
+                frames_sent += _send_tpdos(c);
+            }
+            else if((m_tpdo_sync_dividers[c] == 0) && (m_tpdo_periods[c] > 0) && (now >= m_tpdo_deadlines[c]))
+            {
+                frames_sent += _send_tpdos(c);
+                //drift-free, missed periods are skipped
+                m_tpdo_deadlines[c] = (m_tpdo_deadlines[c] == 0) ? now : m_tpdo_deadlines[c];
+                while(m_tpdo_deadlines[c] <= now) m_tpdo_deadlines[c] += m_tpdo_periods[c];
+            }
+        }
+        m_statistics.ticks_count++;
+        return frames_sent;
+    } //execute()
+
+    /*
+        Runs execute() every tick_period_nsec until is_running becomes false (e.g. from a signal handler)
+    */
+    void run(const volatile bool& is_running, control::nsec_t tick_period_nsec = control::NSEC_PER_SEC / 4000)
+    {
+        control::periodic_scheduler scheduler(tick_period_nsec);
+        while(is_running && m_can.is_connected())
+        {
+            execute();
+            scheduler.wait_next_period();
+        }
+    } //run()
+
+private:
+    //helper function - returns the number of synchronous TPDO frames sent
+    size_t _receive_rpdos()
+    {
+        if(m_can.is_fd_enabled()) return _receive_rpdos_fd();
+        size_t tpdo_frames_sent = 0;
+        can_frame frames[network::CAN_SOCKET_MAX_BATCH_SIZE];
+        size_t frames_received = 0;
+        bool never_block = false; //blocking sockets: waiting for the first batch only
+        do
+        {
+            frames_received = m_can.receive_batch(frames, network::CAN_SOCKET_MAX_BATCH_SIZE, nullptr, never_block);
+            for(size_t i=0; i<frames_received; i++)
+            {
+                tpdo_frames_sent += _process_frame(frames[i].can_id, frames[i].data, frames[i].can_dlc);
+            }
+            never_block = true;
+        }
+        while(m_can.get_last_receive_count() == network::CAN_SOCKET_MAX_BATCH_SIZE);
+        return tpdo_frames_sent;
+    } //_receive_rpdos()
+
+    //helper function - _receive_rpdos() in the CAN FD mode
+    size_t _receive_rpdos_fd()
+    {
+        size_t tpdo_frames_sent = 0;
+        canfd_frame frames[network::CAN_SOCKET_MAX_BATCH_SIZE];
+        size_t frames_received = 0;
+        bool never_block = false; //blocking sockets: waiting for the first batch only
+        do
+        {
+            frames_received = m_can.receive_batch_fd(frames, network::CAN_SOCKET_MAX_BATCH_SIZE, nullptr, never_block);
+            for(size_t i=0; i<frames_received; i++)
+            {
+                tpdo_frames_sent += _process_frame(frames[i].can_id, frames[i].data, frames[i].len);
+            }
+            never_block = true;
+        }
+        while(m_can.get_last_receive_count() == network::CAN_SOCKET_MAX_BATCH_SIZE);
+        return tpdo_frames_sent;
+    } //_receive_rpdos_fd()
+
+    //helper function - SYNC, NMT, an RPDO or a combined command frame; returns the number of synchronous TPDO frames sent
+    size_t _process_frame(canid_t can_id, const uint8_t* payload, uint8_t payload_size)
+    {
+        size_t tpdo_frames_sent = 0;
+        //only standard data frames carry commands
+        if((can_id & ~CAN_SFF_MASK) != 0) return 0;
+        if(can_id == network::canopen::PREDEFINED_SYNC_CHANNEL)
+        {   //sampling the synchronous TPDOs - the commands following this SYNC are not applied yet
+            m_statistics.sync_frames_count++;
+            tpdo_frames_sent += _process_sync();
+        }
+        else if((can_id == network::canopen::PREDEFINED_NMT_CHANNEL) && (payload_size >= 2))
+        {
+            m_statistics.nmt_frames_count++;
+            _process_nmt_command(payload[0], payload[1]);
+        }
+        else if(can_id == RPDO_SERVOSILA_CHANNEL_FOR_MOTOR_CONTROL)
+        {   //combined commands - a slot per drive, a zero Node ID ends the slots
+            m_statistics.combined_rpdo_frames_count++;
+            for(size_t offset=0; offset + SERVOSILA_COMBINED_RPDO_SLOT_SIZE <= payload_size; offset += SERVOSILA_COMBINED_RPDO_SLOT_SIZE)
+            {
+                const uint8_t node_id = payload[offset];
+                if(node_id == 0) break;
+                if((node_id > SERVOSILA_CANBUS_MAX_CONTROLLERS) || (m_drives[node_id].get_node_id() == 0)) continue;
+                if(m_drives[node_id].process_rpdo(RPDO_SERVOSILA_CHANNEL_FOR_MOTOR_CONTROL, &(payload[offset+1]), network::canopen::PDO_PAYLOAD_SIZE)) m_statistics.rpdo_frames_count++;
+            }
+        }
+        else
+        {
+            const uint8_t node_id = network::canopen::extract_node_id_from_cob_id(can_id);
+            const uint16_t function_code = network::canopen::extract_function_code_from_cob_id(can_id);
+            if((m_drives[node_id].get_node_id() != 0) && m_drives[node_id].process_rpdo(function_code, payload, payload_size)) m_statistics.rpdo_frames_count++;
+        }
+        return tpdo_frames_sent;
+    } //_process_frame()
+
+    //helper function - the synchronous TPDOs due on this SYNC
+    size_t _process_sync()
+    {
+        size_t frames_sent = 0;
+        for(size_t c=0; c<SERVOSILA_DRIVE_TPDO_CHANNELS_COUNT; c++)
+        {
+            if((m_tpdo_sync_dividers[c] > 0) && ((m_statistics.sync_frames_count % m_tpdo_sync_dividers[c]) == 0))
+            {
+                frames_sent += _send_tpdos(c);
+            }
+        }
+        return frames_sent;
+    } //_process_sync()
+
+    //helper function
+    void _process_nmt_command(uint8_t command, uint8_t node_id)
+    {
+        if(node_id == network::canopen::NMT_ALL_NODES)
+        {
+            for(size_t d=0; d<m_drives_count; d++) m_drives[m_node_ids[d]].process_nmt_command(command);
+        }
+        else if((node_id <= SERVOSILA_CANBUS_MAX_CONTROLLERS) && (m_drives[node_id].get_node_id() != 0))
+        {
+            m_drives[node_id].process_nmt_command(command);
+        }
+    } //_process_nmt_command()
+
+    //helper function - pending boot-up messages, then the heartbeats of all the drives if due
+    size_t _send_heartbeats(control::nsec_t now)
+    {
+        size_t frames_sent = 0;
+        can_frame frames[SERVOSILA_CANBUS_MAX_CONTROLLERS];
+        size_t frames_count = 0;
+        for(size_t d=0; d<m_drives_count; d++)
+        {
+            if(m_drives[m_node_ids[d]].build_bootup(frames[frames_count])) frames_count++;
+        }
+        if((m_heartbeat_period > 0) && (now >= m_heartbeat_deadline))
+        {   //boot-up messages go first
+            frames_sent += m_can.send_batch(frames, frames_count);
+            frames_count = 0;
+            for(size_t d=0; d<m_drives_count; d++) m_drives[m_node_ids[d]].build_heartbeat(frames[frames_count++]);
+            //drift-free, missed periods are skipped
+            m_heartbeat_deadline = (m_heartbeat_deadline == 0) ? now : m_heartbeat_deadline;
+            while(m_heartbeat_deadline <= now) m_heartbeat_deadline += m_heartbeat_period;
+        }
+        if(frames_count > 0) frames_sent += m_can.send_batch(frames, frames_count);
+        m_statistics.heartbeat_frames_count += frames_sent;
+        return frames_sent;
+    } //_send_heartbeats()
+
+    //helper function - pending EMCYs of all the drives
+    size_t _send_emcys()
+    {
+        can_frame frames[SERVOSILA_CANBUS_MAX_CONTROLLERS];
+        size_t frames_count = 0;
+        for(size_t d=0; d<m_drives_count; d++)
+        {
+            if(m_drives[m_node_ids[d]].build_emcy(frames[frames_count])) frames_count++;
+        }
+        const size_t frames_sent = (frames_count > 0) ? m_can.send_batch(frames, frames_count) : 0;
+        m_statistics.emcy_frames_count += frames_sent;
+        return frames_sent;
+    } //_send_emcys()
+
+    //helper function - one TPDO of every OPERATIONAL drive, sent in batches
+    size_t _send_tpdos(size_t channel_index)
+    {
+        if(m_is_combined_tpdo) return _send_combined_tpdos(channel_index);
+        size_t frames_sent = 0;
+        can_frame frames[network::CAN_SOCKET_MAX_BATCH_SIZE];
+        size_t frames_count = 0;
+        for(size_t d=0; d<m_drives_count; d++)
+        {
+            const servosila_simulated_drive& drive = m_drives[m_node_ids[d]];
+            if(drive.is_operational())
+            {
+                drive.build_tpdo(channel_index, frames[frames_count]);
+                frames_count++;
+            }
+            if((frames_count == network::CAN_SOCKET_MAX_BATCH_SIZE) || ((d+1 == m_drives_count) && (frames_count > 0)))
+            {
+                const size_t chunk_sent = m_can.send_batch(frames, frames_count);
+                frames_sent += chunk_sent;
+                m_statistics.tpdo_send_failures += frames_count - chunk_sent;
+                frames_count = 0;
+            }
+        }
+        m_statistics.tpdo_frames_count += frames_sent;
+        return frames_sent;
+    } //_send_tpdos()
+
+    //helper function - _send_tpdos() with the combined telemetry: TPDO1 slot only for the 2.0 protocol drives
+    size_t _send_combined_tpdos(size_t channel_index)
+    {
+        size_t frames_sent = 0;
+        canfd_frame frames[network::CAN_SOCKET_MAX_BATCH_SIZE];
+        size_t frames_count = 0;
+        for(size_t d=0; d<m_drives_count; d++)
+        {
+            const servosila_simulated_drive& drive = m_drives[m_node_ids[d]];
+            if(drive.is_operational())
+            {
+                if(drive.get_protocol_version() != servosila_simulated_drive::protocol_version_t::PROTOCOL_VERSION_2_0)
+                {   //legacy drives - classic frames
+                    can_frame frame;
+                    drive.build_tpdo(channel_index, frame);
+                    network::copy_to_canfd_frame(frame, frames[frames_count]);
+                    frames_count++;
+                }
+                else if(channel_index == 0)
+                {
+                    drive.build_combined_tpdo(frames[frames_count]);
+                    frames_count++;
+                }
+            }
+            if((frames_count == network::CAN_SOCKET_MAX_BATCH_SIZE) || ((d+1 == m_drives_count) && (frames_count > 0)))
+            {
+                const size_t chunk_sent = m_can.send_batch_fd(frames, frames_count);
+                frames_sent += chunk_sent;
+                m_statistics.tpdo_send_failures += frames_count - chunk_sent;
+                frames_count = 0;
+            }
+        }
+        m_statistics.tpdo_frames_count += frames_sent;
+        return frames_sent;
+    } //_send_combined_tpdos()
+
+}; //class servosila_drive_simulator
+
+} //namespace devices
+
+#endif // DEVICES_SERVOSILA_DRIVE_SIMULATOR_H_INCLUDED
@@ -0,0 +1,268 @@
+#ifndef DEVICES_SERVOSILA_EVENT_LOOP_H_INCLUDED
+#define DEVICES_SERVOSILA_EVENT_LOOP_H_INCLUDED
+
+#include "control/eventloop.h"
+#include "devices/servosila-motor-controller.h"
+#include "devices/servosila-canbus-dispatcher.h"
+
+namespace devices
+{
+
+/*
+    Event-driven execution of the motor controllers on a bus
+    - the CANbus socket and per-controller RPDO and healthcheck timerfds are multiplexed with epoll
+    - the process sleeps until either a frame arrives or an RPDO/healthcheck deadline fires,
+      instead of spinning over execute() and a non-blocking socket
+    - the healthcheck timer is one-shot at the last telemetry plus the timeout, a lost drive is detected on time
+    NOTE: the dispatcher's socket must be opened in non-blocking mode
+*/
+class servosila_event_loop
+{
+private:
+    //CANbus socket readiness -> receive and route the frames
+    class canbus_handler : public control::event_handler
+    {
+    private:
+        servosila_canbus_dispatcher* m_dispatcher;
+    public:
+        canbus_handler() : m_dispatcher(nullptr)
+        {
+        }
+        void set_dispatcher(servosila_canbus_dispatcher* dispatcher)
+        {
+            m_dispatcher = dispatcher;
+        }
+        virtual void handle_event(uint32_t /*events*/)
+        {
+            m_dispatcher->receive_and_dispatch();
+        }
+    }; //class canbus_handler
+
+    //SYNC deadline -> SYNC and the RPDOs of all the controllers
+    class sync_handler : public control::event_handler
+    {
+    public:
+        servosila_canbus_dispatcher* m_dispatcher;
+        control::periodic_timerfd    m_timer;
+    public:
+        sync_handler() : m_dispatcher(nullptr)
+        {
+        }
+        virtual void handle_event(uint32_t /*events*/)
+        {
+            if(m_timer.acknowledge() > 0)
+            {
+                m_dispatcher->execute_sync();
+            }
+        }
+    }; //class sync_handler
+
+    //per-controller timers
+    class controller_timers_handler
+    {
+    public:
+        //RPDO deadline -> send an RPDO
+        class rpdo_handler : public control::event_handler
+        {
+        public:
+            controller_timers_handler* m_owner;
+            virtual void handle_event(uint32_t /*events*/)
+            {
+                if(m_owner->m_rpdo_timer.acknowledge() > 0)
+                {
+                    m_owner->m_controller->execute_rpdo(*(m_owner->m_can));
+                }
+            }
+        };
+        //healthcheck deadline -> check telemetry and heartbeat timeouts and the bus connection, then the next deadline
+        class healthcheck_handler : public control::event_handler
+        {
+        public:
+            controller_timers_handler* m_owner;
+            virtual void handle_event(uint32_t /*events*/)
+            {
+                if(m_owner->m_healthcheck_timer.acknowledge() > 0)
+                {
+                    m_owner->m_controller->execute_healthcheck(*(m_owner->m_can));
+                    m_owner->start_healthcheck_timer();
+                }
+            }
+        };
+    public:
+        servosila_motor_controller* m_controller;
+        network::can_socket*        m_can;
+        control::periodic_timerfd   m_rpdo_timer;
+        control::periodic_timerfd   m_healthcheck_timer;
+        rpdo_handler                m_rpdo_handler;
+        healthcheck_handler         m_healthcheck_handler;
+    public:
+        controller_timers_handler()
+            :   m_controller(nullptr),
+                m_can(nullptr)
+        {
+            m_rpdo_handler.m_owner = this;
+            m_healthcheck_handler.m_owner = this;
+        }
+        /*
+            One-shot at the controller's healthcheck deadline - the last telemetry (or heartbeat) plus the timeout
+            - the telemetry moves the deadline on; the timer follows it when it fires early, so a TPDO costs no timerfd_settime()
+            - nothing to time out: the bus connection is checked every healthcheck period
+        */
+        bool start_healthcheck_timer()
+        {
+            const control::nsec_t now = control::get_now_nsec();
+            control::nsec_t deadline = m_controller->get_healthcheck_deadline();
+            if(deadline != 0) deadline += control::NSEC_PER_USEC; //the controller's timers expire right after the set time
+            if(deadline <= now) deadline = now + control::nsec_t(m_controller->get_healthcheck_period())*control::NSEC_PER_USEC;
+            return m_healthcheck_timer.start_once_at(deadline);
+        }
+    }; //class controller_timers_handler
+
+private:
+    control::event_loop          m_loop;
+    servosila_canbus_dispatcher& m_dispatcher;
+    canbus_handler               m_canbus_handler;
+    sync_handler                 m_sync_handler;
+    controller_timers_handler    m_timers[SERVOSILA_CANBUS_MAX_CONTROLLERS];
+    size_t                       m_timers_count;
+
+public:
+    servosila_event_loop(servosila_canbus_dispatcher& dispatcher)
+        :   m_loop(),
+            m_dispatcher(dispatcher),
+            m_canbus_handler(),
+            m_sync_handler(),
+            m_timers_count(0)
+    {
+        m_canbus_handler.set_dispatcher(&m_dispatcher);
+        m_sync_handler.m_dispatcher = &m_dispatcher;
+    } //servosila_event_loop()
+
+    /*
+        Creates the epoll instance and starts watching the dispatcher's socket
+        The dispatcher shall be started up already.
+    */
+    bool startup()
+    {
+        bool result = false;
+        network::can_socket& can = m_dispatcher.get_can_socket();
+        if(can.is_connected() && m_loop.startup())
+        {
+            result = m_loop.add(can.get_fd(), &m_canbus_handler);
+        }
+        return result;
+    } //startup()
+
+    void shutdown()
+    {
+        for(size_t i=0; i<m_timers_count; i++)
+        {
+            m_timers[i].m_rpdo_timer.shutdown();
+            m_timers[i].m_healthcheck_timer.shutdown();
+        }
+        m_timers_count = 0;
+        if(m_sync_handler.m_timer.get_fd() != -1) m_sync_handler.m_timer.shutdown();
+        m_loop.shutdown();
+    } //shutdown()
+
+    /*
+        Registers a configured controller with the dispatcher and turns its RPDO and healthcheck
+        deadlines into epoll timers; the timeouts are taken from the controller's configure() and configure_heartbeat().
+        The timers are set up first - the controller reaches the dispatcher only once it is going to be driven.
+    */
+    bool register_controller(servosila_motor_controller& controller)
+    {
+        bool result = false;
+        if(m_timers_count < SERVOSILA_CANBUS_MAX_CONTROLLERS)
+        {
+            controller_timers_handler& timers = m_timers[m_timers_count];
+            timers.m_controller = &controller;
+            timers.m_can        = &(m_dispatcher.get_can_socket());
+            //timers
+            result =    timers.m_rpdo_timer.startup()
+                     && timers.m_healthcheck_timer.startup()
+                     && timers.m_rpdo_timer.start(controller.get_rpdo_timeout()*control::NSEC_PER_USEC)
+                     && timers.start_healthcheck_timer()
+                     && m_loop.add(timers.m_rpdo_timer.get_fd(), &(timers.m_rpdo_handler))
+                     && m_loop.add(timers.m_healthcheck_timer.get_fd(), &(timers.m_healthcheck_handler));
+            //the dispatcher last - it has no way back (e.g. a duplicate Node ID)
+            result = result && m_dispatcher.register_controller(controller);
+            if(result)
+            {
+                m_timers_count++;
+                //updating the kernel-side filters
+                if(m_dispatcher.get_can_socket().is_connected()) m_dispatcher.apply_filters();
+            }
+            else
+            {   //rolling back the timers
+                if(timers.m_rpdo_timer.get_fd() != -1)
+                {
+                    m_loop.remove(timers.m_rpdo_timer.get_fd()); //fails harmlessly if not added
+                    timers.m_rpdo_timer.shutdown();
+                }
+                if(timers.m_healthcheck_timer.get_fd() != -1)
+                {
+                    m_loop.remove(timers.m_healthcheck_timer.get_fd());
+                    timers.m_healthcheck_timer.shutdown();
+                }
+            }
+        }
+        return result;
+    } //register_controller()
+
+    /*
+        Turns the dispatcher's SYNC producer on (see servosila_canbus_dispatcher::set_sync_period()),
+        SYNC deadlines become an epoll timer; the controllers' RPDO timers keep firing, but send nothing.
+        period 0 turns it off.
+    */
+    bool set_sync_period(control::usec_t period, uint8_t sync_counter_overflow = 0)
+    {
+        bool result = true;
+        m_dispatcher.set_sync_period(period, sync_counter_overflow);
+        control::periodic_timerfd& timer = m_sync_handler.m_timer;
+        if(period > 0)
+        {
+            if(timer.get_fd() == -1)
+            {
+                result = timer.startup() && m_loop.add(timer.get_fd(), &m_sync_handler);
+            }
+            result = result && timer.start(period*control::NSEC_PER_USEC);
+        }
+        else if(timer.get_fd() != -1)
+        {
+            result = timer.stop();
+        }
+        return result;
+    } //set_sync_period()
+
+    /*
+        Handles the events that are ready, sleeping up to timeout_msec (-1 = forever)
+    */
+    int run_once(int timeout_msec = -1)
+    {
+        return m_loop.run_once(timeout_msec);
+    } //run_once()
+
+    /*
+        Runs until stop() is called
+    */
+    void run()
+    {
+        m_loop.run();
+    } //run()
+
+    void stop()
+    {
+        m_loop.stop();
+    } //stop()
+
+    control::event_loop& get_event_loop()
+    {
+        return m_loop;
+    } //get_event_loop()
+
+}; //class servosila_event_loop
+
+} //namespace devices
+
+#endif // DEVICES_SERVOSILA_EVENT_LOOP_H_INCLUDED
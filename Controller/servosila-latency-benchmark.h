@@ -0,0 +1,378 @@
+#ifndef DEVICES_SERVOSILA_LATENCY_BENCHMARK_H_INCLUDED
+#define DEVICES_SERVOSILA_LATENCY_BENCHMARK_H_INCLUDED
+
+/*
+End-to-end latency benchmarks of the CAN stack over a virtual CANbus (see cansocket.h for the vcan0 setup)
+    - command:   set_speed_command() -> the RPDO hits the bus (kernel timestamp of a listening socket)
+    - telemetry: a TPDO1 hits the bus -> process_tpdo1() has updated the telemetry
+    - roundtrip: set_speed_command() -> a simulated drive receives the RPDO and answers -> the telemetry
+                 shows the commanded speed; a motor not answered within the period is a timeout, recorded
+                 at the time waited (a lower bound of its latency) so that the percentiles do not hide it
+Everything runs in a single thread, so the numbers show the cost of the stack rather than of the scheduler.
+The drives are simulated with servosila_drive_simulator on the same interface.
+
+Usage:
+    devices::benchmark::run_latency_benchmarks("vcan0");
+*/
+
+#include <stdio.h>      /* printf() */
+#include <algorithm>    /* std::sort() */
+#include "control/timer.h"
+#include "network/cansocket.h"
+#include "network/canopen.h"
+#include "devices/servosila-motor-controller.h"
+#include "devices/servosila-canbus-dispatcher.h"
+#include "devices/servosila-drive-simulator.h"
+
+namespace devices
+{
+
+namespace benchmark
+{
+
+//maximum number of latency samples kept per benchmark run
+const size_t LATENCY_BENCHMARK_MAX_SAMPLES = 1000000;
+
+struct latency_statistics_t
+{
+    size_t          samples_count;  //timeouts included
+    size_t          timeouts_count;
+    control::nsec_t p50;
+    control::nsec_t p99;
+    control::nsec_t p999;
+    control::nsec_t max;
+};
+
+/*
+    Collects latency samples into a preallocated array; percentiles are computed once at the end
+    NOTE: the object is large, allocate it statically or on the heap
+*/
+class latency_recorder
+{
+private:
+    control::nsec_t m_samples[LATENCY_BENCHMARK_MAX_SAMPLES];
+    size_t          m_samples_count;
+    size_t          m_timeouts_count;
+public:
+    latency_recorder() : m_samples_count(0), m_timeouts_count(0)
+    {
+    }
+
+    void clear()
+    {
+        m_samples_count  = 0;
+        m_timeouts_count = 0;
+    } //clear()
+
+    void add(control::nsec_t latency)
+    {
+        if(m_samples_count < LATENCY_BENCHMARK_MAX_SAMPLES)
+        {
+            m_samples[m_samples_count] = latency;
+            m_samples_count++;
+        }
+    } //add()
+
+    /*
+        No answer - recorded at the time waited, a lower bound of the latency
+    */
+    void add_timeout(control::nsec_t waited)
+    {
+        m_timeouts_count++;
+        add(waited);
+    } //add_timeout()
+
+    /*
+        Sorts the samples and computes the percentiles
+    */
+    latency_statistics_t compute_statistics()
+    {
+        latency_statistics_t result;
+        memset(&result, 0, sizeof(result));
+        result.samples_count  = m_samples_count;
+        result.timeouts_count = m_timeouts_count;
+        if(m_samples_count > 0)
+        {
+            std::sort(m_samples, m_samples + m_samples_count);
+            result.p50  = _get_percentile(500);
+            result.p99  = _get_percentile(990);
+            result.p999 = _get_percentile(999);
+            result.max  = m_samples[m_samples_count-1];
+        }
+        return result;
+    } //compute_statistics()
+
+private:
+    //helper function - per mille, nearest rank on the sorted samples
+    control::nsec_t _get_percentile(size_t per_mille) const
+    {
+        size_t rank = (m_samples_count*per_mille + 999) / 1000;
+        if(rank == 0) rank = 1;
+        return m_samples[rank-1];
+    } //_get_percentile()
+
+}; //class latency_recorder
+
+//the benchmarks share the controllers, the sockets and the drives - allocated once
+struct latency_benchmark_fixture_t
+{
+    servosila_motor_controller  controllers[SERVOSILA_CANBUS_MAX_CONTROLLERS];
+    servosila_canbus_dispatcher dispatcher;
+    servosila_drive_simulator   simulator;
+    network::can_socket         listener;
+    latency_recorder            recorder;
+    control::nsec_t             command_times[SERVOSILA_CANBUS_MAX_CONTROLLERS+1]; //indexed by Node ID
+};
+
+inline latency_benchmark_fixture_t& get_latency_benchmark_fixture()
+{
+    static latency_benchmark_fixture_t fixture;
+    return fixture;
+} //get_latency_benchmark_fixture()
+
+/*
+    Opens the controllers' socket (and the simulated drives' one if with_simulator) on the interface
+*/
+inline bool _setup_latency_benchmark(const char* can_interface_name, size_t motors_count, bool with_simulator)
+{
+    assert((motors_count > 0) && (motors_count <= SERVOSILA_CANBUS_MAX_CONTROLLERS));
+    latency_benchmark_fixture_t& f = get_latency_benchmark_fixture();
+    f.dispatcher.shutdown();
+    f.dispatcher.clear();
+    f.simulator.shutdown();
+    f.simulator.clear();
+    f.recorder.clear();
+    for(size_t n=0; n<motors_count; n++)
+    {
+        const uint8_t node_id = n + 1;
+        f.controllers[n].configure(node_id, servosila_motor_controller::protocol_version_t::PROTOCOL_VERSION_2_0, true, 1000, 1000000, 0, 65535, -32768, 32767, -32768, 32767);
+        f.dispatcher.register_controller(f.controllers[n]);
+    }
+    bool result = f.dispatcher.startup(can_interface_name, true);
+    if(result && with_simulator)
+    {
+        result = f.simulator.startup(can_interface_name);
+        //the drives answer instantly - the model does not add to the measured latency
+        servosila_simulated_drive::model_t model;
+        model.speed_time_constant   = 1e-9;
+        model.position_gain         = 10.0;
+        model.speed_per_amp         = 100.0;
+        model.amps_per_acceleration = 0.0;
+        model.max_speed             = 32767.0;
+        for(size_t n=0; result && (n<motors_count); n++)
+        {
+            const uint8_t node_id = n + 1;
+            result = f.simulator.add_drive(node_id, servosila_simulated_drive::protocol_version_t::PROTOCOL_VERSION_2_0, true);
+            f.simulator.get_drive(node_id).set_model(model);
+        }
+    }
+    return result;
+} //_setup_latency_benchmark()
+
+/*
+    set_speed_command() -> RPDO on the bus, measured with the kernel timestamps of a listening socket
+    Every period, each of the motors sends one RPDO.
+*/
+inline latency_statistics_t benchmark_command_latency(const char* can_interface_name, size_t motors_count, size_t rate_hz, size_t periods_count = 1000)
+{
+    latency_benchmark_fixture_t& f = get_latency_benchmark_fixture();
+    latency_statistics_t result;
+    memset(&result, 0, sizeof(result));
+    if(_setup_latency_benchmark(can_interface_name, motors_count, false))
+    {
+        network::can_socket& can = f.dispatcher.get_can_socket();
+        //the listener - RPDOs of the motors only
+        if(f.listener.is_connected()) f.listener.shutdown();
+        bool is_ready = f.listener.startup(can_interface_name, true);
+        if(is_ready)
+        {
+            uint8_t node_ids[SERVOSILA_CANBUS_MAX_CONTROLLERS];
+            for(size_t n=0; n<motors_count; n++) node_ids[n] = n + 1;
+            const uint16_t channels[] = { RPDO_SERVOSILA_CHANNEL_FOR_MOTOR_CONTROL };
+            can_filter filters[256];
+            const size_t filters_count = network::canopen::build_receive_filters(node_ids, motors_count, channels, 1, filters, sizeof(filters)/sizeof(filters[0]));
+            is_ready = f.listener.set_filters(filters, filters_count);
+        }
+        //telemetry is coming - otherwise no RPDOs are sent
+        const uint8_t tpdo1[8] = {0,0,0,0,0,0,0,0};
+        for(size_t n=0; n<motors_count; n++) f.controllers[n].process_tpdo1(can, tpdo1, sizeof(tpdo1), 0);
+        //measuring
+        control::periodic_scheduler scheduler(control::NSEC_PER_SEC / rate_hz);
+        can_frame frames[network::CAN_SOCKET_MAX_BATCH_SIZE];
+        control::nsec_t timestamps[network::CAN_SOCKET_MAX_BATCH_SIZE];
+        for(size_t p=0; is_ready && (p<periods_count); p++)
+        {
+            const int16_t speed = (p & 1) ? 100 : -100;
+            for(size_t n=0; n<motors_count; n++)
+            {
+                f.command_times[n+1] = control::get_now_nsec();
+                f.controllers[n].set_speed_command(speed);
+                f.controllers[n].execute_rpdo(can);
+            }
+            //collecting the RPDOs
+            size_t frames_received = 0;
+            bool never_block = false; //blocking sockets: waiting for the first batch only
+            do
+            {
+                frames_received = f.listener.receive_batch(frames, network::CAN_SOCKET_MAX_BATCH_SIZE, timestamps, never_block);
+                for(size_t i=0; i<frames_received; i++)
+                {
+                    const uint8_t node_id = network::canopen::extract_node_id_from_cob_id(frames[i].can_id);
+                    if((timestamps[i] != 0) && (timestamps[i] > f.command_times[node_id])) f.recorder.add(timestamps[i] - f.command_times[node_id]);
+                }
+                never_block = true;
+            }
+            while(f.listener.get_last_receive_count() == network::CAN_SOCKET_MAX_BATCH_SIZE);
+            scheduler.wait_next_period();
+        }
+        result = f.recorder.compute_statistics();
+        if(f.listener.is_connected()) f.listener.shutdown();
+    }
+    f.dispatcher.shutdown();
+    return result;
+} //benchmark_command_latency()
+
+/*
+    TPDO1 on the bus (kernel timestamp) -> telemetry updated by process_tpdo1()
+    Every period, each of the simulated drives sends one TPDO1.
+*/
+inline latency_statistics_t benchmark_telemetry_latency(const char* can_interface_name, size_t motors_count, size_t rate_hz, size_t periods_count = 1000)
+{
+    latency_benchmark_fixture_t& f = get_latency_benchmark_fixture();
+    latency_statistics_t result;
+    memset(&result, 0, sizeof(result));
+    if(_setup_latency_benchmark(can_interface_name, motors_count, true))
+    {
+        network::can_socket& can = f.dispatcher.get_can_socket();
+        //TPDO1 only - on every simulator tick
+        f.simulator.set_tpdo_every_tick(0);
+        for(size_t c=1; c<SERVOSILA_DRIVE_TPDO_CHANNELS_COUNT; c++) f.simulator.set_tpdo_rate(c, 0);
+        //measuring
+        control::periodic_scheduler scheduler(control::NSEC_PER_SEC / rate_hz);
+        can_frame frames[network::CAN_SOCKET_MAX_BATCH_SIZE];
+        control::nsec_t timestamps[network::CAN_SOCKET_MAX_BATCH_SIZE];
+        for(size_t p=0; p<periods_count; p++)
+        {
+            f.simulator.execute();
+            //receiving and routing frame by frame - the latency of each frame
+            size_t frames_received = 0;
+            bool never_block = false; //blocking sockets: waiting for the first batch only
+            do
+            {
+                frames_received = can.receive_batch(frames, network::CAN_SOCKET_MAX_BATCH_SIZE, timestamps, never_block);
+                for(size_t i=0; i<frames_received; i++)
+                {
+                    if(f.dispatcher.dispatch(frames[i], timestamps[i]) && (timestamps[i] != 0))
+                    {
+                        const uint8_t node_id = network::canopen::extract_node_id_from_cob_id(frames[i].can_id);
+                        f.recorder.add(control::get_now_nsec() - f.controllers[node_id-1].get_telemetry_timestamp());
+                    }
+                }
+                never_block = true;
+            }
+            while(can.get_last_receive_count() == network::CAN_SOCKET_MAX_BATCH_SIZE);
+            scheduler.wait_next_period();
+        }
+        result = f.recorder.compute_statistics();
+    }
+    f.simulator.shutdown();
+    f.dispatcher.shutdown();
+    return result;
+} //benchmark_telemetry_latency()
+
+/*
+    set_speed_command() -> RPDO -> simulated drive -> TPDO1 -> the telemetry shows the commanded speed
+    Every period, each of the motors is commanded a new speed.
+*/
+inline latency_statistics_t benchmark_roundtrip_latency(const char* can_interface_name, size_t motors_count, size_t rate_hz, size_t periods_count = 1000)
+{
+    latency_benchmark_fixture_t& f = get_latency_benchmark_fixture();
+    latency_statistics_t result;
+    memset(&result, 0, sizeof(result));
+    if(_setup_latency_benchmark(can_interface_name, motors_count, true))
+    {
+        network::can_socket& can = f.dispatcher.get_can_socket();
+        //TPDO1 only - on every simulator tick
+        f.simulator.set_tpdo_every_tick(0);
+        for(size_t c=1; c<SERVOSILA_DRIVE_TPDO_CHANNELS_COUNT; c++) f.simulator.set_tpdo_rate(c, 0);
+        //telemetry is coming - otherwise no RPDOs are sent
+        f.simulator.execute();
+        f.simulator.execute();
+        f.dispatcher.receive_and_dispatch();
+        //measuring
+        control::periodic_scheduler scheduler(control::NSEC_PER_SEC / rate_hz);
+        for(size_t p=0; p<periods_count; p++)
+        {
+            const int16_t speed = (p & 1) ? 100 : -100;
+            for(size_t n=0; n<motors_count; n++)
+            {
+                f.command_times[n+1] = control::get_now_nsec();
+                f.controllers[n].set_speed_command(speed);
+                f.controllers[n].execute_rpdo(can);
+            }
+            //the drives: RPDOs in, TPDO1s out
+            f.simulator.execute();
+            //the controllers: TPDO1s in
+            f.dispatcher.receive_and_dispatch();
+            const control::nsec_t now = control::get_now_nsec();
+            for(size_t n=0; n<motors_count; n++)
+            {   //the next period commands another speed - an answer missing now is a timeout
+                if(f.controllers[n].is_operational() && (f.controllers[n].get_speed_telemetry() == speed))
+                {
+                    f.recorder.add(now - f.command_times[n+1]);
+                }
+                else
+                {
+                    f.recorder.add_timeout(now - f.command_times[n+1]);
+                }
+            }
+            scheduler.wait_next_period();
+        }
+        result = f.recorder.compute_statistics();
+    }
+    f.simulator.shutdown();
+    f.dispatcher.shutdown();
+    return result;
+} //benchmark_roundtrip_latency()
+
+//helper function
+inline void _print_latency_statistics(const char* name, size_t motors_count, size_t rate_hz, const latency_statistics_t& s)
+{
+    printf("%10s %8zu %8zu %10zu %10zu %10.1f %10.1f %10.1f %10.1f\n", name, motors_count, rate_hz, s.samples_count, s.timeouts_count,
+        s.p50/1000.0, s.p99/1000.0, s.p999/1000.0, s.max/1000.0);
+} //_print_latency_statistics()
+
+/*
+    Runs the latency benchmarks for 1, 8, 32 and 127 motors at 1kHz and 4kHz and prints a table (microseconds)
+*/
+inline void run_latency_benchmarks(const char* can_interface_name = "vcan0", size_t periods_count = 1000)
+{
+    const size_t motors_counts[] = {1, 8, 32, 127};
+    const size_t rates_hz[] = {1000, 4000};
+    //checking the interface
+    network::can_socket probe;
+    if(!probe.startup(can_interface_name, true))
+    {
+        printf("%s is not available - the latency benchmarks are skipped (see cansocket.h for the vcan0 setup)\n", can_interface_name);
+        return;
+    }
+    probe.shutdown();
+    printf("%10s %8s %8s %10s %10s %10s %10s %10s %10s\n", "test", "motors", "rate Hz", "samples", "timeouts", "p50 us", "p99 us", "p99.9 us", "max us");
+    for(size_t r=0; r<sizeof(rates_hz)/sizeof(rates_hz[0]); r++)
+    {
+        for(size_t m=0; m<sizeof(motors_counts)/sizeof(motors_counts[0]); m++)
+        {
+            const size_t motors_count = motors_counts[m];
+            const size_t rate_hz = rates_hz[r];
+            _print_latency_statistics("command",   motors_count, rate_hz, benchmark_command_latency(can_interface_name, motors_count, rate_hz, periods_count));
+            _print_latency_statistics("telemetry", motors_count, rate_hz, benchmark_telemetry_latency(can_interface_name, motors_count, rate_hz, periods_count));
+            _print_latency_statistics("roundtrip", motors_count, rate_hz, benchmark_roundtrip_latency(can_interface_name, motors_count, rate_hz, periods_count));
+        }
+    }
+} //run_latency_benchmarks()
+
+} //namespace benchmark
+
+} //namespace devices
+
+#endif // DEVICES_SERVOSILA_LATENCY_BENCHMARK_H_INCLUDED
@@ -3,7 +3,11 @@
 
 #include "network/canopen.h"
 #include "network/cansocket.h"
+#include "network/pdo-layout.h"
+#include "network/heartbeat.h"
 #include "control/timer.h"
+#include "control/trajectory.h"
+#include "ftl/spsc-ring-buffer.h"
 
 namespace devices
 {
@@ -15,9 +19,221 @@ const uint16_t TPDO_SERVOSILA_CHANNEL_FOR_MOTOR_TELEMETRY_1     = 0x180; //prima
 const uint16_t TPDO_SERVOSILA_CHANNEL_FOR_MOTOR_TELEMETRY_2     = 0x280;
 const uint16_t TPDO_SERVOSILA_CHANNEL_FOR_MOTOR_TELEMETRY_3     = 0x380;
 const uint16_t TPDO_SERVOSILA_CHANNEL_FOR_MOTOR_TELEMETRY_4     = 0x480;
+//all the telemetry channels - used for kernel-side receive filters
+const uint16_t TPDO_SERVOSILA_CHANNELS[] = {   TPDO_SERVOSILA_CHANNEL_FOR_MOTOR_TELEMETRY_1,
+                                                TPDO_SERVOSILA_CHANNEL_FOR_MOTOR_TELEMETRY_2,
+                                                TPDO_SERVOSILA_CHANNEL_FOR_MOTOR_TELEMETRY_3,
+                                                TPDO_SERVOSILA_CHANNEL_FOR_MOTOR_TELEMETRY_4 };
+//all the channels received from a drive: telemetry, heartbeat and EMCY
+const uint16_t SERVOSILA_RECEIVE_CHANNELS[] = {TPDO_SERVOSILA_CHANNEL_FOR_MOTOR_TELEMETRY_1,
+                                                TPDO_SERVOSILA_CHANNEL_FOR_MOTOR_TELEMETRY_2,
+                                                TPDO_SERVOSILA_CHANNEL_FOR_MOTOR_TELEMETRY_3,
+                                                TPDO_SERVOSILA_CHANNEL_FOR_MOTOR_TELEMETRY_4,
+                                                network::canopen::PREDEFINED_HEARTBEAT_CHANNEL,
+                                                network::canopen::PREDEFINED_EMCY_CHANNEL };
+//sign bit of the speed commands of the legacy protocol (sign-magnitude, highest bit of byte 1)
+const uint16_t LEGACY_SPEED_SIGN_BIT = 0x8000;
 //mask for extracting "fault present" bit from status word (CANopen protocol only)
 const uint16_t TELEMETRY_STATUS_FAULT_FLAGS_MASK = 0x7F00;
 
+/*
+    CAN FD combined frames - 2.0 protocol drives with CAN FD firmware only (see servosila_canbus_dispatcher::set_fd_mode())
+    - combined telemetry: TPDO1-TPDO4 payloads back to back in one FD frame sent on the TPDO1 COB ID of the drive
+    - combined commands: the RPDOs of up to 7 drives in one FD frame sent on the RPDO COB ID of Node ID 0,
+      a slot per drive: [Node ID][8-byte RPDO payload]
+*/
+const size_t SERVOSILA_COMBINED_TPDO_PAYLOAD_SIZE = 4 * network::canopen::PDO_PAYLOAD_SIZE;
+const size_t SERVOSILA_COMBINED_RPDO_SLOT_SIZE    = 1 + network::canopen::PDO_PAYLOAD_SIZE;
+const size_t SERVOSILA_COMBINED_RPDO_MAX_SLOTS    = CANFD_MAX_DLEN / SERVOSILA_COMBINED_RPDO_SLOT_SIZE;
+
+/*
+    Telemetry values carried by the TPDOs - the record the TPDO layouts map to
+    Extended telemetry (TPDO2-TPDO4) comes with the 2.0 protocol only, at the rates configured in the drive.
+*/
+struct servosila_telemetry_t
+{
+    //primary telemetry - TPDO1
+    uint16_t status;            //2.0 protocol only
+    uint16_t position;
+    int16_t  speed;
+    int16_t  amps;              //2.0 protocol only
+    uint16_t faults;            //fault and status word, legacy protocol only
+    //extended telemetry - TPDO2-TPDO4 of the 2.0 protocol, PLACEHOLDER layouts (see servosila_tpdo_layouts)
+    //...TPDO2
+    uint16_t supply_voltage;            //0.1V units
+    int16_t  motor_temperature;         //Celsius
+    int16_t  controller_temperature;    //Celsius
+    uint16_t error_code;                //latest error, 0 - no error
+    //...TPDO3
+    int32_t  multiturn_position;        //position ticks, not wrapped around
+    uint16_t warnings;                  //warning flags
+    //...TPDO4
+    uint16_t digital_inputs;            //a bit per input
+    uint16_t analog_input;              //raw ADC value
+};
+
+//a field of a TPDO
+template <class datatype, datatype servosila_telemetry_t::* member, size_t offset>
+using servosila_tpdo_field = network::canopen::pdo_mapping<servosila_telemetry_t, datatype, member, offset>;
+
+//a TPDO layout
+template <class... fields>
+using servosila_tpdo_layout = network::canopen::pdo_layout<servosila_telemetry_t, fields...>;
+
+/*
+    TPDO layouts by channel (0..3 = TPDO1..TPDO4) and protocol version
+    The decoders (servosila_motor_controller) and the encoders (servosila_simulated_drive)
+    are generated from these - a new TPDO field is a new servosila_tpdo_field here, nothing else.
+    NOTE: the TPDO2-TPDO4 layouts of the 2.0 protocol are PLACEHOLDERS - they are not taken from the object dictionary
+    of the drives (TPDO mapping parameters 0x1A01-0x1A03). The controller ignores these TPDOs until the mapping of the drive
+    has been checked against them (read 0x1A01-0x1A03 with network::canopen::sdo_client) and
+    servosila_motor_controller::set_extended_telemetry_mapped() has been called.
+*/
+template <size_t channel_index>
+struct servosila_tpdo_layouts
+{   //no telemetry parsed by default
+    typedef servosila_tpdo_layout<> protocol_2_0_t;
+    typedef servosila_tpdo_layout<> legacy_servo_t;     //drives with a position encoder
+    typedef servosila_tpdo_layout<> legacy_chassis_t;   //drives without an encoder
+};
+
+//TPDO1 - primary telemetry
+template <>
+struct servosila_tpdo_layouts<0>
+{
+    typedef servosila_tpdo_layout<
+                servosila_tpdo_field<uint16_t, &servosila_telemetry_t::status,   0>,
+                servosila_tpdo_field<uint16_t, &servosila_telemetry_t::position, 2>,
+                servosila_tpdo_field<int16_t,  &servosila_telemetry_t::speed,    4>,
+                servosila_tpdo_field<int16_t,  &servosila_telemetry_t::amps,     6> > protocol_2_0_t;
+    typedef servosila_tpdo_layout<
+                servosila_tpdo_field<uint16_t, &servosila_telemetry_t::position, 4> > legacy_servo_t;
+    typedef servosila_tpdo_layout<
+                servosila_tpdo_field<int16_t,  &servosila_telemetry_t::speed,    4> > legacy_chassis_t;
+};
+
+//TPDO2 - PLACEHOLDER (2.0, mapping 0x1A01 unverified): supply voltage, temperatures and error code;
+//speed of the legacy servo drives, the speed of the chassis drives comes in TPDO1
+template <>
+struct servosila_tpdo_layouts<1>
+{
+    typedef servosila_tpdo_layout<
+                servosila_tpdo_field<uint16_t, &servosila_telemetry_t::supply_voltage,         0>,
+                servosila_tpdo_field<int16_t,  &servosila_telemetry_t::motor_temperature,      2>,
+                servosila_tpdo_field<int16_t,  &servosila_telemetry_t::controller_temperature, 4>,
+                servosila_tpdo_field<uint16_t, &servosila_telemetry_t::error_code,             6> > protocol_2_0_t;
+    typedef servosila_tpdo_layout<
+                servosila_tpdo_field<int16_t,  &servosila_telemetry_t::speed,    4> > legacy_servo_t;
+    typedef servosila_tpdo_layout<> legacy_chassis_t;
+};
+
+//TPDO3 - PLACEHOLDER (2.0, mapping 0x1A02 unverified): multiturn position and warnings; fault and status word of the legacy drives
+template <>
+struct servosila_tpdo_layouts<2>
+{
+    typedef servosila_tpdo_layout<
+                servosila_tpdo_field<int32_t,  &servosila_telemetry_t::multiturn_position,     0>,
+                servosila_tpdo_field<uint16_t, &servosila_telemetry_t::warnings,               4> > protocol_2_0_t;
+    typedef servosila_tpdo_layout<
+                servosila_tpdo_field<uint16_t, &servosila_telemetry_t::faults,   0> > legacy_servo_t;
+    typedef servosila_tpdo_layout<
+                servosila_tpdo_field<uint16_t, &servosila_telemetry_t::faults,   0> > legacy_chassis_t;
+};
+
+//TPDO4 - PLACEHOLDER (2.0, mapping 0x1A03 unverified): inputs; not sent by the legacy drives
+template <>
+struct servosila_tpdo_layouts<3>
+{
+    typedef servosila_tpdo_layout<
+                servosila_tpdo_field<uint16_t, &servosila_telemetry_t::digital_inputs,         0>,
+                servosila_tpdo_field<uint16_t, &servosila_telemetry_t::analog_input,           2> > protocol_2_0_t;
+    typedef servosila_tpdo_layout<> legacy_servo_t;
+    typedef servosila_tpdo_layout<> legacy_chassis_t;
+};
+
+/*
+    Protocol policies - what differs between the protocols on the per-frame paths
+    servosila_typed_motor_controller takes one as a template parameter, so the protocol is resolved at compile time;
+    servosila_motor_controller picks one per call as per the protocol version given to configure().
+*/
+struct servosila_protocol_2_0
+{
+    static const bool IS_LEGACY = false;
+
+    //decodes a TPDO as per its layout (see servosila_tpdo_layouts)
+    template <size_t channel_index>
+    static void decode_tpdo(const uint8_t* buffer, servosila_telemetry_t& telemetry, bool /*position_encoder_available*/)
+    {
+        servosila_tpdo_layouts<channel_index>::protocol_2_0_t::decode(buffer, telemetry);
+    }
+
+    //fault flags of the status word
+    static uint16_t get_fault_flags(const servosila_telemetry_t& telemetry)
+    {
+        return uint16_t(telemetry.status & TELEMETRY_STATUS_FAULT_FLAGS_MASK);
+    }
+};
+
+struct servosila_protocol_legacy
+{
+    static const bool IS_LEGACY = true;
+
+    //decodes a TPDO as per its layout - the layouts differ by the type of the drive
+    template <size_t channel_index>
+    static void decode_tpdo(const uint8_t* buffer, servosila_telemetry_t& telemetry, bool position_encoder_available)
+    {
+        if(position_encoder_available) servosila_tpdo_layouts<channel_index>::legacy_servo_t::decode(buffer, telemetry);
+        else                           servosila_tpdo_layouts<channel_index>::legacy_chassis_t::decode(buffer, telemetry);
+    }
+
+    //fault and status word
+    static uint16_t get_fault_flags(const servosila_telemetry_t& telemetry)
+    {
+        return telemetry.faults;
+    }
+};
+
+//number of telemetry samples buffered per motor for cross-thread consumers
+const size_t SERVOSILA_TELEMETRY_RING_CAPACITY = 256;
+
+/*
+    Timestamped telemetry sample - pushed on every TPDO1
+    The extended telemetry fields hold the latest values received with TPDO2 if is_extended_telemetry_valid,
+    zeros otherwise (legacy protocol, or the placeholder mapping not enabled - see set_extended_telemetry_mapped()).
+*/
+struct servosila_telemetry_sample_t
+{
+    control::nsec_t timestamp;  //CLOCK_MONOTONIC
+    uint16_t status;            //2.0 protocol only
+    uint16_t position;
+    int16_t  speed;
+    int16_t  amps;              //2.0 protocol only
+    uint16_t faults;            //fault flags of the status word (2.0), fault and status word (legacy)
+    bool     is_extended_telemetry_valid;
+    uint16_t supply_voltage;            //0.1V units
+    int16_t  motor_temperature;         //Celsius
+    int16_t  controller_temperature;    //Celsius
+    uint16_t error_code;
+};
+
+//number of fault records kept per motor - the oldest ones are overwritten
+const size_t SERVOSILA_FAULT_HISTORY_CAPACITY = 16;
+//minimal interval between two fault ACKs - a flapping fault must not flood the bus
+const control::usec_t SERVOSILA_DEFAULT_FAULT_ACK_INTERVAL = 10000; //10ms
+
+/*
+    Fault history record - a fault from its detection (fault flags in the telemetry or an EMCY) until it clears
+*/
+struct servosila_fault_record_t
+{
+    control::nsec_t timestamp;      //detection, CLOCK_MONOTONIC
+    uint16_t fault_flags;           //all the flags seen while active: status word (2.0), fault and status word (legacy)
+    uint16_t error_code;            //EMCY error code, or the error code of TPDO2 (2.0, extended telemetry mapped); 0 - unknown
+    uint8_t  error_register;        //EMCY error register, 0 - no EMCY
+    size_t   acks_count;            //fault ACKs sent while active, 2.0 protocol only
+    control::nsec_t ack_latency;    //from the detection until the fault cleared, 0 - still active or never cleared
+};
+
 class servosila_motor_controller
 {
 public:
@@ -32,21 +248,43 @@ private:
     //position encoder availability flag
     bool m_is_position_encoder_available;
     //controller status (state)
-    telemetry_state_t m_state; //changes based on telemetry healthcheck timer
+    telemetry_state_t m_state; //changes based on telemetry healthcheck timer and heartbeats
     //switch - operation mode
     operation_mode_t  m_operation_mode; //set by commands given by an upper layer application code
+    //synchronous group mode - RPDOs are sent by the SYNC producer, not on m_rpdo_timer
+    bool m_is_synchronous;
     //timers
     control::timer m_rpdo_timer;
     control::timer m_shaft_healthcheck_timer;
+    //trajectory streaming - the position command interpolated on the RPDO ticks
+    control::trajectory_interpolator m_trajectory;
+    //NMT state and liveness of the drive - see configure_heartbeat()
+    network::canopen::heartbeat_consumer m_heartbeat;
+    bool m_is_nmt_auto_start;   //a rebooted drive is started by the controller
 private:
-    //telemetry
-    uint16_t m_position_telemetry;
-    int16_t  m_speed_telemetry;
-    int16_t  m_amps_telemetry;
-    uint16_t m_status_telemetry;
-    uint16_t m_faults_telemetry; //legacy protocol only
+    //telemetry - decoded from TPDOs as per servosila_tpdo_layouts
+    servosila_telemetry_t m_telemetry;
+    //telemetry sample times (TPDO1), CLOCK_MONOTONIC
+    control::nsec_t m_telemetry_timestamp;
+    control::nsec_t m_previous_telemetry_timestamp;
+    uint16_t        m_previous_position_telemetry;
+    int32_t         m_unwrapped_position;       //TPDO1 position with the wrap-arounds counted on the host
+    bool            m_is_unwrapped_position_valid;
+    //TPDO2-TPDO4 of the 2.0 protocol are decoded only once their placeholder layouts are confirmed
+    bool            m_is_extended_telemetry_mapped;
     //faults and warnings
     size_t   m_fault_ack_counter; //2.0 protocol only
+    size_t   m_fault_acks_suppressed;       //by the rate limit
+    control::nsec_t m_fault_ack_interval;
+    control::nsec_t m_last_fault_ack_time;  //telemetry time of the latest ACK, 0 - none since the reset
+    network::canopen::emcy_message_t m_emcy;    //latest EMCY, error code 0 - no errors
+    size_t   m_emcy_counter;
+    //fault history - a ring, the newest record at (m_faults_count-1) % SERVOSILA_FAULT_HISTORY_CAPACITY
+    servosila_fault_record_t m_fault_history[SERVOSILA_FAULT_HISTORY_CAPACITY];
+    size_t   m_faults_count;        //records ever opened
+    bool     m_is_fault_active;     //the newest record is still open
+    //telemetry stream - the CAN thread produces, any single other thread consumes
+    ftl::spsc_ring_buffer<servosila_telemetry_sample_t, SERVOSILA_TELEMETRY_RING_CAPACITY> m_telemetry_ring;
 public:
     //Position data
     uint16_t m_min_position_limit;
@@ -69,15 +307,30 @@ public:
             //
             m_state(telemetry_state_t::NO_SHAFT_TELEMETRY),
             m_operation_mode(operation_mode_t::UNDEFINED_MODE),
+            m_is_synchronous(false),
             m_rpdo_timer(0),
             m_shaft_healthcheck_timer(0),
+            m_trajectory(),
+            m_heartbeat(),
+            m_is_nmt_auto_start(false),
             //telemetry
-            m_position_telemetry(0),
-            m_speed_telemetry(0),
-            m_amps_telemetry(0),
-            m_status_telemetry(0),
-            m_faults_telemetry(0),
+            m_telemetry(),
+            m_telemetry_timestamp(0),
+            m_previous_telemetry_timestamp(0),
+            m_previous_position_telemetry(0),
+            m_unwrapped_position(0),
+            m_is_unwrapped_position_valid(false),
+            m_is_extended_telemetry_mapped(false),
             m_fault_ack_counter(0),
+            m_fault_acks_suppressed(0),
+            m_fault_ack_interval(SERVOSILA_DEFAULT_FAULT_ACK_INTERVAL * control::NSEC_PER_USEC),
+            m_last_fault_ack_time(0),
+            m_emcy(),
+            m_emcy_counter(0),
+            m_fault_history(),
+            m_faults_count(0),
+            m_is_fault_active(false),
+            m_telemetry_ring(),
             //Position data
             m_min_position_limit(0),
             m_max_position_limit(0),
@@ -113,6 +366,7 @@ public:
     {
         m_device_id = device_id;
         m_protocol_version = protocol_version;
+        m_heartbeat.configure(device_id, m_heartbeat.get_timeout());
         m_is_position_encoder_available = position_encoder_available;
         //timers
         m_rpdo_timer.configure(rpdo_timeout);
@@ -120,7 +374,7 @@ public:
         //position mode configuration
         m_min_position_limit = min_position_limit;
         m_max_position_limit = max_position_limit;
-        m_position_telemetry = min_position_limit;  //just in case, in fact the telemetry value is undefined on start
+        m_telemetry.position = min_position_limit;  //just in case, in fact the telemetry value is undefined on start
         //speed mode configuration
         m_min_speed_limit = min_speed_limit;
         m_max_speed_limit = max_speed_limit;
@@ -136,11 +390,110 @@ public:
         m_shaft_healthcheck_timer.configure(shaft_telemetry_healthcheck_timeout);
     } //configure()
 
+    /*
+        SHAFT_TELEMETRY_COMING from the first TPDO1 until the telemetry times out,
+        or - with the heartbeat consumer configured - until the drive is lost, reboots or leaves the OPERATIONAL state
+    */
     telemetry_state_t get_state() const
     {
         return m_state;
     } //get_telemetry_state()
 
+    /*
+        Heartbeat consumer - detects a lost drive within heartbeat_timeout instead of the telemetry timeout,
+        and a rebooted drive on its boot-up message
+        - the drive has to produce heartbeats, see configure_heartbeat_producer()
+        - heartbeat_timeout is typically 1.5-3 heartbeat periods of the drive, 0 - heartbeats never time out
+        - auto_start: a rebooted drive is put back into the OPERATIONAL state with an NMT command
+        Configure before registering with an event loop: the healthcheck period depends on the timeout.
+    */
+    void configure_heartbeat(control::usec_t heartbeat_timeout, bool auto_start = true)
+    {
+        m_heartbeat.configure(m_device_id, heartbeat_timeout);
+        m_is_nmt_auto_start = auto_start;
+    } //configure_heartbeat()
+
+    /*
+        Extended telemetry (TPDO2-TPDO4) of the 2.0 protocol - off by default
+        The layouts are placeholders (see servosila_tpdo_layouts); enable the decoding only for drives whose
+        TPDO mapping (objects 0x1A01-0x1A03, read with network::canopen::sdo_client) matches them.
+        Until then the extended telemetry stays zero and the samples flag it as not valid.
+    */
+    void set_extended_telemetry_mapped(bool is_mapped)
+    {
+        m_is_extended_telemetry_mapped = is_mapped;
+    } //set_extended_telemetry_mapped()
+
+    bool is_extended_telemetry_mapped() const
+    {
+        return m_is_extended_telemetry_mapped;
+    } //is_extended_telemetry_mapped()
+
+    /*
+        Sets the heartbeat period of the drive (object 0x1017), fire and forget SDO write; 0 - no heartbeats
+    */
+    void configure_heartbeat_producer(network::can_socket& can, uint16_t heartbeat_period_msec) const
+    {
+        assert(m_device_id != 0);
+        network::canopen::send_expedited_sdo_write(can, m_device_id, network::canopen::PRODUCER_HEARTBEAT_TIME_INDEX, 0, heartbeat_period_msec);
+    } //configure_heartbeat_producer()
+
+    /*
+        NMT state of the drive as per its heartbeats (network::canopen::NMT_STATE_*),
+        NMT_STATE_UNKNOWN if no heartbeats are coming
+    */
+    uint8_t get_nmt_state() const
+    {
+        return m_heartbeat.get_state();
+    } //get_nmt_state()
+
+    const network::canopen::heartbeat_consumer& get_heartbeat_consumer() const
+    {
+        return m_heartbeat;
+    } //get_heartbeat_consumer()
+
+    /*
+        NMT master commands addressed to the drive (network::canopen::NMT_COMMAND_*)
+    */
+    bool send_nmt_command(network::can_socket& can, uint8_t command) const
+    {
+        assert(m_device_id != 0);
+        return network::canopen::send_nmt_command(can, command, m_device_id);
+    } //send_nmt_command()
+
+    bool start_node(network::can_socket& can) const
+    {
+        return send_nmt_command(can, network::canopen::NMT_COMMAND_START);
+    } //start_node()
+
+    bool stop_node(network::can_socket& can) const
+    {
+        return send_nmt_command(can, network::canopen::NMT_COMMAND_STOP);
+    } //stop_node()
+
+    bool enter_pre_operational(network::can_socket& can) const
+    {
+        return send_nmt_command(can, network::canopen::NMT_COMMAND_ENTER_PRE_OPERATIONAL);
+    } //enter_pre_operational()
+
+    /*
+        Reboots the drive - recovers it without restarting the process;
+        the telemetry comes back after the boot-up (and the NMT start, see configure_heartbeat())
+    */
+    bool reset_node(network::can_socket& can) const
+    {
+        return send_nmt_command(can, network::canopen::NMT_COMMAND_RESET_NODE);
+    } //reset_node()
+
+    /*
+        Node guarding - for the drives that do not produce heartbeats, call every guarding period
+        (shorter than the heartbeat timeout of configure_heartbeat())
+    */
+    bool send_node_guarding_request(network::can_socket& can)
+    {
+        return m_heartbeat.send_guarding_request(can);
+    } //send_node_guarding_request()
+
     operation_mode_t get_operation_mode() const
     {
         return m_operation_mode;
@@ -156,17 +509,39 @@ public:
         return m_is_position_encoder_available;
     } //is_position_encoder_available()
 
+    protocol_version_t get_protocol_version() const
+    {
+        return m_protocol_version;
+    } //get_protocol_version()
+
     size_t get_faults_ack_counter() const
     {
         return m_fault_ack_counter;
     } //get_faults_ack_counter()
 
     void execute(network::can_socket& can)
+    {   //version router
+        if(_is_protocol_2_0()) _execute<servosila_protocol_2_0>(can);
+        else                   _execute<servosila_protocol_legacy>(can);
+    } //execute()
+
+    /*
+        Healthcheck part of execute()
+        - can be called directly by an event loop when the healthcheck deadline fires
+    */
+    void execute_healthcheck(network::can_socket& can)
     {
         //Reaction to CANbus problems
         if(!can.is_connected())
         {   //sets both NO_TELEMETRY and UNDEFINED_MODE
             _reset_to_initial_state();
+            m_heartbeat.reset();
+        }
+
+        //Heartbeat consumer verification - the drive is lost
+        if(m_heartbeat.check()) //it is reset in process_heartbeat() routine
+        {   //sets NO_TELEMETRY and UNDEFINED_MODE
+            _reset_to_initial_state();
         }
 
         //Healthcheck timer verification
@@ -178,80 +553,183 @@ public:
                 _reset_to_initial_state();
             }
         }
+    } //execute_healthcheck()
 
-        //Sending out RPDO commands
-        //...if time has come to send an RPDO
-        if(m_rpdo_timer.check_and_restart())
-        {   //...sending only when TELEMETRY_COMING
-            if(m_state==telemetry_state_t::SHAFT_TELEMETRY_COMING)
-            {   //Sending out an RPDO frame
-                if(can.is_connected()) _send_rpdo_as_per_current_operation_mode(can);
-            }
+    /*
+        RPDO part of execute() - sends out an RPDO unconditionally of m_rpdo_timer
+        - can be called directly by an event loop when the RPDO deadline fires
+        - does nothing in the synchronous mode, the SYNC producer sends the RPDOs
+    */
+    void execute_rpdo(network::can_socket& can)
+    {   //version router
+        if(_is_protocol_2_0()) _execute_rpdo<servosila_protocol_2_0>(can);
+        else                   _execute_rpdo<servosila_protocol_legacy>(can);
+    } //execute_rpdo()
+
+    /*
+        RPDO frame as execute_rpdo() would send it - for sending the RPDOs of a group in one batch
+        Returns false if there is nothing to send.
+    */
+    bool build_rpdo(can_frame& frame) const
+    {   //version router
+        return _is_protocol_2_0() ? _build_rpdo<servosila_protocol_2_0>(frame) : _build_rpdo<servosila_protocol_legacy>(frame);
+    } //build_rpdo()
+
+    /*
+        Synchronous group mode - the RPDOs are sent right after SYNC by the SYNC producer
+        (see servosila_canbus_dispatcher::set_sync_period()), execute() stops sending them on m_rpdo_timer
+    */
+    void set_synchronous_mode(bool is_synchronous)
+    {
+        m_is_synchronous = is_synchronous;
+    } //set_synchronous_mode()
+
+    bool is_synchronous() const
+    {
+        return m_is_synchronous;
+    } //is_synchronous()
+
+    /*
+        Switches the PDOs of the drive to synchronous transmission (2.0 protocol only), fire and forget SDO writes
+        - the RPDO takes effect on the SYNC following its reception: all the drives of a group apply their commands at once
+        - TPDO1 is sampled on every tpdo1_sync_divider-th SYNC, TPDO2-TPDO4 on every extended_tpdo_sync_divider-th SYNC
+    */
+    void configure_synchronous_pdos(network::can_socket& can, uint8_t tpdo1_sync_divider = 1, uint8_t extended_tpdo_sync_divider = 10) const
+    {
+        assert(m_protocol_version == protocol_version_t::PROTOCOL_VERSION_2_0);
+        assert((tpdo1_sync_divider > 0) && (tpdo1_sync_divider <= network::canopen::PDO_TRANSMISSION_TYPE_SYNCHRONOUS_MAX));
+        assert((extended_tpdo_sync_divider > 0) && (extended_tpdo_sync_divider <= network::canopen::PDO_TRANSMISSION_TYPE_SYNCHRONOUS_MAX));
+        const uint8_t RPDO_TRANSMISSION_TYPE_SYNCHRONOUS = 0;
+        network::canopen::send_expedited_sdo_write(can, m_device_id, network::canopen::RPDO_COMMUNICATION_PARAMETER_INDEX, network::canopen::PDO_TRANSMISSION_TYPE_SUBINDEX, RPDO_TRANSMISSION_TYPE_SYNCHRONOUS);
+        for(uint16_t n=0; n<sizeof(TPDO_SERVOSILA_CHANNELS)/sizeof(TPDO_SERVOSILA_CHANNELS[0]); n++)
+        {
+            const uint8_t transmission_type = (n == 0) ? tpdo1_sync_divider : extended_tpdo_sync_divider;
+            network::canopen::send_expedited_sdo_write(can, m_device_id, uint16_t(network::canopen::TPDO_COMMUNICATION_PARAMETER_INDEX + n), network::canopen::PDO_TRANSMISSION_TYPE_SUBINDEX, transmission_type);
         }
-    } //execute()
+    } //configure_synchronous_pdos()
 
-    bool process_canbus_callback(network::can_socket& can, const uint8_t* buffer, uint8_t bytes_received, canid_t source_can_id, timeval /*timestamp*/)
-    {   //has the message been processed?
-        bool is_processed_flag = false;
-        //Extrating Node ID
-        const uint8_t node_id = network::canopen::extract_node_id_from_cob_id(source_can_id);
-        //Filter
-        if(node_id==m_device_id)
-        {   //Extrating Function Code
-            const uint16_t function_code = network::canopen::extract_function_code_from_cob_id(source_can_id);
-            //process telemetry frames
-            switch(function_code)
-            {
-                case TPDO_SERVOSILA_CHANNEL_FOR_MOTOR_TELEMETRY_1:
-                {   //extracting telemetry values
-                    _parse_tpdo1(buffer, bytes_received);
-                    //reacting on fault bits in status word
-                    _process_faults(can);
-                    //Healthcheck timer reset
-                    m_shaft_healthcheck_timer.restart(); //good health
-                    //setting the status - on any incoming frame
-                    m_state = telemetry_state_t::SHAFT_TELEMETRY_COMING;
-                    //setting result
-                    is_processed_flag = true;
-                    break;
-                }
-                case TPDO_SERVOSILA_CHANNEL_FOR_MOTOR_TELEMETRY_2:
-                {   //extracting telemetry values
-                    _parse_tpdo2(buffer, bytes_received);
-                    //setting result
-                    is_processed_flag = true;
-                    break;
-                }
-                case TPDO_SERVOSILA_CHANNEL_FOR_MOTOR_TELEMETRY_3:
-                {   //extracting telemetry values
-                    _parse_tpdo3(buffer, bytes_received);
-                    //setting result
-                    is_processed_flag = true;
-                    break;
-                }
-                case TPDO_SERVOSILA_CHANNEL_FOR_MOTOR_TELEMETRY_4:
-                {   //extracting telemetry values
-                    //TODO: ...
-                    //setting result
-                    is_processed_flag = true;
-                    break;
-                }
-                default:
-                {   //ignore all other/unknown/non-relevant function codes
-                    break;
-                }
-            } //switch()
-            //
-        } //end of filter by Node ID
+    /*
+        Switches the PDOs of the drive back to asynchronous (event/timer driven) transmission
+    */
+    void configure_asynchronous_pdos(network::can_socket& can) const
+    {
+        assert(m_protocol_version == protocol_version_t::PROTOCOL_VERSION_2_0);
+        network::canopen::send_expedited_sdo_write(can, m_device_id, network::canopen::RPDO_COMMUNICATION_PARAMETER_INDEX, network::canopen::PDO_TRANSMISSION_TYPE_SUBINDEX, network::canopen::PDO_TRANSMISSION_TYPE_ASYNCHRONOUS);
+        for(uint16_t n=0; n<sizeof(TPDO_SERVOSILA_CHANNELS)/sizeof(TPDO_SERVOSILA_CHANNELS[0]); n++)
+        {
+            network::canopen::send_expedited_sdo_write(can, m_device_id, uint16_t(network::canopen::TPDO_COMMUNICATION_PARAMETER_INDEX + n), network::canopen::PDO_TRANSMISSION_TYPE_SUBINDEX, network::canopen::PDO_TRANSMISSION_TYPE_ASYNCHRONOUS);
+        }
+    } //configure_asynchronous_pdos()
+
+    control::usec_t get_rpdo_timeout() const
+    {
+        return m_rpdo_timer.get_interval();
+    } //get_rpdo_timeout()
+
+    control::usec_t get_shaft_healthcheck_timeout() const
+    {
+        return m_shaft_healthcheck_timer.get_interval();
+    } //get_shaft_healthcheck_timeout()
+
+    /*
+        How often execute_healthcheck() has to run - the shorter of the telemetry and heartbeat timeouts
+    */
+    control::usec_t get_healthcheck_period() const
+    {
+        const control::usec_t heartbeat_timeout = m_heartbeat.get_timeout();
+        const control::usec_t shaft_timeout     = m_shaft_healthcheck_timer.get_interval();
+        return ((heartbeat_timeout > 0) && (heartbeat_timeout < shaft_timeout)) ? heartbeat_timeout : shaft_timeout;
+    } //get_healthcheck_period()
+
+    /*
+        When execute_healthcheck() detects a telemetry or heartbeat timeout unless telemetry or a heartbeat comes first;
+        0 if there is nothing to time out (no telemetry coming, no heartbeats tracked)
+        - an event loop arms a one-shot timer here instead of polling every get_healthcheck_period()
+    */
+    control::nsec_t get_healthcheck_deadline() const
+    {
+        control::nsec_t result = (m_state == telemetry_state_t::SHAFT_TELEMETRY_COMING) ? m_shaft_healthcheck_timer.get_set_time_nsec() : 0;
+        const control::nsec_t heartbeat_deadline = m_heartbeat.get_deadline();
+        if((heartbeat_deadline != 0) && ((result == 0) || (heartbeat_deadline < result))) result = heartbeat_deadline;
+        return result;
+    } //get_healthcheck_deadline()
+
+    bool process_canbus_callback(network::can_socket& can, const uint8_t* buffer, uint8_t bytes_received, canid_t source_can_id, control::nsec_t timestamp)
+    {   //version router
+        return _is_protocol_2_0() ? _process_canbus_callback<servosila_protocol_2_0>(can, buffer, bytes_received, source_can_id, timestamp)
+                                  : _process_canbus_callback<servosila_protocol_legacy>(can, buffer, bytes_received, source_can_id, timestamp);
+    } //process_canbus_callback()
+
+    /*
+        TPDO handlers - called by process_canbus_callback() after filtering by Node ID,
+        or directly by a dispatcher that has already routed the frame by its COB ID
+    */
+    bool process_tpdo1(network::can_socket& can, const uint8_t* buffer, uint8_t bytes_received, control::nsec_t timestamp)
+    {   //version router
+        return _is_protocol_2_0() ? _process_tpdo1<servosila_protocol_2_0>(can, buffer, bytes_received, timestamp) : _process_tpdo1<servosila_protocol_legacy>(can, buffer, bytes_received, timestamp);
+    } //process_tpdo1()
+
+    bool process_tpdo2(network::can_socket& can, const uint8_t* buffer, uint8_t bytes_received, control::nsec_t timestamp)
+    {   //version router
+        return _is_protocol_2_0() ? _process_tpdo2<servosila_protocol_2_0>(can, buffer, bytes_received, timestamp) : _process_tpdo2<servosila_protocol_legacy>(can, buffer, bytes_received, timestamp);
+    } //process_tpdo2()
+
+    bool process_tpdo3(network::can_socket& can, const uint8_t* buffer, uint8_t bytes_received, control::nsec_t timestamp)
+    {   //version router
+        return _is_protocol_2_0() ? _process_tpdo3<servosila_protocol_2_0>(can, buffer, bytes_received, timestamp) : _process_tpdo3<servosila_protocol_legacy>(can, buffer, bytes_received, timestamp);
+    } //process_tpdo3()
+
+    bool process_tpdo4(network::can_socket& can, const uint8_t* buffer, uint8_t bytes_received, control::nsec_t timestamp)
+    {   //version router
+        return _is_protocol_2_0() ? _process_tpdo4<servosila_protocol_2_0>(can, buffer, bytes_received, timestamp) : _process_tpdo4<servosila_protocol_legacy>(can, buffer, bytes_received, timestamp);
+    } //process_tpdo4()
+
+    /*
+        CAN FD combined telemetry - TPDO1-TPDO4 payloads back to back (see SERVOSILA_COMBINED_TPDO_PAYLOAD_SIZE)
+        TPDO2-TPDO4 are decoded first, so the sample published by TPDO1 carries the extended telemetry of the same frame.
+    */
+    bool process_combined_tpdo(network::can_socket& can, const uint8_t* buffer, uint8_t bytes_received, control::nsec_t timestamp)
+    {   //version router
+        return _is_protocol_2_0() ? _process_combined_tpdo<servosila_protocol_2_0>(can, buffer, bytes_received, timestamp) : _process_combined_tpdo<servosila_protocol_legacy>(can, buffer, bytes_received, timestamp);
+    } //process_combined_tpdo()
+
+    /*
+        Heartbeat, boot-up and node guarding handler
+        - a boot-up means the drive has lost its commands: the controller starts over, right away
+        - a drive that is not OPERATIONAL ignores the RPDOs and sends no TPDOs: no need to wait for the telemetry timeout
+    */
+    bool process_heartbeat(network::can_socket& can, const uint8_t* buffer, uint8_t bytes_received, control::nsec_t timestamp)
+    {
+        const network::canopen::heartbeat_consumer::event_t event = m_heartbeat.process_heartbeat(buffer, bytes_received, timestamp);
+        if(event == network::canopen::heartbeat_consumer::event_t::BOOTUP)
+        {   //REBOOT! - sets NO_TELEMETRY and UNDEFINED_MODE
+            _reset_to_initial_state();
+            //recovering the drive - it enters PRE_OPERATIONAL after the boot-up
+            if(m_is_nmt_auto_start && can.is_connected()) start_node(can);
+        }
+        else if((m_heartbeat.get_state() != network::canopen::NMT_STATE_OPERATIONAL) && (m_state == telemetry_state_t::SHAFT_TELEMETRY_COMING))
+        {   //stopped or pre-operational - sets NO_TELEMETRY and UNDEFINED_MODE
+            _reset_to_initial_state();
+        }
         //
-        return is_processed_flag;
-    } //process_canbus_frame_()
+        return bytes_received >= 1;
+    } //process_heartbeat()
+
+    /*
+        EMCY handler - the error code and register go into the fault history;
+        an EMCY opens a fault record before the fault flags show up in the telemetry
+    */
+    bool process_emcy(network::can_socket& can, const uint8_t* buffer, uint8_t bytes_received, control::nsec_t timestamp)
+    {   //version router
+        return _is_protocol_2_0() ? _process_emcy<servosila_protocol_2_0>(can, buffer, bytes_received, timestamp) : _process_emcy<servosila_protocol_legacy>(can, buffer, bytes_received, timestamp);
+    } //process_emcy()
 
     void set_position_command(uint16_t position)
     {
         assert(position<=m_max_position_limit);
         assert(position>=m_min_position_limit);
         //
+        m_trajectory.cancel();
         m_operation_mode = operation_mode_t::POSITION_MODE;
         m_position_command = position;
 
@@ -263,6 +741,7 @@ public:
         assert(speed<=m_max_speed_limit);
         assert(speed>=m_min_speed_limit);
         //
+        m_trajectory.cancel();
         m_operation_mode = operation_mode_t::SPEED_MODE;
         m_speed_command = speed;
     } //set_speed_command()
@@ -272,100 +751,270 @@ public:
         assert(amps<=m_max_amps_limit);
         assert(amps>=m_min_amps_limit);
         //
+        m_trajectory.cancel();
         m_operation_mode = operation_mode_t::AMPS_MODE;
         m_amps_command = amps;
     } //set_amps_command()
 
     void set_undefined_command()
     {
+        m_trajectory.cancel();
         m_operation_mode = operation_mode_t::UNDEFINED_MODE;
     } //set_amps_command()
 
+    /*
+        Trajectory streaming - the position command follows time-stamped waypoints (see control::trajectory_interpolator),
+        interpolated on every RPDO tick; the high-level code streams the waypoints at its own, lower rate
+        - the position limits are always honoured; max_velocity limits the rate of the setpoints,
+          position units per second, 0 - unlimited
+        - any set_*_command() or halt() cancels the trajectory, so does a loss of the telemetry
+    */
+    void configure_trajectory(control::interpolation_t interpolation, double max_velocity = 0)
+    {
+        m_trajectory.configure(interpolation, m_min_position_limit, m_max_position_limit, max_velocity);
+    } //configure_trajectory()
+
+    /*
+        Queues waypoints; unless a trajectory is running, starts one at the current position command,
+        or at the position telemetry if the controller is not in POSITION_MODE yet
+        Returns the number of waypoints queued, 0 if there is no position to start from.
+    */
+    size_t append_trajectory(const control::trajectory_point_t* points, size_t points_count)
+    {
+        size_t result = 0;
+        if(!m_trajectory.is_active())
+        {
+            if((m_operation_mode != operation_mode_t::POSITION_MODE) && (m_state == telemetry_state_t::SHAFT_TELEMETRY_COMING) && m_is_position_encoder_available)
+            {   //starting where the motor is
+                const uint16_t position = m_telemetry.position;
+                m_position_command = (position < m_min_position_limit) ? m_min_position_limit : ((position > m_max_position_limit) ? m_max_position_limit : position);
+                m_operation_mode = operation_mode_t::POSITION_MODE;
+            }
+            if(m_operation_mode == operation_mode_t::POSITION_MODE)
+            {   //the limits might have been reconfigured
+                m_trajectory.configure(m_trajectory.get_interpolation(), m_min_position_limit, m_max_position_limit, m_trajectory.get_max_velocity());
+                m_trajectory.begin(control::get_now_nsec(), m_position_command);
+            }
+        }
+        if(m_trajectory.is_active())
+        {
+            result = m_trajectory.append(points, points_count);
+        }
+        return result;
+    } //append_trajectory()
+
+    /*
+        Replaces the running trajectory, if any - the new one starts at the current setpoint
+    */
+    size_t start_trajectory(const control::trajectory_point_t* points, size_t points_count)
+    {
+        m_trajectory.cancel();
+        return append_trajectory(points, points_count);
+    } //start_trajectory()
+
+    /*
+        Stops at the current setpoint, POSITION_MODE is kept
+    */
+    void cancel_trajectory()
+    {
+        m_trajectory.cancel();
+    } //cancel_trajectory()
+
+    bool is_trajectory_active() const
+    {
+        return m_trajectory.is_active();
+    } //is_trajectory_active()
+
+    /*
+        Number of waypoints that can be appended - for pacing the stream
+    */
+    size_t get_trajectory_free_space() const
+    {
+        return m_trajectory.get_free_space();
+    } //get_trajectory_free_space()
+
     /*
         Emergency Stop Routine
         - tries to stop the motor under all circumstances
     */
     void halt(network::can_socket& can)
     {
-        if(m_state == telemetry_state_t::SHAFT_TELEMETRY_COMING)
-        {   //normal situation - telemetry is coming, easy to halt
-            switch(m_operation_mode)
-            {
-                case operation_mode_t::POSITION_MODE:
-                {   //setting the position to the latest position telemetry
-                    set_position_command(m_position_telemetry);
-                    break;
-                }
-                case operation_mode_t::SPEED_MODE:
-                {   //zero speed
-                    set_speed_command(0);
-                    break;
-                }
-                case operation_mode_t::AMPS_MODE:
-                {   //zero amps/torque
-                    set_amps_command(0);
-                    break;
-                }
-                case operation_mode_t::UNDEFINED_MODE:
-                {   //workaround - since UNDEFINED_MODE
-                    //...normally, halt() shall not be called in UNDEFINED_MODE since the motor is not moving anyway
-                    //...but this might happen after an abdrupt process reboot
-                    //...when the process has just restarted, but the motor is still moving
-                    //setting zero speed
-                    set_speed_command(0);
-                    //
-                    break;
-                }
-                default:
-                {   //unknown state
-                    assert(false);
-                    break;
-                }
-            } //switch()
-        }
-        else //NO SHAFT TELEMETRY
-        {   //workaround - since NO SHAFT TELEMETRY
-            //..might happen after a process reboot
-            //setting zero speed
-            set_speed_command(0);
-
-        } //if SHAFT TELEMETRY IS COMING
-        //
-        //AT LEAST ONCE: forcefully sending out the command - just in case TELEMETRY IS NOT COMING
-        if(can.is_connected())
-        {   //sending at least once - since the mode can be switched due to no telemetry
-            _send_rpdo_as_per_current_operation_mode(can);
-        }
-        else
-        {   //cannot stop the motor if CANbus is not connected :-(
+        can_frame frame;
+        if(build_halt_rpdo(frame))
+        {
+            //AT LEAST ONCE: forcefully sending out the command - just in case TELEMETRY IS NOT COMING
+            if(can.is_connected())
+            {   //sending at least once - since the mode can be switched due to no telemetry
+                can.send(frame.can_id, frame.data, frame.can_dlc);
+            }
+            else
+            {   //cannot stop the motor if CANbus is not connected :-(
+            }
         }
-        //
         //AFTER HALT: switching to undefined mode
         set_undefined_command(); //this stops RPDO sending
     }//halt()
 
+    /*
+        Emergency Stop Routine without sending - for stopping a group of motors in one batch
+        - the halt command halt() would send, built into the frame; the controller is left as is,
+          call set_undefined_command() once the frame has been sent, as halt() does
+        - position mode: the latest position telemetry as is, not checked against the limits - the motor is held where it is
+        - the frame stays valid: it can be built in advance and sent several times
+        Returns false if there is no frame to send.
+    */
+    bool build_halt_rpdo(can_frame& frame) const
+    {   //version router
+        return _is_protocol_2_0() ? _build_halt_rpdo<servosila_protocol_2_0>(frame) : _build_halt_rpdo<servosila_protocol_legacy>(frame);
+    } //build_halt_rpdo()
+
     uint16_t get_position_telemetry() const
     {
         assert(m_state == telemetry_state_t::SHAFT_TELEMETRY_COMING);
-        return m_position_telemetry;
+        return m_telemetry.position;
     }
 
     int16_t get_speed_telemetry() const
     {
         assert(m_state == telemetry_state_t::SHAFT_TELEMETRY_COMING);
-        return m_speed_telemetry;
+        return m_telemetry.speed;
     }
 
     int16_t get_amps_telemetry() const
     {
         assert(m_state == telemetry_state_t::SHAFT_TELEMETRY_COMING);
-        return m_amps_telemetry;
+        return m_telemetry.amps;
     }
 
     uint16_t get_status_telemetry() const
     {
         assert(m_state == telemetry_state_t::SHAFT_TELEMETRY_COMING);
-        return m_status_telemetry;
+        return m_telemetry.status;
+    }
+
+    /*
+        Extended telemetry (TPDO2-TPDO4) - 2.0 protocol only, zeros until the first frame arrives
+        and unless the placeholder layouts have been confirmed, see set_extended_telemetry_mapped()
+    */
+    uint16_t get_supply_voltage_telemetry() const
+    {
+        assert(m_state == telemetry_state_t::SHAFT_TELEMETRY_COMING);
+        return m_telemetry.supply_voltage;
+    }
+
+    int16_t get_motor_temperature_telemetry() const
+    {
+        assert(m_state == telemetry_state_t::SHAFT_TELEMETRY_COMING);
+        return m_telemetry.motor_temperature;
+    }
+
+    int16_t get_controller_temperature_telemetry() const
+    {
+        assert(m_state == telemetry_state_t::SHAFT_TELEMETRY_COMING);
+        return m_telemetry.controller_temperature;
+    }
+
+    uint16_t get_error_code_telemetry() const
+    {
+        assert(m_state == telemetry_state_t::SHAFT_TELEMETRY_COMING);
+        return m_telemetry.error_code;
+    }
+
+    int32_t get_multiturn_position_telemetry() const
+    {
+        assert(m_state == telemetry_state_t::SHAFT_TELEMETRY_COMING);
+        return m_telemetry.multiturn_position;
+    }
+
+    uint16_t get_warnings_telemetry() const
+    {
+        assert(m_state == telemetry_state_t::SHAFT_TELEMETRY_COMING);
+        return m_telemetry.warnings;
+    }
+
+    uint16_t get_digital_inputs_telemetry() const
+    {
+        assert(m_state == telemetry_state_t::SHAFT_TELEMETRY_COMING);
+        return m_telemetry.digital_inputs;
+    }
+
+    uint16_t get_analog_input_telemetry() const
+    {
+        assert(m_state == telemetry_state_t::SHAFT_TELEMETRY_COMING);
+        return m_telemetry.analog_input;
+    }
+
+    /*
+        All the telemetry at once - primary and extended
+    */
+    const servosila_telemetry_t& get_telemetry() const
+    {
+        assert(m_state == telemetry_state_t::SHAFT_TELEMETRY_COMING);
+        return m_telemetry;
+    }
+
+    /*
+        Sample time of the latest primary telemetry (TPDO1) in CLOCK_MONOTONIC nanoseconds
+        - kernel receive timestamp of the frame, see control::get_now_nsec()
+    */
+    control::nsec_t get_telemetry_timestamp() const
+    {
+        assert(m_state == telemetry_state_t::SHAFT_TELEMETRY_COMING);
+        return m_telemetry_timestamp;
+    }
+
+    /*
+        Time between the two latest TPDO1 samples, 0 if only one sample has been received
+        - use with get_previous_position_telemetry() for computing the velocity
+    */
+    control::nsec_t get_telemetry_sample_period() const
+    {
+        assert(m_state == telemetry_state_t::SHAFT_TELEMETRY_COMING);
+        return (m_previous_telemetry_timestamp != 0) ? (m_telemetry_timestamp - m_previous_telemetry_timestamp) : 0;
+    }
+
+    uint16_t get_previous_position_telemetry() const
+    {
+        assert(m_state == telemetry_state_t::SHAFT_TELEMETRY_COMING);
+        return m_previous_position_telemetry;
+    }
+
+    /*
+        Multi-turn position from the TPDO1 position - the wrap-arounds are counted on the host,
+        starting at the first position received; needs no extended telemetry.
+        The position shall move less than half a turn between two samples, a telemetry loss included.
+    */
+    int32_t get_unwrapped_position_telemetry() const
+    {
+        assert(m_state == telemetry_state_t::SHAFT_TELEMETRY_COMING);
+        return m_unwrapped_position;
+    }
+
+    /*
+        Age of the latest telemetry sample - the latency between the frame reception and "now"
+    */
+    control::nsec_t get_telemetry_age(control::nsec_t now = control::get_now_nsec()) const
+    {
+        assert(m_state == telemetry_state_t::SHAFT_TELEMETRY_COMING);
+        return (now > m_telemetry_timestamp) ? (now - m_telemetry_timestamp) : 0;
+    }
+
+    /*
+        Fetches up to max_samples buffered telemetry samples, oldest first
+        Lock-free; may be called from one thread other than the CAN thread (single consumer).
+        Returns the number of samples fetched.
+    */
+    size_t drain_telemetry(servosila_telemetry_sample_t* samples, size_t max_samples)
+    {
+        return m_telemetry_ring.pop(samples, max_samples);
+    }
+
+    /*
+        Number of telemetry samples dropped because the consumer did not keep up
+    */
+    size_t get_telemetry_overflow_counter() const
+    {
+        return m_telemetry_ring.get_overflow_counter();
     }
 
     size_t get_fault_ack_counter() const
@@ -373,69 +1022,386 @@ public:
         return m_fault_ack_counter;
     }
 
+    /*
+        Minimal interval between two fault ACKs (2.0 protocol); the ACKs due in between are suppressed
+    */
+    void set_fault_ack_interval(control::usec_t interval)
+    {
+        m_fault_ack_interval = control::nsec_t(interval) * control::NSEC_PER_USEC;
+    }
+
+    size_t get_fault_acks_suppressed() const
+    {
+        return m_fault_acks_suppressed;
+    }
+
+    size_t get_emcy_counter() const
+    {
+        return m_emcy_counter;
+    }
+
+    const network::canopen::emcy_message_t& get_latest_emcy() const
+    {
+        return m_emcy;
+    }
+
+    /*
+        Fault history - read it from the thread running the controller
+        age 0 - the newest record, get_fault_history_size()-1 - the oldest one kept
+    */
+    const servosila_fault_record_t& get_fault_record(size_t age) const
+    {
+        assert(age < get_fault_history_size());
+        return m_fault_history[(m_faults_count - 1 - age) % SERVOSILA_FAULT_HISTORY_CAPACITY];
+    }
+
+    size_t get_fault_history_size() const
+    {
+        return (m_faults_count < SERVOSILA_FAULT_HISTORY_CAPACITY) ? m_faults_count : SERVOSILA_FAULT_HISTORY_CAPACITY;
+    }
+
+    /*
+        Number of faults ever recorded, the overwritten ones included
+    */
+    size_t get_faults_count() const
+    {
+        return m_faults_count;
+    }
+
+    bool is_fault_active() const
+    {
+        return m_is_fault_active;
+    }
+
     uint8_t get_device_id() const
     {
         return m_device_id;
     }
 
+protected:
+    /*
+        Protocol-specific implementations - the protocol is a policy (servosila_protocol_2_0, servosila_protocol_legacy)
+        The public methods of the same names pick the policy as per m_protocol_version,
+        servosila_typed_motor_controller calls these directly.
+    */
+    template <class protocol>
+    void _execute(network::can_socket& can)
+    {
+        //Reaction to CANbus problems and telemetry timeouts
+        execute_healthcheck(can);
+
+        //Sending out RPDO commands
+        //...if time has come to send an RPDO
+        if(m_rpdo_timer.check_and_advance()) //drift-free
+        {
+            _execute_rpdo<protocol>(can);
+        }
+    } //_execute()
+
+    template <class protocol>
+    void _execute_rpdo(network::can_socket& can)
+    {   //...sending only when TELEMETRY_COMING
+        if(m_state==telemetry_state_t::SHAFT_TELEMETRY_COMING)
+        {   //trajectory streaming - the next setpoint, also in the synchronous mode
+            if(m_trajectory.is_active()) _update_trajectory();
+            //Sending out an RPDO frame
+            if(!m_is_synchronous && can.is_connected()) _send_rpdo_as_per_current_operation_mode<protocol>(can);
+        }
+    } //_execute_rpdo()
+
+    template <class protocol>
+    bool _build_rpdo(can_frame& frame) const
+    {
+        return (m_state==telemetry_state_t::SHAFT_TELEMETRY_COMING) && _build_rpdo_as_per_current_operation_mode<protocol>(frame);
+    } //_build_rpdo()
+
+    template <class protocol>
+    bool _build_halt_rpdo(can_frame& frame) const
+    {   //sent at least once - since the mode can be switched due to no telemetry
+        return _build_rpdo_for_command<protocol>(frame, _get_halt_operation_mode(), m_telemetry.position, 0, 0);
+    } //_build_halt_rpdo()
+
+    template <class protocol>
+    bool _process_canbus_callback(network::can_socket& can, const uint8_t* buffer, uint8_t bytes_received, canid_t source_can_id, control::nsec_t timestamp)
+    {   //has the message been processed?
+        bool is_processed_flag = false;
+        //Extrating Node ID
+        const uint8_t node_id = network::canopen::extract_node_id_from_cob_id(source_can_id);
+        //Filter
+        if(node_id==m_device_id)
+        {   //Extrating Function Code
+            const uint16_t function_code = network::canopen::extract_function_code_from_cob_id(source_can_id);
+            //process telemetry frames
+            switch(function_code)
+            {
+                case TPDO_SERVOSILA_CHANNEL_FOR_MOTOR_TELEMETRY_1:
+                {
+                    is_processed_flag = _process_tpdo1<protocol>(can, buffer, bytes_received, timestamp);
+                    break;
+                }
+                case TPDO_SERVOSILA_CHANNEL_FOR_MOTOR_TELEMETRY_2:
+                {
+                    is_processed_flag = _process_tpdo2<protocol>(can, buffer, bytes_received, timestamp);
+                    break;
+                }
+                case TPDO_SERVOSILA_CHANNEL_FOR_MOTOR_TELEMETRY_3:
+                {
+                    is_processed_flag = _process_tpdo3<protocol>(can, buffer, bytes_received, timestamp);
+                    break;
+                }
+                case TPDO_SERVOSILA_CHANNEL_FOR_MOTOR_TELEMETRY_4:
+                {
+                    is_processed_flag = _process_tpdo4<protocol>(can, buffer, bytes_received, timestamp);
+                    break;
+                }
+                case network::canopen::PREDEFINED_HEARTBEAT_CHANNEL:
+                {
+                    is_processed_flag = process_heartbeat(can, buffer, bytes_received, timestamp);
+                    break;
+                }
+                case network::canopen::PREDEFINED_EMCY_CHANNEL:
+                {
+                    is_processed_flag = _process_emcy<protocol>(can, buffer, bytes_received, timestamp);
+                    break;
+                }
+                default:
+                {   //ignore all other/unknown/non-relevant function codes
+                    break;
+                }
+            } //switch()
+            //
+        } //end of filter by Node ID
+        //
+        return is_processed_flag;
+    } //_process_canbus_callback()
+
+    template <class protocol>
+    bool _process_tpdo1(network::can_socket& can, const uint8_t* buffer, uint8_t bytes_received, control::nsec_t timestamp)
+    {   //CAN FD frame on the TPDO1 COB ID
+        if(bytes_received > network::canopen::PDO_PAYLOAD_SIZE) return _process_combined_tpdo<protocol>(can, buffer, bytes_received, timestamp);
+        //keeping the previous sample
+        m_previous_position_telemetry = m_telemetry.position;
+        m_previous_telemetry_timestamp = m_telemetry_timestamp;
+        //extracting telemetry values
+        _parse_tpdo<protocol, 0>(buffer, bytes_received);
+        //counting the wrap-arounds - the shortest way from the previous position
+        if(m_is_unwrapped_position_valid) m_unwrapped_position += int16_t(uint16_t(m_telemetry.position - m_previous_position_telemetry));
+        else                              m_unwrapped_position  = m_telemetry.position;
+        m_is_unwrapped_position_valid = true;
+        //sample time - reception time if the kernel timestamp is not available
+        m_telemetry_timestamp = (timestamp != 0) ? timestamp : control::get_now_nsec();
+        //reacting on fault bits in status word
+        _process_faults<protocol>(can);
+        //Healthcheck timer reset
+        m_shaft_healthcheck_timer.restart(); //good health
+        //setting the status - on any incoming frame
+        m_state = telemetry_state_t::SHAFT_TELEMETRY_COMING;
+        //publishing the sample for other threads - lock-free
+        _push_telemetry_sample<protocol>();
+        //
+        return true;
+    } //_process_tpdo1()
+
+    template <class protocol>
+    bool _process_tpdo2(network::can_socket& /*can*/, const uint8_t* buffer, uint8_t bytes_received, control::nsec_t /*timestamp*/)
+    {   //extracting telemetry values
+        _parse_tpdo<protocol, 1>(buffer, bytes_received);
+        //
+        return true;
+    } //_process_tpdo2()
+
+    template <class protocol>
+    bool _process_tpdo3(network::can_socket& /*can*/, const uint8_t* buffer, uint8_t bytes_received, control::nsec_t /*timestamp*/)
+    {   //extracting telemetry values
+        _parse_tpdo<protocol, 2>(buffer, bytes_received);
+        //
+        return true;
+    } //_process_tpdo3()
+
+    template <class protocol>
+    bool _process_tpdo4(network::can_socket& /*can*/, const uint8_t* buffer, uint8_t bytes_received, control::nsec_t /*timestamp*/)
+    {   //extracting telemetry values
+        _parse_tpdo<protocol, 3>(buffer, bytes_received);
+        //
+        return true;
+    } //_process_tpdo4()
+
+    template <class protocol>
+    bool _process_combined_tpdo(network::can_socket& can, const uint8_t* buffer, uint8_t bytes_received, control::nsec_t timestamp)
+    {
+        const size_t PDO_SIZE = network::canopen::PDO_PAYLOAD_SIZE;
+        if(bytes_received >= 2*PDO_SIZE) _parse_tpdo<protocol, 1>(buffer + 1*PDO_SIZE, PDO_SIZE);
+        if(bytes_received >= 3*PDO_SIZE) _parse_tpdo<protocol, 2>(buffer + 2*PDO_SIZE, PDO_SIZE);
+        if(bytes_received >= 4*PDO_SIZE) _parse_tpdo<protocol, 3>(buffer + 3*PDO_SIZE, PDO_SIZE);
+        return (bytes_received >= PDO_SIZE) && _process_tpdo1<protocol>(can, buffer, PDO_SIZE, timestamp);
+    } //_process_combined_tpdo()
+
+
+    template <class protocol>
+    bool _process_emcy(network::can_socket& /*can*/, const uint8_t* buffer, uint8_t bytes_received, control::nsec_t timestamp)
+    {
+        const bool result = network::canopen::parse_emcy(buffer, bytes_received, m_emcy);
+        if(result)
+        {
+            m_emcy_counter++;
+            _update_fault_history<protocol>((timestamp != 0) ? timestamp : control::get_now_nsec());
+        }
+        return result;
+    } //_process_emcy()
+
 private:
 
+    //helper function - the version of the runtime-configured controller
+    bool _is_protocol_2_0() const
+    {
+        assert((m_protocol_version == protocol_version_t::PROTOCOL_VERSION_2_0) || (m_protocol_version == protocol_version_t::PROTOCOL_VERSION_LEGACY));
+        return m_protocol_version == protocol_version_t::PROTOCOL_VERSION_2_0;
+    } //_is_protocol_2_0()
+
     //helper function
     void _reset_to_initial_state()
     {
         //stop sending RPDOs
         m_operation_mode = operation_mode_t::UNDEFINED_MODE;
+        m_trajectory.cancel();
         //waiting for telemetry to come
         m_state = telemetry_state_t::NO_SHAFT_TELEMETRY; //setting the state to "no connection"
-        //resetting fault statistics
+        //resetting fault statistics - the history is kept, an active fault stays uncleared
         m_fault_ack_counter = 0;
+        m_last_fault_ack_time = 0;
+        m_emcy.error_code = network::canopen::EMCY_ERROR_CODE_RESET;
+        m_is_fault_active = false;
+        //forgetting the sample times - the next sample starts a new series
+        m_previous_telemetry_timestamp = 0;
+        m_telemetry_timestamp = 0;
     }
 
-    //helper function - version router
-    void _send_rpdo_as_per_current_operation_mode(network::can_socket& can) /* const */
+    //helper function - the setpoint is clamped to the position limits by the interpolator
+    void _update_trajectory()
+    {
+        assert(m_operation_mode == operation_mode_t::POSITION_MODE);
+        m_position_command = uint16_t(m_trajectory.update(control::get_now_nsec()) + 0.5);
+    } //_update_trajectory()
+
+    //helper function
+    template <class protocol>
+    void _push_telemetry_sample()
+    {
+        servosila_telemetry_sample_t sample;
+        sample.timestamp = m_telemetry_timestamp;
+        sample.status    = m_telemetry.status;
+        sample.position  = m_telemetry.position;
+        sample.speed     = m_telemetry.speed;
+        sample.amps      = m_telemetry.amps;
+        sample.faults    = protocol::get_fault_flags(m_telemetry);
+        //the placeholder fields are not reported as measurements unless the mapping has been confirmed
+        sample.is_extended_telemetry_valid = !protocol::IS_LEGACY && m_is_extended_telemetry_mapped;
+        sample.supply_voltage         = sample.is_extended_telemetry_valid ? m_telemetry.supply_voltage         : 0;
+        sample.motor_temperature      = sample.is_extended_telemetry_valid ? m_telemetry.motor_temperature      : 0;
+        sample.controller_temperature = sample.is_extended_telemetry_valid ? m_telemetry.controller_temperature : 0;
+        sample.error_code             = sample.is_extended_telemetry_valid ? m_telemetry.error_code             : 0;
+        m_telemetry_ring.push(sample); //a full ring drops the sample - never blocks the control loop
+    } //_push_telemetry_sample()
+
+    //helper function - the mode of the command that stops the motor: holding the latest position telemetry,
+    //...zero speed or zero amps; the command values are not taken from the current commands
+    operation_mode_t _get_halt_operation_mode() const
+    {
+        operation_mode_t result = operation_mode_t::SPEED_MODE;
+        if(m_state == telemetry_state_t::SHAFT_TELEMETRY_COMING)
+        {   //normal situation - telemetry is coming, easy to halt
+            switch(m_operation_mode)
+            {
+                case operation_mode_t::POSITION_MODE:
+                {   //setting the position to the latest position telemetry
+                    result = operation_mode_t::POSITION_MODE;
+                    break;
+                }
+                case operation_mode_t::SPEED_MODE:
+                {   //zero speed
+                    result = operation_mode_t::SPEED_MODE;
+                    break;
+                }
+                case operation_mode_t::AMPS_MODE:
+                {   //zero amps/torque
+                    result = operation_mode_t::AMPS_MODE;
+                    break;
+                }
+                case operation_mode_t::UNDEFINED_MODE:
+                {   //workaround - since UNDEFINED_MODE
+                    //...normally, halt() shall not be called in UNDEFINED_MODE since the motor is not moving anyway
+                    //...but this might happen after an abdrupt process reboot
+                    //...when the process has just restarted, but the motor is still moving
+                    //setting zero speed
+                    result = operation_mode_t::SPEED_MODE;
+                    //
+                    break;
+                }
+                default:
+                {   //unknown state
+                    assert(false);
+                    break;
+                }
+            } //switch()
+        }
+        else //NO SHAFT TELEMETRY
+        {   //workaround - since NO SHAFT TELEMETRY
+            //..might happen after a process reboot
+            //setting zero speed
+            result = operation_mode_t::SPEED_MODE;
+
+        } //if SHAFT TELEMETRY IS COMING
+        return result;
+    } //_get_halt_operation_mode()
+
+    //helper function
+    template <class protocol>
+    void _send_rpdo_as_per_current_operation_mode(network::can_socket& can) const
     {
         assert(can.is_connected());
-        assert(m_device_id != 0);
-        //depending on the version, call the right helper fucntion
-        switch(m_protocol_version)
+        can_frame frame;
+        if(_build_rpdo_as_per_current_operation_mode<protocol>(frame))
         {
-            case protocol_version_t::PROTOCOL_VERSION_LEGACY:
-            {   //legacy
-                _send_rpdo_as_per_current_operation_mode_legacy_protocol(can);
-                break;
-            }
-            case protocol_version_t::PROTOCOL_VERSION_2_0:
-            {   //canopen
-                _send_rpdo_as_per_current_operation_mode_protocol_2_0(can);
-                break;
-            }
-            default:
-            {   //unknown protocol version
-                assert(false);
-                break;
-            }
+            can.send(frame.can_id, frame.data, frame.can_dlc);
         }
     } //_send_rpdo_as_per_current_operation_mode()
 
+    //helper function - the builder of the protocol, chosen at compile time
+    //...returns false if there is no RPDO to send
+    template <class protocol>
+    bool _build_rpdo_as_per_current_operation_mode(can_frame& frame) const
+    {
+        return _build_rpdo_for_command<protocol>(frame, m_operation_mode, m_position_command, m_speed_command, m_amps_command);
+    } //_build_rpdo_as_per_current_operation_mode()
+
+    //helper function - the RPDO of a command given in full, e.g. the halt command (see _build_halt_rpdo())
+    template <class protocol>
+    bool _build_rpdo_for_command(can_frame& frame, operation_mode_t operation_mode, uint16_t position_command, int16_t speed_command, int16_t amps_command) const
+    {
+        return protocol::IS_LEGACY ? _build_rpdo_for_command_legacy_protocol(frame, operation_mode, position_command, speed_command)
+                                   : _build_rpdo_for_command_protocol_2_0(frame, operation_mode, position_command, speed_command, amps_command);
+    } //_build_rpdo_for_command()
+
     //helper function
-    void _send_rpdo_as_per_current_operation_mode_protocol_2_0(network::can_socket& can) const
+    bool _build_rpdo_for_command_protocol_2_0(can_frame& frame, operation_mode_t operation_mode, uint16_t position_command, int16_t speed_command, int16_t amps_command) const
     {
         assert(m_protocol_version == protocol_version_t::PROTOCOL_VERSION_2_0);
-        assert(can.is_connected());
         assert(m_device_id != 0);
-        switch(m_operation_mode)
+        bool result = true;
+        switch(operation_mode)
         {
             case operation_mode_t::UNDEFINED_MODE:
             {   //don't send any RPDO command
+                result = false;
                 break;
             }
             case operation_mode_t::POSITION_MODE:
             {   //device protocol-specific constant
                 const uint16_t RPDO_COMMAND_POSITION            = 0x0021;
                 const uint8_t  RPDO_POSITION_OFFSET_IN_PAYLOAD  = 2;
-                const uint16_t position = m_position_command;
-                //sending
-                network::canopen::send_expedited_rpdo(can, m_device_id, RPDO_SERVOSILA_CHANNEL_FOR_MOTOR_CONTROL, RPDO_COMMAND_POSITION, RPDO_POSITION_OFFSET_IN_PAYLOAD, position);
+                const uint16_t position = position_command;
+                //building
+                network::canopen::build_expedited_rpdo(frame, m_device_id, RPDO_SERVOSILA_CHANNEL_FOR_MOTOR_CONTROL, RPDO_COMMAND_POSITION, RPDO_POSITION_OFFSET_IN_PAYLOAD, position);
                 //
                 break;
             }
@@ -443,9 +1409,9 @@ private:
             {   //device protocol-specific constant
                 const uint16_t RPDO_COMMAND_SPEED            = 0x0005;
                 const uint8_t  RPDO_SPEED_OFFSET_IN_PAYLOAD  = 4;
-                const uint16_t speed = m_speed_command;
-                //sending
-                network::canopen::send_expedited_rpdo(can, m_device_id, RPDO_SERVOSILA_CHANNEL_FOR_MOTOR_CONTROL, RPDO_COMMAND_SPEED, RPDO_SPEED_OFFSET_IN_PAYLOAD, speed);
+                const uint16_t speed = speed_command;
+                //building
+                network::canopen::build_expedited_rpdo(frame, m_device_id, RPDO_SERVOSILA_CHANNEL_FOR_MOTOR_CONTROL, RPDO_COMMAND_SPEED, RPDO_SPEED_OFFSET_IN_PAYLOAD, speed);
                 //
                 break;
             }
@@ -453,312 +1419,465 @@ private:
             {   //device protocol-specific constant
                 const uint16_t RPDO_COMMAND_AMPS            = 0x0001;
                 const uint8_t  RPDO_AMPS_OFFSET_IN_PAYLOAD  = 6;
-                const uint16_t amps = m_amps_command;
-                //sending
-                network::canopen::send_expedited_rpdo(can, m_device_id, RPDO_SERVOSILA_CHANNEL_FOR_MOTOR_CONTROL, RPDO_COMMAND_AMPS, RPDO_AMPS_OFFSET_IN_PAYLOAD, amps);
+                const uint16_t amps = amps_command;
+                //building
+                network::canopen::build_expedited_rpdo(frame, m_device_id, RPDO_SERVOSILA_CHANNEL_FOR_MOTOR_CONTROL, RPDO_COMMAND_AMPS, RPDO_AMPS_OFFSET_IN_PAYLOAD, amps);
                 //
                 break;
             }
             default:
             {
                 assert(false);
+                result = false;
                 break;
             }
         }//switch()
-    } //_send_rpdo_as_per_current_operation_mode_protocol_2_0()
+        return result;
+    } //_build_rpdo_for_command_protocol_2_0()
 
-    //helper function
-    void _send_rpdo_as_per_current_operation_mode_legacy_protocol(network::can_socket& can) /* const */
+    //helper function - no amps mode in the legacy protocol
+    bool _build_rpdo_for_command_legacy_protocol(can_frame& frame, operation_mode_t operation_mode, uint16_t position_command, int16_t speed_command) const
     {
         assert(m_protocol_version == protocol_version_t::PROTOCOL_VERSION_LEGACY);
-        assert(can.is_connected());
         assert(m_device_id != 0);
-
-        switch(m_operation_mode)
+        bool result = true;
+        memset(&frame, 0, sizeof(frame));
+        frame.can_dlc = 8; //RPDO frames size
+        frame.data[4] = m_device_id; //workaround for a ROBOTEQ bug
+        switch(operation_mode)
         {
             case operation_mode_t::UNDEFINED_MODE:
             {   //don't send any RPDO command
+                result = false;
                 break;
             }
             case operation_mode_t::POSITION_MODE:
             {
-                uint8_t command[8] = {0,0,0,0,0,0,0,0};
-                memcpy(&command, &m_position_command, sizeof(m_position_command));
-                command[4] = m_device_id; //workaround for a ROBOTEQ bug
-                //can.send(RPDO_SERVOSILA_CHANNEL_FOR_MOTOR_CONTROL+m_device_id, &m_position_command, sizeof(m_position_command));
-                can.send(RPDO_SERVOSILA_CHANNEL_FOR_MOTOR_CONTROL+m_device_id, &command, sizeof(command));
-                //
-                //std::cout<<"Position command: "<<m_position_command<<std::endl;
+                frame.can_id = RPDO_SERVOSILA_CHANNEL_FOR_MOTOR_CONTROL+m_device_id;
+                ftl::store_little_endian(&(frame.data[0]), position_command);
                 break;
             }
             case operation_mode_t::SPEED_MODE:
-            {
-                //determine handling by the type of the drive - chassis drive or servo drive
+            {   //sign and magnitude
+                uint16_t speed = uint16_t(speed_command);
+                if(speed_command<0) speed = uint16_t(uint16_t(-int32_t(speed_command)) | LEGACY_SPEED_SIGN_BIT);
+                ftl::store_little_endian(&(frame.data[0]), speed);
+                //determine the channel by the type of the drive - chassis drive or servo drive
                 if(m_is_position_encoder_available)
-                {
-                    if(m_speed_command<0)
-                    {
-                        //Regular Servo Motors (not Chassis Drives) in Speed Mode
-                        m_speed_command = -m_speed_command;
-                        uint8_t a[2];
-                        assert(sizeof(a)==sizeof(m_speed_command));
-                        memcpy(&a, &m_speed_command, sizeof(m_speed_command));
-                        a[1] |= 128;
-                        memcpy(&m_speed_command, &a, sizeof(m_speed_command));
-                        //std::cout<<"Legacy servo, negative speed: "<<std::hex<<m_speed_command<<std::endl;
-                    }
-                    uint8_t command[8] = {0,0,0,0,0,0,0,0};
-                    memcpy(&command, &m_speed_command, sizeof(m_speed_command));
-                    command[4] = m_device_id; //workaround for a ROBOTEQ bug
-                    //can.send(RPDO_SERVOSILA_CHANNEL_FOR_LEGACY_SPEED_CONTROL+m_device_id, &m_speed_command, sizeof(m_speed_command));
-                    can.send(RPDO_SERVOSILA_CHANNEL_FOR_LEGACY_SPEED_CONTROL+m_device_id, &command, sizeof(command));
+                {   //Regular Servo Motors (not Chassis Drives) in Speed Mode
+                    frame.can_id = RPDO_SERVOSILA_CHANNEL_FOR_LEGACY_SPEED_CONTROL+m_device_id;
                 }
                 else
                 {   //Chassis Drive Motors
-                    if(m_speed_command<0)
-                    {
-                        //std::cout<<"CHASSIS: Negative speed"<<std::endl;
-                        m_speed_command = -m_speed_command;
-                        uint8_t a[2];
-                        assert(sizeof(a)==sizeof(m_speed_command));
-                        memcpy(&a, &m_speed_command, sizeof(m_speed_command));
-                        a[1] |= 128;
-                        memcpy(&m_speed_command, &a, sizeof(m_speed_command));
-                    }
-                    uint8_t command[8] = {0,0,0,0,0,0,0,0};
-                    memcpy(&command, &m_speed_command, sizeof(m_speed_command));
-                    command[4] = m_device_id; //workaround for a ROBOTEQ bug
-                    //can.send(RPDO_SERVOSILA_CHANNEL_FOR_MOTOR_CONTROL+m_device_id, &m_speed_command, sizeof(m_speed_command));
-                    can.send(RPDO_SERVOSILA_CHANNEL_FOR_MOTOR_CONTROL+m_device_id, &command, sizeof(command));
+                    frame.can_id = RPDO_SERVOSILA_CHANNEL_FOR_MOTOR_CONTROL+m_device_id;
                 }
-                //
                 break;
             }
             case operation_mode_t::AMPS_MODE:
             {
                 assert(false); //not supported
-                //
+                result = false;
                 break;
             }
             default:
             {   //unknown mode
                 assert(false);
+                result = false;
                 break;
             }
         }//switch()
-    } //_send_rpdo_as_per_current_operation_mode_legacy_protocol()
+        return result;
+    } //_build_rpdo_for_command_legacy_protocol()
 
-    //helper function - version router
-    void _parse_tpdo1(const uint8_t* buffer, uint8_t bytes_received)
+    //helper function - decodes a TPDO as per its layout (see servosila_tpdo_layouts)
+    //...the placeholder layouts of TPDO2-TPDO4 (2.0) only if the mapping has been confirmed
+    template <class protocol, size_t channel_index>
+    void _parse_tpdo(const uint8_t* buffer, uint8_t bytes_received)
     {
-        //depending on the version, call the right helper fucntion
-        switch(m_protocol_version)
+        const bool is_layout_known = (channel_index == 0) || protocol::IS_LEGACY || m_is_extended_telemetry_mapped;
+        if(is_layout_known && (bytes_received == network::canopen::PDO_PAYLOAD_SIZE)) //TPDO frames size
         {
-            case protocol_version_t::PROTOCOL_VERSION_LEGACY:
-            {   //legacy
-                _parse_tpdo1_legacy_protocol(buffer, bytes_received);
-                break;
-            }
-            case protocol_version_t::PROTOCOL_VERSION_2_0:
-            {   //canopen
-                _parse_tpdo1_protocol_2_0(buffer, bytes_received);
-                break;
-            }
-            default:
-            {   //unknown protocol version
-                assert(false);
-                break;
-            }
+            protocol::template decode_tpdo<channel_index>(buffer, m_telemetry, m_is_position_encoder_available);
         }
-    } //_parse_tpdo1()
+    } //_parse_tpdo()
+
 
     //helper function
-    void _parse_tpdo1_legacy_protocol(const uint8_t* buffer, uint8_t bytes_received)
+    template <class protocol>
+    void _process_faults(network::can_socket& can)
     {
-        assert(m_protocol_version == protocol_version_t::PROTOCOL_VERSION_LEGACY);
-        //
-        if(bytes_received == 8) //TPDO frames size
+        //recording the fault
+        _update_fault_history<protocol>(m_telemetry_timestamp);
+        //fault handling logic - no fault ACK in the legacy protocol, the faults are only recorded
+        if(!protocol::IS_LEGACY && (protocol::get_fault_flags(m_telemetry) != 0))
         {
-            //determine telemetry type by the type of the drive
-            if(m_is_position_encoder_available)
-            {
-                uint16_t position = 0;
-                memcpy(&position,   &(buffer[4]), sizeof(position));
-                m_position_telemetry = position;
-            }
-            else
-            {
-                int16_t speed = 0;
-                memcpy(&speed,   &(buffer[4]), sizeof(speed));
-                m_speed_telemetry = speed;
+            if(can.is_connected())
+            {   //automatically send ACK to all FAULTs, rate limited
+                if((m_last_fault_ack_time == 0) || (m_telemetry_timestamp - m_last_fault_ack_time >= m_fault_ack_interval))
+                {
+                    _send_fault_ack(can, m_device_id);
+                    m_last_fault_ack_time = m_telemetry_timestamp;
+                    //increment fault counter
+                    m_fault_ack_counter++;
+                    if(m_is_fault_active) _get_active_fault().acks_count++;
+                }
+                else
+                {   //the previous ACK is still on its way
+                    m_fault_acks_suppressed++;
+                }
             }
         }
-    } //_parse_tpdo1_legacy_protocol()
+    } //_process_faults()
 
     //helper function
-    void _parse_tpdo1_protocol_2_0(const uint8_t* buffer, uint8_t bytes_received)
+    servosila_fault_record_t& _get_active_fault()
     {
-        assert(m_protocol_version == protocol_version_t::PROTOCOL_VERSION_2_0);
-        //
-        if(bytes_received == 8) //TPDO frames size
-        {
-            uint16_t status = 0;
-            uint16_t position = 0;
-            int16_t  speed = 0;
-            int16_t  amps = 0;
-
-
-            //TPDO, 0x180, UINT16,Offset 0, Status Word
-            //TPDO, 0x180, UINT16,Offset 2, Position
-            //TPDO, 0x180, INT16, Offset 4, Speed
-            //TPDO, 0x180, INT16, Offset 6, Amps
-            //Extracting
-            memcpy(&status,   &(buffer[0]), sizeof(status));
-            memcpy(&position, &(buffer[2]), sizeof(position));
-            memcpy(&speed,    &(buffer[4]), sizeof(speed));
-            memcpy(&amps,     &(buffer[6]), sizeof(amps));
-            //Setting
-            m_status_telemetry   = status;
-            m_position_telemetry = position;
-            m_speed_telemetry    = speed;
-            m_amps_telemetry     = amps;
-        }
-    } //_parse_tpdo1_protocol_2_0()
+        assert(m_is_fault_active);
+        return m_fault_history[(m_faults_count - 1) % SERVOSILA_FAULT_HISTORY_CAPACITY];
+    } //_get_active_fault()
 
-
-    //helper function - version router
-    void _parse_tpdo2(const uint8_t* buffer, uint8_t bytes_received)
+    //helper function - opens, updates and closes the fault records
+    //...a fault is active while there are fault flags in the telemetry or an EMCY error without an EMCY error reset
+    template <class protocol>
+    void _update_fault_history(control::nsec_t now)
     {
-        //depending on the version, call the right helper fucntion
-        switch(m_protocol_version)
+        const uint16_t fault_flags = protocol::get_fault_flags(m_telemetry);
+        const bool is_fault = (fault_flags != 0) || (m_emcy.error_code != network::canopen::EMCY_ERROR_CODE_RESET);
+        if(is_fault && !m_is_fault_active)
+        {   //new fault - overwriting the oldest record
+            servosila_fault_record_t& record = m_fault_history[m_faults_count % SERVOSILA_FAULT_HISTORY_CAPACITY];
+            memset(&record, 0, sizeof(record));
+            record.timestamp = now;
+            m_faults_count++;
+            m_is_fault_active = true;
+        }
+        if(m_is_fault_active)
         {
-            case protocol_version_t::PROTOCOL_VERSION_LEGACY:
-            {   //legacy
-                _parse_tpdo2_legacy_protocol(buffer, bytes_received);
-                break;
+            servosila_fault_record_t& record = _get_active_fault();
+            record.fault_flags |= fault_flags;
+            if(m_emcy.error_code != network::canopen::EMCY_ERROR_CODE_RESET)
+            {
+                record.error_code     = m_emcy.error_code;
+                record.error_register = m_emcy.error_register;
             }
-            case protocol_version_t::PROTOCOL_VERSION_2_0:
-            {   //canopen
-                break;
+            else if((record.error_code == 0) && !protocol::IS_LEGACY && m_is_extended_telemetry_mapped)
+            {
+                record.error_code = m_telemetry.error_code;
             }
-            default:
-            {   //unknown protocol version
-                assert(false);
-                break;
+            if(!is_fault)
+            {   //cleared
+                record.ack_latency = (now > record.timestamp) ? (now - record.timestamp) : 0;
+                m_is_fault_active = false;
             }
         }
-    } //_parse_tpdo1()
+    } //_update_fault_history()
 
     //helper function
-    void _parse_tpdo2_legacy_protocol(const uint8_t* buffer, uint8_t bytes_received)
+    void _send_fault_ack(network::can_socket& can, uint8_t device_id)
     {
-        assert(m_protocol_version == protocol_version_t::PROTOCOL_VERSION_LEGACY);
-        //
-        if(m_is_position_encoder_available)
-        {
-            if(bytes_received == 8) //TPDO frames size
-            {
-                int16_t speed = 0;
-                memcpy(&speed,   &(buffer[4]), sizeof(speed));
-                m_speed_telemetry = speed;
-            }
-        }
-        else
-        {
-            //ignore TPDO2 for legacy drive motors
-            //..since the drive speed comes in TPDO1
-        }
-    } //_parse_tpdo2_legacy_protocol()
+        assert(m_protocol_version == protocol_version_t::PROTOCOL_VERSION_2_0);
+        //device protocol-specific constant
+        const uint16_t RPDO_COMMAND_FAULT_ACK = 0x0002;
+        const uint8_t  RPDO_FAULT_ACK_OFFSET_IN_PAYLOAD  = 2;
+        const uint8_t  dummy_fault_ack_command = 0;
+        //sending out RPDO command
+        network::canopen::send_expedited_rpdo(can, device_id, RPDO_SERVOSILA_CHANNEL_FOR_MOTOR_CONTROL, RPDO_COMMAND_FAULT_ACK, RPDO_FAULT_ACK_OFFSET_IN_PAYLOAD, dummy_fault_ack_command);
+    }
+
+}; //class servosila_motor_controller
 
-    //helper function - version router
-    void _parse_tpdo3(const uint8_t* buffer, uint8_t bytes_received)
+/*
+    Motor controller of a drive with the protocol fixed at compile time (servosila_protocol_2_0, servosila_protocol_legacy)
+    - TPDO parsing, fault handling and RPDO building have no protocol branches and inline into the caller
+    - servosila_motor_controller is a private base: the protocol independent part of its interface is re-exported,
+      its configure() and its runtime-routed frame handlers are not reachable - the typed path cannot be bypassed,
+      nor the protocol version changed
+    - servosila_canbus_dispatcher routes the frames of a registered typed controller to the methods below
+*/
+template <class protocol>
+class servosila_typed_motor_controller : private servosila_motor_controller
+{
+    //keeps the controller as a servosila_motor_controller, calls the methods below through its handlers
+    friend class servosila_canbus_dispatcher;
+public:
+    typedef protocol protocol_t;
+    using servosila_motor_controller::protocol_version_t;
+    using servosila_motor_controller::telemetry_state_t;
+    using servosila_motor_controller::operation_mode_t;
+    //the protocol independent interface
+    using servosila_motor_controller::change_timeouts;
+    using servosila_motor_controller::get_state;
+    using servosila_motor_controller::configure_heartbeat;
+    using servosila_motor_controller::set_extended_telemetry_mapped;
+    using servosila_motor_controller::is_extended_telemetry_mapped;
+    using servosila_motor_controller::configure_heartbeat_producer;
+    using servosila_motor_controller::get_nmt_state;
+    using servosila_motor_controller::get_heartbeat_consumer;
+    using servosila_motor_controller::send_nmt_command;
+    using servosila_motor_controller::start_node;
+    using servosila_motor_controller::stop_node;
+    using servosila_motor_controller::enter_pre_operational;
+    using servosila_motor_controller::reset_node;
+    using servosila_motor_controller::send_node_guarding_request;
+    using servosila_motor_controller::get_operation_mode;
+    using servosila_motor_controller::is_operational;
+    using servosila_motor_controller::is_position_encoder_available;
+    using servosila_motor_controller::get_protocol_version;
+    using servosila_motor_controller::get_faults_ack_counter;
+    using servosila_motor_controller::execute_healthcheck;
+    using servosila_motor_controller::set_synchronous_mode;
+    using servosila_motor_controller::is_synchronous;
+    using servosila_motor_controller::configure_synchronous_pdos;
+    using servosila_motor_controller::configure_asynchronous_pdos;
+    using servosila_motor_controller::get_rpdo_timeout;
+    using servosila_motor_controller::get_shaft_healthcheck_timeout;
+    using servosila_motor_controller::get_healthcheck_period;
+    using servosila_motor_controller::get_healthcheck_deadline;
+    using servosila_motor_controller::process_heartbeat;
+    using servosila_motor_controller::set_position_command;
+    using servosila_motor_controller::set_speed_command;
+    using servosila_motor_controller::set_amps_command;
+    using servosila_motor_controller::set_undefined_command;
+    using servosila_motor_controller::configure_trajectory;
+    using servosila_motor_controller::append_trajectory;
+    using servosila_motor_controller::start_trajectory;
+    using servosila_motor_controller::cancel_trajectory;
+    using servosila_motor_controller::is_trajectory_active;
+    using servosila_motor_controller::get_trajectory_free_space;
+    using servosila_motor_controller::halt;
+    using servosila_motor_controller::get_position_telemetry;
+    using servosila_motor_controller::get_speed_telemetry;
+    using servosila_motor_controller::get_amps_telemetry;
+    using servosila_motor_controller::get_status_telemetry;
+    using servosila_motor_controller::get_supply_voltage_telemetry;
+    using servosila_motor_controller::get_motor_temperature_telemetry;
+    using servosila_motor_controller::get_controller_temperature_telemetry;
+    using servosila_motor_controller::get_error_code_telemetry;
+    using servosila_motor_controller::get_multiturn_position_telemetry;
+    using servosila_motor_controller::get_warnings_telemetry;
+    using servosila_motor_controller::get_digital_inputs_telemetry;
+    using servosila_motor_controller::get_analog_input_telemetry;
+    using servosila_motor_controller::get_telemetry;
+    using servosila_motor_controller::get_telemetry_timestamp;
+    using servosila_motor_controller::get_telemetry_sample_period;
+    using servosila_motor_controller::get_previous_position_telemetry;
+    using servosila_motor_controller::get_unwrapped_position_telemetry;
+    using servosila_motor_controller::get_telemetry_age;
+    using servosila_motor_controller::drain_telemetry;
+    using servosila_motor_controller::get_telemetry_overflow_counter;
+    using servosila_motor_controller::get_fault_ack_counter;
+    using servosila_motor_controller::set_fault_ack_interval;
+    using servosila_motor_controller::get_fault_acks_suppressed;
+    using servosila_motor_controller::get_emcy_counter;
+    using servosila_motor_controller::get_latest_emcy;
+    using servosila_motor_controller::get_fault_record;
+    using servosila_motor_controller::get_fault_history_size;
+    using servosila_motor_controller::get_faults_count;
+    using servosila_motor_controller::is_fault_active;
+    using servosila_motor_controller::get_device_id;
+    //limits and commands
+    using servosila_motor_controller::m_min_position_limit;
+    using servosila_motor_controller::m_max_position_limit;
+    using servosila_motor_controller::m_position_command;
+    using servosila_motor_controller::m_min_speed_limit;
+    using servosila_motor_controller::m_max_speed_limit;
+    using servosila_motor_controller::m_speed_command;
+    using servosila_motor_controller::m_min_amps_limit;
+    using servosila_motor_controller::m_max_amps_limit;
+    using servosila_motor_controller::m_amps_command;
+
+    static protocol_version_t get_static_protocol_version()
     {
-        //depending on the version, call the right helper fucntion
-        switch(m_protocol_version)
-        {
-            case protocol_version_t::PROTOCOL_VERSION_LEGACY:
-            {   //legacy
-                _parse_tpdo3_legacy_protocol(buffer, bytes_received);
-                break;
-            }
-            case protocol_version_t::PROTOCOL_VERSION_2_0:
-            {   //canopen
-                break;
-            }
-            default:
-            {   //unknown protocol version
-                assert(false);
-                break;
-            }
-        }
-    } //_parse_tpdo3()
+        return protocol::IS_LEGACY ? protocol_version_t::PROTOCOL_VERSION_LEGACY : protocol_version_t::PROTOCOL_VERSION_2_0;
+    } //get_static_protocol_version()
 
-    //helper function
-    void _parse_tpdo3_legacy_protocol(const uint8_t* buffer, uint8_t bytes_received)
+    //servosila_motor_controller::configure() without the protocol version
+    void configure( uint8_t  device_id,
+                    bool     position_encoder_available, //chassis drives don't have an encoder
+                    control::usec_t rpdo_timeout,
+                    control::usec_t shaft_telemetry_healthcheck_timeout,
+                    uint16_t min_position_limit,
+                    uint16_t max_position_limit,
+                    int16_t  min_speed_limit,
+                    int16_t  max_speed_limit,
+                    int16_t  min_amps_limit,
+                    int16_t  max_amps_limit
+                  )
     {
-        assert(m_protocol_version == protocol_version_t::PROTOCOL_VERSION_LEGACY);
-        //
-        if(bytes_received == 8) //TPDO frames size
-        {
-            uint16_t fault_and_status = 0;
-            memcpy(&fault_and_status,   &(buffer[0]), sizeof(fault_and_status));
-            m_faults_telemetry = fault_and_status;
-        }
-    } //_parse_tpdo3_legacy_protocol()
+        servosila_motor_controller::configure(device_id, get_static_protocol_version(), position_encoder_available,
+                                              rpdo_timeout, shaft_telemetry_healthcheck_timeout,
+                                              min_position_limit, max_position_limit,
+                                              min_speed_limit, max_speed_limit,
+                                              min_amps_limit, max_amps_limit);
+    } //configure()
 
+    void execute(network::can_socket& can)
+    {
+        _execute<protocol>(can);
+    } //execute()
 
-    //helper - version router
-    void _process_faults(network::can_socket& can)
+    void execute_rpdo(network::can_socket& can)
     {
-        switch(m_protocol_version)
-        {
-            case protocol_version_t::PROTOCOL_VERSION_2_0:
-            {
-                _process_faults_protocol_2_0(can);
-                break;
-            }
-            case protocol_version_t::PROTOCOL_VERSION_LEGACY:
-            {   //no faults handling in the legacy protocol
-                break;
-            }
-            default:
-            {   //unknown protocol version
-                assert(false);
-            }
-        } //switch()
-    } //_process_faults()
+        _execute_rpdo<protocol>(can);
+    } //execute_rpdo()
 
-    //helper function
-    void _process_faults_protocol_2_0(network::can_socket& can)
+    bool build_rpdo(can_frame& frame) const
     {
-        //applying the bit mask: computing the fault flags
-        const uint16_t fault_flags = m_status_telemetry & TELEMETRY_STATUS_FAULT_FLAGS_MASK;
-        //fault handling logic
-        if(fault_flags!=0)
-        {
-            if(can.is_connected())
-            {   //automatically send ACK to all FAULTs
-                _send_fault_ack(can, m_device_id);
-                //increment fault counter
-                m_fault_ack_counter++;
-                //log the fault here
+        return _build_rpdo<protocol>(frame);
+    } //build_rpdo()
+
+    bool build_halt_rpdo(can_frame& frame) const
+    {
+        return _build_halt_rpdo<protocol>(frame);
+    } //build_halt_rpdo()
+
+    bool process_canbus_callback(network::can_socket& can, const uint8_t* buffer, uint8_t bytes_received, canid_t source_can_id, control::nsec_t timestamp)
+    {
+        return _process_canbus_callback<protocol>(can, buffer, bytes_received, source_can_id, timestamp);
+    } //process_canbus_callback()
+
+    bool process_tpdo1(network::can_socket& can, const uint8_t* buffer, uint8_t bytes_received, control::nsec_t timestamp)
+    {
+        return _process_tpdo1<protocol>(can, buffer, bytes_received, timestamp);
+    } //process_tpdo1()
+
+    bool process_tpdo2(network::can_socket& can, const uint8_t* buffer, uint8_t bytes_received, control::nsec_t timestamp)
+    {
+        return _process_tpdo2<protocol>(can, buffer, bytes_received, timestamp);
+    } //process_tpdo2()
+
+    bool process_tpdo3(network::can_socket& can, const uint8_t* buffer, uint8_t bytes_received, control::nsec_t timestamp)
+    {
+        return _process_tpdo3<protocol>(can, buffer, bytes_received, timestamp);
+    } //process_tpdo3()
+
+    bool process_tpdo4(network::can_socket& can, const uint8_t* buffer, uint8_t bytes_received, control::nsec_t timestamp)
+    {
+        return _process_tpdo4<protocol>(can, buffer, bytes_received, timestamp);
+    } //process_tpdo4()
+
+    bool process_combined_tpdo(network::can_socket& can, const uint8_t* buffer, uint8_t bytes_received, control::nsec_t timestamp)
+    {
+        return _process_combined_tpdo<protocol>(can, buffer, bytes_received, timestamp);
+    } //process_combined_tpdo()
+
+    bool process_emcy(network::can_socket& can, const uint8_t* buffer, uint8_t bytes_received, control::nsec_t timestamp)
+    {
+        return _process_emcy<protocol>(can, buffer, bytes_received, timestamp);
+    } //process_emcy()
+
+}; //class servosila_typed_motor_controller
+
+typedef servosila_typed_motor_controller<servosila_protocol_2_0>  servosila_motor_controller_2_0;
+typedef servosila_typed_motor_controller<servosila_protocol_legacy> servosila_legacy_motor_controller;
+
+/*
+    Executes a group of motor controllers sharing one CANbus socket
+    - drains the socket with one receive_batch() call per tick (more only if the batch is full)
+    - offers every received frame to the controllers
+    - runs execute() on every controller
+    Returns the number of frames received.
+*/
+inline size_t execute_motor_controllers(network::can_socket& can, servosila_motor_controller* const* controllers, size_t controllers_count)
+{
+    size_t total_frames_received = 0;
+    //receive buffers
+    can_frame frames[network::CAN_SOCKET_MAX_BATCH_SIZE];
+    control::nsec_t timestamps[network::CAN_SOCKET_MAX_BATCH_SIZE];
+    //draining the socket
+    size_t frames_received = 0;
+    bool never_block = false; //blocking sockets: waiting for the first batch only
+    do
+    {
+        frames_received = can.receive_batch(frames, network::CAN_SOCKET_MAX_BATCH_SIZE, timestamps, never_block);
+        //offering every frame to the controllers
+        for(size_t i=0; i<frames_received; i++)
+        {   //only standard data frames carry telemetry
+            if((frames[i].can_id & ~CAN_SFF_MASK) != 0) continue;
+            for(size_t c=0; c<controllers_count; c++)
+            {
+                if(controllers[c]->process_canbus_callback(can, frames[i].data, frames[i].can_dlc, frames[i].can_id, timestamps[i])) break;
             }
         }
-    } //_process_faults_protocol_2_0()
+        total_frames_received += frames_received;
+        never_block = true;
+    }
+    while(can.get_last_receive_count() == network::CAN_SOCKET_MAX_BATCH_SIZE);
+    //healthchecks and RPDOs
+    for(size_t c=0; c<controllers_count; c++)
+    {
+        controllers[c]->execute(can);
+    }
+    //
+    return total_frames_received;
+} //execute_motor_controllers()
 
-    //helper function
-    void _send_fault_ack(network::can_socket& can, uint8_t device_id)
+/*
+    Packs a 2.0 protocol RPDO into a CAN FD combined command frame (see SERVOSILA_COMBINED_RPDO_SLOT_SIZE)
+    The frame has to be zeroed with its COB ID set before the first slot, see build_combined_rpdo_frame().
+    Returns false if the frame is full or the RPDO is not a motor control RPDO.
+*/
+inline bool add_combined_rpdo_slot(canfd_frame& frame, const can_frame& rpdo)
+{
+    bool result = false;
+    const uint16_t function_code = network::canopen::extract_function_code_from_cob_id(rpdo.can_id);
+    if((function_code == RPDO_SERVOSILA_CHANNEL_FOR_MOTOR_CONTROL) && (rpdo.can_dlc == network::canopen::PDO_PAYLOAD_SIZE) && (frame.len + SERVOSILA_COMBINED_RPDO_SLOT_SIZE <= CANFD_MAX_DLEN))
     {
-        assert(m_protocol_version == protocol_version_t::PROTOCOL_VERSION_2_0);
-        //device protocol-specific constant
-        const uint16_t RPDO_COMMAND_FAULT_ACK = 0x0002;
-        const uint8_t  RPDO_FAULT_ACK_OFFSET_IN_PAYLOAD  = 2;
-        const uint8_t  dummy_fault_ack_command = 0;
-        //sending out RPDO command
-        network::canopen::send_expedited_rpdo(can, device_id, RPDO_SERVOSILA_CHANNEL_FOR_MOTOR_CONTROL, RPDO_COMMAND_FAULT_ACK, RPDO_FAULT_ACK_OFFSET_IN_PAYLOAD, dummy_fault_ack_command);
+        uint8_t* slot = &(frame.data[frame.len]);
+        slot[0] = network::canopen::extract_node_id_from_cob_id(rpdo.can_id);
+        memcpy(&(slot[1]), rpdo.data, network::canopen::PDO_PAYLOAD_SIZE);
+        frame.len = uint8_t(frame.len + SERVOSILA_COMBINED_RPDO_SLOT_SIZE);
+        result = true;
     }
+    return result;
+} //add_combined_rpdo_slot()
 
-}; //class servosila_motor_controller
+/*
+    An empty CAN FD combined command frame - bit rate switched
+*/
+inline void build_combined_rpdo_frame(canfd_frame& frame)
+{
+    memset(&frame, 0, sizeof(frame));
+    frame.can_id = RPDO_SERVOSILA_CHANNEL_FOR_MOTOR_CONTROL; //Node ID 0
+    frame.flags  = CANFD_BRS | CANFD_FDF;
+} //build_combined_rpdo_frame()
+
+/*
+    Pads a combined command frame to a valid CAN FD payload size before sending - a zero Node ID ends the slots
+*/
+inline void finalize_combined_rpdo_frame(canfd_frame& frame)
+{
+    frame.len = network::get_canfd_payload_size(frame.len);
+} //finalize_combined_rpdo_frame()
+
+/*
+    Configures kernel-side receive filters on the socket so that only the TPDO, heartbeat and EMCY frames
+    of the given controllers wake up the process; all foreign traffic is dropped by the kernel.
+    Error frames are delivered as specified by error_mask (see can_socket::set_error_filter()).
+*/
+inline bool apply_motor_controllers_filters(network::can_socket& can, const servosila_motor_controller* const* controllers, size_t controllers_count, can_err_mask_t error_mask = 0)
+{
+    //collecting node IDs
+    uint8_t node_ids[128];
+    assert(controllers_count <= sizeof(node_ids));
+    for(size_t c=0; c<controllers_count; c++)
+    {
+        assert(controllers[c]->get_device_id() != 0);
+        node_ids[c] = controllers[c]->get_device_id();
+    }
+    //building the filters
+    can_filter filters[512];
+    const size_t channels_count = sizeof(SERVOSILA_RECEIVE_CHANNELS)/sizeof(SERVOSILA_RECEIVE_CHANNELS[0]);
+    const size_t filters_count = network::canopen::build_receive_filters(node_ids, controllers_count, SERVOSILA_RECEIVE_CHANNELS, channels_count, filters, sizeof(filters)/sizeof(filters[0]));
+    //setting the filters
+    bool result = false;
+    if((filters_count > 0) || (controllers_count == 0))
+    {
+        result = can.set_filters(filters, filters_count) && can.set_error_filter(error_mask);
+    }
+    //
+    return result;
+} //apply_motor_controllers_filters()
 
 } //namespace devices
 
@@ -0,0 +1,305 @@
+#ifndef DEVICES_SERVOSILA_MOTOR_GROUP_H_INCLUDED
+#define DEVICES_SERVOSILA_MOTOR_GROUP_H_INCLUDED
+
+#include "control/timer.h"
+#include "control/trajectory.h"
+#include "devices/servosila-motor-controller.h"
+#include "devices/servosila-canbus-dispatcher.h"
+
+namespace devices
+{
+
+/*
+    A group of motor controllers seen as arrays - the shape kinematics and logging code works with
+    - telemetry, commands and limits are kept as structure-of-arrays: one array per value, a slot per motor
+      in order of add_controller(); a loop over one value touches contiguous memory only
+    - update() gathers the telemetry of the controllers after the dispatcher has received the frames
+    - set_*_commands() clamp a whole array of commands to the limits in one branch-free loop,
+      then hand the commands over to the controllers; the RPDOs go out as usual (execute(), execute_sync())
+    - a command array switches all the motors it covers to its mode, keep the position and the speed
+      controlled motors in separate groups
+    Single-threaded: use the group from the thread running the controllers - the arrays are not cache-line aligned,
+    there is no false sharing to avoid, and the group can be allocated with operator new.
+*/
+template <size_t capacity>
+class servosila_motor_group
+{
+    static_assert(capacity > 0, "capacity must be positive");
+private:
+    servosila_motor_controller* m_controllers[capacity];
+    size_t m_controllers_count;
+    //telemetry - valid where m_is_operational is set, the latest values are kept otherwise
+    uint16_t m_positions[capacity];
+    int32_t  m_multiturn_positions[capacity];  //TPDO1 position with the wrap-arounds counted on the host
+    int16_t  m_speeds[capacity];
+    int16_t  m_amps[capacity];
+    uint16_t m_status[capacity];     //status word, 2.0 protocol only
+    uint16_t m_faults[capacity];     //fault flags of either protocol, 0 - no faults
+    control::nsec_t m_timestamps[capacity];
+    uint8_t  m_is_operational[capacity];
+    //limits - copied from the controllers
+    uint16_t m_min_position_limits[capacity];
+    uint16_t m_max_position_limits[capacity];
+    int16_t  m_min_speed_limits[capacity];
+    int16_t  m_max_speed_limits[capacity];
+    int16_t  m_min_amps_limits[capacity];
+    int16_t  m_max_amps_limits[capacity];
+    //latest commands - clamped
+    uint16_t m_position_commands[capacity];
+    int16_t  m_speed_commands[capacity];
+    int16_t  m_amps_commands[capacity];
+
+public:
+    servosila_motor_group()
+        :   m_controllers_count(0)
+    {
+        memset(m_controllers, 0, sizeof(m_controllers));
+        memset(m_positions, 0, sizeof(m_positions));
+        memset(m_multiturn_positions, 0, sizeof(m_multiturn_positions));
+        memset(m_speeds, 0, sizeof(m_speeds));
+        memset(m_amps, 0, sizeof(m_amps));
+        memset(m_status, 0, sizeof(m_status));
+        memset(m_faults, 0, sizeof(m_faults));
+        memset(m_timestamps, 0, sizeof(m_timestamps));
+        memset(m_is_operational, 0, sizeof(m_is_operational));
+        memset(m_position_commands, 0, sizeof(m_position_commands));
+        memset(m_speed_commands, 0, sizeof(m_speed_commands));
+        memset(m_amps_commands, 0, sizeof(m_amps_commands));
+    } //servosila_motor_group()
+
+    /*
+        Adds a configured controller - the limits are taken from it (see update_limits())
+        The controller must outlive the group.
+    */
+    bool add_controller(servosila_motor_controller& controller)
+    {
+        bool result = false;
+        assert(controller.get_device_id() != 0);
+        if(m_controllers_count < capacity)
+        {
+            m_controllers[m_controllers_count] = &controller;
+            _copy_limits(m_controllers_count);
+            m_controllers_count++;
+            result = true;
+        }
+        return result;
+    } //add_controller()
+
+    /*
+        Re-reads the limits after the controllers have been reconfigured
+    */
+    void update_limits()
+    {
+        for(size_t i=0; i<m_controllers_count; i++)
+        {
+            _copy_limits(i);
+        }
+    } //update_limits()
+
+    size_t get_controllers_count() const
+    {
+        return m_controllers_count;
+    } //get_controllers_count()
+
+    servosila_motor_controller& get_controller(size_t index)
+    {
+        assert(index < m_controllers_count);
+        return *m_controllers[index];
+    } //get_controller()
+
+    /*
+        Gathers the latest telemetry of the controllers into the arrays
+        - call after the frames have been received (servosila_canbus_dispatcher::receive_and_dispatch())
+        - the fault flags come from the status word (2.0) or the fault word (legacy) without checking the protocol:
+          the layouts of a protocol never fill the word of the other one
+        Returns the number of operational controllers.
+    */
+    size_t update()
+    {
+        size_t operational_count = 0;
+        for(size_t i=0; i<m_controllers_count; i++)
+        {
+            const servosila_motor_controller& controller = *m_controllers[i];
+            const bool is_operational = controller.is_operational();
+            m_is_operational[i] = is_operational ? 1 : 0;
+            if(is_operational)
+            {
+                const servosila_telemetry_t& telemetry = controller.get_telemetry();
+                m_positions[i]           = telemetry.position;
+                m_multiturn_positions[i] = controller.get_unwrapped_position_telemetry();
+                m_speeds[i]              = telemetry.speed;
+                m_amps[i]                = telemetry.amps;
+                m_status[i]              = telemetry.status;
+                m_faults[i]              = uint16_t((telemetry.status & TELEMETRY_STATUS_FAULT_FLAGS_MASK) | telemetry.faults);
+                m_timestamps[i]          = controller.get_telemetry_timestamp();
+                operational_count++;
+            }
+        }
+        return operational_count;
+    } //update()
+
+    /*
+        Telemetry arrays - get_controllers_count() items each, as of the latest update()
+    */
+    const uint16_t* get_positions() const { return m_positions; }
+    const int32_t*  get_multiturn_positions() const { return m_multiturn_positions; }
+    const int16_t*  get_speeds() const { return m_speeds; }
+    const int16_t*  get_amps() const { return m_amps; }
+    const uint16_t* get_status() const { return m_status; }
+    const uint16_t* get_faults() const { return m_faults; }
+    const control::nsec_t* get_timestamps() const { return m_timestamps; }
+    const uint8_t*  get_operational_flags() const { return m_is_operational; }
+
+    /*
+        Copies the primary telemetry of the first max_count motors, nullptr skips an array
+        Returns the number of motors copied.
+    */
+    size_t read_telemetry(uint16_t* positions, int16_t* speeds, int16_t* amps, uint16_t* faults, size_t max_count) const
+    {
+        const size_t count = (max_count < m_controllers_count) ? max_count : m_controllers_count;
+        if(positions != nullptr) memcpy(positions, m_positions, count * sizeof(m_positions[0]));
+        if(speeds != nullptr)    memcpy(speeds,    m_speeds,    count * sizeof(m_speeds[0]));
+        if(amps != nullptr)      memcpy(amps,      m_amps,      count * sizeof(m_amps[0]));
+        if(faults != nullptr)    memcpy(faults,    m_faults,    count * sizeof(m_faults[0]));
+        return count;
+    } //read_telemetry()
+
+    /*
+        Position (speed, amps) commands of the first count motors, clamped to their limits
+        Returns the number of motors commanded.
+    */
+    size_t set_position_commands(const uint16_t* positions, size_t count)
+    {
+        count = _clamp(positions, m_min_position_limits, m_max_position_limits, m_position_commands, count);
+        for(size_t i=0; i<count; i++)
+        {
+            m_controllers[i]->set_position_command(m_position_commands[i]);
+        }
+        return count;
+    } //set_position_commands()
+
+    size_t set_speed_commands(const int16_t* speeds, size_t count)
+    {
+        count = _clamp(speeds, m_min_speed_limits, m_max_speed_limits, m_speed_commands, count);
+        for(size_t i=0; i<count; i++)
+        {
+            m_controllers[i]->set_speed_command(m_speed_commands[i]);
+        }
+        return count;
+    } //set_speed_commands()
+
+    size_t set_amps_commands(const int16_t* amps, size_t count)
+    {
+        count = _clamp(amps, m_min_amps_limits, m_max_amps_limits, m_amps_commands, count);
+        for(size_t i=0; i<count; i++)
+        {
+            m_controllers[i]->set_amps_command(m_amps_commands[i]);
+        }
+        return count;
+    } //set_amps_commands()
+
+    /*
+        Latest commands as clamped by set_*_commands()
+    */
+    const uint16_t* get_position_commands() const { return m_position_commands; }
+    const int16_t*  get_speed_commands() const { return m_speed_commands; }
+    const int16_t*  get_amps_commands() const { return m_amps_commands; }
+
+    /*
+        Trajectory streaming for the whole group (see servosila_motor_controller::append_trajectory())
+        max_velocities - a limit per motor, position units per second; nullptr - unlimited
+    */
+    void configure_trajectories(control::interpolation_t interpolation, const double* max_velocities = nullptr)
+    {
+        for(size_t i=0; i<m_controllers_count; i++)
+        {
+            m_controllers[i]->configure_trajectory(interpolation, (max_velocities != nullptr) ? max_velocities[i] : 0);
+        }
+    } //configure_trajectories()
+
+    /*
+        Queues a waypoint of the same time for each of the first count motors - a point of a multi-joint trajectory
+        velocities, accelerations - nullptr for zeros (the motion stops at the waypoint)
+        Returns the number of motors that have queued the waypoint.
+    */
+    size_t append_trajectory_point(control::nsec_t time, const double* positions, const double* velocities, const double* accelerations, size_t count)
+    {
+        assert(positions != nullptr);
+        if(count > m_controllers_count) count = m_controllers_count;
+        size_t appended = 0;
+        for(size_t i=0; i<count; i++)
+        {
+            control::trajectory_point_t point;
+            point.time         = time;
+            point.position     = positions[i];
+            point.velocity     = (velocities != nullptr) ? velocities[i] : 0;
+            point.acceleration = (accelerations != nullptr) ? accelerations[i] : 0;
+            appended += m_controllers[i]->append_trajectory(&point, 1);
+        }
+        return appended;
+    } //append_trajectory_point()
+
+    void cancel_trajectories()
+    {
+        for(size_t i=0; i<m_controllers_count; i++)
+        {
+            m_controllers[i]->cancel_trajectory();
+        }
+    } //cancel_trajectories()
+
+    /*
+        Number of motors still following a trajectory
+    */
+    size_t get_active_trajectories_count() const
+    {
+        size_t active_count = 0;
+        for(size_t i=0; i<m_controllers_count; i++)
+        {
+            if(m_controllers[i]->is_trajectory_active()) active_count++;
+        }
+        return active_count;
+    } //get_active_trajectories_count()
+
+    /*
+        Emergency stop of all the motors of the group - through the dispatcher the controllers are registered with,
+        see servosila_canbus_dispatcher::emergency_stop(): one burst of the halt commands built in advance
+        - repetitions: copies of the halt commands back to back, in case a frame is lost
+        Returns the number of frames sent.
+    */
+    size_t halt(servosila_canbus_dispatcher& dispatcher, size_t repetitions = 1)
+    {
+        return dispatcher.emergency_stop(m_controllers, m_controllers_count, repetitions);
+    } //halt()
+
+private:
+    //helper function
+    void _copy_limits(size_t index)
+    {
+        const servosila_motor_controller& controller = *m_controllers[index];
+        m_min_position_limits[index] = controller.m_min_position_limit;
+        m_max_position_limits[index] = controller.m_max_position_limit;
+        m_min_speed_limits[index]    = controller.m_min_speed_limit;
+        m_max_speed_limits[index]    = controller.m_max_speed_limit;
+        m_min_amps_limits[index]     = controller.m_min_amps_limit;
+        m_max_amps_limits[index]     = controller.m_max_amps_limit;
+    } //_copy_limits()
+
+    //helper function - no branches in the loop body, the compiler turns it into min/max vector instructions
+    template <class datatype>
+    size_t _clamp(const datatype* values, const datatype* min_limits, const datatype* max_limits, datatype* clamped, size_t count) const
+    {
+        assert(values != nullptr);
+        if(count > m_controllers_count) count = m_controllers_count;
+        for(size_t i=0; i<count; i++)
+        {
+            const datatype value = (values[i] < min_limits[i]) ? min_limits[i] : values[i];
+            clamped[i] = (value > max_limits[i]) ? max_limits[i] : value;
+        }
+        return count;
+    } //_clamp()
+
+}; //class servosila_motor_group
+
+} //namespace devices
+
+#endif // DEVICES_SERVOSILA_MOTOR_GROUP_H_INCLUDED
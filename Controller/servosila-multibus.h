@@ -0,0 +1,479 @@
+#ifndef DEVICES_SERVOSILA_MULTIBUS_H_INCLUDED
+#define DEVICES_SERVOSILA_MULTIBUS_H_INCLUDED
+
+/*
+Several CANbus interfaces driven in parallel, e.g. the chassis drives on can0 and the manipulator drives on can1
+    - a servosila_canbus_dispatcher (with its own socket) per bus
+    - a thread per bus running the control loop of the bus, pinned to its own CPU core,
+      optionally with a real-time priority; the buses never wait on each other
+    - the controllers are routed to the buses by configuration; the application sees one list of motors,
+      numbered in registration order across all the buses
+    - commands from the application thread reach the bus threads through lock-free SPSC rings,
+      the telemetry comes back through the telemetry rings of the controllers (see drain_telemetry())
+    - an emergency stop bypasses the rings: each bus thread sends the halt commands of all its motors
+      in one burst at its next tick (see emergency_stop())
+
+Chassis on can0 (core 2), arm on can1 (core 3):
+    static devices::servosila_multibus_manager buses;
+    buses.add_bus("can0", 2);
+    buses.add_bus("can1", 3);
+    buses.register_controller(0, left_track);  //motor 0
+    buses.register_controller(0, right_track); //motor 1
+    buses.register_controller(1, shoulder);    //motor 2
+    buses.startup();
+    buses.start();
+    buses.set_speed_command(0, 100);
+    ...
+    buses.stop();
+    buses.shutdown();
+NOTE: the controllers and the dispatchers must be configured before start() - after that they belong
+to the bus threads; a single application thread issues the commands and drains the telemetry.
+NOTE: the object is large, allocate it statically or on the heap.
+*/
+
+#include <pthread.h>
+#include <sched.h>      /* cpu_set_t */
+#include <net/if.h>     /* IFNAMSIZ */
+#include <string.h>
+#include <assert.h>
+#include <atomic>
+#include "control/timer.h"
+#include "ftl/spsc-ring-buffer.h"
+#include "devices/servosila-motor-controller.h"
+#include "devices/servosila-canbus-dispatcher.h"
+
+namespace devices
+{
+
+//maximum number of buses in a process
+const size_t SERVOSILA_MULTIBUS_MAX_BUSES = 4;
+//maximum number of motors on all the buses
+const size_t SERVOSILA_MULTIBUS_MAX_MOTORS = SERVOSILA_MULTIBUS_MAX_BUSES * SERVOSILA_CANBUS_MAX_CONTROLLERS;
+//commands queued per bus between two ticks of its control loop
+const size_t SERVOSILA_MULTIBUS_COMMAND_RING_CAPACITY = 256;
+//default period of the control loop of a bus
+const control::nsec_t SERVOSILA_MULTIBUS_DEFAULT_TICK_PERIOD = control::NSEC_PER_SEC / 1000; //1kHz
+
+/*
+    A command handed over from the application thread to a bus thread
+*/
+struct servosila_command_t
+{
+    enum struct type_t { POSITION, SPEED, AMPS, UNDEFINED, HALT };
+    servosila_motor_controller* controller;
+    type_t  type;
+    int32_t value;  //position, speed or amps
+};
+
+class servosila_multibus_manager
+{
+private:
+    struct bus_t
+    {
+        servosila_canbus_dispatcher dispatcher;
+        //application thread -> bus thread
+        ftl::spsc_ring_buffer<servosila_command_t, SERVOSILA_MULTIBUS_COMMAND_RING_CAPACITY> commands;
+        //configuration
+        char            interface_name[IFNAMSIZ];
+        int             cpu_core;           //-1 - not pinned
+        int             realtime_priority;  //SCHED_FIFO priority, 0 - default scheduling
+        control::nsec_t tick_period;
+        //thread
+        pthread_t         thread;
+        bool              is_thread_started;
+        std::atomic<bool> is_running;
+        //statistics, written by the bus thread
+        std::atomic<size_t> ticks_count;
+        std::atomic<size_t> overruns_count;
+        //emergency stop request: trigger time, 0 - none
+        std::atomic<control::nsec_t> emergency_stop_time;
+        std::atomic<size_t>          emergency_stop_repetitions;
+        //emergency stop statistics, written by the bus thread
+        std::atomic<control::nsec_t> emergency_stop_max_latency;
+        std::atomic<control::nsec_t> emergency_stop_max_wire_latency;
+    };
+private:
+    bus_t  m_buses[SERVOSILA_MULTIBUS_MAX_BUSES];
+    size_t m_buses_count;
+    //all the motors, in registration order
+    servosila_motor_controller* m_motors[SERVOSILA_MULTIBUS_MAX_MOTORS];
+    uint8_t                     m_motor_buses[SERVOSILA_MULTIBUS_MAX_MOTORS];
+    size_t                      m_motors_count;
+
+public:
+    servosila_multibus_manager()
+        :   m_buses_count(0),
+            m_motors_count(0)
+    {
+        for(size_t b=0; b<SERVOSILA_MULTIBUS_MAX_BUSES; b++)
+        {
+            m_buses[b].is_thread_started = false;
+            m_buses[b].is_running        = false;
+        }
+    } //servosila_multibus_manager()
+
+    ~servosila_multibus_manager()
+    {
+        stop(); //just in case
+    }
+
+    /*
+        Adds a bus; buses are numbered in the order they are added
+        cpu_core: the core the bus thread is pinned to, -1 - not pinned
+        realtime_priority: SCHED_FIFO priority of the bus thread (1..99, needs CAP_SYS_NICE), 0 - default scheduling
+    */
+    bool add_bus(const char* interface_name, int cpu_core = -1, control::nsec_t tick_period = SERVOSILA_MULTIBUS_DEFAULT_TICK_PERIOD, int realtime_priority = 0)
+    {
+        bool result = false;
+        assert(interface_name != nullptr);
+        assert(tick_period > 0);
+        if((m_buses_count < SERVOSILA_MULTIBUS_MAX_BUSES) && (strlen(interface_name) < IFNAMSIZ))
+        {
+            bus_t& bus = m_buses[m_buses_count];
+            strncpy(bus.interface_name, interface_name, IFNAMSIZ);
+            bus.cpu_core          = cpu_core;
+            bus.realtime_priority = realtime_priority;
+            bus.tick_period       = tick_period;
+            bus.ticks_count       = 0;
+            bus.overruns_count    = 0;
+            bus.emergency_stop_time             = 0;
+            bus.emergency_stop_repetitions      = 1;
+            bus.emergency_stop_max_latency      = 0;
+            bus.emergency_stop_max_wire_latency = 0;
+            m_buses_count++;
+            result = true;
+        }
+        return result;
+    } //add_bus()
+
+    /*
+        Routes a configured controller to a bus; the controller becomes the next motor
+    */
+    bool register_controller(size_t bus_index, servosila_motor_controller& controller)
+    {
+        assert(bus_index < m_buses_count);
+        assert(!m_buses[bus_index].is_running);
+        bool result = false;
+        if((m_motors_count < SERVOSILA_MULTIBUS_MAX_MOTORS) && m_buses[bus_index].dispatcher.register_controller(controller))
+        {
+            m_motors[m_motors_count]      = &controller;
+            m_motor_buses[m_motors_count] = uint8_t(bus_index);
+            m_motors_count++;
+            result = true;
+        }
+        return result;
+    } //register_controller()
+
+    /*
+        Opens the sockets of all the buses
+    */
+    bool startup()
+    {
+        bool result = (m_buses_count > 0);
+        for(size_t b=0; (b<m_buses_count) && result; b++)
+        {
+            result = m_buses[b].dispatcher.startup(m_buses[b].interface_name, true);
+        }
+        return result;
+    } //startup()
+
+    void shutdown()
+    {
+        stop();
+        for(size_t b=0; b<m_buses_count; b++) m_buses[b].dispatcher.shutdown();
+    } //shutdown()
+
+    /*
+        Starts the bus threads; all or nothing - on a failure the threads started are stopped
+    */
+    bool start()
+    {
+        bool result = true;
+        for(size_t b=0; (b<m_buses_count) && result; b++)
+        {
+            result = _start_bus_thread(m_buses[b]);
+        }
+        if(!result) stop();
+        return result;
+    } //start()
+
+    /*
+        Stops and joins the bus threads
+    */
+    void stop()
+    {
+        for(size_t b=0; b<m_buses_count; b++) m_buses[b].is_running = false;
+        for(size_t b=0; b<m_buses_count; b++)
+        {
+            if(m_buses[b].is_thread_started)
+            {
+                pthread_join(m_buses[b].thread, nullptr);
+                m_buses[b].is_thread_started = false;
+            }
+        }
+    } //stop()
+
+    size_t get_buses_count() const
+    {
+        return m_buses_count;
+    } //get_buses_count()
+
+    /*
+        The dispatcher of a bus - for configuration before start() (e.g. set_sync_period(), apply_filters())
+    */
+    servosila_canbus_dispatcher& get_bus(size_t bus_index)
+    {
+        assert(bus_index < m_buses_count);
+        return m_buses[bus_index].dispatcher;
+    } //get_bus()
+
+    const char* get_bus_interface_name(size_t bus_index) const
+    {
+        assert(bus_index < m_buses_count);
+        return m_buses[bus_index].interface_name;
+    } //get_bus_interface_name()
+
+    /*
+        Number of control loop ticks a bus thread has run
+    */
+    size_t get_bus_ticks_count(size_t bus_index) const
+    {
+        assert(bus_index < m_buses_count);
+        return m_buses[bus_index].ticks_count.load(std::memory_order_relaxed);
+    } //get_bus_ticks_count()
+
+    /*
+        Number of tick periods a bus thread has missed completely
+    */
+    size_t get_bus_overruns_count(size_t bus_index) const
+    {
+        assert(bus_index < m_buses_count);
+        return m_buses[bus_index].overruns_count.load(std::memory_order_relaxed);
+    } //get_bus_overruns_count()
+
+    /*
+        Number of commands dropped because a bus thread did not keep up
+    */
+    size_t get_bus_commands_dropped(size_t bus_index) const
+    {
+        assert(bus_index < m_buses_count);
+        return m_buses[bus_index].commands.get_overflow_counter();
+    } //get_bus_commands_dropped()
+
+    /*
+        Worst emergency stop latency of a bus - from emergency_stop() to the last frame handed over to the kernel,
+        the wait for the next tick included; see servosila_emergency_stop_statistics_t
+    */
+    control::nsec_t get_bus_emergency_stop_max_latency(size_t bus_index) const
+    {
+        assert(bus_index < m_buses_count);
+        return m_buses[bus_index].emergency_stop_max_latency.load(std::memory_order_relaxed);
+    } //get_bus_emergency_stop_max_latency()
+
+    /*
+        Worst emergency stop latency of a bus to the last frame on the wire, as confirmed by the kernel;
+        0 unless the dispatcher of the bus is in the TX confirmation mode, see servosila_emergency_stop_statistics_t
+    */
+    control::nsec_t get_bus_emergency_stop_max_wire_latency(size_t bus_index) const
+    {
+        assert(bus_index < m_buses_count);
+        return m_buses[bus_index].emergency_stop_max_wire_latency.load(std::memory_order_relaxed);
+    } //get_bus_emergency_stop_max_wire_latency()
+
+    size_t get_motors_count() const
+    {
+        return m_motors_count;
+    } //get_motors_count()
+
+    /*
+        A motor - its getters are safe to call from the application thread for the configuration only,
+        the telemetry is read with drain_telemetry()
+    */
+    const servosila_motor_controller& get_motor(size_t motor_index) const
+    {
+        assert(motor_index < m_motors_count);
+        return *(m_motors[motor_index]);
+    } //get_motor()
+
+    size_t get_motor_bus(size_t motor_index) const
+    {
+        assert(motor_index < m_motors_count);
+        return m_motor_buses[motor_index];
+    } //get_motor_bus()
+
+    /*
+        Commands - applied by the bus thread of the motor at its next tick
+        Return false if the command ring of the bus is full (the command is dropped).
+    */
+    bool set_position_command(size_t motor_index, uint16_t position)
+    {
+        return _submit_command(motor_index, servosila_command_t::type_t::POSITION, position);
+    } //set_position_command()
+
+    bool set_speed_command(size_t motor_index, int16_t speed)
+    {
+        return _submit_command(motor_index, servosila_command_t::type_t::SPEED, speed);
+    } //set_speed_command()
+
+    bool set_amps_command(size_t motor_index, int16_t amps)
+    {
+        return _submit_command(motor_index, servosila_command_t::type_t::AMPS, amps);
+    } //set_amps_command()
+
+    bool set_undefined_command(size_t motor_index)
+    {
+        return _submit_command(motor_index, servosila_command_t::type_t::UNDEFINED, 0);
+    } //set_undefined_command()
+
+    bool halt(size_t motor_index)
+    {
+        return _submit_command(motor_index, servosila_command_t::type_t::HALT, 0);
+    } //halt()
+
+    /*
+        Stops all the motors on all the buses
+    */
+    bool halt_all()
+    {
+        bool result = true;
+        for(size_t m=0; m<m_motors_count; m++) result = halt(m) && result;
+        return result;
+    } //halt_all()
+
+    /*
+        Emergency stop of all the motors on all the buses - see servosila_canbus_dispatcher::emergency_stop()
+        - unlike halt_all(), never dropped: the request bypasses the command rings,
+          the commands queued before it are applied first
+        - each bus thread sends the halt commands of its motors in one burst at its next tick, within a tick period;
+          buses without a running thread are stopped right away from the calling thread
+        - repetitions 1..SERVOSILA_EMERGENCY_STOP_MAX_REPETITIONS
+    */
+    void emergency_stop(size_t repetitions = 1)
+    {
+        assert((repetitions >= 1) && (repetitions <= SERVOSILA_EMERGENCY_STOP_MAX_REPETITIONS));
+        const control::nsec_t trigger_time = control::get_now_nsec();
+        for(size_t b=0; b<m_buses_count; b++)
+        {
+            bus_t& bus = m_buses[b];
+            if(bus.is_thread_started)
+            {   //the bus thread owns the controllers
+                bus.emergency_stop_repetitions.store(repetitions, std::memory_order_relaxed);
+                bus.emergency_stop_time.store(trigger_time, std::memory_order_release);
+            }
+            else
+            {
+                _emergency_stop_bus(bus, repetitions, trigger_time);
+            }
+        }
+    } //emergency_stop()
+
+    /*
+        Telemetry samples of a motor - see servosila_motor_controller::drain_telemetry()
+    */
+    size_t drain_telemetry(size_t motor_index, servosila_telemetry_sample_t* samples, size_t max_samples)
+    {
+        assert(motor_index < m_motors_count);
+        return m_motors[motor_index]->drain_telemetry(samples, max_samples);
+    } //drain_telemetry()
+
+private:
+    //helper function
+    bool _submit_command(size_t motor_index, servosila_command_t::type_t type, int32_t value)
+    {
+        assert(motor_index < m_motors_count);
+        servosila_command_t command;
+        command.controller = m_motors[motor_index];
+        command.type       = type;
+        command.value      = value;
+        return m_buses[m_motor_buses[motor_index]].commands.push(command);
+    } //_submit_command()
+
+    //helper function
+    static bool _start_bus_thread(bus_t& bus)
+    {
+        assert(!bus.is_thread_started);
+        pthread_attr_t attributes;
+        pthread_attr_init(&attributes);
+        bool result = true;
+        if(bus.cpu_core >= 0)
+        {   //pinning
+            cpu_set_t cpus;
+            CPU_ZERO(&cpus);
+            CPU_SET(bus.cpu_core, &cpus);
+            result = (pthread_attr_setaffinity_np(&attributes, sizeof(cpus), &cpus) == 0);
+        }
+        if(result && (bus.realtime_priority > 0))
+        {   //real-time scheduling
+            sched_param parameters;
+            memset(&parameters, 0, sizeof(parameters));
+            parameters.sched_priority = bus.realtime_priority;
+            result =    (pthread_attr_setinheritsched(&attributes, PTHREAD_EXPLICIT_SCHED) == 0)
+                     && (pthread_attr_setschedpolicy(&attributes, SCHED_FIFO) == 0)
+                     && (pthread_attr_setschedparam(&attributes, &parameters) == 0);
+        }
+        if(result)
+        {
+            bus.is_running = true;
+            result = (pthread_create(&(bus.thread), &attributes, &_run_bus, &bus) == 0);
+            bus.is_thread_started = result;
+            if(!result) bus.is_running = false;
+        }
+        pthread_attr_destroy(&attributes);
+        return result;
+    } //_start_bus_thread()
+
+    //helper function - the control loop of a bus
+    static void* _run_bus(void* argument)
+    {
+        bus_t& bus = *static_cast<bus_t*>(argument);
+        control::periodic_scheduler scheduler(bus.tick_period);
+        while(bus.is_running.load(std::memory_order_relaxed))
+        {
+            _apply_commands(bus);
+            const control::nsec_t emergency_stop_time = bus.emergency_stop_time.exchange(0, std::memory_order_acquire);
+            if(emergency_stop_time != 0)
+            {
+                _emergency_stop_bus(bus, bus.emergency_stop_repetitions.load(std::memory_order_relaxed), emergency_stop_time);
+            }
+            bus.dispatcher.execute();
+            bus.ticks_count.fetch_add(1, std::memory_order_relaxed);
+            const size_t overruns = scheduler.wait_next_period();
+            if(overruns > 0) bus.overruns_count.fetch_add(overruns, std::memory_order_relaxed);
+        }
+        return nullptr;
+    } //_run_bus()
+
+    //helper function - from the thread that owns the controllers of the bus
+    static void _emergency_stop_bus(bus_t& bus, size_t repetitions, control::nsec_t trigger_time)
+    {
+        bus.dispatcher.emergency_stop(repetitions, trigger_time);
+        const servosila_emergency_stop_statistics_t& statistics = bus.dispatcher.get_emergency_stop_statistics();
+        bus.emergency_stop_max_latency.store(statistics.max_latency, std::memory_order_relaxed);
+        bus.emergency_stop_max_wire_latency.store(statistics.max_wire_latency, std::memory_order_relaxed);
+    } //_emergency_stop_bus()
+
+    //helper function - the commands queued since the previous tick
+    static void _apply_commands(bus_t& bus)
+    {
+        servosila_command_t commands[SERVOSILA_MULTIBUS_COMMAND_RING_CAPACITY];
+        const size_t commands_count = bus.commands.pop(commands, SERVOSILA_MULTIBUS_COMMAND_RING_CAPACITY);
+        for(size_t i=0; i<commands_count; i++)
+        {
+            servosila_motor_controller& controller = *(commands[i].controller);
+            switch(commands[i].type)
+            {
+                case servosila_command_t::type_t::POSITION:  controller.set_position_command(uint16_t(commands[i].value)); break;
+                case servosila_command_t::type_t::SPEED:     controller.set_speed_command(int16_t(commands[i].value)); break;
+                case servosila_command_t::type_t::AMPS:      controller.set_amps_command(int16_t(commands[i].value)); break;
+                case servosila_command_t::type_t::UNDEFINED: controller.set_undefined_command(); break;
+                case servosila_command_t::type_t::HALT:      controller.halt(bus.dispatcher.get_can_socket()); break;
+                default: assert(false); break;
+            }
+        }
+    } //_apply_commands()
+
+}; //class servosila_multibus_manager
+
+} //namespace devices
+
+#endif // DEVICES_SERVOSILA_MULTIBUS_H_INCLUDED
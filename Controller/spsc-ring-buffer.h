@@ -0,0 +1,115 @@
+#ifndef FTL_SPSC_RING_BUFFER_H_INCLUDED
+#define FTL_SPSC_RING_BUFFER_H_INCLUDED
+
+#include <stddef.h>     /* size_t */
+#include <atomic>
+
+namespace ftl
+{
+
+//size of a cache line - the producer's and the consumer's data never share one
+const size_t CACHE_LINE_SIZE = 64;
+
+/*
+    Lock-free single-producer/single-consumer ring buffer
+    - exactly one thread calls push(), exactly one (other) thread calls pop()
+    - no locks, no allocations, no syscalls; a full buffer drops the new item and counts an overflow
+    - capacity must be a power of two
+    - the producer's and the consumer's positions are a cache line of padding apart rather than cache-line aligned,
+      so the buffer and the objects holding it keep the default alignment and can be allocated with operator new
+*/
+template <class T, size_t capacity>
+class spsc_ring_buffer
+{
+    static_assert((capacity > 0) && ((capacity & (capacity-1)) == 0), "capacity must be a power of two");
+private:
+    //producer's data
+    std::atomic<size_t> m_head;    //next item to be written
+    size_t              m_cached_tail;
+    std::atomic<size_t> m_overflow_counter;
+    char                m_producer_padding[CACHE_LINE_SIZE];
+    //consumer's data
+    std::atomic<size_t> m_tail;    //next item to be read
+    size_t              m_cached_head;
+    char                m_consumer_padding[CACHE_LINE_SIZE];
+    //items
+    T m_items[capacity];
+
+public:
+    spsc_ring_buffer()
+        :   m_head(0),
+            m_cached_tail(0),
+            m_overflow_counter(0),
+            m_tail(0),
+            m_cached_head(0)
+    {
+    }
+
+    /*
+        Producer side - never blocks
+        Returns false if the buffer is full (the item is dropped).
+    */
+    bool push(const T& item)
+    {
+        bool result = false;
+        const size_t head = m_head.load(std::memory_order_relaxed);
+        //checking for free space - re-reading the consumer's position only when needed
+        if(head - m_cached_tail >= capacity) m_cached_tail = m_tail.load(std::memory_order_acquire);
+        if(head - m_cached_tail < capacity)
+        {
+            m_items[head & (capacity-1)] = item;
+            m_head.store(head + 1, std::memory_order_release);
+            result = true;
+        }
+        else
+        {   //consumer is too slow
+            m_overflow_counter.fetch_add(1, std::memory_order_relaxed);
+        }
+        return result;
+    } //push()
+
+    /*
+        Consumer side - fetches up to max_items in one go, never blocks
+        Returns the number of items fetched.
+    */
+    size_t pop(T* items, size_t max_items)
+    {
+        const size_t tail = m_tail.load(std::memory_order_relaxed);
+        //re-reading the producer's position only when needed
+        if(m_cached_head - tail < max_items) m_cached_head = m_head.load(std::memory_order_acquire);
+        size_t count = m_cached_head - tail;
+        if(count > max_items) count = max_items;
+        for(size_t i=0; i<count; i++)
+        {
+            items[i] = m_items[(tail + i) & (capacity-1)];
+        }
+        m_tail.store(tail + count, std::memory_order_release);
+        return count;
+    } //pop()
+
+    /*
+        Number of items ready to be popped - approximate if called concurrently
+    */
+    size_t size() const
+    {
+        return m_head.load(std::memory_order_acquire) - m_tail.load(std::memory_order_acquire);
+    } //size()
+
+    size_t get_capacity() const
+    {
+        return capacity;
+    } //get_capacity()
+
+    /*
+        Number of items dropped since construction because the buffer was full
+    */
+    size_t get_overflow_counter() const
+    {
+        return m_overflow_counter.load(std::memory_order_relaxed);
+    } //get_overflow_counter()
+
+}; //class spsc_ring_buffer
+
+} //namespace ftl
+
+#endif // FTL_SPSC_RING_BUFFER_H_INCLUDED
@@ -0,0 +1,19 @@
+#ifndef SERVOSILA_TESTS_CHECK_H_INCLUDED
+#define SERVOSILA_TESTS_CHECK_H_INCLUDED
+
+/*
+    Checks of the standalone test programs - independent of NDEBUG (the tests build as Release too)
+    A failed check is printed and counted; main() returns CHECK_RESULT(), non-zero if any check has failed.
+*/
+
+#include <stdio.h>      /* printf() */
+
+static int g_check_failures = 0;
+
+#define CHECK(condition) \
+    do { if(!(condition)) { printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); g_check_failures++; } } while(0)
+
+#define CHECK_RESULT() \
+    ((g_check_failures == 0) ? (printf("OK\n"), 0) : (printf("%d checks failed\n", g_check_failures), 1))
+
+#endif // SERVOSILA_TESTS_CHECK_H_INCLUDED
@@ -0,0 +1,110 @@
+/*
+    network::can_log_writer / can_log_reader - write, read back; can_replay_socket over the same log
+*/
+
+#include <stdlib.h>     /* mkstemp() */
+#include <unistd.h>     /* unlink() */
+#include "network/canlog.h"
+#include "network/canreplay.h"
+#include "check.h"
+
+//a frame with a payload derived from i
+static can_frame make_frame(size_t i)
+{
+    can_frame frame;
+    memset(&frame, 0, sizeof(frame));
+    frame.can_id  = (i % 3 == 2) ? canid_t(0x12345678 | CAN_EFF_FLAG) : canid_t(0x180 + (i % 127));
+    frame.can_dlc = uint8_t(i % 9);
+    for(uint8_t b=0; b<frame.can_dlc; b++) frame.data[b] = uint8_t(i*7 + b);
+    return frame;
+} //make_frame()
+
+int main()
+{
+    char file_name[] = "/tmp/servosila_test_canlog_XXXXXX";
+    const int fd = ::mkstemp(file_name);
+    CHECK(fd != -1);
+    if(fd == -1) return CHECK_RESULT();
+    ::close(fd);
+    const size_t capacity = 100;
+    const control::nsec_t base_time = 1000*control::NSEC_PER_SEC;
+    //writing - every third frame is a TX one; the log fills up and drops the rest
+    {
+        network::can_log_writer writer;
+        CHECK(writer.open(file_name, capacity));
+        for(size_t i=0; i<capacity + 5; i++)
+        {
+            const network::can_log_direction_t direction = (i % 3 == 0) ? network::can_log_direction_t::TX : network::can_log_direction_t::RX;
+            CHECK(writer.append(make_frame(i), base_time + i*control::NSEC_PER_USEC, direction) == (i < capacity));
+        }
+        CHECK(writer.get_records_count() == capacity);
+        CHECK(writer.get_overflow_counter() == 5);
+        writer.close();
+    }
+    //reading back - every field as written
+    {
+        network::can_log_reader reader;
+        CHECK(reader.open(file_name));
+        CHECK(reader.get_records_count() == capacity);
+        for(size_t i=0; (i<reader.get_records_count()) && (i<capacity); i++)
+        {
+            const network::can_log_record_t& record = reader.get_record(i);
+            const can_frame frame = make_frame(i);
+            CHECK(record.timestamp == base_time + i*control::NSEC_PER_USEC);
+            CHECK(record.can_id == frame.can_id);
+            CHECK(record.can_dlc == frame.can_dlc);
+            CHECK(record.direction == uint8_t((i % 3 == 0) ? network::can_log_direction_t::TX : network::can_log_direction_t::RX));
+            CHECK(memcmp(record.data, frame.data, sizeof(record.data)) == 0);
+        }
+        reader.close();
+    }
+    //replaying as fast as possible - the RX frames only, in order, with the recorded intervals
+    {
+        network::can_replay_socket replay;
+        CHECK(replay.startup(file_name, 0.0));
+        can_frame frames[network::CAN_SOCKET_MAX_BATCH_SIZE];
+        control::nsec_t timestamps[network::CAN_SOCKET_MAX_BATCH_SIZE];
+        size_t i = 0;
+        size_t frames_replayed = 0;
+        control::nsec_t first_timestamp = 0;
+        while(replay.is_connected())
+        {
+            const size_t frames_received = replay.receive_batch(frames, network::CAN_SOCKET_MAX_BATCH_SIZE, timestamps);
+            CHECK(frames_received > 0);
+            if(frames_received == 0) break;
+            for(size_t f=0; f<frames_received; f++)
+            {
+                while(i % 3 == 0) i++; //the TX frames are not replayed
+                const can_frame frame = make_frame(i);
+                if(first_timestamp == 0) first_timestamp = timestamps[f] - (i - 1)*control::NSEC_PER_USEC;
+                CHECK(frames[f].can_id == frame.can_id);
+                CHECK(frames[f].can_dlc == frame.can_dlc);
+                CHECK(memcmp(frames[f].data, frame.data, frame.can_dlc) == 0);
+                CHECK(timestamps[f] - first_timestamp == (i - 1)*control::NSEC_PER_USEC);
+                i++;
+                frames_replayed++;
+            }
+        }
+        CHECK(frames_replayed == capacity - (capacity + 2)/3);
+        //the sent frames are swallowed and counted
+        CHECK(!replay.send(0x201, frames[0].data, 8));  //disconnected at the end of the log
+        replay.restart();
+        CHECK(replay.send(0x201, frames[0].data, 8));
+        CHECK(replay.get_frames_sent() == 1);
+        replay.shutdown();
+    }
+    //not a log - refused
+    {
+        network::can_log_writer writer;
+        CHECK(writer.open(file_name, 1));
+        writer.close();
+        const int corrupt_fd = ::open(file_name, O_WRONLY);
+        const uint32_t bad_magic = 0;
+        CHECK((corrupt_fd != -1) && (::write(corrupt_fd, &bad_magic, sizeof(bad_magic)) == ssize_t(sizeof(bad_magic))));
+        if(corrupt_fd != -1) ::close(corrupt_fd);
+        network::can_log_reader reader;
+        CHECK(!reader.open(file_name));
+    }
+    ::unlink(file_name);
+    return CHECK_RESULT();
+} //main()
@@ -0,0 +1,140 @@
+/*
+    network::canopen::heartbeat_consumer - NMT state tracking, consumer timeout and the node guarding toggle
+*/
+
+#include <unistd.h>     /* usleep() */
+#include "network/heartbeat.h"
+#include "check.h"
+
+using namespace network::canopen;
+
+const uint8_t NODE_ID = 9;
+const control::usec_t CONSUMER_TIMEOUT = 20000; //20ms
+
+//swallows the guarding requests
+class fake_can_socket : public network::can_socket
+{
+public:
+    size_t requests_count;
+
+    fake_can_socket() : requests_count(0)
+    {
+    }
+    virtual bool is_connected() const
+    {
+        return true;
+    }
+    virtual bool send(canid_t destination_can_id, const void*, uint8_t payload_size)
+    {
+        CHECK(destination_can_id == (CAN_RTR_FLAG | (PREDEFINED_HEARTBEAT_CHANNEL + NODE_ID)));
+        CHECK(payload_size == 0);
+        requests_count++;
+        return true;
+    }
+}; //class fake_can_socket
+
+static heartbeat_consumer::event_t feed(heartbeat_consumer& consumer, uint8_t byte, control::nsec_t timestamp = 0)
+{
+    return consumer.process_heartbeat(&byte, 1, timestamp);
+} //feed()
+
+static void test_states()
+{
+    heartbeat_consumer consumer;
+    consumer.configure(NODE_ID, CONSUMER_TIMEOUT);
+    CHECK(consumer.is_enabled());
+    CHECK(consumer.get_timeout() == CONSUMER_TIMEOUT);
+    CHECK(!consumer.is_alive());
+    CHECK(consumer.get_state() == NMT_STATE_UNKNOWN);
+    CHECK(consumer.get_deadline() == 0);
+    CHECK(!consumer.check()); //nothing heard yet - nothing to lose
+    //boot-up, then pre-operational, then operational
+    CHECK(feed(consumer, NMT_STATE_BOOTUP, 1000) == heartbeat_consumer::event_t::BOOTUP);
+    CHECK(consumer.is_alive());
+    CHECK(consumer.get_timestamp() == 1000);
+    CHECK(consumer.get_bootups_count() == 1);
+    CHECK(feed(consumer, NMT_STATE_PRE_OPERATIONAL) == heartbeat_consumer::event_t::STATE_CHANGED);
+    CHECK(consumer.get_timestamp() > 1000); //stamped on arrival
+    CHECK(feed(consumer, NMT_STATE_OPERATIONAL) == heartbeat_consumer::event_t::STATE_CHANGED);
+    CHECK(feed(consumer, NMT_STATE_OPERATIONAL) == heartbeat_consumer::event_t::NONE);
+    CHECK(consumer.get_state() == NMT_STATE_OPERATIONAL);
+    CHECK(consumer.process_heartbeat(nullptr, 0, 0) == heartbeat_consumer::event_t::NONE); //empty - ignored
+    //a reboot
+    CHECK(feed(consumer, NMT_STATE_BOOTUP) == heartbeat_consumer::event_t::BOOTUP);
+    CHECK(consumer.get_bootups_count() == 2);
+    CHECK(consumer.get_timeouts_count() == 0);
+    //reset - the state is forgotten, the statistics kept
+    consumer.reset();
+    CHECK(!consumer.is_alive());
+    CHECK(consumer.get_state() == NMT_STATE_UNKNOWN);
+    CHECK(consumer.get_bootups_count() == 2);
+} //test_states()
+
+static void test_timeout()
+{
+    heartbeat_consumer consumer;
+    consumer.configure(NODE_ID, CONSUMER_TIMEOUT);
+    //heartbeats coming in time - no loss
+    for(int i=0; i<5; i++)
+    {
+        feed(consumer, NMT_STATE_OPERATIONAL);
+        CHECK(consumer.get_deadline() > control::get_now_nsec());
+        ::usleep(CONSUMER_TIMEOUT/4);
+        CHECK(!consumer.check());
+    }
+    //the heartbeats stop - lost once
+    ::usleep(2*CONSUMER_TIMEOUT);
+    CHECK(consumer.check());
+    CHECK(!consumer.check());
+    CHECK(!consumer.is_alive());
+    CHECK(consumer.get_state() == NMT_STATE_UNKNOWN);
+    CHECK(consumer.get_timeouts_count() == 1);
+    CHECK(consumer.get_deadline() == 0);
+    //back again
+    CHECK(feed(consumer, NMT_STATE_OPERATIONAL) == heartbeat_consumer::event_t::STATE_CHANGED);
+    CHECK(consumer.is_alive());
+    //no consumer timeout - tracked, never lost
+    consumer.configure(NODE_ID, 0);
+    CHECK(!consumer.is_enabled());
+    CHECK(consumer.get_timeout() == 0);
+    ::usleep(2*CONSUMER_TIMEOUT);
+    CHECK(!consumer.check());
+    CHECK(consumer.is_alive());
+} //test_timeout()
+
+static void test_guarding()
+{
+    fake_can_socket can;
+    heartbeat_consumer consumer;
+    consumer.configure(NODE_ID, CONSUMER_TIMEOUT);
+    //the toggle alternates from 0, starting over on boot-up
+    CHECK(consumer.send_guarding_request(can));
+    CHECK(feed(consumer, NMT_STATE_PRE_OPERATIONAL) == heartbeat_consumer::event_t::STATE_CHANGED);
+    CHECK(consumer.send_guarding_request(can));
+    CHECK(feed(consumer, NODE_GUARDING_TOGGLE_BIT | NMT_STATE_PRE_OPERATIONAL) == heartbeat_consumer::event_t::NONE);
+    CHECK(consumer.send_guarding_request(can));
+    CHECK(feed(consumer, NMT_STATE_OPERATIONAL) == heartbeat_consumer::event_t::STATE_CHANGED);
+    CHECK(consumer.get_toggle_errors_count() == 0);
+    //a lost response - the toggle is repeated
+    CHECK(consumer.send_guarding_request(can));
+    CHECK(feed(consumer, NMT_STATE_OPERATIONAL) == heartbeat_consumer::event_t::TOGGLE_ERROR);
+    CHECK(consumer.get_toggle_errors_count() == 1);
+    //resynchronized on the received toggle
+    CHECK(consumer.send_guarding_request(can));
+    CHECK(feed(consumer, NODE_GUARDING_TOGGLE_BIT | NMT_STATE_OPERATIONAL) == heartbeat_consumer::event_t::NONE);
+    CHECK(consumer.get_toggle_errors_count() == 1);
+    //boot-up - starting over from 0
+    CHECK(feed(consumer, NMT_STATE_BOOTUP) == heartbeat_consumer::event_t::BOOTUP);
+    CHECK(consumer.send_guarding_request(can));
+    CHECK(feed(consumer, NMT_STATE_PRE_OPERATIONAL) == heartbeat_consumer::event_t::STATE_CHANGED);
+    CHECK(consumer.get_toggle_errors_count() == 1);
+    CHECK(can.requests_count == 6);
+} //test_guarding()
+
+int main()
+{
+    test_states();
+    test_timeout();
+    test_guarding();
+    return CHECK_RESULT();
+} //main()
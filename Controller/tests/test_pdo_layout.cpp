@@ -0,0 +1,119 @@
+/*
+    network::canopen::pdo_layout and the ftl little endian helpers - decode/encode against known payloads
+*/
+
+#include "network/pdo-layout.h"
+#include "devices/servosila-motor-controller.h"
+#include "check.h"
+
+using namespace network::canopen;
+
+struct record_t
+{
+    uint8_t  mode;
+    int16_t  speed;
+    uint32_t position;
+    int8_t   offset;
+};
+
+typedef pdo_layout<record_t,
+            pdo_mapping<record_t, uint8_t,  &record_t::mode,     0>,
+            pdo_mapping<record_t, int16_t,  &record_t::speed,    1>,
+            pdo_mapping<record_t, uint32_t, &record_t::position, 3> > layout_t;
+
+typedef pdo_layout<record_t,
+            pdo_mapping<record_t, int8_t,   &record_t::offset,   7> > tail_layout_t;
+
+static_assert(layout_t::BYTES_MASK == 0x7F, "mode, speed and position take bytes 0-6");
+static_assert(tail_layout_t::BYTES_MASK == 0x80, "offset takes byte 7");
+static_assert(pdo_layout<record_t>::BYTES_MASK == 0, "an empty layout takes no bytes");
+
+static void test_highlow()
+{
+    uint16_t word = 0x1234;
+    CHECK(ftl::get_high(word) == 0x12);
+    CHECK(ftl::get_low(word) == 0x34);
+    ftl::set_high(word, 0xAB);
+    CHECK(word == 0xAB34);
+    ftl::set_low(word, 0xCD);
+    CHECK(word == 0xABCD);
+} //test_highlow()
+
+static void test_little_endian()
+{
+    const uint8_t bytes[4] = {0x78, 0x56, 0x34, 0x12};
+    CHECK(ftl::load_little_endian<uint8_t>(bytes) == 0x78);
+    CHECK(ftl::load_little_endian<uint16_t>(bytes) == 0x5678);
+    CHECK(ftl::load_little_endian<uint32_t>(bytes) == 0x12345678);
+    //signed - reinterpreted bit by bit
+    const uint8_t negative[4] = {0xFE, 0xFF, 0xFF, 0xFF};
+    CHECK(ftl::load_little_endian<int8_t>(negative) == -2);
+    CHECK(ftl::load_little_endian<int16_t>(negative) == -2);
+    CHECK(ftl::load_little_endian<int32_t>(negative) == -2);
+    //stores - lowest byte first, nothing past the size touched
+    uint8_t stored[5] = {0, 0, 0, 0, 0xEE};
+    ftl::store_little_endian(stored, uint32_t(0x12345678));
+    CHECK(memcmp(stored, bytes, 4) == 0);
+    CHECK(stored[4] == 0xEE);
+    ftl::store_little_endian(stored, int16_t(-300));
+    CHECK((stored[0] == 0xD4) && (stored[1] == 0xFE) && (stored[2] == 0x34));
+    //round trip of a float
+    const float value = -1.5f;
+    ftl::store_little_endian(stored, value);
+    CHECK(ftl::load_little_endian<float>(stored) == value);
+    CHECK((stored[0] == 0x00) && (stored[1] == 0x00) && (stored[2] == 0xC0) && (stored[3] == 0xBF));
+} //test_little_endian()
+
+static void test_layout()
+{
+    const uint8_t payload[PDO_PAYLOAD_SIZE] = {0x06, 0x18, 0xFC, 0x04, 0x03, 0x02, 0x01, 0xFF};
+    record_t r;
+    memset(&r, 0, sizeof(r));
+    layout_t::decode(payload, r);
+    CHECK(r.mode == 6);
+    CHECK(r.speed == -1000);
+    CHECK(r.position == 0x01020304);
+    CHECK(r.offset == 0); //not in the layout
+    tail_layout_t::decode(payload, r);
+    CHECK(r.offset == -1);
+    //encoding into a zeroed payload - the byte not covered stays zero
+    uint8_t encoded[PDO_PAYLOAD_SIZE] = {0, 0, 0, 0, 0, 0, 0, 0};
+    layout_t::encode(r, encoded);
+    CHECK(memcmp(encoded, payload, 7) == 0);
+    CHECK(encoded[7] == 0);
+    tail_layout_t::encode(r, encoded);
+    CHECK(memcmp(encoded, payload, sizeof(payload)) == 0);
+    //empty layout - nothing decoded or encoded
+    uint8_t untouched[PDO_PAYLOAD_SIZE] = {1, 2, 3, 4, 5, 6, 7, 8};
+    pdo_layout<record_t>::encode(r, untouched);
+    CHECK((untouched[0] == 1) && (untouched[7] == 8));
+} //test_layout()
+
+static void test_servosila_tpdo1()
+{   //status 0x0237, position 40000, speed -120, amps 15
+    const uint8_t payload[PDO_PAYLOAD_SIZE] = {0x37, 0x02, 0x40, 0x9C, 0x88, 0xFF, 0x0F, 0x00};
+    devices::servosila_telemetry_t telemetry;
+    memset(&telemetry, 0, sizeof(telemetry));
+    devices::servosila_tpdo_layouts<0>::protocol_2_0_t::decode(payload, telemetry);
+    CHECK(telemetry.status == 0x0237);
+    CHECK(telemetry.position == 40000);
+    CHECK(telemetry.speed == -120);
+    CHECK(telemetry.amps == 15);
+    uint8_t encoded[PDO_PAYLOAD_SIZE] = {0, 0, 0, 0, 0, 0, 0, 0};
+    devices::servosila_tpdo_layouts<0>::protocol_2_0_t::encode(telemetry, encoded);
+    CHECK(memcmp(encoded, payload, sizeof(payload)) == 0);
+    //legacy servo drives - the position only, at bytes 4-5
+    memset(&telemetry, 0, sizeof(telemetry));
+    devices::servosila_tpdo_layouts<0>::legacy_servo_t::decode(payload, telemetry);
+    CHECK(telemetry.position == 0xFF88);
+    CHECK(telemetry.status == 0);
+} //test_servosila_tpdo1()
+
+int main()
+{
+    test_highlow();
+    test_little_endian();
+    test_layout();
+    test_servosila_tpdo1();
+    return CHECK_RESULT();
+} //main()
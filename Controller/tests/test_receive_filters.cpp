@@ -0,0 +1,80 @@
+/*
+    network::canopen::build_receive_filters() - the merged filters pass exactly the requested COB IDs
+    The kernel matching of CAN_RAW_FILTER is reproduced over the whole 11bit space, extended and RTR frames included.
+*/
+
+#include <linux/can.h>
+#include "network/canopen.h"
+#include "check.h"
+
+//as the kernel does: (frame.can_id & filter.can_mask) == (filter.can_id & filter.can_mask) for any filter
+static bool is_passing(canid_t can_id, const can_filter* filters, size_t filters_count)
+{
+    bool result = false;
+    for(size_t i=0; (i<filters_count) && !result; i++)
+    {
+        result = ((can_id & filters[i].can_mask) == (filters[i].can_id & filters[i].can_mask));
+    }
+    return result;
+} //is_passing()
+
+static bool is_requested(uint16_t cob_id, const uint8_t* node_ids, size_t nodes_count, const uint16_t* function_codes, size_t function_codes_count)
+{
+    bool result = false;
+    for(size_t f=0; f<function_codes_count; f++)
+    {
+        for(size_t n=0; n<nodes_count; n++)
+        {
+            if(cob_id == (function_codes[f] | node_ids[n])) result = true;
+        }
+    }
+    return result;
+} //is_requested()
+
+//every 11bit COB ID passes if and only if requested; never as an extended or an RTR frame
+static void check_exact(const uint8_t* node_ids, size_t nodes_count, const uint16_t* function_codes, size_t function_codes_count)
+{
+    can_filter filters[512];
+    const size_t filters_count = network::canopen::build_receive_filters(node_ids, nodes_count, function_codes, function_codes_count, filters, 512);
+    CHECK(filters_count > 0);
+    CHECK(filters_count <= nodes_count*function_codes_count);
+    for(uint16_t cob_id=0; cob_id<=CAN_SFF_MASK; cob_id++)
+    {
+        const bool is_expected = is_requested(cob_id, node_ids, nodes_count, function_codes, function_codes_count);
+        CHECK(is_passing(cob_id, filters, filters_count) == is_expected);
+        CHECK(!is_passing(cob_id | CAN_RTR_FLAG, filters, filters_count));
+        CHECK(!is_passing(cob_id | CAN_EFF_FLAG, filters, filters_count));
+    }
+} //check_exact()
+
+int main()
+{
+    //a single node - TPDO1 and TPDO3 differ in one bit and collapse into one filter
+    {
+        const uint8_t  node_ids[] = { 1 };
+        const uint16_t function_codes[] = { 0x180, 0x380 };
+        can_filter filters[4];
+        CHECK(network::canopen::build_receive_filters(node_ids, 1, function_codes, 2, filters, 4) == 1);
+        check_exact(node_ids, 1, function_codes, 2);
+    }
+    //a bus of motors - the TPDOs, heartbeat and EMCY of each
+    {
+        const uint8_t  node_ids[] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12 };
+        const uint16_t function_codes[] = { 0x180, 0x280, 0x380, 0x480, 0x700, 0x080 };
+        check_exact(node_ids, 12, function_codes, 6);
+    }
+    //scattered Node IDs, duplicates included - no foreign COB ID may pass through a merged mask
+    {
+        const uint8_t  node_ids[] = { 5, 17, 17, 64, 127, 3 };
+        const uint16_t function_codes[] = { 0x180, 0x700 };
+        check_exact(node_ids, 6, function_codes, 2);
+    }
+    //too few filters - nothing is written
+    {
+        const uint8_t  node_ids[] = { 1, 3 };
+        const uint16_t function_codes[] = { 0x180, 0x700 };
+        can_filter filters[1];
+        CHECK(network::canopen::build_receive_filters(node_ids, 2, function_codes, 2, filters, 1) == 0);
+    }
+    return CHECK_RESULT();
+} //main()
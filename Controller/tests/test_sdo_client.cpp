@@ -0,0 +1,290 @@
+/*
+    network::canopen::sdo_client - expedited, segmented and block transfers against a scripted server
+    The client sends into a fake socket; the test plays the server and answers through process_response().
+*/
+
+#include "network/sdoclient.h"
+#include "check.h"
+
+using namespace network::canopen;
+
+//records the frames sent by the client; nothing to receive
+class fake_can_socket : public network::can_socket
+{
+public:
+    can_frame frames[256];
+    size_t    frames_count;
+
+    fake_can_socket() : frames_count(0)
+    {
+    }
+    virtual bool is_connected() const
+    {
+        return true;
+    }
+    virtual bool send(canid_t destination_can_id, const void* payload, uint8_t payload_size)
+    {
+        can_frame& frame = frames[frames_count++ % 256];
+        memset(&frame, 0, sizeof(frame));
+        frame.can_id  = destination_can_id;
+        frame.can_dlc = payload_size;
+        memcpy(frame.data, payload, payload_size);
+        return true;
+    }
+    virtual size_t send_batch(const can_frame* _frames, size_t count)
+    {
+        for(size_t i=0; i<count; i++) send(_frames[i].can_id, _frames[i].data, _frames[i].can_dlc);
+        return count;
+    }
+    virtual size_t receive_batch(can_frame*, size_t, control::nsec_t* = nullptr, bool = false)
+    {
+        return 0;
+    }
+    const can_frame& last(size_t back = 0) const
+    {
+        return frames[(frames_count - 1 - back) % 256];
+    }
+}; //class fake_can_socket
+
+const uint8_t  NODE_ID  = 5;
+const uint16_t INDEX    = 0x2100;
+const uint8_t  SUBINDEX = 3;
+
+//server's answer with the initiate/abort layout
+static bool respond(sdo_client& client, uint8_t command, uint32_t value = 0, uint16_t index = INDEX, uint8_t subindex = SUBINDEX)
+{
+    uint8_t payload[8] = {command, ftl::get_low(index), ftl::get_high(index), subindex, 0, 0, 0, 0};
+    ftl::store_little_endian(&(payload[4]), value);
+    return client.process_response(PREDEFINED_SDO_RESPONSE_CHANNEL + NODE_ID, payload, sizeof(payload));
+} //respond()
+
+//server's segment: command (or sequence number) byte followed by up to 7 data bytes
+static bool respond_segment(sdo_client& client, uint8_t command, const uint8_t* data, size_t size)
+{
+    can_frame frame;
+    build_sdo_segment(frame, NODE_ID, command, data, size);
+    return client.process_response(PREDEFINED_SDO_RESPONSE_CHANNEL + NODE_ID, frame.data, frame.can_dlc);
+} //respond_segment()
+
+//the frame is an initiate/abort frame for the test object
+static bool is_command(const can_frame& frame, uint8_t command, uint32_t value = 0)
+{
+    return (frame.can_id == PREDEFINED_SDO_CHANNEL + NODE_ID) && (frame.can_dlc == 8) && (frame.data[0] == command) &&
+           (ftl::load_little_endian<uint16_t>(&(frame.data[1])) == INDEX) && (frame.data[3] == SUBINDEX) &&
+           (ftl::load_little_endian<uint32_t>(&(frame.data[4])) == value);
+} //is_command()
+
+//the frame is a segment carrying the given data
+static bool is_segment(const can_frame& frame, uint8_t command, const uint8_t* data, size_t size)
+{
+    return (frame.can_id == PREDEFINED_SDO_CHANNEL + NODE_ID) && (frame.can_dlc == 8) && (frame.data[0] == command) &&
+           (memcmp(&(frame.data[1]), data, size) == 0);
+} //is_segment()
+
+static void test_crc()
+{   //CRC-16-CCITT (XModem) check value of CiA 301 block transfers
+    const uint8_t digits[] = {'1','2','3','4','5','6','7','8','9'};
+    CHECK(compute_sdo_block_crc(0, digits, sizeof(digits)) == 0x31C3);
+    CHECK(compute_sdo_block_crc(0, digits, 0) == 0);
+    //incremental
+    CHECK(compute_sdo_block_crc(compute_sdo_block_crc(0, digits, 4), digits + 4, 5) == 0x31C3);
+} //test_crc()
+
+static void test_expedited(sdo_client& client, fake_can_socket& can)
+{
+    sdo_request_t request;
+    //write - 2 bytes, acknowledged
+    request.set_write(NODE_ID, INDEX, SUBINDEX, uint16_t(0x1234));
+    client.submit(request);
+    CHECK(is_command(can.last(), WRITE_COMMAND_BYTE_2_BYTES_PAYLOAD, 0x1234));
+    CHECK(request.status == sdo_request_t::status_t::IN_PROGRESS);
+    CHECK(!respond(client, SDO_SCS_DOWNLOAD_RESPONSE, 0, INDEX, SUBINDEX + 1)); //another object - not matched
+    CHECK(respond(client, SDO_SCS_DOWNLOAD_RESPONSE));
+    CHECK(request.is_successful());
+    CHECK(client.get_pending_count() == 0);
+    //read - the size indicated by the server wins
+    request.set_read(NODE_ID, INDEX, SUBINDEX, 4);
+    client.submit(request);
+    CHECK(is_command(can.last(), READ_COMMAND_BYTE_4_BYTES_PAYLOAD));
+    CHECK(respond(client, SDO_SCS_UPLOAD_RESPONSE | SDO_EXPEDITED_BIT | SDO_SIZE_INDICATED_BIT | (2 << 2), 0xABCD5678));
+    CHECK(request.is_successful());
+    CHECK(request.data_size == 2);
+    CHECK(request.data == 0x5678);
+    //aborted by the server
+    request.set_read(NODE_ID, INDEX, SUBINDEX, 4);
+    client.submit(request);
+    CHECK(respond(client, SDO_CS_ABORT, SDO_ABORT_OBJECT_NOT_EXISTING));
+    CHECK(request.status == sdo_request_t::status_t::ABORTED);
+    CHECK(request.abort_code == SDO_ABORT_OBJECT_NOT_EXISTING);
+    //one request in flight per node - the second one is sent when the first completes
+    sdo_request_t second;
+    request.set_write(NODE_ID, INDEX, SUBINDEX, uint8_t(7));
+    second.set_write(NODE_ID, INDEX, SUBINDEX, uint32_t(0x01020304));
+    client.submit(request);
+    client.submit(second);
+    CHECK(is_command(can.last(), WRITE_COMMAND_BYTE_1_BYTES_PAYLOAD, 7));
+    CHECK(second.status == sdo_request_t::status_t::QUEUED);
+    CHECK(client.get_pending_count() == 2);
+    CHECK(respond(client, SDO_SCS_DOWNLOAD_RESPONSE));
+    CHECK(request.is_successful());
+    CHECK(is_command(can.last(), WRITE_COMMAND_BYTE_4_BYTES_PAYLOAD, 0x01020304));
+    CHECK(second.status == sdo_request_t::status_t::IN_PROGRESS);
+    //no answer - timed out, the node is told to give up
+    client.execute(control::get_now_nsec() + 2*control::nsec_t(SDO_CLIENT_DEFAULT_TIMEOUT)*control::NSEC_PER_USEC);
+    CHECK(second.status == sdo_request_t::status_t::TIMED_OUT);
+    CHECK(second.abort_code == SDO_ABORT_TIMEOUT);
+    CHECK(is_command(can.last(), SDO_CS_ABORT, SDO_ABORT_TIMEOUT));
+    CHECK(client.get_pending_count() == 0);
+} //test_expedited()
+
+static void test_segmented(sdo_client& client, fake_can_socket& can)
+{
+    uint8_t data[17];
+    for(size_t i=0; i<sizeof(data); i++) data[i] = uint8_t(0xA0 + i);
+    sdo_request_t request;
+    //write - 7 + 7 + 3 bytes, toggling
+    request.set_segmented_write(NODE_ID, INDEX, SUBINDEX, data, sizeof(data));
+    client.submit(request);
+    CHECK(is_command(can.last(), SDO_CCS_INITIATE_DOWNLOAD | SDO_SIZE_INDICATED_BIT, sizeof(data)));
+    CHECK(respond(client, SDO_SCS_DOWNLOAD_RESPONSE));
+    CHECK(is_segment(can.last(), SDO_CCS_DOWNLOAD_SEGMENT, data, 7));
+    CHECK(respond(client, SDO_SCS_DOWNLOAD_SEGMENT));
+    CHECK(is_segment(can.last(), SDO_CCS_DOWNLOAD_SEGMENT | SDO_TOGGLE_BIT, data + 7, 7));
+    CHECK(respond(client, SDO_SCS_DOWNLOAD_SEGMENT | SDO_TOGGLE_BIT));
+    CHECK(is_segment(can.last(), SDO_CCS_DOWNLOAD_SEGMENT | (4 << 1) | SDO_LAST_SEGMENT_BIT, data + 14, 3));
+    CHECK(request.is_pending());
+    CHECK(respond(client, SDO_SCS_DOWNLOAD_SEGMENT));
+    CHECK(request.is_successful());
+    CHECK(request.transferred == sizeof(data));
+    //write - a wrong toggle bit aborts
+    request.set_segmented_write(NODE_ID, INDEX, SUBINDEX, data, sizeof(data));
+    client.submit(request);
+    CHECK(respond(client, SDO_SCS_DOWNLOAD_RESPONSE));
+    CHECK(respond(client, SDO_SCS_DOWNLOAD_SEGMENT | SDO_TOGGLE_BIT));
+    CHECK(request.status == sdo_request_t::status_t::ABORTED);
+    CHECK(request.abort_code == SDO_ABORT_TOGGLE_BIT);
+    CHECK(is_command(can.last(), SDO_CS_ABORT, SDO_ABORT_TOGGLE_BIT));
+    //read - 10 bytes indicated, 7 + 3
+    uint8_t buffer[32];
+    memset(buffer, 0, sizeof(buffer));
+    request.set_segmented_read(NODE_ID, INDEX, SUBINDEX, buffer, sizeof(buffer));
+    client.submit(request);
+    CHECK(is_command(can.last(), SDO_CCS_INITIATE_UPLOAD));
+    CHECK(respond(client, SDO_SCS_UPLOAD_RESPONSE | SDO_SIZE_INDICATED_BIT, 10));
+    CHECK(can.last().data[0] == SDO_CCS_UPLOAD_SEGMENT);
+    CHECK(respond_segment(client, SDO_SCS_UPLOAD_SEGMENT, data, 7));
+    CHECK(can.last().data[0] == (SDO_CCS_UPLOAD_SEGMENT | SDO_TOGGLE_BIT));
+    CHECK(respond_segment(client, SDO_SCS_UPLOAD_SEGMENT | SDO_TOGGLE_BIT | (4 << 1) | SDO_LAST_SEGMENT_BIT, data + 7, 3));
+    CHECK(request.is_successful());
+    CHECK(request.transferred == 10);
+    CHECK(memcmp(buffer, data, 10) == 0);
+    //read - more data than indicated
+    request.set_segmented_read(NODE_ID, INDEX, SUBINDEX, buffer, sizeof(buffer));
+    client.submit(request);
+    CHECK(respond(client, SDO_SCS_UPLOAD_RESPONSE | SDO_SIZE_INDICATED_BIT, 5));
+    CHECK(respond_segment(client, SDO_SCS_UPLOAD_SEGMENT | SDO_LAST_SEGMENT_BIT, data, 7));
+    CHECK(request.status == sdo_request_t::status_t::ABORTED);
+    CHECK(request.abort_code == SDO_ABORT_LENGTH_MISMATCH);
+    //read - the buffer is too small for the indicated size
+    request.set_segmented_read(NODE_ID, INDEX, SUBINDEX, buffer, 8);
+    client.submit(request);
+    CHECK(respond(client, SDO_SCS_UPLOAD_RESPONSE | SDO_SIZE_INDICATED_BIT, 10));
+    CHECK(request.status == sdo_request_t::status_t::ABORTED);
+    CHECK(request.abort_code == SDO_ABORT_OUT_OF_MEMORY);
+} //test_segmented()
+
+static void test_block_download(sdo_client& client, fake_can_socket& can)
+{
+    uint8_t data[20];
+    for(size_t i=0; i<sizeof(data); i++) data[i] = uint8_t(3*i + 1);
+    sdo_request_t request;
+    request.set_block_write(NODE_ID, INDEX, SUBINDEX, data, sizeof(data));
+    client.submit(request);
+    CHECK(is_command(can.last(), SDO_CCS_BLOCK_DOWNLOAD | SDO_BLOCK_CRC_BIT | SDO_BLOCK_SIZE_INDICATED_BIT | SDO_BLOCK_INITIATE, sizeof(data)));
+    //the server takes 2 segments per block
+    size_t sent = can.frames_count;
+    CHECK(respond(client, SDO_SCS_BLOCK_DOWNLOAD | SDO_BLOCK_CRC_BIT | SDO_BLOCK_INITIATE, 2));
+    CHECK(can.frames_count - sent == 2);
+    CHECK(is_segment(can.last(1), 1, data, 7));
+    CHECK(is_segment(can.last(), 2, data + 7, 7));
+    //more segments acknowledged than sent
+    uint8_t ack[8] = {SDO_SCS_BLOCK_DOWNLOAD | SDO_BLOCK_ACK, 3, 2, 0, 0, 0, 0, 0};
+    CHECK(client.process_response(PREDEFINED_SDO_RESPONSE_CHANNEL + NODE_ID, ack, sizeof(ack)));
+    CHECK(request.status == sdo_request_t::status_t::ABORTED);
+    CHECK(request.abort_code == SDO_ABORT_INVALID_SEQUENCE);
+    //the second segment is lost - repeated as the first one of the next block, along with the last one
+    request.set_block_write(NODE_ID, INDEX, SUBINDEX, data, sizeof(data));
+    client.submit(request);
+    CHECK(respond(client, SDO_SCS_BLOCK_DOWNLOAD | SDO_BLOCK_CRC_BIT | SDO_BLOCK_INITIATE, 2));
+    sent = can.frames_count;
+    ack[1] = 1;
+    CHECK(client.process_response(PREDEFINED_SDO_RESPONSE_CHANNEL + NODE_ID, ack, sizeof(ack)));
+    CHECK(can.frames_count - sent == 2);
+    CHECK(is_segment(can.last(1), 1, data + 7, 7));
+    CHECK(is_segment(can.last(), 2 | SDO_BLOCK_LAST_SEGMENT_BIT, data + 14, 6));
+    CHECK(request.transferred == 7);
+    //all acknowledged - ending with the CRC, 1 byte of the last segment unused
+    ack[1] = 2;
+    CHECK(client.process_response(PREDEFINED_SDO_RESPONSE_CHANNEL + NODE_ID, ack, sizeof(ack)));
+    const uint16_t crc = compute_sdo_block_crc(0, data, sizeof(data));
+    CHECK(can.last().data[0] == (SDO_CCS_BLOCK_DOWNLOAD | (1 << 2) | SDO_BLOCK_END));
+    CHECK(ftl::load_little_endian<uint16_t>(&(can.last().data[1])) == crc);
+    CHECK(request.is_pending());
+    CHECK(respond(client, SDO_SCS_BLOCK_DOWNLOAD | SDO_BLOCK_END, 0, 0, 0));
+    CHECK(request.is_successful());
+    CHECK(request.transferred == sizeof(data));
+} //test_block_download()
+
+static void test_block_upload(sdo_client& client, fake_can_socket& can)
+{
+    uint8_t data[10];
+    for(size_t i=0; i<sizeof(data); i++) data[i] = uint8_t(0x55 ^ i);
+    const uint16_t crc = compute_sdo_block_crc(0, data, sizeof(data));
+    uint8_t buffer[64];
+    for(int attempt=0; attempt<2; attempt++)
+    {   //the second attempt gets a wrong CRC
+        memset(buffer, 0, sizeof(buffer));
+        sdo_request_t request;
+        request.set_block_read(NODE_ID, INDEX, SUBINDEX, buffer, sizeof(buffer), 4);
+        client.submit(request);
+        CHECK(is_command(can.last(), SDO_CCS_BLOCK_UPLOAD | SDO_BLOCK_CRC_BIT | SDO_BLOCK_INITIATE, 4));
+        CHECK(respond(client, SDO_SCS_BLOCK_UPLOAD | SDO_BLOCK_CRC_BIT | SDO_BLOCK_SIZE_INDICATED_BIT | SDO_BLOCK_INITIATE, sizeof(data)));
+        CHECK(can.last().data[0] == (SDO_CCS_BLOCK_UPLOAD | SDO_BLOCK_START_UPLOAD));
+        //2 segments, the last one with 3 bytes of data
+        const size_t sent = can.frames_count;
+        CHECK(respond_segment(client, 1, data, 7));
+        CHECK(can.frames_count == sent); //no acknowledgement in the middle of the block
+        CHECK(respond_segment(client, 2 | SDO_BLOCK_LAST_SEGMENT_BIT, data + 7, 3));
+        CHECK(can.frames_count == sent + 1);
+        CHECK((can.last().data[0] == (SDO_CCS_BLOCK_UPLOAD | SDO_BLOCK_ACK)) && (can.last().data[1] == 2) && (can.last().data[2] == 4));
+        //end - 4 bytes of the last segment unused
+        const uint16_t end_crc = (attempt == 0) ? crc : uint16_t(crc ^ 1);
+        CHECK(respond(client, SDO_SCS_BLOCK_UPLOAD | (4 << 2) | SDO_BLOCK_END, 0, end_crc, 0));
+        if(attempt == 0)
+        {
+            CHECK(request.is_successful());
+            CHECK(request.transferred == sizeof(data));
+            CHECK(memcmp(buffer, data, sizeof(data)) == 0);
+            CHECK(can.last().data[0] == (SDO_CCS_BLOCK_UPLOAD | SDO_BLOCK_END));
+        }
+        else
+        {
+            CHECK(request.status == sdo_request_t::status_t::ABORTED);
+            CHECK(request.abort_code == SDO_ABORT_CRC_ERROR);
+        }
+    }
+} //test_block_upload()
+
+int main()
+{
+    fake_can_socket can;
+    sdo_client client;
+    client.set_can_socket(can);
+    test_crc();
+    test_expedited(client, can);
+    test_segmented(client, can);
+    test_block_download(client, can);
+    test_block_upload(client, can);
+    CHECK(client.get_pending_count() == 0);
+    return CHECK_RESULT();
+} //main()
@@ -0,0 +1,80 @@
+/*
+    ftl::spsc_ring_buffer - order and wraparound of the positions, overflow, a producer and a consumer thread
+*/
+
+#include <stdint.h>
+#include <thread>
+#include "ftl/spsc-ring-buffer.h"
+#include "check.h"
+
+int main()
+{
+    //single thread - the positions run around the buffer many times, the pops of varying sizes straddle the end
+    {
+        ftl::spsc_ring_buffer<uint32_t, 8> ring;
+        CHECK(ring.get_capacity() == 8);
+        uint32_t next_pushed = 0;
+        uint32_t next_popped = 0;
+        for(size_t round=0; round<1000; round++)
+        {
+            const size_t push_count = 1 + (round % 8);
+            for(size_t i=0; i<push_count; i++) CHECK(ring.push(next_pushed++));
+            CHECK(ring.size() == push_count);
+            uint32_t items[8];
+            const size_t pop_size = 1 + (round % 3);
+            size_t popped = 0;
+            while(popped < push_count)
+            {
+                const size_t count = ring.pop(items, pop_size);
+                CHECK((count > 0) && (count <= pop_size));
+                if(count == 0) break;
+                for(size_t i=0; i<count; i++) CHECK(items[i] == next_popped++);
+                popped += count;
+            }
+            CHECK(ring.size() == 0);
+        }
+        CHECK(ring.get_overflow_counter() == 0);
+    }
+    //full - the pushes beyond the capacity are dropped and counted, the items kept are the oldest ones
+    {
+        ftl::spsc_ring_buffer<uint32_t, 4> ring;
+        for(uint32_t i=0; i<3; i++) ring.push(100 + i);
+        uint32_t items[4];
+        CHECK(ring.pop(items, 2) == 2);
+        for(uint32_t i=0; i<6; i++) ring.push(i);
+        CHECK(ring.get_overflow_counter() == 3);
+        CHECK(ring.pop(items, 4) == 4);
+        CHECK((items[0] == 102) && (items[1] == 0) && (items[2] == 1) && (items[3] == 2));
+        CHECK(ring.pop(items, 4) == 0);
+    }
+    //two threads - every item arrives once and in order while the producer retries on a full buffer
+    {
+        static ftl::spsc_ring_buffer<uint32_t, 64> ring;
+        const uint32_t items_count = 100000;
+        std::thread producer([&]()
+        {
+            for(uint32_t i=0; i<items_count; i++)
+            {
+                while(!ring.push(i)) std::this_thread::yield();
+            }
+        });
+        uint32_t next_popped = 0;
+        bool is_in_order = true;
+        while(next_popped < items_count)
+        {
+            uint32_t items[16];
+            const size_t count = ring.pop(items, 16);
+            if(count == 0) std::this_thread::yield();
+            for(size_t i=0; i<count; i++)
+            {
+                if(items[i] != next_popped) is_in_order = false;
+                next_popped++;
+            }
+        }
+        producer.join();
+        CHECK(is_in_order);
+        CHECK(next_popped == items_count);
+        CHECK(ring.size() == 0);
+    }
+    return CHECK_RESULT();
+} //main()
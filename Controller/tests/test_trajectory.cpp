@@ -0,0 +1,167 @@
+/*
+    control::interpolate() and control::trajectory_interpolator - boundary conditions of the segments,
+    waypoint queueing, position clamping and the velocity limit
+*/
+
+#include <math.h>       /* fabs() */
+#include "control/trajectory.h"
+#include "check.h"
+
+using namespace control;
+
+const nsec_t NSEC_PER_MSEC = 1000*NSEC_PER_USEC;
+
+static bool is_near(double a, double b, double tolerance = 1e-9)
+{
+    return fabs(a - b) <= tolerance;
+} //is_near()
+
+static trajectory_point_t make_point(nsec_t time, double position, double velocity = 0, double acceleration = 0)
+{
+    trajectory_point_t point;
+    point.time         = time;
+    point.position     = position;
+    point.velocity     = velocity;
+    point.acceleration = acceleration;
+    return point;
+} //make_point()
+
+//one-sided finite differences at an end of the segment, h = 1ms
+static double get_velocity(const trajectory_point_t& p0, const trajectory_point_t& p1, nsec_t time, interpolation_t interpolation, int direction)
+{
+    const nsec_t h = NSEC_PER_MSEC;
+    const double x0 = interpolate(p0, p1, time, interpolation);
+    const double x1 = interpolate(p0, p1, (direction > 0) ? time + h : time - h, interpolation);
+    return direction*(x1 - x0) / (double(h) / NSEC_PER_SEC);
+} //get_velocity()
+
+static double get_acceleration(const trajectory_point_t& p0, const trajectory_point_t& p1, nsec_t time, int direction)
+{
+    const nsec_t h = NSEC_PER_MSEC;
+    const double x0 = interpolate(p0, p1, time, interpolation_t::QUINTIC);
+    const double x1 = interpolate(p0, p1, (direction > 0) ? time + h : time - h, interpolation_t::QUINTIC);
+    const double x2 = interpolate(p0, p1, (direction > 0) ? time + 2*h : time - 2*h, interpolation_t::QUINTIC);
+    const double h_sec = double(h) / NSEC_PER_SEC;
+    return (x2 - 2*x1 + x0) / (h_sec*h_sec);
+} //get_acceleration()
+
+static void test_segments()
+{
+    const nsec_t t0 = 10*NSEC_PER_SEC;
+    const nsec_t t1 = t0 + 2*NSEC_PER_SEC;
+    const trajectory_point_t p0 = make_point(t0, 1.0,  2.0, -3.0);
+    const trajectory_point_t p1 = make_point(t1, 4.0, -1.0,  5.0);
+    //linear - straight line
+    CHECK(is_near(interpolate(p0, p1, t0, interpolation_t::LINEAR), 1.0));
+    CHECK(is_near(interpolate(p0, p1, (t0 + t1)/2, interpolation_t::LINEAR), 2.5));
+    CHECK(is_near(interpolate(p0, p1, t1, interpolation_t::LINEAR), 4.0));
+    //cubic - positions and velocities of both ends
+    CHECK(is_near(interpolate(p0, p1, t0, interpolation_t::CUBIC), 1.0));
+    CHECK(is_near(interpolate(p0, p1, t1, interpolation_t::CUBIC), 4.0));
+    CHECK(is_near(get_velocity(p0, p1, t0, interpolation_t::CUBIC,  1),  2.0, 1e-2));
+    CHECK(is_near(get_velocity(p0, p1, t1, interpolation_t::CUBIC, -1), -1.0, 1e-2));
+    //quintic - positions, velocities and accelerations of both ends
+    CHECK(is_near(interpolate(p0, p1, t0, interpolation_t::QUINTIC), 1.0));
+    CHECK(is_near(interpolate(p0, p1, t1, interpolation_t::QUINTIC), 4.0));
+    CHECK(is_near(get_velocity(p0, p1, t0, interpolation_t::QUINTIC,  1),  2.0, 1e-2));
+    CHECK(is_near(get_velocity(p0, p1, t1, interpolation_t::QUINTIC, -1), -1.0, 1e-2));
+    CHECK(is_near(get_acceleration(p0, p1, t0,  1), -3.0, 5e-2));
+    CHECK(is_near(get_acceleration(p0, p1, t1, -1),  5.0, 5e-2));
+    //at rest at both ends - symmetric about the middle
+    const trajectory_point_t r0 = make_point(t0, 0.0);
+    const trajectory_point_t r1 = make_point(t1, 1.0);
+    CHECK(is_near(interpolate(r0, r1, (t0 + t1)/2, interpolation_t::CUBIC), 0.5));
+    CHECK(is_near(interpolate(r0, r1, (t0 + t1)/2, interpolation_t::QUINTIC), 0.5));
+    CHECK(is_near(interpolate(r0, r1, t0 + NSEC_PER_SEC/2, interpolation_t::QUINTIC) + interpolate(r0, r1, t1 - NSEC_PER_SEC/2, interpolation_t::QUINTIC), 1.0));
+} //test_segments()
+
+static void test_queue()
+{
+    const nsec_t t0 = NSEC_PER_SEC;
+    trajectory_interpolator trajectory;
+    trajectory.configure(interpolation_t::LINEAR, -100, 100);
+    trajectory.begin(t0, 0.0);
+    CHECK(trajectory.is_active());
+    CHECK(trajectory.get_setpoint() == 0.0);
+    //times must increase - the rest of the batch is rejected
+    const trajectory_point_t points[3] = {make_point(t0 + 100*NSEC_PER_MSEC, 1.0), make_point(t0 + 200*NSEC_PER_MSEC, 3.0), make_point(t0 + 150*NSEC_PER_MSEC, 9.0)};
+    CHECK(trajectory.append(points, 3) == 2);
+    CHECK(trajectory.append(points, 1) == 0); //not later than the last one queued
+    CHECK(trajectory.get_points_count() == 2);
+    CHECK(trajectory.get_free_space() == TRAJECTORY_CAPACITY - 2);
+    //sampled along the segments
+    CHECK(is_near(trajectory.update(t0 + 50*NSEC_PER_MSEC), 0.5));
+    CHECK(is_near(trajectory.update(t0 + 100*NSEC_PER_MSEC), 1.0));
+    CHECK(trajectory.get_points_count() == 1);
+    CHECK(is_near(trajectory.update(t0 + 150*NSEC_PER_MSEC), 2.0));
+    //the last waypoint passed - the end, the setpoint stays there
+    CHECK(is_near(trajectory.update(t0 + 250*NSEC_PER_MSEC), 3.0));
+    CHECK(!trajectory.is_active());
+    CHECK(is_near(trajectory.update(t0 + 300*NSEC_PER_MSEC), 3.0));
+    //the queue is full
+    trajectory.begin(t0, 0.0);
+    trajectory_point_t many[TRAJECTORY_CAPACITY + 4];
+    for(size_t i=0; i<TRAJECTORY_CAPACITY + 4; i++) many[i] = make_point(t0 + nsec_t(i + 1)*NSEC_PER_MSEC, double(i));
+    CHECK(trajectory.append(many, TRAJECTORY_CAPACITY + 4) == TRAJECTORY_CAPACITY);
+    CHECK(trajectory.get_free_space() == 0);
+    //the ring wraps around as the waypoints are passed
+    trajectory.update(t0 + 10*NSEC_PER_MSEC);
+    CHECK(trajectory.get_free_space() == 10);
+    CHECK(trajectory.append(many + TRAJECTORY_CAPACITY, 4) == 4);
+    CHECK(is_near(trajectory.update(t0 + nsec_t(TRAJECTORY_CAPACITY + 4)*NSEC_PER_MSEC), double(TRAJECTORY_CAPACITY + 3)));
+    CHECK(!trajectory.is_active());
+    //cancelled - the setpoint stays where it was
+    trajectory.begin(t0, 5.0);
+    trajectory.append(points, 2);
+    trajectory.update(t0 + 50*NSEC_PER_MSEC);
+    const double setpoint = trajectory.get_setpoint();
+    trajectory.cancel();
+    CHECK(!trajectory.is_active());
+    CHECK(trajectory.get_points_count() == 0);
+    CHECK(trajectory.update(t0 + 150*NSEC_PER_MSEC) == setpoint);
+} //test_queue()
+
+static void test_limits()
+{
+    const nsec_t t0 = NSEC_PER_SEC;
+    trajectory_interpolator trajectory;
+    //clamped to the position limits, along the way and at the end
+    trajectory.configure(interpolation_t::QUINTIC, -1.0, 1.0);
+    trajectory.begin(t0, 0.0);
+    const trajectory_point_t beyond = make_point(t0 + NSEC_PER_SEC, 3.0);
+    trajectory.append(&beyond, 1);
+    for(nsec_t t=t0; t<=t0 + 2*NSEC_PER_SEC; t+=10*NSEC_PER_MSEC)
+    {
+        const double setpoint = trajectory.update(t);
+        CHECK((setpoint >= -1.0) && (setpoint <= 1.0));
+    }
+    CHECK(trajectory.get_setpoint() == 1.0);
+    CHECK(!trajectory.is_active()); //the clamped waypoint counts as reached
+    //rate limited - 2 units per second at most
+    trajectory.configure(interpolation_t::CUBIC, -100, 100, 2.0);
+    CHECK(trajectory.get_max_velocity() == 2.0);
+    trajectory.begin(t0, 0.0);
+    const trajectory_point_t jump = make_point(t0 + 100*NSEC_PER_MSEC, 10.0);
+    trajectory.append(&jump, 1);
+    double previous = 0.0;
+    nsec_t t = t0;
+    while(trajectory.is_active() && (t < t0 + 10*NSEC_PER_SEC))
+    {
+        t += 10*NSEC_PER_MSEC;
+        const double setpoint = trajectory.update(t);
+        CHECK(setpoint - previous <= 2.0*0.010 + 1e-9);
+        previous = setpoint;
+    }
+    //the waypoint is reached late, at the limited velocity
+    CHECK(!trajectory.is_active());
+    CHECK(trajectory.get_setpoint() == 10.0);
+    CHECK(is_near(double(t - t0) / NSEC_PER_SEC, 5.0, 0.011));
+} //test_limits()
+
+int main()
+{
+    test_segments();
+    test_queue();
+    test_limits();
+    return CHECK_RESULT();
+} //main()
@@ -2,12 +2,41 @@
 #define TIMER_H_INCLUDED
 
 #include <unistd.h>     /* usleep() */
-#include <sys/time.h>   /*gettimeofday() */
+#include <sys/time.h>   /* timeval */
+#include <time.h>       /* clock_gettime(), clock_nanosleep() */
+#include <errno.h>
+#include <stdint.h>     /* uint64_t */
 
 namespace control
 {
 
 typedef useconds_t usec_t;
+typedef uint64_t   nsec_t;
+
+const nsec_t NSEC_PER_SEC  = 1000000000ULL;
+const nsec_t NSEC_PER_USEC = 1000ULL;
+
+/*
+    Monotonic "now" - not affected by NTP or manual wall clock adjustments
+    All the "now" values passed to the timers below shall be obtained with this function.
+*/
+inline void get_now(timeval& now)
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    now.tv_sec  = ts.tv_sec;
+    now.tv_usec = ts.tv_nsec / 1000;
+} //get_now()
+
+/*
+    Monotonic "now" in nanoseconds
+*/
+inline nsec_t get_now_nsec()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return nsec_t(ts.tv_sec)*NSEC_PER_SEC + ts.tv_nsec;
+} //get_now_nsec()
 
 class timer
 {
@@ -41,16 +70,24 @@ public:
     {
         //getting "now"
         timeval now;
-        gettimeofday(&now, nullptr);
+        get_now(now);
         //setting the timer
         timeradd(&m_interval, &now, &m_set_time);
     }
 
+    /*
+        The set time in monotonic nanoseconds (see get_now_nsec()) - check() turns true right after it
+    */
+    nsec_t get_set_time_nsec() const
+    {
+        return nsec_t(m_set_time.tv_sec)*NSEC_PER_SEC + nsec_t(m_set_time.tv_usec)*NSEC_PER_USEC;
+    }
+
     bool check() const
     {
         //getting "now"
         timeval now;
-        gettimeofday(&now, nullptr);
+        get_now(now);
         //comparing and returning the result
         return check(now);
     }
@@ -75,6 +112,36 @@ public:
         return result;
     }
 
+    /*
+        Same as check_and_restart(), but the next set time is advanced by exactly one interval
+        from the previous set time rather than from "now", so the loop's execution time does not
+        accumulate as drift. If more than one interval has been missed, the timer is re-synchronized to "now".
+    */
+    bool check_and_advance()
+    {
+        timeval now;
+        get_now(now);
+        return check_and_advance(now);
+    }
+
+    bool check_and_advance(timeval& now)
+    {
+        bool result;
+        //checking if the time has come
+        if(check(now))
+        {   //advancing by exactly one interval
+            timeval next_set_time;
+            timeradd(&m_set_time, &m_interval, &next_set_time);
+            //re-synchronizing if missed more than one interval
+            if(timercmp(&now, &next_set_time, >)) timeradd(&now, &m_interval, &next_set_time);
+            m_set_time = next_set_time;
+            result = true;
+        }
+        else result = false;
+        //
+        return result;
+    }
+
     bool check_and_restart(timeval& now)
     {
         bool result;
@@ -96,7 +163,7 @@ public:
     {
         //getting "now"
         timeval now;
-        gettimeofday(&now, nullptr);
+        get_now(now);
         //checking if the set time has been passed already
         if(timercmp(&now, &m_set_time, <=))
         {
@@ -127,14 +194,14 @@ public:
 
     void restart()
     {   //setting start time as "now"
-        gettimeofday(&m_start_time, nullptr);
+        get_now(m_start_time);
     } //restart()
 
     usec_t get_elapsed_usec() const
     {
         //getting "now"
         timeval now;
-        gettimeofday(&now, nullptr);
+        get_now(now);
         //sleep time in sec & microsec
         timeval elapsed_time;
         //computing the difference
@@ -146,6 +213,122 @@ public:
     } //get_elapsed_time()
 }; //class stopwatch
 
+/*
+    Drift-free periodic scheduler
+    - the deadline is advanced by exactly one period on every cycle (absolute deadlines)
+    - sleeps with clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME), so the loop's execution time
+      and the wake-up latency never accumulate
+    - overruns (deadlines missed completely) are counted and skipped to keep the phase
+    - wake-up jitter statistics (actual wake-up time minus deadline)
+*/
+class periodic_scheduler
+{
+public:
+    struct statistics_t
+    {
+        size_t cycles_count;        //number of completed wait_next_period() calls
+        size_t overruns_count;      //number of periods missed completely
+        nsec_t min_jitter_nsec;     //wake-up lateness
+        nsec_t max_jitter_nsec;
+        nsec_t total_jitter_nsec;   //for computing the mean
+
+        nsec_t get_mean_jitter_nsec() const
+        {
+            return (cycles_count > 0) ? (total_jitter_nsec / cycles_count) : 0;
+        }
+    };
+private:
+    nsec_t       m_period;
+    nsec_t       m_deadline;
+    statistics_t m_statistics;
+public:
+    periodic_scheduler(nsec_t period_nsec = 0)
+        :   m_period(0),
+            m_deadline(0),
+            m_statistics()
+    {
+        configure(period_nsec);
+    }
+
+    void configure(nsec_t period_nsec)
+    {
+        m_period = period_nsec;
+        //setting the first deadline
+        start();
+    }
+
+    nsec_t get_period() const
+    {
+        return m_period;
+    }
+
+    nsec_t get_deadline() const
+    {
+        return m_deadline;
+    }
+
+    /*
+        Sets the first deadline one period from "now" and resets the statistics
+    */
+    void start()
+    {
+        m_deadline = get_now_nsec() + m_period;
+        reset_statistics();
+    }
+
+    void reset_statistics()
+    {
+        m_statistics.cycles_count      = 0;
+        m_statistics.overruns_count    = 0;
+        m_statistics.min_jitter_nsec   = nsec_t(-1);
+        m_statistics.max_jitter_nsec   = 0;
+        m_statistics.total_jitter_nsec = 0;
+    }
+
+    const statistics_t& get_statistics() const
+    {
+        return m_statistics;
+    }
+
+    /*
+        Sleeps till the current deadline, then advances the deadline by exactly one period
+        Returns the number of periods missed (overruns) since the previous call, 0 normally.
+    */
+    size_t wait_next_period()
+    {
+        size_t overruns = 0;
+        nsec_t now = get_now_nsec();
+        //overrun check - the loop has been running past the deadline for longer than a period
+        if((m_period > 0) && (now >= m_deadline + m_period))
+        {   //skipping the missed periods - keeping the phase
+            overruns = (now - m_deadline) / m_period;
+            m_deadline += overruns * m_period;
+            m_statistics.overruns_count += overruns;
+        }
+        //sleeping till the absolute deadline
+        if(now < m_deadline)
+        {
+            timespec deadline;
+            deadline.tv_sec  = m_deadline / NSEC_PER_SEC;
+            deadline.tv_nsec = m_deadline % NSEC_PER_SEC;
+            while(::clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, nullptr) == EINTR)
+            {   //interrupted by a signal - sleeping again till the same deadline
+            }
+            now = get_now_nsec();
+        }
+        //jitter statistics
+        const nsec_t jitter = (now > m_deadline) ? (now - m_deadline) : 0;
+        if(jitter < m_statistics.min_jitter_nsec) m_statistics.min_jitter_nsec = jitter;
+        if(jitter > m_statistics.max_jitter_nsec) m_statistics.max_jitter_nsec = jitter;
+        m_statistics.total_jitter_nsec += jitter;
+        m_statistics.cycles_count++;
+        //advancing the deadline by exactly one period
+        m_deadline += m_period;
+        //
+        return overruns;
+    }
+}; //class periodic_scheduler
+
 } //namespace control
 
 
@@ -0,0 +1,249 @@
+#ifndef CONTROL_TRAJECTORY_H_INCLUDED
+#define CONTROL_TRAJECTORY_H_INCLUDED
+
+/*
+Trajectory interpolation between time-stamped waypoints:
+    linear, cubic (Hermite - positions and velocities) and quintic (positions, velocities and accelerations)
+
+The high-level code streams waypoints at its own rate (e.g. 50Hz),
+the control loop samples the trajectory at the setpoint rate (e.g. the 1kHz RPDO rate).
+*/
+
+#include <stddef.h>     /* size_t */
+#include <assert.h>
+#include "control/timer.h"
+
+namespace control
+{
+
+//number of waypoints queued per trajectory - 0.64s of waypoints streamed at 50Hz
+const size_t TRAJECTORY_CAPACITY = 32;
+
+enum struct interpolation_t { LINEAR, CUBIC, QUINTIC };
+
+struct trajectory_point_t
+{
+    nsec_t time;            //CLOCK_MONOTONIC, see get_now_nsec()
+    double position;
+    double velocity;        //position units per second - cubic and quintic; zeros stop the motion at the waypoint
+    double acceleration;    //position units per second^2 - quintic
+};
+
+/*
+    Position of the segment p0-p1 at the given time, p0.time <= time <= p1.time
+*/
+inline double interpolate(const trajectory_point_t& p0, const trajectory_point_t& p1, nsec_t time, interpolation_t interpolation)
+{
+    assert(p1.time > p0.time);
+    const double T   = double(p1.time - p0.time) / NSEC_PER_SEC;   //segment duration, seconds
+    const double tau = double(time - p0.time) / NSEC_PER_SEC;      //time into the segment, seconds
+    const double s   = tau / T;
+    const double dx  = p1.position - p0.position;
+    double result = p0.position;
+    switch(interpolation)
+    {
+        case interpolation_t::LINEAR:
+        {
+            result = p0.position + dx*s;
+            break;
+        }
+        case interpolation_t::CUBIC:
+        {   //Hermite basis
+            const double s2 = s*s;
+            const double s3 = s2*s;
+            result =   (2*s3 - 3*s2 + 1)*p0.position + (s3 - 2*s2 + s)*T*p0.velocity
+                     + (-2*s3 + 3*s2)*p1.position    + (s3 - s2)*T*p1.velocity;
+            break;
+        }
+        case interpolation_t::QUINTIC:
+        {   //x(tau) = a0 + a1*tau + ... + a5*tau^5 matching the positions, velocities and accelerations of both ends
+            const double T2 = T*T;
+            const double T3 = T2*T;
+            const double a2 = p0.acceleration / 2;
+            const double a3 = ( 20*dx - (8*p1.velocity + 12*p0.velocity)*T - (3*p0.acceleration -   p1.acceleration)*T2) / (2*T3);
+            const double a4 = (-30*dx + (14*p1.velocity + 16*p0.velocity)*T + (3*p0.acceleration - 2*p1.acceleration)*T2) / (2*T3*T);
+            const double a5 = ( 12*dx - 6*(p1.velocity + p0.velocity)*T     - (  p0.acceleration -   p1.acceleration)*T2) / (2*T3*T2);
+            result = p0.position + tau*(p0.velocity + tau*(a2 + tau*(a3 + tau*(a4 + tau*a5))));
+            break;
+        }
+        default:
+        {   //unknown interpolation
+            assert(false);
+            break;
+        }
+    }
+    return result;
+} //interpolate()
+
+/*
+    Waypoint queue sampled by the control loop
+    - begin() anchors the trajectory at the current setpoint, append() queues the waypoints (increasing times)
+    - update() drops the waypoints passed, interpolates the current segment, clamps the result to the position limits
+      and limits its rate of change to the maximal velocity
+    - the trajectory ends once the last waypoint has been passed and reached; the setpoint stays there
+    No allocations; single-threaded - use from the thread running the control loop.
+*/
+class trajectory_interpolator
+{
+private:
+    trajectory_point_t m_points[TRAJECTORY_CAPACITY]; //queue - a ring
+    size_t             m_head;          //index of the next waypoint
+    size_t             m_count;         //waypoints queued
+    trajectory_point_t m_start;         //beginning of the current segment - the latest waypoint passed
+    interpolation_t    m_interpolation;
+    double             m_min_position;
+    double             m_max_position;
+    double             m_max_velocity;  //position units per second, 0 - unlimited
+    double             m_setpoint;
+    nsec_t             m_setpoint_time;
+    bool               m_is_active;
+public:
+    trajectory_interpolator()
+        :   m_head(0),
+            m_count(0),
+            m_start(),
+            m_interpolation(interpolation_t::CUBIC),
+            m_min_position(0),
+            m_max_position(0),
+            m_max_velocity(0),
+            m_setpoint(0),
+            m_setpoint_time(0),
+            m_is_active(false)
+    {
+    }
+
+    void configure(interpolation_t interpolation, double min_position, double max_position, double max_velocity = 0)
+    {
+        assert(min_position <= max_position);
+        assert(max_velocity >= 0);
+        m_interpolation = interpolation;
+        m_min_position  = min_position;
+        m_max_position  = max_position;
+        m_max_velocity  = max_velocity;
+    } //configure()
+
+    interpolation_t get_interpolation() const
+    {
+        return m_interpolation;
+    } //get_interpolation()
+
+    double get_max_velocity() const
+    {
+        return m_max_velocity;
+    } //get_max_velocity()
+
+    /*
+        Starts a trajectory at the current setpoint - at rest, the waypoints are appended after
+    */
+    void begin(nsec_t now, double position)
+    {
+        m_head  = 0;
+        m_count = 0;
+        m_start.time         = now;
+        m_start.position     = position;
+        m_start.velocity     = 0;
+        m_start.acceleration = 0;
+        m_setpoint      = position;
+        m_setpoint_time = now;
+        m_is_active     = true;
+    } //begin()
+
+    /*
+        Queues the waypoints; a waypoint not later than the previous one, and the ones that do not fit, are rejected
+        Returns the number of waypoints queued.
+    */
+    size_t append(const trajectory_point_t* points, size_t points_count)
+    {
+        assert(m_is_active);
+        size_t appended = 0;
+        while((appended < points_count) && (m_count < TRAJECTORY_CAPACITY) && (points[appended].time > _get_last_point().time))
+        {
+            m_points[(m_head + m_count) % TRAJECTORY_CAPACITY] = points[appended];
+            m_count++;
+            appended++;
+        }
+        return appended;
+    } //append()
+
+    /*
+        Stops at the current setpoint, the queued waypoints are dropped
+    */
+    void cancel()
+    {
+        m_count     = 0;
+        m_is_active = false;
+    } //cancel()
+
+    bool is_active() const
+    {
+        return m_is_active;
+    } //is_active()
+
+    size_t get_points_count() const
+    {
+        return m_count;
+    } //get_points_count()
+
+    size_t get_free_space() const
+    {
+        return TRAJECTORY_CAPACITY - m_count;
+    } //get_free_space()
+
+    double get_setpoint() const
+    {
+        return m_setpoint;
+    } //get_setpoint()
+
+    /*
+        Samples the trajectory at "now" - call on every setpoint tick
+        Returns the new setpoint.
+    */
+    double update(nsec_t now)
+    {
+        if(m_is_active)
+        {   //dropping the waypoints passed
+            while((m_count > 0) && (now >= m_points[m_head].time))
+            {
+                m_start = m_points[m_head];
+                m_head  = (m_head + 1) % TRAJECTORY_CAPACITY;
+                m_count--;
+            }
+            //target - on the current segment, or the last waypoint
+            const double final_position = _clamp_position(m_start.position);
+            double target = (m_count > 0) ? _clamp_position(interpolate(m_start, m_points[m_head], (now > m_start.time) ? now : m_start.time, m_interpolation)) : final_position;
+            //rate limit
+            if((m_max_velocity > 0) && (now > m_setpoint_time))
+            {
+                const double max_step = m_max_velocity * double(now - m_setpoint_time) / NSEC_PER_SEC;
+                if(target > m_setpoint + max_step) target = m_setpoint + max_step;
+                if(target < m_setpoint - max_step) target = m_setpoint - max_step;
+            }
+            m_setpoint      = target;
+            m_setpoint_time = now;
+            //the end - the last waypoint reached
+            if((m_count == 0) && (m_setpoint == final_position))
+            {
+                m_is_active = false;
+            }
+        }
+        return m_setpoint;
+    } //update()
+
+private:
+    //helper function
+    double _clamp_position(double position) const
+    {
+        return (position < m_min_position) ? m_min_position : ((position > m_max_position) ? m_max_position : position);
+    } //_clamp_position()
+
+    //helper function
+    const trajectory_point_t& _get_last_point() const
+    {
+        return (m_count > 0) ? m_points[(m_head + m_count - 1) % TRAJECTORY_CAPACITY] : m_start;
+    } //_get_last_point()
+
+}; //class trajectory_interpolator
+
+} //namespace control
+
+#endif // CONTROL_TRAJECTORY_H_INCLUDED
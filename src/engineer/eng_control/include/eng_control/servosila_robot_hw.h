@@ -0,0 +1,134 @@
+#ifndef ENG_CONTROL_SERVOSILA_ROBOT_HW_H_
+#define ENG_CONTROL_SERVOSILA_ROBOT_HW_H_
+
+#include <ros/ros.h>
+#include <hardware_interface/robot_hw.h>
+#include <hardware_interface/joint_state_interface.h>
+#include <hardware_interface/joint_command_interface.h>
+
+#include <list>
+#include <string>
+
+#include "devices/servosila-canbus-dispatcher.h"
+
+namespace eng_control
+{
+
+// 14 joints on the Engineer, with some headroom
+const size_t SERVOSILA_ROBOT_HW_MAX_JOINTS = 16;
+
+/*
+    ros_control hardware interface of the Engineer robot - the joints are driven by Servosila drives on one CANbus
+    - every joint offers the position, velocity and effort command interfaces,
+      the interface the running controller claims selects the mode of the drive:
+      position (POSITION_MODE), velocity (SPEED_MODE) or effort (AMPS_MODE)
+    - one command interface per joint at a time: a controller switch that would claim a joint
+      through two interfaces is rejected (see prepareSwitch())
+    - a joint nobody writes a command to is halted once, then left as is
+    - the state of a joint is updated only while its drive sends the telemetry (see is_operational()),
+      otherwise the last known state is reported
+    - read() and write() run in the control loop thread, no allocations after init()
+    NOTE: the object is about 200KB, allocate it statically or on the heap
+
+    Joint parameters (see config/eng_hardware.yaml):
+        node_id          Node ID of the drive
+        protocol         "2.0" or "legacy"
+        encoder          false for the chassis drives
+        position_scale   rad per position unit, negative for the mirrored joints
+        position_zero    position telemetry at 0 rad
+        continuous       true: multi-turn position, the wrap-arounds counted on the host (wheels)
+        velocity_scale   rad/s per speed unit
+        effort_scale     Nm per current unit
+        min_position, max_position, max_speed, max_amps - limits in the drive units
+*/
+class ServosilaRobotHW : public hardware_interface::RobotHW
+{
+public:
+    ServosilaRobotHW();
+    ~ServosilaRobotHW();
+
+    // Reads the joints and the CANbus parameters from robot_hw_nh, opens the CANbus socket
+    bool init(ros::NodeHandle& root_nh, ros::NodeHandle& robot_hw_nh);
+
+    // Receives the telemetry and updates the joint states
+    void read(const ros::Time& time, const ros::Duration& period);
+
+    // Turns the commands of this cycle into the drive commands and sends the RPDOs (and SYNC, if configured)
+    void write(const ros::Time& time, const ros::Duration& period);
+
+    // Halts all the drives and closes the socket
+    void shutdown();
+
+    // Rejects the switch if a joint would be claimed through more than one command interface
+    bool prepareSwitch(const std::list<hardware_interface::ControllerInfo>& start_list,
+                       const std::list<hardware_interface::ControllerInfo>& stop_list);
+
+    // Selects the command interface of the joints claimed by the controllers started and stopped
+    void doSwitch(const std::list<hardware_interface::ControllerInfo>& start_list,
+                  const std::list<hardware_interface::ControllerInfo>& stop_list);
+
+    devices::servosila_canbus_dispatcher& getDispatcher() { return dispatcher_; }
+
+private:
+    // the command interface a joint is claimed through
+    enum CommandMode
+    {
+        NO_COMMAND,
+        POSITION_COMMAND,
+        VELOCITY_COMMAND,
+        EFFORT_COMMAND
+    };
+
+    struct Joint
+    {
+        std::string name;
+        devices::servosila_motor_controller controller;
+        double position_scale;
+        int    position_zero;
+        bool   continuous;
+        double velocity_scale;
+        double effort_scale;
+        int    min_position;
+        int    max_position;
+        int    max_speed;
+        int    max_amps;
+        // state - the last known one while the drive is not operational
+        double position;
+        double velocity;
+        double effort;
+        bool   is_operational;
+        // commands - NaN unless written by a controller within the cycle
+        double position_command;
+        double velocity_command;
+        double effort_command;
+        CommandMode command_mode;
+        bool   is_commanded;
+    };
+
+    bool loadJoint(ros::NodeHandle& joint_nh, const std::string& name,
+                   control::usec_t rpdo_timeout, control::usec_t telemetry_timeout, control::usec_t heartbeat_timeout,
+                   Joint& joint);
+    void writeJoint(Joint& joint);
+    CommandMode getCommandMode(const std::string& hardware_interface) const;
+    bool switchCommandModes(const std::list<hardware_interface::ControllerInfo>& start_list,
+                            const std::list<hardware_interface::ControllerInfo>& stop_list,
+                            CommandMode* command_modes) const;
+
+private:
+    devices::servosila_canbus_dispatcher dispatcher_;
+    Joint  joints_[SERVOSILA_ROBOT_HW_MAX_JOINTS];
+    size_t joints_count_;
+
+    hardware_interface::JointStateInterface    joint_state_interface_;
+    hardware_interface::PositionJointInterface position_joint_interface_;
+    hardware_interface::VelocityJointInterface velocity_joint_interface_;
+    hardware_interface::EffortJointInterface   effort_joint_interface_;
+    // names of the command interfaces, as in hardware_interface::ControllerInfo
+    std::string position_interface_name_;
+    std::string velocity_interface_name_;
+    std::string effort_interface_name_;
+};
+
+} // namespace eng_control
+
+#endif
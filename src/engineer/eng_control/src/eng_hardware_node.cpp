@@ -0,0 +1,116 @@
+// Real-robot counterpart of the Gazebo ros_control plugin: runs the controllers of config/eng_control.yaml
+// on the Servosila drives - read, update and write in one real-time thread
+
+#include <ros/ros.h>
+#include <controller_manager/controller_manager.h>
+#include <diagnostic_updater/diagnostic_updater.h>
+
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+
+#include "eng_control/servosila_robot_hw.h"
+#include "control/timer.h"
+#include "network/busload.h"
+
+namespace
+{
+
+volatile sig_atomic_t is_running = 1;
+
+void onSignal(int /*signal*/)
+{
+    is_running = 0;
+}
+
+// static - see the NOTE on ServosilaRobotHW
+eng_control::ServosilaRobotHW robot_hw;
+
+// CANbus load of the dispatcher's meter (bus_load_period_us) - runs in the spinner thread,
+// the snapshots come from the control loop through the meter's lock-free ring
+class BusLoadDiagnosticTask : public diagnostic_updater::DiagnosticTask
+{
+public:
+    explicit BusLoadDiagnosticTask(network::can_bus_load_meter& meter)
+        : diagnostic_updater::DiagnosticTask("CANbus load"), meter_(meter), snapshot_()
+    {
+    }
+
+    virtual void run(diagnostic_updater::DiagnosticStatusWrapper& status)
+    {
+        meter_.fetch_snapshot(snapshot_); // keeps the previous snapshot if no window has closed since
+        if (snapshot_.timestamp == 0)
+        {
+            status.summary(diagnostic_msgs::DiagnosticStatus::WARN, "no bus load window closed yet");
+            return;
+        }
+        network::visit_bus_load_diagnostics(snapshot_, [&status](const char* key, double value) { status.add(key, value); });
+        status.summary(network::get_bus_load_level(snapshot_), "CANbus load");
+    }
+
+private:
+    network::can_bus_load_meter& meter_;
+    network::can_bus_load_snapshot_t snapshot_;
+};
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    ros::init(argc, argv, "eng_hardware", ros::init_options::NoSigintHandler);
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+
+    ros::NodeHandle nh;                 // namespace of the controllers, /eng
+    ros::NodeHandle hw_nh(nh, "hardware");
+    double rate;
+    int realtime_priority;
+    hw_nh.param("rate", rate, 1000.0);
+    hw_nh.param("realtime_priority", realtime_priority, 0);
+
+    if (!robot_hw.init(nh, hw_nh))
+        return 1;
+    controller_manager::ControllerManager controller_manager(&robot_hw, nh);
+
+    // bus load diagnostics, published from the spinner thread
+    diagnostic_updater::Updater updater;
+    updater.setHardwareID("servosila");
+    BusLoadDiagnosticTask bus_load_task(robot_hw.getDispatcher().get_bus_load_meter());
+    if (robot_hw.getDispatcher().is_bus_load_meter_enabled())
+        updater.add(bus_load_task);
+    const ros::WallTimer diagnostics_timer = nh.createWallTimer(ros::WallDuration(0.1),
+        [&updater](const ros::WallTimerEvent&) { updater.update(); }); // update() keeps to the diagnostic_period
+
+    // controller_manager services and the diagnostics in their own thread - the control loop only runs read, update and write
+    ros::AsyncSpinner spinner(1);
+    spinner.start();
+
+    if (realtime_priority > 0)
+    {
+        sched_param parameters;
+        parameters.sched_priority = realtime_priority;
+        if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &parameters) != 0)
+            ROS_WARN("SCHED_FIFO priority %d not granted (needs CAP_SYS_NICE), running with the default scheduling", realtime_priority);
+    }
+
+    control::periodic_scheduler scheduler(control::nsec_t(control::NSEC_PER_SEC / rate));
+    ros::Time previous_time = ros::Time::now();
+    while (is_running && ros::ok())
+    {
+        const ros::Time time = ros::Time::now();
+        const ros::Duration period = time - previous_time;
+        previous_time = time;
+        robot_hw.read(time, period);
+        controller_manager.update(time, period);
+        robot_hw.write(time, period);
+        scheduler.wait_next_period();
+    }
+
+    const control::periodic_scheduler::statistics_t& statistics = scheduler.get_statistics();
+    ROS_INFO("%zu cycles, %zu overruns, mean jitter %lluns", statistics.cycles_count, statistics.overruns_count,
+             static_cast<unsigned long long>(statistics.get_mean_jitter_nsec()));
+    robot_hw.shutdown();
+    spinner.stop();
+    ros::shutdown();
+    return 0;
+}
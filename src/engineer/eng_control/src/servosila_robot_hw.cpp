@@ -0,0 +1,318 @@
+#include "eng_control/servosila_robot_hw.h"
+
+#include <hardware_interface/internal/demangle_symbol.h>
+
+#include <cmath>
+#include <limits>
+
+namespace eng_control
+{
+
+namespace
+{
+
+long clamp(long value, long min_value, long max_value)
+{
+    return (value < min_value) ? min_value : ((value > max_value) ? max_value : value);
+}
+
+} // namespace
+
+ServosilaRobotHW::ServosilaRobotHW()
+    : joints_count_(0),
+      position_interface_name_(hardware_interface::internal::demangledTypeName<hardware_interface::PositionJointInterface>()),
+      velocity_interface_name_(hardware_interface::internal::demangledTypeName<hardware_interface::VelocityJointInterface>()),
+      effort_interface_name_(hardware_interface::internal::demangledTypeName<hardware_interface::EffortJointInterface>())
+{
+}
+
+ServosilaRobotHW::~ServosilaRobotHW()
+{
+}
+
+bool ServosilaRobotHW::init(ros::NodeHandle& /*root_nh*/, ros::NodeHandle& robot_hw_nh)
+{
+    std::string can_interface;
+    int rpdo_timeout, telemetry_timeout, heartbeat_timeout, sync_period, bus_load_period, bitrate;
+    bool tx_confirmation;
+    robot_hw_nh.param<std::string>("can_interface", can_interface, "can0");
+    robot_hw_nh.param("rpdo_timeout_us",      rpdo_timeout,      1000);
+    robot_hw_nh.param("telemetry_timeout_us", telemetry_timeout, 100000);
+    robot_hw_nh.param("heartbeat_timeout_us", heartbeat_timeout, 0);
+    robot_hw_nh.param("sync_period_us",       sync_period,       0);
+    robot_hw_nh.param("bus_load_period_us",   bus_load_period,   0);
+    robot_hw_nh.param("bitrate",              bitrate,           int(network::CAN_BUS_LOAD_DEFAULT_BITRATE));
+    robot_hw_nh.param("tx_confirmation",      tx_confirmation,   false);
+
+    XmlRpc::XmlRpcValue joints;
+    if (!robot_hw_nh.getParam("joints", joints) || joints.getType() != XmlRpc::XmlRpcValue::TypeStruct)
+    {
+        ROS_ERROR_STREAM("No joints configured in " << robot_hw_nh.getNamespace() << "/joints");
+        return false;
+    }
+
+    for (XmlRpc::XmlRpcValue::iterator it = joints.begin(); it != joints.end(); ++it)
+    {
+        if (joints_count_ == SERVOSILA_ROBOT_HW_MAX_JOINTS)
+        {
+            ROS_ERROR("Too many joints, at most %zu are supported", SERVOSILA_ROBOT_HW_MAX_JOINTS);
+            return false;
+        }
+        Joint& joint = joints_[joints_count_];
+        ros::NodeHandle joint_nh(robot_hw_nh, "joints/" + it->first);
+        if (!loadJoint(joint_nh, it->first, rpdo_timeout, telemetry_timeout, heartbeat_timeout, joint))
+            return false;
+        if (!dispatcher_.register_controller(joint.controller))
+        {
+            ROS_ERROR_STREAM("Joint " << joint.name << ": Node ID is already taken");
+            return false;
+        }
+
+        hardware_interface::JointStateHandle state_handle(joint.name, &joint.position, &joint.velocity, &joint.effort);
+        joint_state_interface_.registerHandle(state_handle);
+        position_joint_interface_.registerHandle(hardware_interface::JointHandle(state_handle, &joint.position_command));
+        velocity_joint_interface_.registerHandle(hardware_interface::JointHandle(state_handle, &joint.velocity_command));
+        effort_joint_interface_.registerHandle(hardware_interface::JointHandle(state_handle, &joint.effort_command));
+        joints_count_++;
+    }
+
+    registerInterface(&joint_state_interface_);
+    registerInterface(&position_joint_interface_);
+    registerInterface(&velocity_joint_interface_);
+    registerInterface(&effort_joint_interface_);
+
+    if (sync_period > 0)
+        dispatcher_.set_sync_period(sync_period);
+
+    // the filters of the registered controllers are applied on startup
+    if (!dispatcher_.startup(can_interface.c_str(), true))
+    {
+        ROS_ERROR_STREAM("Failed to open CANbus interface " << can_interface);
+        return false;
+    }
+    if (bus_load_period > 0)
+        dispatcher_.enable_bus_load_meter(bus_load_period, bitrate);
+    // the echoes of the sent frames - the wire latency of the emergency stop is measured
+    if (tx_confirmation && !dispatcher_.set_tx_confirmation_mode())
+        ROS_WARN_STREAM("TX confirmations are not available on " << can_interface);
+
+    ROS_INFO("%zu joints on %s", joints_count_, can_interface.c_str());
+    return true;
+}
+
+bool ServosilaRobotHW::loadJoint(ros::NodeHandle& joint_nh, const std::string& name,
+                                 control::usec_t rpdo_timeout, control::usec_t telemetry_timeout, control::usec_t heartbeat_timeout,
+                                 Joint& joint)
+{
+    int node_id, min_position, max_position, max_speed, max_amps;
+    std::string protocol;
+    bool encoder;
+    joint.name = name;
+    joint_nh.param("node_id",        node_id,              0);
+    joint_nh.param<std::string>("protocol", protocol,      "2.0");
+    joint_nh.param("encoder",        encoder,              true);
+    joint_nh.param("position_scale", joint.position_scale, 2.0 * M_PI / 65536.0);
+    joint_nh.param("position_zero",  joint.position_zero,  0);
+    joint_nh.param("continuous",     joint.continuous,     false);
+    joint_nh.param("velocity_scale", joint.velocity_scale, 1.0);
+    joint_nh.param("effort_scale",   joint.effort_scale,   1.0);
+    joint_nh.param("min_position",   min_position,         0);
+    joint_nh.param("max_position",   max_position,         65535);
+    joint_nh.param("max_speed",      max_speed,            32767);
+    joint_nh.param("max_amps",       max_amps,             32767);
+
+    if (node_id < 1 || node_id > 127)
+    {
+        ROS_ERROR_STREAM("Joint " << name << ": node_id has to be 1..127");
+        return false;
+    }
+    if (protocol != "2.0" && protocol != "legacy")
+    {
+        ROS_ERROR_STREAM("Joint " << name << ": protocol has to be \"2.0\" or \"legacy\"");
+        return false;
+    }
+    if (joint.position_scale == 0.0 || joint.velocity_scale == 0.0 || joint.effort_scale == 0.0)
+    {
+        ROS_ERROR_STREAM("Joint " << name << ": zero scale");
+        return false;
+    }
+    joint.min_position = clamp(min_position, 0, 65535);
+    joint.max_position = clamp(max_position, joint.min_position, 65535);
+    joint.max_speed    = clamp(max_speed, 0, 32767);
+    joint.max_amps     = clamp(max_amps, 0, 32767);
+
+    typedef devices::servosila_motor_controller::protocol_version_t protocol_version_t;
+    joint.controller.configure(uint8_t(node_id),
+                               (protocol == "2.0") ? protocol_version_t::PROTOCOL_VERSION_2_0 : protocol_version_t::PROTOCOL_VERSION_LEGACY,
+                               encoder, rpdo_timeout, telemetry_timeout,
+                               uint16_t(joint.min_position), uint16_t(joint.max_position),
+                               int16_t(-joint.max_speed), int16_t(joint.max_speed),
+                               int16_t(-joint.max_amps), int16_t(joint.max_amps));
+    if (heartbeat_timeout > 0)
+        joint.controller.configure_heartbeat(heartbeat_timeout);
+
+    joint.position = joint.velocity = joint.effort = 0.0;
+    joint.position_command = joint.velocity_command = joint.effort_command = std::numeric_limits<double>::quiet_NaN();
+    joint.command_mode = NO_COMMAND;
+    joint.is_commanded = false;
+    joint.is_operational = false;
+    return true;
+}
+
+void ServosilaRobotHW::read(const ros::Time& /*time*/, const ros::Duration& /*period*/)
+{
+    dispatcher_.receive_and_dispatch();
+    for (size_t i = 0; i < joints_count_; i++)
+    {
+        Joint& joint = joints_[i];
+        const devices::servosila_motor_controller& controller = joint.controller;
+        const bool is_operational = controller.is_operational();
+        if (is_operational)
+        {
+            const double position = joint.continuous ? double(controller.get_unwrapped_position_telemetry())
+                                                     : double(controller.get_position_telemetry());
+            joint.position = (position - joint.position_zero) * joint.position_scale;
+            joint.velocity = controller.get_speed_telemetry() * joint.velocity_scale;
+            joint.effort   = controller.get_amps_telemetry() * joint.effort_scale;
+        }
+        // no telemetry yet, or the drive dropped out - the last known state is kept
+        if (is_operational != joint.is_operational)
+        {
+            if (is_operational)
+                ROS_INFO_STREAM("Joint " << joint.name << ": telemetry is coming");
+            else
+                ROS_WARN_STREAM("Joint " << joint.name << ": telemetry lost, the joint state is stale");
+            joint.is_operational = is_operational;
+        }
+        // the controllers running in this cycle write their commands before write()
+        joint.position_command = joint.velocity_command = joint.effort_command = std::numeric_limits<double>::quiet_NaN();
+    }
+}
+
+void ServosilaRobotHW::write(const ros::Time& /*time*/, const ros::Duration& /*period*/)
+{
+    for (size_t i = 0; i < joints_count_; i++)
+        writeJoint(joints_[i]);
+    dispatcher_.execute_transmit();
+}
+
+void ServosilaRobotHW::writeJoint(Joint& joint)
+{
+    devices::servosila_motor_controller& controller = joint.controller;
+    if (joint.command_mode == POSITION_COMMAND && !std::isnan(joint.position_command))
+    {
+        long position = std::lround(joint.position_zero + joint.position_command / joint.position_scale);
+        if (joint.continuous)
+            position = ((position % 65536) + 65536) % 65536;
+        controller.set_position_command(uint16_t(clamp(position, joint.min_position, joint.max_position)));
+        joint.is_commanded = true;
+    }
+    else if (joint.command_mode == VELOCITY_COMMAND && !std::isnan(joint.velocity_command))
+    {
+        const long speed = std::lround(joint.velocity_command / joint.velocity_scale);
+        controller.set_speed_command(int16_t(clamp(speed, -joint.max_speed, joint.max_speed)));
+        joint.is_commanded = true;
+    }
+    else if (joint.command_mode == EFFORT_COMMAND && !std::isnan(joint.effort_command))
+    {
+        const long amps = std::lround(joint.effort_command / joint.effort_scale);
+        controller.set_amps_command(int16_t(clamp(amps, -joint.max_amps, joint.max_amps)));
+        joint.is_commanded = true;
+    }
+    else if (joint.is_commanded)
+    {   // the controller has been stopped
+        controller.halt(dispatcher_.get_can_socket());
+        joint.is_commanded = false;
+    }
+}
+
+bool ServosilaRobotHW::prepareSwitch(const std::list<hardware_interface::ControllerInfo>& start_list,
+                                     const std::list<hardware_interface::ControllerInfo>& stop_list)
+{
+    CommandMode command_modes[SERVOSILA_ROBOT_HW_MAX_JOINTS];
+    for (size_t i = 0; i < joints_count_; i++)
+        command_modes[i] = joints_[i].command_mode;
+    return switchCommandModes(start_list, stop_list, command_modes);
+}
+
+void ServosilaRobotHW::doSwitch(const std::list<hardware_interface::ControllerInfo>& start_list,
+                                const std::list<hardware_interface::ControllerInfo>& stop_list)
+{
+    // validated by prepareSwitch()
+    CommandMode command_modes[SERVOSILA_ROBOT_HW_MAX_JOINTS];
+    for (size_t i = 0; i < joints_count_; i++)
+        command_modes[i] = joints_[i].command_mode;
+    switchCommandModes(start_list, stop_list, command_modes);
+    for (size_t i = 0; i < joints_count_; i++)
+        joints_[i].command_mode = command_modes[i];
+}
+
+ServosilaRobotHW::CommandMode ServosilaRobotHW::getCommandMode(const std::string& hardware_interface) const
+{
+    if (hardware_interface == position_interface_name_)
+        return POSITION_COMMAND;
+    if (hardware_interface == velocity_interface_name_)
+        return VELOCITY_COMMAND;
+    if (hardware_interface == effort_interface_name_)
+        return EFFORT_COMMAND;
+    return NO_COMMAND;
+}
+
+bool ServosilaRobotHW::switchCommandModes(const std::list<hardware_interface::ControllerInfo>& start_list,
+                                          const std::list<hardware_interface::ControllerInfo>& stop_list,
+                                          CommandMode* command_modes) const
+{
+    typedef std::list<hardware_interface::ControllerInfo>::const_iterator ControllerIterator;
+    typedef std::vector<hardware_interface::InterfaceResources>::const_iterator ClaimIterator;
+    typedef std::set<std::string>::const_iterator ResourceIterator;
+    // the joints of the controllers stopped are released first...
+    for (ControllerIterator controller = stop_list.begin(); controller != stop_list.end(); ++controller)
+        for (ClaimIterator claim = controller->claimed_resources.begin(); claim != controller->claimed_resources.end(); ++claim)
+            if (getCommandMode(claim->hardware_interface) != NO_COMMAND)
+                for (size_t i = 0; i < joints_count_; i++)
+                    if (claim->resources.count(joints_[i].name) > 0)
+                        command_modes[i] = NO_COMMAND;
+    // ...then claimed by the controllers started
+    bool result = true;
+    for (ControllerIterator controller = start_list.begin(); controller != start_list.end(); ++controller)
+    {
+        for (ClaimIterator claim = controller->claimed_resources.begin(); claim != controller->claimed_resources.end(); ++claim)
+        {
+            const CommandMode command_mode = getCommandMode(claim->hardware_interface);
+            if (command_mode == NO_COMMAND)
+                continue;
+            for (ResourceIterator resource = claim->resources.begin(); resource != claim->resources.end(); ++resource)
+            {
+                for (size_t i = 0; i < joints_count_; i++)
+                {
+                    if (joints_[i].name != *resource)
+                        continue;
+                    if (command_modes[i] != NO_COMMAND && command_modes[i] != command_mode)
+                    {
+                        ROS_ERROR_STREAM("Controller " << controller->name << ": joint " << *resource
+                                         << " is already claimed through another command interface");
+                        result = false;
+                    }
+                    command_modes[i] = command_mode;
+                }
+            }
+        }
+    }
+    return result;
+}
+
+void ServosilaRobotHW::shutdown()
+{
+    if (!dispatcher_.get_can_socket().is_connected())
+        return;
+    // all the halt commands in one burst, twice - followed by SYNC in the synchronous mode
+    dispatcher_.emergency_stop(2);
+    const devices::servosila_emergency_stop_statistics_t& statistics = dispatcher_.get_emergency_stop_statistics();
+    ROS_INFO("halted: %zu frames sent in %lluns, %zu not sent", statistics.frames_sent,
+             static_cast<unsigned long long>(statistics.latency), statistics.frames_not_sent);
+    if (statistics.is_wire_latency_measured)
+        ROS_INFO("halted: the last frame on the wire in %lluns", static_cast<unsigned long long>(statistics.wire_latency));
+    dispatcher_.shutdown();
+}
+
+} // namespace eng_control